@@ -0,0 +1,584 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Micro-benchmarks of the SLAM hot kernels.
+//
+// Every kernel runs on a seeded synthetic RGB-D frame (textured image, depth
+// of a floor, a wall and a box) or on a recorded one given with --image and
+// --depth. Each kernel is timed alone for every requested thread count: the
+// threads run the same operation concurrently on private copies of the
+// inputs. Reported per kernel and thread count: ns/op, ops/s, speedup over
+// one thread and operator new calls per op.
+
+#include <Converter.h>
+#include <G2oTypes.h>
+#include <ImuTypes.h>
+#include <LidarProcess.h>
+#include <ORBmatcher.h>
+#include <Optimizer.h>
+#include <RegistrationGICP.h>
+#include <Settings.h>
+#include <System.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+// Every operator new of the process is counted, including the ones of the
+// library. OpenCV and Eigen aligned buffers bypass it.
+static std::atomic<size_t> gnAllocs(0);
+
+void *operator new(size_t n) {
+  gnAllocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(n ? n : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t n) {
+  gnAllocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(n ? n : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// Kernel inputs shared by every thread, read only once built
+struct Scene {
+  Settings *pSettings;
+  ORBVocabulary *pVocabulary;
+  GeometricCamera *pCamera;
+  cv::Mat K, distCoef;
+  float bf, thDepth;
+  cv::Mat imGray, imRGB, imDepth;
+  pcl::PointCloud<PointType>::Ptr pCloud;
+  std::vector<Eigen::Vector4f> vSourcePoints, vTargetPoints;
+  unsigned int seed;
+};
+
+// Per-thread state of a frame based kernel
+struct FrameContext {
+  ORBextractor *pExtractor;
+  Frame *pFrame;
+  Map *pMap;
+  std::vector<MapPoint *> vpMapPoints;
+
+  FrameContext() : pExtractor(NULL), pFrame(NULL), pMap(NULL) {}
+  ~FrameContext() {
+    for (size_t i = 0; i < vpMapPoints.size(); i++) delete vpMapPoints[i];
+    delete pFrame;
+    delete pMap;
+    delete pExtractor;
+  }
+};
+
+// A kernel builds the private state of one thread (not timed) and returns
+// the operation to time
+struct Kernel {
+  std::string name;
+  int nIterations;
+  std::function<std::function<void()>(const Scene &)> setup;
+};
+
+struct Result {
+  std::string name;
+  int nThreads;
+  double ns_per_op;
+  double ops_per_s;
+  double allocs_per_op;
+  double speedup;
+};
+
+ORBextractor *CreateExtractor(const Scene &scene) {
+  Settings *pSettings = scene.pSettings;
+  return new ORBextractor(pSettings->nFeatures(), pSettings->scaleFactor(),
+                          pSettings->nLevels(), pSettings->initThFAST(),
+                          pSettings->minThFAST());
+}
+
+// Frame at the origin with one map point per keypoint with valid depth
+std::shared_ptr<FrameContext> CreateFrameContext(const Scene &scene,
+                                                 const bool bMapPoints) {
+  std::shared_ptr<FrameContext> ctx = std::make_shared<FrameContext>();
+  cv::Mat K = scene.K.clone(), distCoef = scene.distCoef.clone();
+  ctx->pExtractor = CreateExtractor(scene);
+  ctx->pFrame = new Frame(scene.imGray, scene.imRGB, scene.imDepth, 0.0,
+                          ctx->pExtractor, scene.pVocabulary, scene.pSettings,
+                          K, distCoef, scene.bf, scene.thDepth, scene.pCamera);
+  ctx->pFrame->SetPose(Sophus::SE3f());
+  if (!bMapPoints) return ctx;
+
+  ctx->pMap = new Map();
+  ctx->vpMapPoints.assign(ctx->pFrame->N, static_cast<MapPoint *>(NULL));
+  for (int i = 0; i < ctx->pFrame->N; i++) {
+    Eigen::Vector3f x3D;
+    if (!ctx->pFrame->UnprojectStereo(i, x3D)) continue;
+    ctx->vpMapPoints[i] = new MapPoint(x3D, ctx->pMap, ctx->pFrame, i);
+  }
+  return ctx;
+}
+
+void BuildKernels(std::vector<Kernel> &vKernels) {
+  Kernel orb;
+  orb.name = "ORBextractor::operator()";
+  orb.nIterations = 50;
+  orb.setup = [](const Scene &scene) -> std::function<void()> {
+    std::shared_ptr<ORBextractor> pExtractor(CreateExtractor(scene));
+    std::shared_ptr<std::vector<cv::KeyPoint>> pKeys =
+        std::make_shared<std::vector<cv::KeyPoint>>();
+    std::shared_ptr<cv::Mat> pDesc = std::make_shared<cv::Mat>();
+    cv::Mat im = scene.imGray.clone();
+    return [pExtractor, pKeys, pDesc, im]() {
+      std::vector<int> vLapping = {0, 0};
+      (*pExtractor)(im, cv::Mat(), *pKeys, *pDesc, vLapping);
+    };
+  };
+  vKernels.push_back(orb);
+
+  Kernel distance;
+  distance.name = "ORBmatcher::DescriptorDistance";
+  distance.nIterations = 2000000;
+  distance.setup = [](const Scene &scene) -> std::function<void()> {
+    cv::RNG rng(scene.seed);
+    std::shared_ptr<cv::Mat> pDesc = std::make_shared<cv::Mat>(1024, 32, CV_8U);
+    rng.fill(*pDesc, cv::RNG::UNIFORM, 0, 256);
+    std::shared_ptr<int> pIdx = std::make_shared<int>(0);
+    std::shared_ptr<int> pSink = std::make_shared<int>(0);
+    return [pDesc, pIdx, pSink]() {
+      const int i = (*pIdx)++ & 1023;
+      *pSink += ORBmatcher::DescriptorDistance(pDesc->row(i),
+                                               pDesc->row((i + 1) & 1023));
+    };
+  };
+  vKernels.push_back(distance);
+
+  Kernel search;
+  search.name = "ORBmatcher::SearchByProjection";
+  search.nIterations = 200;
+  search.setup = [](const Scene &scene) -> std::function<void()> {
+    std::shared_ptr<FrameContext> ctx = CreateFrameContext(scene, true);
+    std::vector<MapPoint *> vpLocalMapPoints;
+    for (size_t i = 0; i < ctx->vpMapPoints.size(); i++) {
+      MapPoint *pMP = ctx->vpMapPoints[i];
+      if (pMP && ctx->pFrame->isInFrustum(pMP, 0.5))
+        vpLocalMapPoints.push_back(pMP);
+    }
+    std::shared_ptr<ORBmatcher> pMatcher = std::make_shared<ORBmatcher>(0.8);
+    return [ctx, vpLocalMapPoints, pMatcher]() {
+      std::fill(ctx->pFrame->mvpMapPoints.begin(),
+                ctx->pFrame->mvpMapPoints.end(), static_cast<MapPoint *>(NULL));
+      pMatcher->SearchByProjection(*ctx->pFrame, vpLocalMapPoints, 3);
+    };
+  };
+  vKernels.push_back(search);
+
+  Kernel bow;
+  bow.name = "ORBVocabulary::transform";
+  bow.nIterations = 50;
+  bow.setup = [](const Scene &scene) -> std::function<void()> {
+    if (!scene.pVocabulary) return std::function<void()>();
+    std::shared_ptr<ORBextractor> pExtractor(CreateExtractor(scene));
+    std::vector<cv::KeyPoint> vKeys;
+    cv::Mat desc;
+    std::vector<int> vLapping = {0, 0};
+    (*pExtractor)(scene.imGray, cv::Mat(), vKeys, desc, vLapping);
+    const std::vector<cv::Mat> vDesc = Converter::toDescriptorVector(desc);
+    std::shared_ptr<DBoW2::BowVector> pBowVec =
+        std::make_shared<DBoW2::BowVector>();
+    std::shared_ptr<DBoW2::FeatureVector> pFeatVec =
+        std::make_shared<DBoW2::FeatureVector>();
+    ORBVocabulary *pVocabulary = scene.pVocabulary;
+    return [pVocabulary, vDesc, pBowVec, pFeatVec]() {
+      pVocabulary->transform(vDesc, *pBowVec, *pFeatVec, 4);
+    };
+  };
+  vKernels.push_back(bow);
+
+  Kernel gicp;
+  gicp.name = "RegistrationGICP::RegisterPointClouds";
+  gicp.nIterations = 20;
+  gicp.setup = [](const Scene &scene) -> std::function<void()> {
+    std::shared_ptr<RegistrationGICP> pRegistration =
+        std::make_shared<RegistrationGICP>();
+    const std::vector<Eigen::Vector4f> &vTarget = scene.vTargetPoints;
+    const std::vector<Eigen::Vector4f> &vSource = scene.vSourcePoints;
+    return [pRegistration, &vTarget, &vSource]() {
+      pRegistration->RegisterPointClouds(vTarget, vSource,
+                                         Eigen::Isometry3d::Identity());
+    };
+  };
+  vKernels.push_back(gicp);
+
+  Kernel edges;
+  edges.name = "Optimizer::GenerateLidarEdge";
+  edges.nIterations = 50;
+  edges.setup = [](const Scene &scene) -> std::function<void()> {
+    std::shared_ptr<FrameContext> ctx = CreateFrameContext(scene, false);
+    ctx->pFrame->mpPointCloudDownsampled = scene.pCloud;
+    pcl::KdTreeFLANN<PointType>::Ptr pKdtree(new pcl::KdTreeFLANN<PointType>());
+    pKdtree->setInputCloud(scene.pCloud);
+    pcl::PointCloud<PointType>::Ptr pMapCloud = scene.pCloud;
+    return [ctx, pKdtree, pMapCloud]() {
+      std::vector<EdgeSE3LidarPoint2Plane *> vpEdges =
+          Optimizer::GenerateLidarEdge<EdgeSE3LidarPoint2Plane, Frame>(
+              ctx->pFrame, Eigen::Matrix4d::Identity(), pMapCloud, pKdtree);
+      for (size_t i = 0; i < vpEdges.size(); i++) delete vpEdges[i];
+    };
+  };
+  vKernels.push_back(edges);
+
+  Kernel pose;
+  pose.name = "Optimizer::PoseOptimization";
+  pose.nIterations = 100;
+  pose.setup = [](const Scene &scene) -> std::function<void()> {
+    std::shared_ptr<FrameContext> ctx = CreateFrameContext(scene, true);
+    // Starts 5 cm and ~1 deg away from the true pose
+    const Sophus::SE3f Tinit(
+        Eigen::AngleAxisf(0.017f, Eigen::Vector3f::UnitY()).toRotationMatrix(),
+        Eigen::Vector3f(0.05f, 0.f, 0.f));
+    return [ctx, Tinit]() {
+      Frame *pFrame = ctx->pFrame;
+      std::copy(ctx->vpMapPoints.begin(), ctx->vpMapPoints.end(),
+                pFrame->mvpMapPoints.begin());
+      std::fill(pFrame->mvbOutlier.begin(), pFrame->mvbOutlier.end(), false);
+      pFrame->SetPose(Tinit);
+      Optimizer::PoseOptimization(pFrame);
+    };
+  };
+  vKernels.push_back(pose);
+
+  Kernel imu;
+  imu.name = "IMU::Preintegrated::IntegrateNewMeasurement";
+  imu.nIterations = 1000000;
+  imu.setup = [](const Scene &scene) -> std::function<void()> {
+    Settings *pSettings = scene.pSettings;
+    const IMU::Calib calib(pSettings->Tbc(), pSettings->noiseGyro(),
+                           pSettings->noiseAcc(), pSettings->gyroWalk(),
+                           pSettings->accWalk());
+    std::shared_ptr<IMU::Preintegrated> pPreintegrated(
+        new IMU::Preintegrated(IMU::Bias(), calib));
+    std::shared_ptr<int> pCount = std::make_shared<int>(0);
+    const Eigen::Vector3f acc(0.1f, -9.7f, 0.3f), gyro(0.01f, 0.02f, -0.03f);
+    return [pPreintegrated, pCount, acc, gyro]() {
+      // A frame to frame span at 200 Hz, restarted to keep it bounded
+      if (++(*pCount) % 1000 == 0) pPreintegrated->Initialize(IMU::Bias());
+      pPreintegrated->IntegrateNewMeasurement(acc, gyro, 0.005f);
+    };
+  };
+  vKernels.push_back(imu);
+
+  Kernel laser;
+  laser.name = "LaserProcessingClass::featureExtraction";
+  laser.nIterations = 50;
+  laser.setup = [](const Scene &scene) -> std::function<void()> {
+    std::string strConfig = scene.pSettings->lidarConfigFile();
+    if (strConfig.empty()) return std::function<void()>();
+    std::shared_ptr<LaserProcessingClass> pLaser =
+        std::make_shared<LaserProcessingClass>();
+    pLaser->init(strConfig);
+    pcl::PointCloud<PointType>::Ptr pCloud = scene.pCloud;
+    return [pLaser, pCloud]() {
+      pcl::PointCloud<PointType>::Ptr pEdge(new pcl::PointCloud<PointType>());
+      pcl::PointCloud<PointType>::Ptr pSurf(new pcl::PointCloud<PointType>());
+      pLaser->featureExtraction(pCloud, pEdge, pSurf);
+    };
+  };
+  vKernels.push_back(laser);
+}
+
+// Textured scene: a wall at 3 m, a box at 2 m and the floor 1 m below the
+// camera. The texture is random rectangles and circles on smooth noise.
+void CreateSyntheticFrame(const Scene &scene, const cv::Size &size,
+                          cv::Mat &imRGB, cv::Mat &imDepth) {
+  cv::RNG rng(scene.seed);
+  cv::Mat im(size, CV_8UC1);
+  rng.fill(im, cv::RNG::UNIFORM, 0, 256);
+  cv::GaussianBlur(im, im, cv::Size(0, 0), 3.0);
+  for (int i = 0; i < 400; i++) {
+    const cv::Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+    const cv::Scalar color(rng.uniform(0, 256));
+    if (i % 2)
+      cv::rectangle(im, p,
+                    p + cv::Point(rng.uniform(5, 40), rng.uniform(5, 40)),
+                    color, cv::FILLED);
+    else
+      cv::circle(im, p, rng.uniform(3, 20), color, cv::FILLED);
+  }
+  cv::cvtColor(im, imRGB, cv::COLOR_GRAY2BGR);
+
+  const float fy = scene.K.at<float>(1, 1);
+  const float cy = scene.K.at<float>(1, 2);
+  imDepth = cv::Mat(size, CV_32F);
+  for (int v = 0; v < size.height; v++) {
+    for (int u = 0; u < size.width; u++) {
+      float d = 3.f;
+      if (u > size.width / 3 && u < size.width / 2 && v > size.height / 3)
+        d = 2.f;
+      if (v > cy) d = std::min(d, fy * 1.f / (v - cy));
+      imDepth.at<float>(v, u) = d;
+    }
+  }
+}
+
+void CreateClouds(Scene &scene) {
+  const float fx = scene.K.at<float>(0, 0), fy = scene.K.at<float>(1, 1);
+  const float cx = scene.K.at<float>(0, 2), cy = scene.K.at<float>(1, 2);
+  scene.pCloud.reset(new pcl::PointCloud<PointType>());
+  for (int v = 0; v < scene.imDepth.rows; v += 4) {
+    for (int u = 0; u < scene.imDepth.cols; u += 4) {
+      const float d = scene.imDepth.at<float>(v, u);
+      if (d < 0.1f || d > 10.f) continue;
+      PointType p;
+      p.x = (u - cx) * d / fx;
+      p.y = (v - cy) * d / fy;
+      p.z = d;
+      const cv::Vec3b color = scene.imRGB.at<cv::Vec3b>(v, u);
+      p.b = color[0];
+      p.g = color[1];
+      p.r = color[2];
+      p.a = 255;
+      scene.pCloud->push_back(p);
+      scene.vSourcePoints.push_back(Eigen::Vector4f(p.x, p.y, p.z, 1.f));
+    }
+  }
+
+  // Target seen after a 2 cm / 1 deg motion
+  Eigen::Isometry3f T_target_source = Eigen::Isometry3f::Identity();
+  T_target_source.rotate(
+      Eigen::AngleAxisf(0.017f, Eigen::Vector3f::UnitY()).toRotationMatrix());
+  T_target_source.pretranslate(Eigen::Vector3f(0.02f, 0.f, 0.f));
+  for (size_t i = 0; i < scene.vSourcePoints.size(); i++) {
+    Eigen::Vector4f p = scene.vSourcePoints[i];
+    p.head<3>() = T_target_source * p.head<3>().eval();
+    scene.vTargetPoints.push_back(p);
+  }
+}
+
+bool RunKernel(const Kernel &kernel, const Scene &scene, const int nThreads,
+               const int nIterations, Result &result) {
+  std::vector<std::function<void()>> vOps(nThreads);
+  for (int t = 0; t < nThreads; t++) {
+    vOps[t] = kernel.setup(scene);
+    if (!vOps[t]) return false;
+    vOps[t]();  // warm up
+  }
+
+  std::atomic<int> nReady(0);
+  std::atomic<bool> bStart(false);
+  std::vector<std::thread> vThreads;
+  for (int t = 0; t < nThreads; t++) {
+    vThreads.push_back(std::thread([&, t]() {
+      nReady++;
+      while (!bStart.load()) std::this_thread::yield();
+      for (int i = 0; i < nIterations; i++) vOps[t]();
+    }));
+  }
+  while (nReady.load() < nThreads) std::this_thread::yield();
+
+  const size_t nAllocs0 = gnAllocs.load();
+  const std::chrono::steady_clock::time_point t0 =
+      std::chrono::steady_clock::now();
+  bStart = true;
+  for (int t = 0; t < nThreads; t++) vThreads[t].join();
+  const std::chrono::steady_clock::time_point t1 =
+      std::chrono::steady_clock::now();
+  const size_t nAllocs1 = gnAllocs.load();
+
+  const double nOps = static_cast<double>(nThreads) * nIterations;
+  const double wall_ns =
+      std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(
+          t1 - t0)
+          .count();
+  result.name = kernel.name;
+  result.nThreads = nThreads;
+  // Latency of one operation, each thread runs its share back to back
+  result.ns_per_op = wall_ns * nThreads / nOps;
+  result.ops_per_s = nOps / (wall_ns * 1e-9);
+  result.allocs_per_op = (nAllocs1 - nAllocs0) / nOps;
+  result.speedup = 1.0;
+  return true;
+}
+
+std::vector<int> ParseThreads(const std::string &str) {
+  std::vector<int> vThreads;
+  std::stringstream ss(str);
+  std::string item;
+  while (getline(ss, item, ',')) {
+    const int n = atoi(item.c_str());
+    if (n > 0) vThreads.push_back(n);
+  }
+  return vThreads;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    cerr << endl
+         << "Usage: ./slam_microbench path_to_vocabulary path_to_settings "
+            "[--filter substring] [--iters n] [--threads 1,2,4] "
+            "[--image rgb.png --depth depth.png] [--seed n] [--report file]"
+         << endl
+         << "  path_to_vocabulary may be - to skip ORBVocabulary::transform"
+         << endl;
+    return 1;
+  }
+
+  std::string strFilter, strImage, strDepth, strReport;
+  int nIterations = 0;
+  std::vector<int> vThreads = {1, 2, 4};
+  Scene scene;
+  scene.seed = 42;
+  for (int i = 3; i < argc; i++) {
+    const std::string arg(argv[i]);
+    if (arg == "--filter" && i + 1 < argc)
+      strFilter = argv[++i];
+    else if (arg == "--iters" && i + 1 < argc)
+      nIterations = atoi(argv[++i]);
+    else if (arg == "--threads" && i + 1 < argc)
+      vThreads = ParseThreads(argv[++i]);
+    else if (arg == "--image" && i + 1 < argc)
+      strImage = argv[++i];
+    else if (arg == "--depth" && i + 1 < argc)
+      strDepth = argv[++i];
+    else if (arg == "--seed" && i + 1 < argc)
+      scene.seed = atoi(argv[++i]);
+    else if (arg == "--report" && i + 1 < argc)
+      strReport = argv[++i];
+    else {
+      cerr << "Unknown option " << arg << endl;
+      return 1;
+    }
+  }
+  if (vThreads.empty()) vThreads.push_back(1);
+
+#ifdef _OPENMP
+  // Internal parallel loops would hide the scaling over bench threads
+  omp_set_num_threads(1);
+#endif
+
+  scene.pSettings = new Settings(argv[2], System::IMU_RGBD);
+  scene.pCamera = scene.pSettings->camera1();
+  scene.K = cv::Mat::eye(3, 3, CV_32F);
+  scene.K.at<float>(0, 0) = scene.pCamera->getParameter(0);
+  scene.K.at<float>(1, 1) = scene.pCamera->getParameter(1);
+  scene.K.at<float>(0, 2) = scene.pCamera->getParameter(2);
+  scene.K.at<float>(1, 2) = scene.pCamera->getParameter(3);
+  scene.distCoef = scene.pSettings->needToUndistort()
+                       ? scene.pSettings->camera1DistortionCoef().clone()
+                       : cv::Mat::zeros(4, 1, CV_32F);
+  scene.bf = scene.pSettings->bf();
+  scene.thDepth = scene.pSettings->b() * scene.pSettings->thDepth();
+
+  scene.pVocabulary = NULL;
+  if (std::string(argv[1]) != "-") {
+    cout << "Loading ORB vocabulary ..." << endl;
+    scene.pVocabulary = new ORBVocabulary();
+    if (!scene.pVocabulary->loadFromTextFile(argv[1])) {
+      cerr << "Wrong path to vocabulary " << argv[1] << endl;
+      return 1;
+    }
+  }
+
+  if (!strImage.empty()) {
+    scene.imRGB = cv::imread(strImage, cv::IMREAD_COLOR);
+    cv::Mat imD = cv::imread(strDepth, cv::IMREAD_UNCHANGED);
+    if (scene.imRGB.empty() || imD.empty()) {
+      cerr << "Failed to load " << strImage << " / " << strDepth << endl;
+      return 1;
+    }
+    imD.convertTo(scene.imDepth, CV_32F, scene.pSettings->depthMapFactor());
+  } else {
+    CreateSyntheticFrame(scene, scene.pSettings->newImSize(), scene.imRGB,
+                         scene.imDepth);
+  }
+  cv::cvtColor(scene.imRGB, scene.imGray, cv::COLOR_BGR2GRAY);
+  CreateClouds(scene);
+
+  std::vector<Kernel> vKernels;
+  BuildKernels(vKernels);
+
+  std::vector<Result> vResults;
+  cout << fixed << setprecision(1);
+  cout << left << setw(46) << "kernel" << right << setw(8) << "threads"
+       << setw(14) << "ns/op" << setw(14) << "ops/s" << setw(12)
+       << "allocs/op" << setw(10) << "speedup" << endl;
+  for (size_t k = 0; k < vKernels.size(); k++) {
+    const Kernel &kernel = vKernels[k];
+    if (!strFilter.empty() && kernel.name.find(strFilter) == std::string::npos)
+      continue;
+    double single_ops_per_s = 0;
+    for (size_t t = 0; t < vThreads.size(); t++) {
+      Result result;
+      if (!RunKernel(kernel, scene, vThreads[t],
+                     nIterations > 0 ? nIterations : kernel.nIterations,
+                     result)) {
+        cout << left << setw(46) << kernel.name << right << setw(8) << "-"
+             << "  skipped, missing input" << endl;
+        break;
+      }
+      if (t == 0) single_ops_per_s = result.ops_per_s / vThreads[t];
+      result.speedup = result.ops_per_s / single_ops_per_s;
+      vResults.push_back(result);
+      cout << left << setw(46) << result.name << right << setw(8)
+           << result.nThreads << setw(14) << result.ns_per_op << setw(14)
+           << result.ops_per_s << setw(12) << result.allocs_per_op
+           << setw(10) << result.speedup << endl;
+    }
+  }
+
+  if (!strReport.empty()) {
+    ofstream f(strReport.c_str());
+    f << fixed << setprecision(3);
+    f << "{" << endl;
+    f << "  \"seed\": " << scene.seed << "," << endl;
+    f << "  \"input\": \"" << (strImage.empty() ? "synthetic" : strImage)
+      << "\"," << endl;
+    f << "  \"results\": [" << endl;
+    for (size_t i = 0; i < vResults.size(); i++) {
+      const Result &r = vResults[i];
+      f << "    {\"kernel\": \"" << r.name << "\", \"threads\": " << r.nThreads
+        << ", \"ns_per_op\": " << r.ns_per_op
+        << ", \"ops_per_s\": " << r.ops_per_s
+        << ", \"allocs_per_op\": " << r.allocs_per_op
+        << ", \"speedup\": " << r.speedup << "}"
+        << (i + 1 < vResults.size() ? "," : "") << endl;
+    }
+    f << "  ]" << endl;
+    f << "}" << endl;
+    cout << "report saved to " << strReport << endl;
+  }
+
+  return 0;
+}
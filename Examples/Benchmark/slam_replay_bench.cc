@@ -0,0 +1,486 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Offline replay benchmark of the RGB-D inertial pipeline.
+//
+// Replays a sequence with the layout read by rgbd_inertial (association file,
+// imu/imu.txt and optionally imu/odom.txt, timestamps in ms) either as fast as
+// possible or at a fixed frame rate, and writes a JSON report with the
+// per-stage latency percentiles, the throughput, the peak RSS and the ATE
+// against a ground truth trajectory.
+
+#include <System.h>
+#include <sys/resource.h>
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <opencv2/core/core.hpp>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct BenchOptions {
+  double rate;        // frames per second, 0 replays as fast as possible
+  bool bLockStep;     // wait for the mapping threads after every frame
+  bool bPreload;      // decode every image before the replay starts
+  string strGroundTruth;
+  double gtStampScale;  // seconds per ground truth stamp unit
+  string strReport;
+  string strTrace;    // Chrome trace of the replay, see Trace.h
+};
+
+struct StampedPose {
+  double t;
+  Eigen::Vector3d p;
+};
+
+void LoadImages(const string &strAssociationFilename,
+                vector<string> &vstrImageFilenamesRGB,
+                vector<string> &vstrImageFilenamesD,
+                vector<double> &vTimestamps);
+void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps,
+             vector<cv::Point3f> &vAcc, vector<cv::Point3f> &vGyro);
+void LoadOdom(const string &strOdomPath, vector<double> &vTimeStamps,
+              vector<Eigen::Vector3f> &vPos);
+void LoadTrajectoryTUM(const string &strFile, const double stampScale,
+                       vector<StampedPose> &vPoses);
+bool ParseStampUnit(const string &strUnit, double &stampScale);
+
+double ComputeATE(const vector<StampedPose> &vEstimated,
+                  const vector<StampedPose> &vGroundTruth, int &nMatched);
+double Percentile(const vector<double> &vSorted, const double p);
+size_t PeakRSSKiB();
+void WriteStage(ofstream &f, const string &name, vector<double> v,
+                const bool bLast);
+
+int main(int argc, char **argv) {
+  if (argc < 5) {
+    cerr << endl
+         << "Usage: ./slam_replay_bench path_to_vocabulary path_to_settings "
+            "path_to_sequence path_to_association [--rate fps] [--lockstep] "
+            "[--no-preload] [--groundtruth file] [--groundtruth-unit "
+            "s|ms|us|ns] [--report file] [--trace file]"
+         << endl;
+    return 1;
+  }
+
+  const string strSequence = string(argv[3]);
+  BenchOptions options;
+  options.rate = 0.0;
+  options.bLockStep = false;
+  options.bPreload = true;
+  options.gtStampScale = 1e-3;
+  options.strReport = strSequence + "/ReplayBench.json";
+  for (int i = 5; i < argc; i++) {
+    const string arg(argv[i]);
+    if (arg == "--rate" && i + 1 < argc)
+      options.rate = atof(argv[++i]);
+    else if (arg == "--lockstep")
+      options.bLockStep = true;
+    else if (arg == "--no-preload")
+      options.bPreload = false;
+    else if (arg == "--groundtruth" && i + 1 < argc)
+      options.strGroundTruth = argv[++i];
+    else if (arg == "--groundtruth-unit" && i + 1 < argc) {
+      if (!ParseStampUnit(argv[++i], options.gtStampScale)) {
+        cerr << "Unknown time unit " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if (arg == "--report" && i + 1 < argc)
+      options.strReport = argv[++i];
+    else if (arg == "--trace" && i + 1 < argc)
+      options.strTrace = argv[++i];
+    else {
+      cerr << "Unknown option " << arg << endl;
+      return 1;
+    }
+  }
+
+  cv::FileStorage fsSettings(string(argv[2]), cv::FileStorage::READ);
+  if (!fsSettings.isOpened()) {
+    cerr << "Failed to open setting file at: " << string(argv[2]) << endl;
+    return 1;
+  }
+
+  vector<string> vstrImageFilenamesRGB;
+  vector<string> vstrImageFilenamesD;
+  vector<double> vTimestamps;
+  LoadImages(string(argv[4]), vstrImageFilenamesRGB, vstrImageFilenamesD,
+             vTimestamps);
+  const int nImages = vstrImageFilenamesRGB.size();
+  if (nImages == 0) {
+    cerr << endl << "No images found in provided path." << endl;
+    return 1;
+  } else if (vstrImageFilenamesD.size() != vstrImageFilenamesRGB.size()) {
+    cerr << endl << "Different number of images for rgb and depth." << endl;
+    return 1;
+  }
+
+  vector<cv::Point3f> vAcc, vGyro;
+  vector<double> vTimestampsImu, vTimestampsOdom;
+  LoadIMU(strSequence + "/imu/imu.txt", vTimestampsImu, vAcc, vGyro);
+  if (vTimestampsImu.empty()) {
+    cerr << endl << "No IMU measurements found in provided path." << endl;
+    return 1;
+  }
+  int bUseOdom = fsSettings["UseRobotOdom"];
+  vector<Eigen::Vector3f> vPos;
+  if (bUseOdom) LoadOdom(strSequence + "/imu/odom.txt", vTimestampsOdom, vPos);
+
+  // Every frame is decoded up front so that disk I/O stays out of the
+  // measured loop
+  vector<cv::Mat> vImRGB, vImD;
+  if (options.bPreload) {
+    cout << "Preloading " << nImages << " frames ..." << endl;
+    vImRGB.resize(nImages);
+    vImD.resize(nImages);
+    for (int ni = 0; ni < nImages; ni++) {
+      vImRGB[ni] = cv::imread(strSequence + "/" + vstrImageFilenamesRGB[ni],
+                              cv::IMREAD_UNCHANGED);
+      vImD[ni] = cv::imread(strSequence + "/" + vstrImageFilenamesD[ni],
+                            cv::IMREAD_UNCHANGED);
+      if (vImRGB[ni].empty()) {
+        cerr << "Failed to load image at: " << strSequence << "/"
+             << vstrImageFilenamesRGB[ni] << endl;
+        return 1;
+      }
+    }
+  }
+
+  // Measurements up to the first frame initialize the IMU span
+  size_t first_imu = 0, first_odom = 0;
+  while (first_imu < vTimestampsImu.size() &&
+         vTimestampsImu[first_imu] <= vTimestamps[0])
+    first_imu++;
+  if (first_imu > 0) first_imu--;
+  if (bUseOdom) {
+    while (first_odom < vTimestampsOdom.size() &&
+           vTimestampsOdom[first_odom] <= vTimestamps[0])
+      first_odom++;
+    if (first_odom > 0) first_odom--;
+  }
+
+  ORB_SLAM3::System SLAM(argv[1], argv[2], ORB_SLAM3::System::IMU_RGBD, false,
+                         0, std::string(), strSequence);
+  const float imageScale = SLAM.GetImageScale();
+  if (!options.strTrace.empty()) SLAM.SetTracing(true);
+
+  cout << endl << "-------" << endl;
+  cout << "Replaying " << nImages << " frames";
+  if (options.rate > 0)
+    cout << " at " << options.rate << " fps";
+  else
+    cout << " as fast as possible";
+  if (options.bLockStep) cout << ", lock-step";
+  cout << endl << endl;
+
+  vector<double> vdFrame_ms;
+  vdFrame_ms.reserve(nImages);
+  vector<ORB_SLAM3::IMU::Point> vImuMeas;
+  vector<Eigen::Vector3f> vOdomMeas;
+  cv::Mat imRGB, imD;
+  int nTracked = 0;
+
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  for (int ni = 0; ni < nImages; ni++) {
+    if (options.rate > 0) {
+      std::this_thread::sleep_until(
+          start_time + std::chrono::microseconds(
+                           static_cast<long>(ni * 1e6 / options.rate)));
+    }
+
+    if (options.bPreload) {
+      imRGB = vImRGB[ni];
+      imD = vImD[ni];
+    } else {
+      imRGB = cv::imread(strSequence + "/" + vstrImageFilenamesRGB[ni],
+                         cv::IMREAD_UNCHANGED);
+      imD = cv::imread(strSequence + "/" + vstrImageFilenamesD[ni],
+                       cv::IMREAD_UNCHANGED);
+    }
+    if (imageScale != 1.f) {
+      const int width = imRGB.cols * imageScale;
+      const int height = imRGB.rows * imageScale;
+      cv::resize(imRGB, imRGB, cv::Size(width, height));
+      cv::resize(imD, imD, cv::Size(width, height));
+    }
+
+    vImuMeas.clear();
+    vOdomMeas.clear();
+    if (ni > 0) {
+      while (first_imu < vTimestampsImu.size() &&
+             vTimestampsImu[first_imu] <= vTimestamps[ni]) {
+        vImuMeas.push_back(ORB_SLAM3::IMU::Point(
+            vAcc[first_imu].x, vAcc[first_imu].y, vAcc[first_imu].z,
+            vGyro[first_imu].x, vGyro[first_imu].y, vGyro[first_imu].z,
+            vTimestampsImu[first_imu]));
+        first_imu++;
+      }
+      while (bUseOdom && first_odom < vTimestampsOdom.size() &&
+             vTimestampsOdom[first_odom] <= vTimestamps[ni]) {
+        vOdomMeas.push_back(vPos[first_odom]);
+        first_odom++;
+      }
+    }
+    // Same gating as rgbd_inertial
+    if (vImuMeas.size() < 3) continue;
+
+    const std::chrono::steady_clock::time_point t1 =
+        std::chrono::steady_clock::now();
+    if (bUseOdom)
+      SLAM.TrackRGBD(imRGB, imD, vTimestamps[ni], vImuMeas, vOdomMeas);
+    else
+      SLAM.TrackRGBD(imRGB, imD, vTimestamps[ni], vImuMeas);
+    const std::chrono::steady_clock::time_point t2 =
+        std::chrono::steady_clock::now();
+    vdFrame_ms.push_back(
+        std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
+            t2 - t1)
+            .count());
+    nTracked++;
+
+    if (options.bLockStep) SLAM.WaitForMapping();
+  }
+  const std::chrono::steady_clock::time_point end_time =
+      std::chrono::steady_clock::now();
+  const double replay_s =
+      std::chrono::duration_cast<std::chrono::duration<double>>(end_time -
+                                                                start_time)
+          .count();
+
+  SLAM.Shutdown(strSequence);
+  if (!options.strTrace.empty()) SLAM.SaveTrace(options.strTrace);
+
+  const string strTrajectory = strSequence + "/CameraTrajectory_Bench.txt";
+  SLAM.SaveTrajectoryTUM(strTrajectory.c_str());
+
+  double ate = -1.0;
+  int nMatched = 0;
+  if (!options.strGroundTruth.empty()) {
+    vector<StampedPose> vEstimated, vGroundTruth;
+    // SaveTrajectoryTUM writes the stamps in ms
+    LoadTrajectoryTUM(strTrajectory, 1e-3, vEstimated);
+    LoadTrajectoryTUM(options.strGroundTruth, options.gtStampScale,
+                      vGroundTruth);
+    ate = ComputeATE(vEstimated, vGroundTruth, nMatched);
+  }
+
+  std::map<std::string, vector<double>> mStageTimes;
+#ifdef REGISTER_TIMES
+  SLAM.GetStageTimes(mStageTimes);
+#endif
+  mStageTimes["replay/frame"] = vdFrame_ms;
+
+  ofstream f(options.strReport.c_str());
+  if (!f.is_open()) {
+    cerr << "Failed to open report file " << options.strReport << endl;
+    return 1;
+  }
+  f << fixed << setprecision(4);
+  f << "{" << endl;
+  f << "  \"frames\": " << nImages << "," << endl;
+  f << "  \"tracked_frames\": " << nTracked << "," << endl;
+  f << "  \"lost_frames\": " << SLAM.GetTrackLostCnt() << "," << endl;
+  f << "  \"rate_fps\": " << options.rate << "," << endl;
+  f << "  \"lockstep\": " << (options.bLockStep ? "true" : "false") << ","
+    << endl;
+  f << "  \"preload\": " << (options.bPreload ? "true" : "false") << ","
+    << endl;
+  f << "  \"wall_time_s\": " << replay_s << "," << endl;
+  f << "  \"throughput_fps\": " << (replay_s > 0 ? nTracked / replay_s : 0.0)
+    << "," << endl;
+  f << "  \"peak_rss_mib\": " << PeakRSSKiB() / 1024.0 << "," << endl;
+  if (ate >= 0) {
+    f << "  \"ate_rmse_m\": " << ate << "," << endl;
+    f << "  \"ate_matched_poses\": " << nMatched << "," << endl;
+  } else {
+    f << "  \"ate_rmse_m\": null," << endl;
+  }
+  f << "  \"stages_ms\": {" << endl;
+  for (std::map<std::string, vector<double>>::iterator it =
+           mStageTimes.begin();
+       it != mStageTimes.end(); it++) {
+    WriteStage(f, it->first, it->second, std::next(it) == mStageTimes.end());
+  }
+  f << "  }" << endl;
+  f << "}" << endl;
+  f.close();
+
+  cout << "-------" << endl << endl;
+  cout << "throughput: " << (replay_s > 0 ? nTracked / replay_s : 0.0)
+       << " fps" << endl;
+  cout << "peak RSS: " << PeakRSSKiB() / 1024.0 << " MiB" << endl;
+  if (ate >= 0) cout << "ATE RMSE: " << ate << " m" << endl;
+  cout << "report saved to " << options.strReport << endl;
+
+  return 0;
+}
+
+double Percentile(const vector<double> &vSorted, const double p) {
+  if (vSorted.empty()) return 0.0;
+  // Nearest rank
+  size_t rank = static_cast<size_t>(std::ceil(p * vSorted.size()));
+  rank = std::min(std::max<size_t>(rank, 1), vSorted.size());
+  return vSorted[rank - 1];
+}
+
+void WriteStage(ofstream &f, const string &name, vector<double> v,
+                const bool bLast) {
+  sort(v.begin(), v.end());
+  double sum = 0;
+  for (size_t i = 0; i < v.size(); i++) sum += v[i];
+  f << "    \"" << name << "\": {\"count\": " << v.size()
+    << ", \"mean\": " << (v.empty() ? 0.0 : sum / v.size())
+    << ", \"p50\": " << Percentile(v, 0.5)
+    << ", \"p90\": " << Percentile(v, 0.9)
+    << ", \"p99\": " << Percentile(v, 0.99)
+    << ", \"max\": " << (v.empty() ? 0.0 : v.back()) << "}"
+    << (bLast ? "" : ",") << endl;
+}
+
+size_t PeakRSSKiB() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_maxrss;  // KiB on Linux
+}
+
+double ComputeATE(const vector<StampedPose> &vEstimated,
+                  const vector<StampedPose> &vGroundTruth, int &nMatched) {
+  // Associate each estimated pose with the closest ground truth stamp
+  const double maxTimeDiff = 0.02;
+  vector<Eigen::Vector3d> vEst, vGt;
+  size_t j = 0;
+  for (size_t i = 0; i < vEstimated.size() && !vGroundTruth.empty(); i++) {
+    const double t = vEstimated[i].t;
+    while (j + 1 < vGroundTruth.size() &&
+           std::abs(vGroundTruth[j + 1].t - t) <=
+               std::abs(vGroundTruth[j].t - t))
+      j++;
+    if (std::abs(vGroundTruth[j].t - t) > maxTimeDiff) continue;
+    vEst.push_back(vEstimated[i].p);
+    vGt.push_back(vGroundTruth[j].p);
+  }
+  nMatched = vEst.size();
+  if (nMatched < 3) return -1.0;
+
+  Eigen::Matrix3Xd est(3, nMatched), gt(3, nMatched);
+  for (int i = 0; i < nMatched; i++) {
+    est.col(i) = vEst[i];
+    gt.col(i) = vGt[i];
+  }
+  // Metric scale with RGB-D, only a rigid alignment is estimated
+  const Eigen::Matrix4d T = Eigen::umeyama(est, gt, false);
+  const Eigen::Matrix3Xd aligned =
+      (T.topLeftCorner<3, 3>() * est).colwise() + T.topRightCorner<3, 1>();
+  return std::sqrt((aligned - gt).colwise().squaredNorm().sum() / nMatched);
+}
+
+void LoadTrajectoryTUM(const string &strFile, const double stampScale,
+                       vector<StampedPose> &vPoses) {
+  ifstream f(strFile.c_str());
+  string s;
+  while (getline(f, s)) {
+    if (s.empty() || s[0] == '#') continue;
+    stringstream ss(s);
+    StampedPose pose;
+    double qx, qy, qz, qw;
+    if (!(ss >> pose.t >> pose.p(0) >> pose.p(1) >> pose.p(2) >> qx >> qy >>
+          qz >> qw))
+      continue;
+    pose.t *= stampScale;
+    vPoses.push_back(pose);
+  }
+}
+
+bool ParseStampUnit(const string &strUnit, double &stampScale) {
+  if (strUnit == "s")
+    stampScale = 1.0;
+  else if (strUnit == "ms")
+    stampScale = 1e-3;
+  else if (strUnit == "us")
+    stampScale = 1e-6;
+  else if (strUnit == "ns")
+    stampScale = 1e-9;
+  else
+    return false;
+  return true;
+}
+
+void LoadImages(const string &strAssociationFilename,
+                vector<string> &vstrImageFilenamesRGB,
+                vector<string> &vstrImageFilenamesD,
+                vector<double> &vTimestamps) {
+  ifstream fAssociation(strAssociationFilename.c_str());
+  string s;
+  while (getline(fAssociation, s)) {
+    if (s.empty()) continue;
+    stringstream ss(s);
+    double t;
+    string sRGB, sD;
+    ss >> t >> sRGB >> sD;
+    // ms to s
+    vTimestamps.push_back(t / 1e3);
+    vstrImageFilenamesRGB.push_back(sRGB);
+    vstrImageFilenamesD.push_back(sD);
+  }
+}
+
+// Comma separated rows: t[ms],ax,ay,az,gx,gy,gz
+void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps,
+             vector<cv::Point3f> &vAcc, vector<cv::Point3f> &vGyro) {
+  ifstream fImu(strImuPath.c_str());
+  string s;
+  while (getline(fImu, s)) {
+    if (s.empty() || s[0] == '#') continue;
+    double data[7];
+    char comma;
+    stringstream ss(s);
+    ss >> data[0];
+    for (int i = 1; i < 7; i++) ss >> comma >> data[i];
+    if (ss.fail()) continue;
+    vTimeStamps.push_back(data[0] / 1e3);
+    vAcc.push_back(cv::Point3f(data[1], data[2], data[3]));
+    vGyro.push_back(cv::Point3f(data[4], data[5], data[6]));
+  }
+}
+
+// Comma separated rows: t[ms],vx,vy,vz,...
+void LoadOdom(const string &strOdomPath, vector<double> &vTimeStamps,
+              vector<Eigen::Vector3f> &vPos) {
+  ifstream fOdom(strOdomPath.c_str());
+  string s;
+  while (getline(fOdom, s)) {
+    if (s.empty() || s[0] == '#') continue;
+    double data[4];
+    char comma;
+    stringstream ss(s);
+    ss >> data[0];
+    for (int i = 1; i < 4; i++) ss >> comma >> data[i];
+    if (ss.fail()) continue;
+    vTimeStamps.push_back(data[0] / 1e3);
+    vPos.push_back(Eigen::Vector3f(data[1], data[2], data[3]));
+  }
+}
@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
 #include <mutex>
@@ -36,17 +37,25 @@
 #include <vector>
 
 #include "../../../include/ImuTypes.h"
+#include "../../../include/SpscRing.h"
 #include "../../../include/System.h"
 
 using namespace std;
 
 float shift = 0;
 
+struct OdomSample {
+  double t;
+  Eigen::Vector3f v;
+};
+
 class ImageGrabber : public rclcpp::Node {
  public:
   ImageGrabber(ORB_SLAM3::System *pSLAM, const bool bRect, const bool bClahe)
       : Node("image_grabber"),
         mpSLAM(pSLAM),
+        imuRing(8192),
+        odomRing(1024),
         do_rectify(bRect),
         mbClahe(bClahe) {
     rclcpp::QoS qos_profile(100);  // 默认的 QoS 策略，队列大小为 100
@@ -72,26 +81,60 @@ class ImageGrabber : public rclcpp::Node {
   }
 
   void GrabImageRgb(const sensor_msgs::msg::Image::SharedPtr msg) {
-    std::lock_guard<std::mutex> lock(mBufMutexRgb);
-    if (!imgRgbBuf.empty()) imgRgbBuf.pop();
-    // cout << "RGB image received" << endl;
-    imgRgbBuf.push(msg);
+    {
+      std::lock_guard<std::mutex> lock(mBufMutexRgb);
+      if (!imgRgbBuf.empty()) imgRgbBuf.pop();
+      // cout << "RGB image received" << endl;
+      imgRgbBuf.push(msg);
+    }
+    NotifyImage();
   }
 
   void GrabImageDepth(const sensor_msgs::msg::Image::SharedPtr msg) {
-    std::lock_guard<std::mutex> lock(mBufMutexDepth);
-    if (!imgDepthBuf.empty()) imgDepthBuf.pop();
-    // cout << "Depth image received" << endl;
-    imgDepthBuf.push(msg);
+    {
+      std::lock_guard<std::mutex> lock(mBufMutexDepth);
+      if (!imgDepthBuf.empty()) imgDepthBuf.pop();
+      // cout << "Depth image received" << endl;
+      imgDepthBuf.push(msg);
+    }
+    NotifyImage();
+  }
+  void NotifyImage() {
+    // Taking the lock orders the push before a waiter's predicate check
+    { std::lock_guard<std::mutex> lock(mMutexImageWait); }
+    mcvImage.notify_one();
+  }
+  bool HasImages() {
+    std::lock_guard<std::mutex> lockRgb(mBufMutexRgb);
+    std::lock_guard<std::mutex> lockDepth(mBufMutexDepth);
+    return !imgRgbBuf.empty() && !imgDepthBuf.empty();
+  }
+  // Blocks until both an rgb and a depth image are queued or the timeout
+  // expires
+  bool WaitImages(const std::chrono::milliseconds& timeout) {
+    std::unique_lock<std::mutex> lock(mMutexImageWait);
+    return mcvImage.wait_for(lock, timeout, [&]() { return HasImages(); });
   }
   void GrabImu(const sensor_msgs::msg::Imu::SharedPtr imu_msg) {
-    std::lock_guard<std::mutex> lock(mBufMutex);
-    imuBuf.push(imu_msg);
+    double t = imu_msg->header.stamp.sec + imu_msg->header.stamp.nanosec * 1e-9;
+    cv::Point3f acc(imu_msg->linear_acceleration.x,
+                    imu_msg->linear_acceleration.y,
+                    imu_msg->linear_acceleration.z);
+    cv::Point3f gyr(imu_msg->angular_velocity.x, imu_msg->angular_velocity.y,
+                    imu_msg->angular_velocity.z);
+    if (!imuRing.Push(ORB_SLAM3::IMU::Point(acc, gyr, t)))
+      RCLCPP_WARN(this->get_logger(), "IMU ring full, sample dropped");
     // cout << "IMU data received" << endl;
   }
   void GrabOdom(const nav_msgs::msg::Odometry::SharedPtr odom_msg) {
-    std::lock_guard<std::mutex> lock(mBufMutexOdom);
-    odomBuf.push(odom_msg);
+    OdomSample sample;
+    sample.t =
+        odom_msg->header.stamp.sec + odom_msg->header.stamp.nanosec * 1e-9;
+    sample.v = Eigen::Vector3f(odom_msg->twist.twist.linear.x,
+                               odom_msg->twist.twist.linear.y,
+                               odom_msg->twist.twist.linear.z);
+    if (!odomRing.Push(sample))
+      RCLCPP_WARN(this->get_logger(), "Odom ring full, sample dropped");
     // cout << "Odom data received" << endl;
   }
   cv::Mat GetImage(const sensor_msgs::msg::Image::SharedPtr img_msg) {
@@ -105,17 +148,24 @@ class ImageGrabber : public rclcpp::Node {
 
   void SyncWithImu() {
     const double maxTimeDiff = 0.03333;
+    // Bounds the waits so that shutdown is noticed
+    const std::chrono::milliseconds waitTimeout(100);
     while (rclcpp::ok()) {
       cv::Mat imRgb, imDepth;
       double tImRgb = 0, tImDepth = 0;
-      // if (imuBuf.empty()) {
-      //   // cout << "IMU data is empty" << endl;
-      // }
-      if (!imgRgbBuf.empty() && !imgDepthBuf.empty() && !imuBuf.empty()) {
-        tImRgb = imgRgbBuf.front()->header.stamp.sec +
-                 imgRgbBuf.front()->header.stamp.nanosec * 1e-9;
-        tImDepth = imgDepthBuf.front()->header.stamp.sec +
-                   imgDepthBuf.front()->header.stamp.nanosec * 1e-9;
+      // Block until images and IMU data are queued instead of polling
+      if (WaitImages(waitTimeout) && imuRing.WaitNewData(0, waitTimeout)) {
+        sensor_msgs::msg::Image::SharedPtr rgbMsg, depthMsg;
+        {
+          std::lock_guard<std::mutex> lockRgb(mBufMutexRgb);
+          std::lock_guard<std::mutex> lockDepth(mBufMutexDepth);
+          rgbMsg = imgRgbBuf.front();
+          depthMsg = imgDepthBuf.front();
+        }
+        tImRgb =
+            rgbMsg->header.stamp.sec + rgbMsg->header.stamp.nanosec * 1e-9;
+        tImDepth =
+            depthMsg->header.stamp.sec + depthMsg->header.stamp.nanosec * 1e-9;
         // cout << "tImRgb: " << tImRgb << ", tImDepth: " << tImDepth << endl;
         {
           std::lock_guard<std::mutex> lock(mBufMutexDepth);
@@ -135,10 +185,25 @@ class ImageGrabber : public rclcpp::Node {
           }
         }
 
-        if (std::abs(tImRgb - tImDepth) > maxTimeDiff) continue;
-        if (tImRgb > imuBuf.back()->header.stamp.sec +
-                         imuBuf.back()->header.stamp.nanosec * 1e-9)
+        // Only the newest image of each stream is kept, drop the older one
+        // unless it was already replaced, and wait for the next
+        if (tImRgb - tImDepth > maxTimeDiff) {
+          std::lock_guard<std::mutex> lock(mBufMutexDepth);
+          if (!imgDepthBuf.empty() && imgDepthBuf.front() == depthMsg)
+            imgDepthBuf.pop();
           continue;
+        }
+        if (tImDepth - tImRgb > maxTimeDiff) {
+          std::lock_guard<std::mutex> lock(mBufMutexRgb);
+          if (!imgRgbBuf.empty() && imgRgbBuf.front() == rgbMsg)
+            imgRgbBuf.pop();
+          continue;
+        }
+        // The IMU has not caught up with the image yet
+        if (tImRgb > imuRing.Back().t) {
+          imuRing.WaitNewData(imuRing.Size(), waitTimeout);
+          continue;
+        }
 
         {
           std::lock_guard<std::mutex> lock(mBufMutexRgb);
@@ -152,40 +217,15 @@ class ImageGrabber : public rclcpp::Node {
           imgDepthBuf.pop();
         }
 
-        vector<ORB_SLAM3::IMU::Point> vImuMeas;
-        {
-          std::lock_guard<std::mutex> lock(mBufMutex);
-          while (!imuBuf.empty() &&
-                 imuBuf.front()->header.stamp.sec +
-                         imuBuf.front()->header.stamp.nanosec * 1e-9 <=
-                     tImRgb + shift) {
-            double t = imuBuf.front()->header.stamp.sec +
-                       imuBuf.front()->header.stamp.nanosec * 1e-9;
-            cv::Point3f acc(imuBuf.front()->linear_acceleration.x,
-                            imuBuf.front()->linear_acceleration.y,
-                            imuBuf.front()->linear_acceleration.z);
-            cv::Point3f gyr(imuBuf.front()->angular_velocity.x,
-                            imuBuf.front()->angular_velocity.y,
-                            imuBuf.front()->angular_velocity.z);
-            vImuMeas.push_back(ORB_SLAM3::IMU::Point(acc, gyr, t));
-            imuBuf.pop();
-          }
+        vImuMeas.clear();
+        while (!imuRing.Empty() && imuRing.Front().t <= tImRgb + shift) {
+          vImuMeas.push_back(imuRing.Front());
+          imuRing.Pop();
         }
-        vector<Eigen::Vector3f> vOdomMeas;
-        {
-          std::lock_guard<std::mutex> lock(mBufMutex);
-          while (!odomBuf.empty() &&
-                 odomBuf.front()->header.stamp.sec +
-                         odomBuf.front()->header.stamp.nanosec * 1e-9 <=
-                     tImRgb + shift) {
-            double t = odomBuf.front()->header.stamp.sec +
-                       odomBuf.front()->header.stamp.nanosec * 1e-9;
-            Eigen::Vector3f pos(odomBuf.front()->twist.twist.linear.x,
-                                odomBuf.front()->twist.twist.linear.y,
-                                odomBuf.front()->twist.twist.linear.z);
-            vOdomMeas.push_back(pos);
-            odomBuf.pop();
-          }
+        vOdomMeas.clear();
+        while (!odomRing.Empty() && odomRing.Front().t <= tImRgb + shift) {
+          vOdomMeas.push_back(odomRing.Front().v);
+          odomRing.Pop();
         }
 
         // if (mbClahe) {
@@ -250,11 +290,16 @@ class ImageGrabber : public rclcpp::Node {
   rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr odom_sub_;
   std::queue<sensor_msgs::msg::Image::SharedPtr> imgRgbBuf, imgDepthBuf;
   std::mutex mBufMutexRgb, mBufMutexDepth;
-  std::queue<sensor_msgs::msg::Imu::SharedPtr> imuBuf;
-  std::queue<nav_msgs::msg::Odometry::SharedPtr> odomBuf;
-  std::mutex mBufMutex;
-  std::mutex mBufMutexOdom;
+  // Wakes SyncWithImu when an image arrives
+  std::mutex mMutexImageWait;
+  std::condition_variable mcvImage;
   ORB_SLAM3::System *mpSLAM;
+  // Filled by the executor thread, drained by SyncWithImu
+  ORB_SLAM3::SpscRing<ORB_SLAM3::IMU::Point> imuRing;
+  ORB_SLAM3::SpscRing<OdomSample> odomRing;
+  // Reused across frames
+  vector<ORB_SLAM3::IMU::Point> vImuMeas;
+  vector<Eigen::Vector3f> vOdomMeas;
   std::mutex track_mutex_;  // 用于同步 TrackRGBD 调用的互斥锁
   // std::shared_ptr<ImuGrabber> mpImuGb;
 
@@ -24,6 +24,7 @@
 
 #include <boost/serialization/export.hpp>
 #include <boost/serialization/vector.hpp>
+#include <memory>
 #include <mutex>
 #include <set>
 
@@ -43,12 +44,14 @@ class KeyFrameDatabase;
 class Frame;
 class KannalaBrandt8;
 class Pinhole;
+class AtlasArchive;
 
 // BOOST_CLASS_EXPORT_GUID(Pinhole, "Pinhole")
 // BOOST_CLASS_EXPORT_GUID(KannalaBrandt8, "KannalaBrandt8")
 
 class Atlas {
   friend class boost::serialization::access;
+  friend class AtlasArchive;
 
   template <class Archive>
   void serialize(Archive& ar, const unsigned int version) {
@@ -125,7 +128,9 @@ class Atlas {
 
   // Function for garantee the correction of serialization of this object
   void PreSave();
-  void PostLoad();
+  // bRebuildDatabase is false when the KeyFrameDatabase is restored from its
+  // own saved inverted file (chunked atlas format)
+  void PostLoad(const bool bRebuildDatabase = true);
 
   map<long unsigned int, KeyFrame*> GetAtlasKeyframes();
 
@@ -159,6 +164,10 @@ class Atlas {
   KeyFrameDatabase* mpKeyFrameDB;
   ORBVocabulary* mpORBVocabulary;
 
+  // Chunked file the keyframe descriptors are mapped from, unmapped with the
+  // atlas
+  std::shared_ptr<const char> mpMappedArchive;
+
   // Mutex
   std::mutex mMutexAtlas;
 
@@ -0,0 +1,106 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ATLASARCHIVE_H
+#define ATLASARCHIVE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+class Atlas;
+class Map;
+class KeyFrameDatabase;
+
+// Chunked atlas file (.osc). The atlas is split in independent sections that
+// are (de)serialized in parallel:
+//
+//   [FileHeader][section 0][section 1]...[section n-1][SectionEntry x n]
+//
+// META holds the vocabulary, cameras and static ids, every map gets a
+// MAP_HEADER, several KEYFRAMES / MAPPOINTS chunks and a COVISIBILITY
+// section, and the KeyFrameDatabase inverted file is saved once in
+// BOW_DATABASE so it does not have to be rebuilt from the BoW vectors.
+// On load the file is memory mapped and sections are decoded in place.
+//
+// The descriptors of each KEYFRAMES chunk are stored raw in a following
+// KF_DESCRIPTORS section. They are not decoded: the loaded keyframes point
+// into the mapping, so a keyframe's descriptors are only read from disk the
+// first time they are used. The mapping lives as long as the atlas.
+class AtlasArchive {
+ public:
+  enum SectionType {
+    SECTION_META = 0,
+    SECTION_MAP_HEADER = 1,
+    SECTION_KEYFRAMES = 2,
+    SECTION_MAPPOINTS = 3,
+    SECTION_COVISIBILITY = 4,
+    SECTION_BOW_DATABASE = 5,
+    SECTION_KF_DESCRIPTORS = 6
+  };
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numSections;
+    uint64_t indexOffset;
+  };
+
+  struct SectionEntry {
+    uint32_t type;
+    uint32_t mapId;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Descriptors of a keyframe in a KF_DESCRIPTORS section, which starts with
+  // the number of entries followed by the entries, offsets are relative to
+  // the section
+  struct DescriptorEntry {
+    uint64_t kfId;
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    uint32_t padding;
+    uint64_t offset;
+  };
+
+  static const uint32_t kVersion = 2;
+  // KeyFrames / MapPoints per chunk
+  static const size_t kElementsPerChunk = 256;
+
+  // Atlas::PreSave() must be called before
+  static bool Save(Atlas* pAtlas, KeyFrameDatabase* pKFDB,
+                   const std::string& strFileName,
+                   const std::string& strVocabularyName,
+                   const std::string& strVocabularyChecksum);
+
+  // Returns a new Atlas ready for Atlas::PostLoad(false), the inverted file
+  // is left in pKFDB waiting for KeyFrameDatabase::PostLoad. Returns NULL if
+  // the file can not be read.
+  static Atlas* Load(const std::string& strFileName, KeyFrameDatabase* pKFDB,
+                     std::string& strVocabularyName,
+                     std::string& strVocabularyChecksum);
+
+ private:
+  template <class Archive>
+  static void SerializeMapHeader(Archive& ar, Map* pMap);
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // ATLASARCHIVE_H
@@ -0,0 +1,77 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EPOCHRECLAIMER_H
+#define EPOCHRECLAIMER_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+namespace ORB_SLAM3 {
+
+// Deferred deletion of map entities culled while other threads may still
+// hold pointers to them (quiescent state based reclamation).
+//
+// Threads that keep map pointers across their iterations register and call
+// Quiescent() whenever they hold no pointer to an entity that is already bad.
+// A retired object is deleted once every registered thread has passed two
+// quiescent states since the retirement, so a thread may drop its stale
+// pointers on one pass and still be mid-iteration on the first. Threads that
+// never register must not keep pointers to map entities between calls.
+// Disabled by default, retired objects are then leaked as before.
+class EpochReclaimer {
+ public:
+  static void Enable(const bool bEnable) {
+    sbEnabled.store(bEnable, std::memory_order_relaxed);
+  }
+  static bool IsEnabled() { return sbEnabled.load(std::memory_order_relaxed); }
+
+  // Registration does not depend on the enabled flag, so threads started
+  // before the system is configured are accounted for
+  static void Register();
+  static void Unregister();
+
+  // The calling thread holds no pointer to a bad entity, registers it on
+  // first use. Frees the objects whose grace period is over.
+  static void Quiescent();
+
+  template <typename T>
+  static void Retire(T* p) {
+    if (IsEnabled()) Retire(p, &Delete<T>);
+  }
+
+  // Objects retired and not freed yet
+  static size_t Pending();
+
+ private:
+  template <typename T>
+  static void Delete(void* p) {
+    delete static_cast<T*>(p);
+  }
+  static void Retire(void* p, void (*deleter)(void*));
+
+  static std::atomic<bool> sbEnabled;
+};
+
+// Registers the thread for the lifetime of the scope
+class EpochParticipant {
+ public:
+  EpochParticipant() { EpochReclaimer::Register(); }
+  ~EpochParticipant() { EpochReclaimer::Unregister(); }
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // EPOCHRECLAIMER_H
@@ -28,10 +28,10 @@
 #include <pcl/common/transforms.h>
 #include <pcl/filters/crop_box.h>
 #include <pcl/filters/filter.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
+#include <memory>
 #include <mutex>
 #include <opencv2/opencv.hpp>
 #include <vector>
@@ -45,6 +45,7 @@
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
 #include "Thirdparty/Sophus/sophus/geometry.hpp"
+#include "Voxelizer.h"
 #include "sophus/se3.hpp"
 
 typedef pcl::PointXYZRGBA PointType;
@@ -72,8 +73,13 @@ class Frame {
   cv::Size frameSize;
   Frame();
 
-  // Copy constructor.
+  // Copy constructor. The images are shared with the copied frame, they are
+  // not modified once the frame is built.
   Frame(const Frame &frame);
+  // Frames are handed from the input queue to the tracker by move
+  Frame(Frame &&frame) = default;
+  Frame &operator=(const Frame &frame) = default;
+  Frame &operator=(Frame &&frame) = default;
 
   // Constructor for stereo cameras.
   Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp,
@@ -102,6 +108,9 @@ class Frame {
   // ~Frame();
   // void extract();
   void AddFeatures(const bool mono);
+  // Runs the ORB extraction skipped by the constructor, if any
+  void ExtractDeferredORB(const bool mono);
+  bool IsORBDeferred() const { return mbDeferredORB; }
 
   void AddPts(const std::vector<cv::KeyPoint> &pts,
               const std::vector<MapPoint *> &mps, const bool mono);
@@ -219,8 +228,12 @@ class Frame {
     // mFrame2MapReprojError[idx].emplace_back(reproj);
     mFrame2MapReprojError.emplace_back(reproj);
   }
-  vector<float> GetFrame2FrameReprojError() { return mFrame2FrameReprojError; }
-  vector<float> GetFrame2MapReprojError() { return mFrame2MapReprojError; }
+  const vector<float>& GetFrame2FrameReprojError() const {
+    return mFrame2FrameReprojError;
+  }
+  const vector<float>& GetFrame2MapReprojError() const {
+    return mFrame2MapReprojError;
+  }
 
  private:
   vector<float> mFrame2FrameReprojError;
@@ -279,7 +292,7 @@ class Frame {
   cv::Mat imageRGB;
   cv::Mat imageDepth;
   pcl::PointCloud<PointType>::Ptr mpPointCloud, mpPointCloudDownsampled;
-  pcl::VoxelGrid<PointType> downSizeFilterSurf;
+  VoxelFilter<PointType> downSizeFilterSurf;
   std::shared_ptr<std::vector<Eigen::Vector4f>> source_points;  // 深度点云
   std::shared_ptr<LaserProcessingClass> laserProcessing;
   // Stereo baseline multiplied by fx.
@@ -380,6 +393,9 @@ class Frame {
   // Current matches in frame
   int mnMatchesInliers;
 
+  // Keypoints so far only come from optical flow, see LazyORBExtraction
+  bool mbDeferredORB = false;
+
 #ifdef REGISTER_TIMES
   double mTimeORB_Ext;
   double mTimeStereoMatch;
@@ -403,10 +419,11 @@ class Frame {
 
   bool mbImuPreintegrated;
 
-  std::mutex *mpMutexImu;
-  std::mutex *mpMutexKeyPoints;
-  std::mutex *mMutexFeatures;
-  std::mutex *mMutexPose;
+  // Shared by the copies of a frame
+  std::shared_ptr<std::mutex> mpMutexImu;
+  std::shared_ptr<std::mutex> mpMutexKeyPoints;
+  std::shared_ptr<std::mutex> mMutexFeatures;
+  std::shared_ptr<std::mutex> mMutexPose;
 
  public:
   GeometricCamera *mpCamera, *mpCamera2;
@@ -32,10 +32,12 @@
 #include <opencv2/core/core.hpp>
 
 #include "Converter.h"
+#include "ObjectPool.h"
 #include "Thirdparty/g2o/g2o/core/base_binary_edge.h"
 #include "Thirdparty/g2o/g2o/core/base_multi_edge.h"
 #include "Thirdparty/g2o/g2o/core/base_unary_edge.h"
 #include "Thirdparty/g2o/g2o/core/base_vertex.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
 #include "Thirdparty/g2o/g2o/types/se3quat.h"
 #include "Thirdparty/g2o/g2o/types/types_sba.h"
 namespace ORB_SLAM3 {
@@ -52,6 +54,12 @@ typedef Eigen::Matrix<double, 12, 12> Matrix12d;
 typedef Eigen::Matrix<double, 15, 15> Matrix15d;
 typedef Eigen::Matrix<double, 9, 9> Matrix9d;
 
+// One per edge in most optimizations, deleted with its edge
+class PooledRobustKernelHuber : public g2o::RobustKernelHuber {
+ public:
+  POOL_ALLOCATED_OPERATOR_NEW(PooledRobustKernelHuber)
+};
+
 Eigen::Matrix3d ExpSO3(const double x, const double y, const double z);
 Eigen::Matrix3d ExpSO3(const Eigen::Vector3d& w);
 
@@ -133,7 +141,7 @@ class InvDepthPoint {
 // Optimizable parameters are IMU pose
 class VertexPose : public g2o::BaseVertex<6, ImuCamPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(VertexPose)
   VertexPose() {}
   VertexPose(KeyFrame* pKF) { setEstimate(ImuCamPose(pKF)); }
   VertexPose(Frame* pF) { setEstimate(ImuCamPose(pF)); }
@@ -180,7 +188,7 @@ class VertexPose4DoF : public g2o::BaseVertex<4, ImuCamPose> {
 
 class VertexVelocity : public g2o::BaseVertex<3, Eigen::Vector3d> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(VertexVelocity)
   VertexVelocity() {}
   VertexVelocity(KeyFrame* pKF);
   VertexVelocity(Frame* pF);
@@ -199,7 +207,7 @@ class VertexVelocity : public g2o::BaseVertex<3, Eigen::Vector3d> {
 
 class VertexGyroBias : public g2o::BaseVertex<3, Eigen::Vector3d> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(VertexGyroBias)
   VertexGyroBias() {}
   VertexGyroBias(KeyFrame* pKF);
   VertexGyroBias(Frame* pF);
@@ -218,7 +226,7 @@ class VertexGyroBias : public g2o::BaseVertex<3, Eigen::Vector3d> {
 
 class VertexAccBias : public g2o::BaseVertex<3, Eigen::Vector3d> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(VertexAccBias)
   VertexAccBias() {}
   VertexAccBias(KeyFrame* pKF);
   VertexAccBias(Frame* pF);
@@ -307,7 +315,7 @@ class EdgeMono
     : public g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ,
                                  VertexPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeMono)
 
   EdgeMono(int cam_idx_ = 0) : cam_idx(cam_idx_) {}
 
@@ -354,7 +362,7 @@ class EdgeMono
 class EdgeMonoOnlyPose
     : public g2o::BaseUnaryEdge<2, Eigen::Vector2d, VertexPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeMonoOnlyPose)
 
   EdgeMonoOnlyPose(const Eigen::Vector3f& Xw_, int cam_idx_ = 0)
       : Xw(Xw_.cast<double>()), cam_idx(cam_idx_) {}
@@ -389,7 +397,7 @@ class EdgeStereo
     : public g2o::BaseBinaryEdge<3, Eigen::Vector3d, g2o::VertexSBAPointXYZ,
                                  VertexPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeStereo)
 
   EdgeStereo(int cam_idx_ = 0) : cam_idx(cam_idx_) {}
 
@@ -429,7 +437,7 @@ class EdgeStereo
 class EdgeStereoOnlyPose
     : public g2o::BaseUnaryEdge<3, Eigen::Vector3d, VertexPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeStereoOnlyPose)
 
   EdgeStereoOnlyPose(const Eigen::Vector3f& Xw_, int cam_idx_ = 0)
       : Xw(Xw_.cast<double>()), cam_idx(cam_idx_) {}
@@ -457,7 +465,7 @@ class EdgeStereoOnlyPose
 
 class EdgeInertial : public g2o::BaseMultiEdge<9, Vector9d> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeInertial)
 
   EdgeInertial(IMU::Preintegrated* pInt);
 
@@ -508,7 +516,7 @@ class EdgeInertial : public g2o::BaseMultiEdge<9, Vector9d> {
 class EdgeICP
     : public g2o::BaseBinaryEdge<6, g2o::SE3Quat, VertexPose, VertexPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeICP)
 
   EdgeICP(const Eigen::Matrix3d& Rc1_c2, const Eigen::Vector3d& tc1_c2,
           int cam_idx = 0)
@@ -575,7 +583,7 @@ class EdgeSE3LidarPoint2Plane
     : public g2o::BaseUnaryEdge<1, Eigen::Vector2d,
                                 g2o::VertexSE3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeSE3LidarPoint2Plane)
 
   EdgeSE3LidarPoint2Plane(Eigen::Vector3d curr_point_, Eigen::Vector4d plane_,
                           double s_)
@@ -602,7 +610,7 @@ class EdgeSE3LidarPoint2Plane
 class EdgeLidarPoint2Plane
     : public g2o::BaseUnaryEdge<1, Eigen::Vector2d, VertexPose> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeLidarPoint2Plane)
 
   EdgeLidarPoint2Plane(Eigen::Vector3d curr_point_, Eigen::Vector4d plane_,
                        double s_)
@@ -782,7 +790,7 @@ class EdgeGyro : public g2o::BaseUnaryEdge<3, Eigen::Vector3d, VertexGyroBias> {
 class EdgeGyroRW : public g2o::BaseBinaryEdge<3, Eigen::Vector3d,
                                               VertexGyroBias, VertexGyroBias> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeGyroRW)
 
   EdgeGyroRW() {}
 
@@ -819,7 +827,7 @@ class EdgeGyroRW : public g2o::BaseBinaryEdge<3, Eigen::Vector3d,
 class EdgeAccRW : public g2o::BaseBinaryEdge<3, Eigen::Vector3d, VertexAccBias,
                                              VertexAccBias> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeAccRW)
 
   EdgeAccRW() {}
 
@@ -895,7 +903,7 @@ class ConstraintPoseICP {
 };
 class EdgePriorPoseImu : public g2o::BaseMultiEdge<15, Vector15d> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgePriorPoseImu)
   EdgePriorPoseImu(ConstraintPoseImu* c);
 
   virtual bool read(std::istream& is) { return false; }
@@ -953,7 +961,7 @@ class EdgePriorPoseICP
 class EdgePriorAcc
     : public g2o::BaseUnaryEdge<3, Eigen::Vector3d, VertexAccBias> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgePriorAcc)
 
   EdgePriorAcc(const Eigen::Vector3f& bprior_)
       : bprior(bprior_.cast<double>()) {}
@@ -978,7 +986,7 @@ class EdgePriorAcc
 class EdgePriorGyro
     : public g2o::BaseUnaryEdge<3, Eigen::Vector3d, VertexGyroBias> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgePriorGyro)
 
   EdgePriorGyro(const Eigen::Vector3f& bprior_)
       : bprior(bprior_.cast<double>()) {}
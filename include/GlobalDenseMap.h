@@ -0,0 +1,84 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLOBALDENSEMAP_H
+#define GLOBALDENSEMAP_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Voxelizer.h"
+#include "sophus/se3.hpp"
+
+namespace ORB_SLAM3 {
+
+class KeyFrame;
+
+// Dense map of the whole atlas kept up to date while mapping, instead of
+// being assembled from every keyframe cloud at shutdown.
+//
+// Points are accumulated in a sparse voxel hash, so memory grows with the
+// mapped volume rather than with the number of keyframes. Each keyframe only
+// records the pose it was integrated with: when the keyframe becomes bad, or
+// its pose moves enough to displace its points by half a voxel (local BA,
+// loop closure, map merge), its contribution is recomputed from its cloud at
+// the recorded pose and subtracted, and it is integrated again. Keyframes
+// whose pose did not move are not touched.
+class GlobalDenseMap {
+ public:
+  explicit GlobalDenseMap(const float resolution);
+
+  // Integrates the new keyframes, removes the bad ones and re-integrates the
+  // moved ones. Returns the number of keyframes integrated.
+  int Update(const std::vector<KeyFrame *> &vpKFs);
+
+  void Clear();
+
+  size_t NumPoints();
+
+  // Writes the voxel centroids as a binary PCD, streamed in fixed size chunks
+  // without assembling the cloud. Can be called at any time, updates wait
+  // until it is done.
+  bool Save(const std::string &filename);
+
+ private:
+  struct Voxel {
+    double sum[3];
+    uint32_t colorSum[3];
+    uint32_t n;
+  };
+
+  // Adds (sign 1) or subtracts (sign -1) the cloud seen from Twc
+  void Accumulate(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud,
+                  const Sophus::SE3f &Twc, const int sign);
+
+  bool Moved(const Sophus::SE3f &Twc0, const Sophus::SE3f &Twc1) const;
+
+  const float mfResolution;
+
+  std::mutex mMutex;
+  Voxelizer mVoxelizer;
+  std::unordered_map<uint64_t, Voxel> mmVoxels;
+  // Pose each integrated keyframe was integrated with
+  std::unordered_map<KeyFrame *, Sophus::SE3f> mmIntegratedPoses;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // GLOBALDENSEMAP_H
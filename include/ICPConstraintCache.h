@@ -0,0 +1,103 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ICPCONSTRAINTCACHE_H
+#define ICPCONSTRAINTCACHE_H
+
+#include <stddef.h>
+
+#include <Eigen/Geometry>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+
+#include "RegistrationGICP.h"
+#include "ThreadPool.h"
+
+namespace ORB_SLAM3 {
+
+class KeyFrame;
+
+// Result of registering the cloud of a source keyframe into a target one
+struct ICPConstraint {
+  Eigen::Isometry3d T_target_source;
+  size_t num_inliers;
+  double error;
+  bool converged;
+
+  ICPConstraint()
+      : T_target_source(Eigen::Isometry3d::Identity()),
+        num_inliers(0),
+        error(0.0),
+        converged(false) {}
+};
+
+// Keyframe-pair ICP constraints keyed by (target KF id, source KF id), shared
+// by the local BAs and the essential graph optimizations. Consecutive pairs
+// are registered in the background right after the keyframe is created, so
+// most optimizations only read the cache. A cached constraint is reused while
+// the requested initial guess stays close to it; constraints of a keyframe
+// must be invalidated if its cloud changes. Only constraints good enough to
+// become an edge are kept, and the oldest keyframe pairs are dropped once the
+// cache is full.
+class ICPConstraintCache {
+ public:
+  typedef std::pair<long unsigned int, long unsigned int> Key;
+
+  explicit ICPConstraintCache(const int nThreads = 1);
+  ~ICPConstraintCache();
+
+  // Registers pSourceKF into pTargetKF or returns the cached constraint
+  ICPConstraint Get(KeyFrame* pTargetKF, KeyFrame* pSourceKF,
+                    const Eigen::Isometry3d& init_T_target_source);
+
+  // Queues the registration, Get() waits for it if already requested
+  void RequestAsync(KeyFrame* pTargetKF, KeyFrame* pSourceKF,
+                    const Eigen::Isometry3d& init_T_target_source);
+
+  // Drops every constraint involving pKF, registrations still running for it
+  // are discarded when they finish
+  void Invalidate(KeyFrame* pKF);
+
+  void PrintStats();
+
+  // Uncached registration, also used when no cache is set in the Optimizer
+  static ICPConstraint Register(KeyFrame* pTargetKF, KeyFrame* pSourceKF,
+                                const Eigen::Isometry3d& init_T_target_source);
+
+ protected:
+  static bool IsCompatible(const ICPConstraint& constraint,
+                           const Eigen::Isometry3d& init_T_target_source);
+  // Publishes the result of a pending registration
+  void Store(const Key& key, const ICPConstraint& constraint);
+
+  std::map<Key, ICPConstraint> mmConstraints;
+  std::set<Key> msPending;
+  // Pending registrations invalidated before they finished
+  std::set<Key> msCancelled;
+  size_t mnHits;
+  size_t mnMisses;
+  size_t mnAsync;
+  std::mutex mMutexCache;
+  std::condition_variable mcvPending;
+
+  std::shared_ptr<hobot::CThreadPool> mpThreadPool;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // ICPCONSTRAINTCACHE_H
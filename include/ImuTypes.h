@@ -45,6 +45,7 @@ const Eigen::Vector3d GRAVITY_VECTOR(0.0, 0.0, -GRAVITY_MAGNITUDE);
 // IMU measurement (gyro, accelerometer and timestamp)
 class Point {
  public:
+  Point() : t(0.0) {}
   Point(const float &acc_x, const float &acc_y, const float &acc_z,
         const float &ang_vel_x, const float &ang_vel_y, const float &ang_vel_z,
         const double &timestamp)
@@ -186,6 +187,10 @@ class Preintegrated {
   void Initialize(const Bias &b_);
   void IntegrateNewMeasurement(const Eigen::Vector3f &acceleration,
                                const Eigen::Vector3f &angVel, const float &dt);
+  struct integrable;
+  // Integrates a whole span of (a, w, dt) samples, e.g. the IMU data between
+  // two frames. Rotation is only re-orthonormalized periodically.
+  void IntegrateNewMeasurements(const std::vector<integrable> &vMeasurements);
   void Reintegrate();
   void MergePrevious(Preintegrated *pPrev);
   void SetNewBias(const Bias &bu_);
@@ -239,6 +244,11 @@ class Preintegrated {
   Eigen::Matrix<float, 6, 1> db;
   std::mutex mMutex;
 
+  // Propagates the preintegration by one sample without storing it nor
+  // re-orthonormalizing dR
+  void Propagate(const Eigen::Vector3f &acceleration,
+                 const Eigen::Vector3f &angVel, const float dt);
+
  public:
   struct integrable {
     template <class Archive>
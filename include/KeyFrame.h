@@ -27,6 +27,7 @@
 
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/map.hpp>
+#include <atomic>
 #include <boost/serialization/vector.hpp>
 #include <mutex>
 
@@ -37,6 +38,7 @@
 #include "MapPoint.h"
 #include "ORBVocabulary.h"
 #include "ORBextractor.h"
+#include "ObjectPool.h"
 #include "SerializationUtils.h"
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
@@ -48,6 +50,7 @@ class Frame;
 class KeyFrameDatabase;
 class feature_pt;
 class GeometricCamera;
+class KeyFramePayloadStore;
 
 class KeyFrame {
   friend class boost::serialization::access;
@@ -191,7 +194,7 @@ class KeyFrame {
   }
 
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(KeyFrame)
   KeyFrame();
   KeyFrame(Frame& F, Map* pMap, KeyFrameDatabase* pKFDB);
   cv::Size frameSize;
@@ -221,12 +224,18 @@ class KeyFrame {
 
   void UpdateConnections(bool upParent = true);
   void UpdateBestCovisibles();
+  // Sorts the stale ordered connections, mMutexConnections must be held
+  void SortConnections();
   std::set<KeyFrame*> GetConnectedKeyFrames();
   std::vector<KeyFrame*> GetVectorCovisibleKeyFrames();
   std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int& N);
   std::vector<KeyFrame*> GetCovisiblesByWeight(const int& w);
   int GetWeight(KeyFrame* pKF);
 
+  // Counts of map points shared with other keyframes, changed by the map
+  // point observation events so UpdateConnections doesn't recount them
+  void ChangeCovisibility(KeyFrame* pKF, const int n);
+
   // Spanning tree functions
   void AddChild(KeyFrame* pKF);
   void EraseChild(KeyFrame* pKF);
@@ -305,11 +314,22 @@ class KeyFrame {
   void SetORBVocabulary(ORBVocabulary* pORBVoc);
   void SetKeyFrameDatabase(KeyFrameDatabase* pKFDB);
 
+  // Payload access, rehydrated by the KeyFramePayloadStore once the keyframe
+  // has left the local window. Use these instead of the members below.
+  cv::Mat GetImage();
+  cv::Mat GetImageRGB();
+  cv::Mat GetImageDepth();
+  std::shared_ptr<std::vector<Eigen::Vector4f>> GetSourcePoints();
+  pcl::PointCloud<PointType>::Ptr GetPointCloudDownsampled();
+
   bool bImu;
   // 建图专用
   cv::Mat imRGB, imDepth;
   pcl::PointCloud<PointType>::Ptr mpPointCloudDownsampled;
   std::shared_ptr<std::vector<Eigen::Vector4f>> source_points;  // 深度点云
+  // Set when the keyframe is registered, guards the payload members
+  std::atomic<KeyFramePayloadStore*> mpPayloadStore;
+  std::mutex mMutexPayload;
   // The following variables are accesed from only 1 thread or never change (no
   // mutex needed).
  public:
@@ -469,6 +489,13 @@ class KeyFrame {
   std::map<KeyFrame*, int> mConnectedKeyFrameWeights;
   std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
   std::vector<int> mvOrderedWeights;
+  // The ordered connections are sorted lazily, they are stale while their
+  // version is behind the one of the weights
+  unsigned long mnConnectionsVersion;
+  unsigned long mnOrderedConnectionsVersion;
+  // Map points shared with every other keyframe, including the ones below
+  // the connection threshold
+  std::map<KeyFrame*, int> mCovisibilityCounts;
   // For save relation without pointer, this is necessary for save/load function
   std::map<long unsigned int, int> mBackupConnectedKeyFrameIdWeights;
 
@@ -507,6 +534,7 @@ class KeyFrame {
   // Mutex
   std::mutex mMutexPose;  // for pose, velocity and biases
   std::mutex mMutexConnections;
+  std::mutex mMutexCovisibility;
   std::mutex mMutexFeatures;
   std::mutex mMutexMap;
   std::mutex mMutexTrackFeatures;
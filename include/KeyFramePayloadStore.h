@@ -0,0 +1,159 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYFRAMEPAYLOADSTORE_H
+#define KEYFRAMEPAYLOADSTORE_H
+
+#include <stddef.h>
+
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "KeyFrame.h"
+
+namespace ORB_SLAM3 {
+
+// Tiered storage for the heavy keyframe payload (images and point clouds).
+//
+//   HOT         images and clouds live in the KeyFrame members
+//   COMPRESSED  images are PNG encoded in memory, clouds stay in memory
+//   SPILLED     everything is written to the disk cache, clouds are reloaded
+//               on demand and dropped again when the budget is exceeded
+//
+// Keyframes of the local window (covisible and temporal neighbours of the
+// current keyframe) are always kept HOT. The remaining keyframes are demoted,
+// least recently used first, until the resident payload fits in the budget.
+// Readers go through the KeyFrame accessors (GetSourcePoints, GetImageRGB...)
+// which rehydrate the payload transparently.
+class KeyFramePayloadStore {
+ public:
+  enum Tier { TIER_HOT = 0, TIER_COMPRESSED = 1, TIER_SPILLED = 2 };
+
+  struct Stats {
+    size_t nKeyFrames;
+    size_t nHits;
+    size_t nMisses;
+    size_t nCompressed;
+    size_t nSpilled;
+    size_t nReloaded;
+    size_t nRawBytes;         // uncompressed images and resident clouds
+    size_t nCompressedBytes;  // PNG buffers kept in memory
+    size_t nDiskBytes;
+  };
+
+  // fMemoryBudgetMB: total resident payload, the local window counts towards
+  //                  it but is never demoted to meet it
+  // nLocalWindow: covisible / previous keyframes never demoted
+  // strCacheDir: disk cache, spilling is disabled if empty
+  KeyFramePayloadStore(const float fMemoryBudgetMB, const int nLocalWindow,
+                       const std::string& strCacheDir);
+  ~KeyFramePayloadStore();
+
+  // Registers pCurrentKF and demotes cold keyframes until the budget holds.
+  // Called by LocalMapping once the keyframe has been processed.
+  void Update(KeyFrame* pCurrentKF);
+
+  cv::Mat GetImage(KeyFrame* pKF);
+  cv::Mat GetImageRGB(KeyFrame* pKF);
+  cv::Mat GetImageDepth(KeyFrame* pKF);
+  std::shared_ptr<std::vector<Eigen::Vector4f>> GetSourcePoints(KeyFrame* pKF);
+  pcl::PointCloud<PointType>::Ptr GetPointCloudDownsampled(KeyFrame* pKF);
+
+  Stats GetStats();
+  void PrintStats();
+
+ protected:
+  struct PackedImage {
+    enum Encoding { EMPTY = 0, PNG = 1, PNG_FLOAT = 2, RAW = 3 };
+    int encoding;
+    int rows, cols, type;
+    std::vector<uchar> buffer;
+
+    PackedImage() : encoding(EMPTY), rows(0), cols(0), type(0) {}
+  };
+
+  enum ImageSlot {
+    SLOT_IMAGE = 0,
+    SLOT_RGB = 1,
+    SLOT_DEPTH = 2,
+    NUM_SLOTS = 3
+  };
+
+  struct Entry {
+    int tier;
+    bool bCloudsResident;
+    PackedImage images[NUM_SLOTS];
+    size_t nRawBytes;
+    size_t nCompressedBytes;
+    size_t nDiskBytes;
+    std::string strFile;
+    std::list<KeyFrame*>::iterator itLRU;
+
+    Entry()
+        : tier(TIER_HOT),
+          bCloudsResident(true),
+          nRawBytes(0),
+          nCompressedBytes(0),
+          nDiskBytes(0) {}
+  };
+
+  void Register(KeyFrame* pKF);
+  void CollectLocalWindow(KeyFrame* pCurrentKF, std::set<KeyFrame*>& spLocal);
+  cv::Mat GetImageSlot(KeyFrame* pKF, const int slot);
+
+  // The following must be called with pKF->mMutexPayload locked
+  // Looks the entry up, counts a hit or a miss and refreshes the LRU
+  Entry* Access(KeyFrame* pKF, const bool bClouds);
+  void Compress(KeyFrame* pKF, Entry* pEntry);
+  bool Spill(KeyFrame* pKF, Entry* pEntry);
+  void DropClouds(KeyFrame* pKF, Entry* pEntry);
+  bool ReloadClouds(KeyFrame* pKF, Entry* pEntry);
+
+  static cv::Mat* ImageMember(KeyFrame* pKF, const int slot);
+  static size_t ImageBytes(KeyFrame* pKF);
+  static size_t CloudBytes(KeyFrame* pKF);
+  static void Pack(const cv::Mat& im, PackedImage& packed);
+  static cv::Mat Unpack(const PackedImage& packed);
+
+  // Disk cache layout: packed images followed by source_points and
+  // mpPointCloudDownsampled
+  static bool WriteFile(const std::string& strFile, const Entry* pEntry,
+                        KeyFrame* pKF, size_t& nBytes);
+  static bool ReadFile(const std::string& strFile, PackedImage* pImages,
+                       KeyFrame* pKF);
+
+  size_t mnMemoryBudget;
+  int mnLocalWindow;
+  std::string mStrCacheDir;
+
+  // Entries are never erased while the system runs, so Entry pointers stay
+  // valid once the store mutex is released. Entry fields are guarded by the
+  // payload mutex of their keyframe, lock order is payload -> store.
+  std::map<KeyFrame*, Entry*> mmEntries;
+  // Least recently used at the front
+  std::list<KeyFrame*> mlLRU;
+
+  Stats mStats;
+  std::mutex mMutexStore;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // KEYFRAMEPAYLOADSTORE_H
@@ -21,7 +21,6 @@
 #define LidarMapping_H
 #include <pcl/common/transforms.h>
 #include <pcl/filters/statistical_outlier_removal.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
 
@@ -29,8 +28,10 @@
 #include <condition_variable>
 #include <pcl/impl/pcl_base.hpp>
 
+#include "GlobalDenseMap.h"
 #include "System.h"
 #include "Tracking.h"
+#include "Voxelizer.h"
 // using namespace ORB_SLAM3;
 
 namespace ORB_SLAM3 {
@@ -40,6 +41,8 @@ class LidarMapping {
   LidarMapping(double global_resolution_, double local_resolution_,
                double meank_, double thresh_, string save_path_);
   void save();
+  // Saves the global map as it is now, can be called while mapping
+  bool SaveGlobalMap(const string &filename);
   void insertKeyFrame(KeyFrame *kf, cv::Mat &color, cv::Mat &depth, int idk,
                       vector<KeyFrame *> vpKFs);
   void insertKeyFrame(KeyFrame *kf);
@@ -68,7 +71,10 @@ class LidarMapping {
 
   std::list<KeyFrame *> mlNewKeyFrames;
   std::list<KeyFrame *> mlAllKeyFrames;
-  pcl::PointCloud<PointType>::Ptr globalMap, localMap;
+  // Poses changed by a loop closure or a map merge
+  bool mbMapChanged = false;
+  GlobalDenseMap *mpGlobalDenseMap;
+  pcl::PointCloud<PointType>::Ptr localMap;
   shared_ptr<thread> viewerThread;
   Tracking *mpTracker;
 
@@ -76,7 +82,7 @@ class LidarMapping {
   std::mutex shutDownMutex;
 
   condition_variable keyFrameUpdated;
-  std::mutex mMutexGlobalMap, mMutexLocalMap;
+  std::mutex mMutexLocalMap;
   // vector<PointCloude>     pointcloud;
   // data to generate point clouds
   vector<KeyFrame *> keyframes;
@@ -94,8 +100,7 @@ class LidarMapping {
   double meank = 50;
   double thresh = 1;
   std::string save_path;
-  pcl::VoxelGrid<PointType> *voxel_global;
-  pcl::VoxelGrid<PointType> *voxel_local;
+  VoxelFilter<PointType> *voxel_local;
   pcl::StatisticalOutlierRemoval<PointType> *statistical_filter;
 };
 }  // namespace ORB_SLAM3
@@ -9,11 +9,11 @@
 #include <pcl/filters/filter.h>
 #include <pcl/filters/passthrough.h>
 #include <pcl/filters/radius_outlier_removal.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
 #include "Lidar.h"
+#include "Voxelizer.h"
 // points covariance class
 typedef pcl::PointXYZRGBA PointType;
 namespace ORB_SLAM3 {
@@ -47,8 +47,8 @@ class LaserProcessingClass {
 
  private:
   LidarParam lidar_param;
-  pcl::VoxelGrid<PointType> edge_downsize_filter;
-  pcl::VoxelGrid<PointType> surf_downsize_filter;
+  VoxelFilter<PointType> edge_downsize_filter;
+  VoxelFilter<PointType> surf_downsize_filter;
   pcl::RadiusOutlierRemoval<PointType> edge_noise_filter;
   pcl::RadiusOutlierRemoval<PointType> surf_noise_filter;
 };
@@ -22,12 +22,16 @@
 #ifndef LOCALMAPPING_H
 #define LOCALMAPPING_H
 
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 
 #include "Atlas.h"
+#include "ICPConstraintCache.h"
 #include "ImuInitializer.h"
 #include "KeyFrame.h"
 #include "KeyFrameDatabase.h"
+#include "KeyFramePayloadStore.h"
 #include "LidarMapping.h"
 #include "LoopClosing.h"
 #include "Settings.h"
@@ -53,6 +57,12 @@ class LocalMapping {
   void SetPointCloudMapper(LidarMapping* pLidarMapping) {
     mpLidarMapping = pLidarMapping;
   }
+  void SetPayloadStore(KeyFramePayloadStore* pPayloadStore) {
+    mpPayloadStore = pPayloadStore;
+  }
+  void SetICPConstraintCache(ICPConstraintCache* pICPCache) {
+    mpICPCache = pICPCache;
+  }
   // Main function
   void Run();
 
@@ -69,6 +79,9 @@ class LocalMapping {
   bool stopRequested();
   bool AcceptKeyFrames();
   void SetAcceptKeyFrames(bool flag);
+  // Blocks until the end of the next iteration of the mapping loop, or the
+  // timeout expires
+  void WaitIdle(const std::chrono::milliseconds& timeout);
   bool SetNotStop(bool flag);
 
   void InterruptBA();
@@ -137,12 +150,23 @@ class LocalMapping {
  protected:
   bool CheckNewKeyFrames();
   void ProcessNewKeyFrame();
+  // Queues the ICP registration of pKF against its previous keyframe
+  void RequestICPConstraint(KeyFrame* pKF);
   void CreateNewMapPoints();
   void CreateNewMapPointsNew();
   cv::Mat ComputeF12(KeyFrame*& pKF1, KeyFrame*& pKF2);
   void MapPointCulling();
   void SearchInNeighbors();
+  // Recomputes descriptor, normal and depth of the points queued since the
+  // last call, once per point
+  void UpdatePendingMapPoints();
   void KeyFrameCulling();
+  // Whether the points of pKF are seen by enough other keyframes at the same
+  // or finer scale, only reads the map
+  bool IsRedundantKeyFrame(KeyFrame* pKF, const float redundant_th);
+  // Drops the points culled by the other threads from the recently added
+  // ones, before the thread is reported quiescent to the reclaimer
+  void ReleaseBadMapPoints();
 
   System* mpSystem;
 
@@ -166,11 +190,14 @@ class LocalMapping {
   LoopClosing* mpLoopCloser;
   Tracking* mpTracker;
   LidarMapping* mpLidarMapping;
+  KeyFramePayloadStore* mpPayloadStore;
+  ICPConstraintCache* mpICPCache;
   std::list<KeyFrame*> mlNewKeyFrames, mlNewKeyFrameForDenseMap;
 
   KeyFrame* mpCurrentKeyFrame;
 
   std::list<MapPoint*> mlpRecentAddedMapPoints;
+  std::vector<MapPoint*> mvpPendingMapPoints;
 
   std::mutex mMutexNewKFs;
   std::condition_variable cv;
@@ -185,6 +212,9 @@ class LocalMapping {
   std::mutex mMutexStop;
 
   bool mbAcceptKeyFrames;
+  // Iterations of the mapping loop completed, WaitIdle waits for it to move
+  size_t mnIdleIterations;
+  std::condition_variable mcvIdle;
   std::mutex mMutexAccept;
 
   void InitializeIMU(float priorG = 1e2, float priorA = 1e6,
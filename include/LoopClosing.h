@@ -22,6 +22,7 @@
 #ifndef LOOPCLOSING_H
 #define LOOPCLOSING_H
 
+#include <atomic>
 #include <boost/algorithm/string.hpp>
 #include <mutex>
 #include <thread>
@@ -64,11 +65,19 @@ class LoopClosing {
 
   void InsertKeyFrame(KeyFrame* pKF);
 
+  int KeyframesInQueue() {
+    unique_lock<std::mutex> lock(mMutexLoopQueue);
+    return mlpLoopKeyFrameQueue.size();
+  }
+
   void RequestReset();
   void RequestResetActiveMap(Map* pMap);
 
-  // This function will run in a separate thread
-  void RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF);
+  // This function will run in a separate thread. The incremental mode only
+  // optimizes the keyframes moved by the loop corrections (see
+  // AddGBARegion) and falls back to the full BA on inertial maps.
+  void RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF,
+                                 const bool bIncremental = false);
 
   bool isRunningGBA() {
     unique_lock<std::mutex> lock(mMutexGBA);
@@ -133,6 +142,27 @@ class LoopClosing {
                                   int& nNumCoincidences,
                                   std::vector<MapPoint*>& vpMPs,
                                   std::vector<MapPoint*>& vpMatchedMPs);
+  // Place recognition hypothesis verified from a BoW candidate
+  struct BoWCandidate {
+    KeyFrame* pMatchedKF;
+    g2o::Sim3 gScw;
+    std::vector<MapPoint*> vpMapPoints;
+    std::vector<MapPoint*> vpMatchedMPs;
+    int nProjOptMatches;
+    int nNumCoincidences;
+
+    BoWCandidate()
+        : pMatchedKF(NULL), nProjOptMatches(0), nNumCoincidences(0) {}
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  // Geometric verification of one candidate, true if the Sim3 is confirmed by
+  // enough current covisibles. Gives up as soon as a better ranked candidate
+  // (index below nIdx) has been accepted.
+  bool VerifyBoWCandidate(KeyFrame* pKFi,
+                          const set<KeyFrame*>& spConnectedKeyFrames,
+                          const int nIdx, const std::atomic<int>& nAcceptedIdx,
+                          BoWCandidate& candidate);
   bool DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF,
                                      g2o::Sim3& gScw, int& nNumProjMatches,
                                      std::vector<MapPoint*>& vpMPs,
@@ -150,6 +180,14 @@ class LoopClosing {
 
   void CorrectLoop();
 
+  // Incremental GBA region: keyframes of pMap whose pose moved beyond the
+  // thresholds since vPosesBefCorrection, and their fixed covisible halo
+  void AddGBARegion(Map* pMap,
+                    const std::vector<std::pair<KeyFrame*, Sophus::SE3f> >&
+                        vPosesBefCorrection);
+  void CollectGBARegion(Map* pMap, std::vector<KeyFrame*>& vpRegionKFs,
+                        std::vector<KeyFrame*>& vpFixedKFs);
+
   void MergeLocal();
   void MergeLocal2();
 
@@ -240,6 +278,14 @@ class LoopClosing {
   // bool mnFullBAIdx;
   int mnFullBAIdx;
 
+  // Incremental GBA. Keyframes moved by loop corrections and not refined yet
+  // by a finished GBA, guarded by mMutexGBA
+  bool mbIncrementalGBA;
+  float mfGBAMinTranslation;
+  float mfGBAMinRotation;
+  int mnGBAHalo;
+  std::set<KeyFrame*> mspGBARegionKFs;
+
   vector<double> vdPR_CurrentTime;
   vector<double> vdPR_MatchedTime;
   vector<int> vnPR_TypeRecogn;
@@ -54,6 +54,7 @@
 
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
+#include <random>
 
 #include "Frame.h"
 #include "MapPoint.h"
@@ -215,6 +216,8 @@ class MLPnPsolver {
 
   // Indices for random selection [0 .. N-1]
   vector<size_t> mvAllIndices;
+  // Seeded from the frame id, the samples do not depend on other threads
+  std::mt19937 mRng;
 
   // RANSAC probability
   double mRansacProb;
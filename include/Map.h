@@ -28,8 +28,10 @@ typedef unsigned char GLubyte;
 #endif
 
 #include <boost/serialization/base_object.hpp>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
 
 #include "KeyFrame.h"
 #include "MapPoint.h"
@@ -40,9 +42,11 @@ class MapPoint;
 class KeyFrame;
 class Atlas;
 class KeyFrameDatabase;
+class AtlasArchive;
 
 class Map {
   friend class boost::serialization::access;
+  friend class AtlasArchive;
 
   template <class Archive>
   void serialize(Archive& ar, const unsigned int version) {
@@ -83,6 +87,13 @@ class Map {
   void InformNewBigChange();
   int GetLastBigChangeIdx();
 
+  // Immutable views of the map content, shared by all the readers until the
+  // map changes. Prefer them over the copies for read only loops.
+  typedef std::shared_ptr<const std::vector<KeyFrame*>> KeyFrameSnapshot;
+  typedef std::shared_ptr<const std::vector<MapPoint*>> MapPointSnapshot;
+  KeyFrameSnapshot GetKeyFrameSnapshot();
+  MapPointSnapshot GetMapPointSnapshot();
+
   std::vector<KeyFrame*> GetAllKeyFrames();
   std::vector<MapPoint*> GetAllMapPoints();
   std::vector<MapPoint*> GetReferenceMapPoints();
@@ -138,7 +149,8 @@ class Map {
       KeyFrameDatabase* pKFDB,
       ORBVocabulary*
           pORBVoc /*, map<long unsigned int, KeyFrame*>& mpKeyFrameId*/,
-      map<unsigned int, GeometricCamera*>& mpCams);
+      map<unsigned int, GeometricCamera*>& mpCams,
+      const bool bAddToDatabase = true);
 
   void printReprojectionError(list<KeyFrame*>& lpLocalWindowKFs,
                               KeyFrame* mpCurrentKF, string& name,
@@ -171,6 +183,10 @@ class Map {
   std::set<MapPoint*> mspMapPoints;
   std::set<KeyFrame*> mspKeyFrames;
 
+  // Built on demand, reset whenever the sets change
+  MapPointSnapshot mpMapPointSnapshot;
+  KeyFrameSnapshot mpKeyFrameSnapshot;
+
   // Save/load, the set structure is broken in libboost 1.58 for ubuntu 16.04, a
   // vector is serializated
   std::vector<MapPoint*> mvpBackupMapPoints;
@@ -208,7 +224,7 @@ class Map {
   bool mbIMU_BA2;
 
   // Mutex
-  std::mutex mMutexMap;
+  std::shared_mutex mMutexMap;
 };
 
 }  // namespace ORB_SLAM3
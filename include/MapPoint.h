@@ -25,14 +25,18 @@
 #include <boost/serialization/array.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/serialization.hpp>
+#include <atomic>
 #include <mutex>
 #include <opencv2/core/core.hpp>
+#include <shared_mutex>
 
 #include "Converter.h"
 #include "Frame.h"
 #include "KeyFrame.h"
 #include "Map.h"
+#include "ObjectPool.h"
 #include "SerializationUtils.h"
+#include "SmallFlatMap.h"
 
 namespace ORB_SLAM3 {
 
@@ -47,7 +51,9 @@ class MapPoint {
     ar & mnId;
     ar & mnFirstKFid;
     ar & mnFirstFrame;
-    ar & nObs;
+    int nObservations = nObs;
+    ar & nObservations;
+    nObs = nObservations;
     // Variables used by the tracking
     // ar & mTrackProjX;
     // ar & mTrackProjY;
@@ -99,7 +105,11 @@ class MapPoint {
   }
 
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(MapPoint)
+  // Observing keyframe -> (left index, right index), -1 if not seen by that
+  // camera. Most points are seen by a handful of keyframes.
+  typedef SmallFlatMap<KeyFrame*, std::tuple<int, int>, 8> ObservationMap;
+
   MapPoint();
 
   MapPoint(const Eigen::Vector3f& Pos, KeyFrame* pRefKF, Map* pMap);
@@ -116,8 +126,22 @@ class MapPoint {
 
   KeyFrame* GetReferenceKeyFrame();
 
-  std::map<KeyFrame*, std::tuple<int, int>> GetObservations();
+  ObservationMap GetObservations();
+  // Calls f(pKF, indexes) on every observation without copying them. Runs
+  // under the observation lock: f must not call into this map point nor lock
+  // a keyframe.
+  template <typename F>
+  void ForEachObservation(F f) {
+    std::shared_lock<std::shared_mutex> lock(mMutexFeatures);
+    for (ObservationMap::const_iterator mit = mObservations.begin(),
+                                        mend = mObservations.end();
+         mit != mend; mit++)
+      f(mit->first, mit->second);
+  }
+  // Cached, does not lock
   int Observations();
+  // Keyframes other than pKF observing the point at nLevel or a finer scale
+  int ObservationsUpToLevel(const int nLevel, KeyFrame* pKF);
 
   void AddObservation(KeyFrame* pKF, int idx);
   void EraseObservation(KeyFrame* pKF);
@@ -162,9 +186,11 @@ class MapPoint {
   std::shared_ptr<feature_pt> feature;
   long unsigned int mnId;
   static long unsigned int nNextId;
+  // Observations sampled for the distinctive descriptor, 0 for all
+  static int nMaxDescriptorSamples;
   long int mnFirstKFid;
   long int mnFirstFrame;
-  int nObs;
+  std::atomic<int> nObs;
 
   // Variables used by the tracking
   float mTrackProjX;
@@ -210,7 +236,10 @@ class MapPoint {
   Eigen::Vector3f mWorldPos;
 
   // Keyframes observing the point and associated index in keyframe
-  std::map<KeyFrame*, std::tuple<int, int>> mObservations;
+  ObservationMap mObservations;
+  // Observing keyframes by the finest scale level they see the point at,
+  // kept along mObservations
+  std::vector<int> mvnObservationsPerLevel;
   // For save relation without pointer, this is necessary for save/load function
   std::map<long unsigned int, int> mBackupObservationsId1;
   std::map<long unsigned int, int> mBackupObservationsId2;
@@ -221,6 +250,20 @@ class MapPoint {
   // Best descriptor to fast matching
   cv::Mat mDescriptor;
 
+  // Descriptors sampled from the observations and their pairwise distances,
+  // kept between ComputeDistinctiveDescriptors calls so that only the new
+  // observations are matched
+  struct DescriptorSamples {
+    std::vector<std::pair<KeyFrame*, int>> vKeys;
+    cv::Mat descriptors;
+    std::vector<uint16_t> vDistances;
+
+    // Syncs the samples with vNewKeys and returns the descriptor with the
+    // least median distance to the others
+    cv::Mat Update(const std::vector<std::pair<KeyFrame*, int>>& vNewKeys);
+  };
+  DescriptorSamples mDescriptorSamples;
+
   // Reference KeyFrame
   KeyFrame* mpRefKF;
   long unsigned int mBackupRefKFId;
@@ -243,9 +286,11 @@ class MapPoint {
 
   // Mutex
   std::mutex mMutexPos;
-  std::mutex mMutexFeatures;
+  // Observations, descriptor, reference keyframe, counters and bad flag
+  std::shared_mutex mMutexFeatures;
   std::mutex mMutexMap;
   std::mutex mMutexFeaturesUpdate;
+  std::mutex mMutexDescriptorSamples;
 };
 
 }  // namespace ORB_SLAM3
@@ -39,6 +39,8 @@ class ORBmatcher {
 
   // Computes the Hamming distance between two ORB descriptors
   static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
+  // Same on the raw 32 bytes, no cv::Mat header to build per pair
+  static int DescriptorDistance(const uchar *a, const uchar *b);
 
   // Search matches between Frame keypoints and projected MapPoints. Returns
   // number of matches Used to track the local map (Tracking)
@@ -125,6 +127,14 @@ class ORBmatcher {
   // Project MapPoints into KeyFrame and search for duplicated MapPoints.
   int Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
            const float th = 3.0, const bool bRight = false);
+  // The two steps of Fuse. The keypoint of pKF each map point would be fused
+  // with (-1 if none) is searched without changing the map, so searches in
+  // several keyframes can run at once; the fusions are then applied in order.
+  void SearchForFusion(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
+                       vector<int> &vnFuseIdx, const float th = 3.0,
+                       const bool bRight = false);
+  int FuseMatches(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
+                  const vector<int> &vnFuseIdx);
 
   // Project MapPoints into KeyFrame using a given Sim3 and search for
   // duplicated MapPoints.
@@ -0,0 +1,185 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Type specific slab allocator.
+//
+// Blocks of sizeof(T) are carved from slabs that are never given back to the
+// system, so addresses stay stable and long runs do not fragment the heap.
+// Every thread allocates from and frees to its own cache without locking;
+// only refilling or trimming a cache, a batch of blocks at a time, goes
+// through the shared free list. A g2o graph freed by ~SparseOptimizer thus
+// lands in the cache of the optimizing thread and is reused by its next
+// optimization.
+//
+// Use it through POOL_ALLOCATED_OPERATOR_NEW(T) in the class body. Requests
+// bigger than a block (a derived class without its own pool) fall back to
+// the heap, deletes are sized so both paths are told apart.
+template <typename T>
+class ObjectPool {
+ public:
+  // Enough for Eigen fixed size members with AVX
+  static constexpr size_t kAlignment = 32;
+
+  static void* Allocate(const size_t n) {
+    if (n > BlockSize())
+      return ::operator new(n, std::align_val_t(kAlignment));
+    Cache& cache = GetCache();
+    if (!cache.pHead) Refill(cache);
+    Block* pBlock = cache.pHead;
+    cache.pHead = pBlock->pNext;
+    cache.nBlocks--;
+    return pBlock;
+  }
+
+  static void Deallocate(void* p, const size_t n) {
+    if (!p) return;
+    if (n > BlockSize()) {
+      ::operator delete(p, std::align_val_t(kAlignment));
+      return;
+    }
+    Cache& cache = GetCache();
+    Block* pBlock = static_cast<Block*>(p);
+    pBlock->pNext = cache.pHead;
+    cache.pHead = pBlock;
+    if (++cache.nBlocks > 2 * BatchSize()) Trim(cache, BatchSize());
+  }
+
+  // Bytes reserved by the slabs of this type
+  static size_t ReservedBytes() {
+    Shared& shared = GetShared();
+    std::unique_lock<std::mutex> lock(shared.mMutex);
+    return shared.mvpSlabs.size() * SlabBlocks() * BlockSize();
+  }
+
+ private:
+  struct Block {
+    Block* pNext;
+  };
+
+  struct Cache {
+    Block* pHead;
+    size_t nBlocks;
+
+    Cache() : pHead(NULL), nBlocks(0) {}
+    // Blocks of an exiting thread go back to the shared list
+    ~Cache() { Trim(*this, nBlocks); }
+  };
+
+  struct Shared {
+    std::mutex mMutex;
+    Block* pFree;
+    // Not yet handed out part of the last slab
+    char* pSlabBegin;
+    char* pSlabEnd;
+    std::vector<void*> mvpSlabs;
+
+    Shared() : pFree(NULL), pSlabBegin(NULL), pSlabEnd(NULL) {}
+  };
+
+  static constexpr size_t BlockSize() {
+    return (std::max(sizeof(T), sizeof(Block)) + kAlignment - 1) &
+           ~(kAlignment - 1);
+  }
+  // Blocks moved between a thread cache and the shared list at once, ~16 KB
+  static constexpr size_t BatchSize() {
+    return std::max<size_t>(8, 16384 / BlockSize());
+  }
+  static constexpr size_t SlabBlocks() { return 16 * BatchSize(); }
+
+  static Cache& GetCache() {
+    static thread_local Cache cache;
+    return cache;
+  }
+
+  // Never destroyed, thread caches may be flushed during exit
+  static Shared& GetShared() {
+    static Shared* pShared = new Shared();
+    return *pShared;
+  }
+
+  static void Refill(Cache& cache) {
+    Shared& shared = GetShared();
+    std::unique_lock<std::mutex> lock(shared.mMutex);
+    while (cache.nBlocks < BatchSize()) {
+      Block* pBlock = shared.pFree;
+      if (pBlock) {
+        shared.pFree = pBlock->pNext;
+      } else {
+        if (shared.pSlabBegin == shared.pSlabEnd) {
+          const size_t nBytes = SlabBlocks() * BlockSize();
+          shared.pSlabBegin = static_cast<char*>(
+              ::operator new(nBytes, std::align_val_t(kAlignment)));
+          shared.pSlabEnd = shared.pSlabBegin + nBytes;
+          shared.mvpSlabs.push_back(shared.pSlabBegin);
+        }
+        pBlock = reinterpret_cast<Block*>(shared.pSlabBegin);
+        shared.pSlabBegin += BlockSize();
+      }
+      pBlock->pNext = cache.pHead;
+      cache.pHead = pBlock;
+      cache.nBlocks++;
+    }
+  }
+
+  static void Trim(Cache& cache, const size_t n) {
+    if (n == 0) return;
+    // Detach the first n blocks, then splice them in one locked step
+    Block* pFirst = cache.pHead;
+    Block* pLast = pFirst;
+    for (size_t i = 1; i < n; i++) pLast = pLast->pNext;
+    cache.pHead = pLast->pNext;
+    cache.nBlocks -= n;
+
+    Shared& shared = GetShared();
+    std::unique_lock<std::mutex> lock(shared.mMutex);
+    pLast->pNext = shared.pFree;
+    shared.pFree = pFirst;
+  }
+};
+
+}  // namespace ORB_SLAM3
+
+// Replaces EIGEN_MAKE_ALIGNED_OPERATOR_NEW, keeping its array and placement
+// forms
+#define POOL_ALLOCATED_OPERATOR_NEW(Type)                                   \
+  static void* operator new(size_t n) {                                     \
+    return ORB_SLAM3::ObjectPool<Type>::Allocate(n);                        \
+  }                                                                         \
+  static void operator delete(void* p, size_t n) {                          \
+    ORB_SLAM3::ObjectPool<Type>::Deallocate(p, n);                          \
+  }                                                                         \
+  static void* operator new[](size_t n) {                                   \
+    return ::operator new[](                                                \
+        n, std::align_val_t(ORB_SLAM3::ObjectPool<Type>::kAlignment));      \
+  }                                                                         \
+  static void operator delete[](void* p) {                                  \
+    ::operator delete[](                                                    \
+        p, std::align_val_t(ORB_SLAM3::ObjectPool<Type>::kAlignment));      \
+  }                                                                         \
+  static void* operator new(size_t, void* p) { return p; }                  \
+  static void operator delete(void*, void*) {}
+
+#endif  // OBJECTPOOL_H
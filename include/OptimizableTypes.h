@@ -29,12 +29,13 @@
 #include <Eigen/Geometry>
 
 #include "Thirdparty/g2o/g2o/core/base_unary_edge.h"
+#include "ObjectPool.h"
 
 namespace ORB_SLAM3 {
 class EdgeSE3ProjectXYZOnlyPose
     : public g2o::BaseUnaryEdge<2, Eigen::Vector2d, g2o::VertexSE3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeSE3ProjectXYZOnlyPose)
 
   EdgeSE3ProjectXYZOnlyPose() {}
 
@@ -64,7 +65,7 @@ class EdgeSE3ProjectXYZOnlyPose
 class EdgeSE3ProjectXYZOnlyPoseToBody
     : public g2o::BaseUnaryEdge<2, Eigen::Vector2d, g2o::VertexSE3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeSE3ProjectXYZOnlyPoseToBody)
 
   EdgeSE3ProjectXYZOnlyPoseToBody() {}
 
@@ -97,7 +98,7 @@ class EdgeSE3ProjectXYZ
     : public g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ,
                                  g2o::VertexSE3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeSE3ProjectXYZ)
 
   EdgeSE3ProjectXYZ();
 
@@ -131,7 +132,7 @@ class EdgeSE3ProjectXYZToBody
     : public g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ,
                                  g2o::VertexSE3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeSE3ProjectXYZToBody)
 
   EdgeSE3ProjectXYZToBody();
 
@@ -165,7 +166,7 @@ class EdgeSE3ProjectXYZToBody
 
 class VertexSim3Expmap : public g2o::BaseVertex<7, g2o::Sim3> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(VertexSim3Expmap)
   VertexSim3Expmap();
   virtual bool read(std::istream& is);
   virtual bool write(std::ostream& os) const;
@@ -190,7 +191,7 @@ class EdgeSim3ProjectXYZ
     : public g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ,
                                  ORB_SLAM3::VertexSim3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeSim3ProjectXYZ)
   EdgeSim3ProjectXYZ();
   virtual bool read(std::istream& is);
   virtual bool write(std::ostream& os) const;
@@ -212,7 +213,7 @@ class EdgeInverseSim3ProjectXYZ
     : public g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ,
                                  VertexSim3Expmap> {
  public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_ALLOCATED_OPERATOR_NEW(EdgeInverseSim3ProjectXYZ)
   EdgeInverseSim3ProjectXYZ();
   virtual bool read(std::istream& is);
   virtual bool write(std::ostream& os) const;
@@ -26,6 +26,7 @@
 
 #include "Frame.h"
 #include "G2oTypes.h"
+#include "ICPConstraintCache.h"
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Map.h"
@@ -52,7 +53,15 @@ class Optimizer {
                                const std::vector<MapPoint *> &vpMP,
                                int nIterations = 5, bool *pbStopFlag = NULL,
                                const unsigned long nLoopKF = 0,
-                               const bool bRobust = true);
+                               const bool bRobust = true,
+                               const std::set<KeyFrame *> *pspFixedKFs = NULL);
+  // Global BA restricted to vpKFs and the points they observe, vpFixedKFs
+  // bound the region. Starts from the current (loop corrected) estimates.
+  void static RegionBundleAdjustment(const std::vector<KeyFrame *> &vpKFs,
+                                     const std::vector<KeyFrame *> &vpFixedKFs,
+                                     int nIterations, bool *pbStopFlag,
+                                     const unsigned long nLoopKF,
+                                     int &nOptMPs);
   void static GlobalBundleAdjustemnt(Map *pMap, int nIterations = 5,
                                      bool *pbStopFlag = NULL,
                                      const unsigned long nLoopKF = 0,
@@ -199,7 +208,19 @@ class Optimizer {
                                    double &scale);
   bool static InertialOptimization(Map *pMap, Eigen::Vector3d &bg,
                                    float priorG = 1e2);
+
+  // Keyframe-pair ICP constraints shared by the local BAs and the essential
+  // graph optimizations. Pairs are registered on every call if not set.
+  void static SetICPConstraintCache(ICPConstraintCache *pICPCache);
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+ protected:
+  static ICPConstraint RegisterKeyFramePair(KeyFrame *pTargetKF,
+                                            KeyFrame *pSourceKF,
+                                            const Eigen::Isometry3d &init_T);
+
+  static ICPConstraintCache *mpICPCache;
 };
 
 }  // namespace ORB_SLAM3
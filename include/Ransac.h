@@ -0,0 +1,191 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RANSAC_H
+#define RANSAC_H
+
+#include <limits.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Hypothesize and verify loop shared by the robust estimators.
+//
+// The problem is described by a model type providing
+//
+//   typedef ... Hypothesis;
+//   // Scores per datum, added in order to the score of a hypothesis
+//   static constexpr int kTerms;
+//   int NumData() const;
+//   // Fits a minimal sample, false if it is degenerate. Called concurrently.
+//   bool Fit(const std::vector<size_t>& vSample, Hypothesis& h) const;
+//   // Writes the kTerms non negative scores of the data [i0, i1), 0 for a
+//   // rejected term, and whether each datum is an inlier. Called
+//   // concurrently, meant to be a branch free loop over contiguous arrays.
+//   void Score(const Hypothesis& h, int i0, int i1, float* pTerms,
+//              unsigned char* pbInliers) const;
+//   // Upper bound of a single term
+//   float MaxTerm() const;
+//
+// Minimal samples are drawn by the caller, so the outcome does not depend on
+// the number of threads. Hypotheses are fitted and scored in parallel, the
+// data a block at a time. A hypothesis is dropped as soon as perfect scores
+// on its remaining data could not beat the best one found so far, which never
+// drops the winner: the result is the first hypothesis with the highest
+// score, as if all of them had been scored.
+//
+// Given a confidence in (0, 1), the sets are run in batches and the loop
+// stops once the inlier ratio of the best hypothesis makes it that likely
+// that an all inlier sample has been drawn. With 0 every set is run.
+template <typename Model>
+class Ransac {
+ public:
+  typedef typename Model::Hypothesis Hypothesis;
+
+  explicit Ransac(const Model& model, const float confidence = 0.f)
+      : mModel(model), mfConfidence(confidence), mnEvaluated(0) {}
+
+  // Returns the index of the best set, -1 if no hypothesis scored above 0,
+  // in which case best is left untouched.
+  int Run(const std::vector<std::vector<size_t> >& vSets, Hypothesis& best,
+          float& score, std::vector<bool>& vbInliers) {
+    const int nSets = vSets.size();
+    const bool bAdaptive = mfConfidence > 0.f && mfConfidence < 1.f;
+    const int nBatch = bAdaptive ? std::min(kBatchSize, nSets) : nSets;
+
+    std::vector<Hypothesis> vHypotheses(nBatch);
+    std::vector<float> vScores(nBatch);
+    std::vector<int> vnInliers(nBatch);
+
+    int nBest = -1;
+    int nBestInliers = 0;
+    int nRequired = nSets;
+    score = 0.f;
+    mnEvaluated = 0;
+
+    for (int first = 0; first < std::min(nSets, nRequired); first += nBatch) {
+      const int last = std::min(first + nBatch, nSets);
+      std::atomic<float> bestScore(score);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int it = first; it < last; it++) {
+        const int k = it - first;
+        vScores[k] = -1.f;
+        if (!mModel.Fit(vSets[it], vHypotheses[k])) continue;
+        vScores[k] = Evaluate(vHypotheses[k], bestScore, vnInliers[k]);
+      }
+      mnEvaluated += last - first;
+
+      // In order, so ties keep going to the first set
+      for (int it = first; it < last; it++) {
+        const int k = it - first;
+        if (vScores[k] > score) {
+          nBest = it;
+          nBestInliers = vnInliers[k];
+          best = vHypotheses[k];
+          score = vScores[k];
+        }
+      }
+
+      if (bAdaptive && nBest >= 0)
+        nRequired = RequiredIterations(nBestInliers, vSets[nBest].size());
+    }
+
+    const int N = mModel.NumData();
+    vbInliers.assign(N, false);
+    if (nBest >= 0) MarkInliers(best, vbInliers);
+
+    return nBest;
+  }
+
+  // Sets fitted by the last run
+  int Evaluated() const { return mnEvaluated; }
+
+ private:
+  static constexpr int kBlockSize = 64;
+  static constexpr int kBatchSize = 32;
+
+  // Returns the score of h, -1 if it can't beat bestScore, and raises
+  // bestScore otherwise
+  float Evaluate(const Hypothesis& h, std::atomic<float>& bestScore,
+                 int& nInliers) const {
+    const int N = mModel.NumData();
+    const double maxDatumScore = Model::kTerms * mModel.MaxTerm();
+
+    float vTerms[kBlockSize * Model::kTerms];
+    unsigned char vbInliers[kBlockSize];
+
+    float score = 0.f;
+    nInliers = 0;
+    for (int i0 = 0; i0 < N; i0 += kBlockSize) {
+      const int i1 = std::min(i0 + kBlockSize, N);
+      mModel.Score(h, i0, i1, vTerms, vbInliers);
+
+      for (int j = 0, jend = (i1 - i0) * Model::kTerms; j < jend; j++)
+        score += vTerms[j];
+      for (int j = 0; j < i1 - i0; j++) nInliers += vbInliers[j];
+
+      // Some slack for the rounding of the partial sums
+      const double bound = (score + (N - i1) * maxDatumScore) * (1.0 + 1e-4);
+      if (bound < bestScore.load(std::memory_order_relaxed)) return -1.f;
+    }
+
+    float current = bestScore.load(std::memory_order_relaxed);
+    while (score > current &&
+           !bestScore.compare_exchange_weak(current, score,
+                                            std::memory_order_relaxed)) {
+    }
+
+    return score;
+  }
+
+  void MarkInliers(const Hypothesis& h, std::vector<bool>& vbInliers) const {
+    const int N = mModel.NumData();
+
+    float vTerms[kBlockSize * Model::kTerms];
+    unsigned char vbBlockInliers[kBlockSize];
+
+    for (int i0 = 0; i0 < N; i0 += kBlockSize) {
+      const int i1 = std::min(i0 + kBlockSize, N);
+      mModel.Score(h, i0, i1, vTerms, vbBlockInliers);
+      for (int i = i0; i < i1; i++) vbInliers[i] = vbBlockInliers[i - i0];
+    }
+  }
+
+  int RequiredIterations(const int nInliers, const size_t nSampleSize) const {
+    const double w = double(nInliers) / mModel.NumData();
+    const double pAllInliers = std::pow(w, double(nSampleSize));
+    if (pAllInliers >= 1.0) return 1;
+    if (pAllInliers <= 0.0) return INT_MAX;
+
+    const double n =
+        std::ceil(std::log(1.0 - mfConfidence) / std::log(1.0 - pAllInliers));
+    return n < INT_MAX ? int(n) : INT_MAX;
+  }
+
+  const Model& mModel;
+  const float mfConfidence;
+  int mnEvaluated;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // RANSAC_H
@@ -2,7 +2,9 @@
 // SPDX-License-Identifier: MIT
 
 /// @brief Basic point cloud registration example with small_gicp::align()
-#include <pcl/filters/voxel_grid.h>
+#ifndef REGISTRATIONGICP_H
+#define REGISTRATIONGICP_H
+
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -14,6 +16,8 @@
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <queue>
+
+#include "Voxelizer.h"
 using namespace small_gicp;
 
 class RegistrationGICP {
@@ -31,3 +35,5 @@ class RegistrationGICP {
                        pcl::PointCloud<pcl::PointXYZ>::Ptr& output_cloud,
                        Eigen::Matrix4f& final_transform);
 };
+
+#endif  // REGISTRATIONGICP_H
@@ -102,9 +102,14 @@ class Settings {
   float depthMapFactor() { return depthMapFactor_; }
 
   bool useOpticalFlow() { return enableOpticalFlow_; }
+  bool lazyORBExtraction() {
+    return enableOpticalFlow_ && lazyORBExtraction_;
+  }
+  int lazyORBMinTracked() { return lazyORBMinTracked_; }
   std::string cameraModel() { return mCameraModel_; }
   bool useClahe() { return enableClahe_; }
   float timeRecentlyLost() { return timeRecentlyLost_; }
+  float relocalizationBudget() { return relocalizationBudget_; }
   float GetKfInsertInterval() { return kfInsertInterval_; }
   int nFeatures() { return nFeatures_; }
   int nLevels() { return nLevels_; }
@@ -126,8 +131,24 @@ class Settings {
 
   std::string atlasLoadFile() { return sLoadFrom_; }
   std::string atlasSaveFile() { return sSaveto_; }
+  int atlasFileType() { return atlasFileType_; }
 
   float thFarPoints() { return thFarPoints_; }
+  int payloadStoreEnable() { return payloadStoreEnable_; }
+  float payloadMemoryBudget() { return payloadMemoryBudget_; }
+  int payloadLocalWindow() { return payloadLocalWindow_; }
+  std::string payloadCacheDir() { return payloadCacheDir_; }
+  int incrementalGBA() { return incrementalGBA_; }
+  float incrementalGBAMinTranslation() { return incrementalGBAMinTranslation_; }
+  float incrementalGBAMinRotation() { return incrementalGBAMinRotation_; }
+  int incrementalGBAHalo() { return incrementalGBAHalo_; }
+  std::string traceFile() { return traceFile_; }
+  int trajectoryCapacity() { return trajectoryCapacity_; }
+  std::string trajectoryFile() { return trajectoryFile_; }
+  int trajectoryFileFormat() { return trajectoryFileFormat_; }
+  int diagnosticsPeriod() { return diagnosticsPeriod_; }
+  int mapPointMaxDescriptorSamples() { return mapPointMaxDescriptorSamples_; }
+  int reclaimCulledMapPoints() { return reclaimCulledMapPoints_; }
   std::string extractor_tpye() { return extractor_tpye_; }
   std::string lidarConfigFile() { return lidarConfigFile_; }
   cv::Mat M1l() { return M1l_; }
@@ -237,9 +258,12 @@ class Settings {
   float depthMapFactor_;
 
   int enableOpticalFlow_;
+  int lazyORBExtraction_;
+  int lazyORBMinTracked_;
   int enableClahe_;
 
   float timeRecentlyLost_;
+  float relocalizationBudget_;
 
   float kfInsertInterval_;
   std::string mCameraModel_;
@@ -269,11 +293,27 @@ class Settings {
    * Save & load maps
    */
   std::string sLoadFrom_, sSaveto_;
+  int atlasFileType_;
 
   /*
    * Other stuff
    */
   float thFarPoints_;
+  int payloadStoreEnable_;
+  float payloadMemoryBudget_;
+  int payloadLocalWindow_;
+  std::string payloadCacheDir_;
+  int incrementalGBA_;
+  float incrementalGBAMinTranslation_;
+  float incrementalGBAMinRotation_;
+  int incrementalGBAHalo_;
+  std::string traceFile_;
+  int trajectoryCapacity_;
+  std::string trajectoryFile_;
+  int trajectoryFileFormat_;
+  int diagnosticsPeriod_;
+  int mapPointMaxDescriptorSamples_;
+  int reclaimCulledMapPoints_;
   int imuInitMethod_;
   int fast_init_;
   int lkWinsize_;
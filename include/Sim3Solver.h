@@ -23,6 +23,7 @@
 #define SIM3SOLVER_H
 
 #include <opencv2/opencv.hpp>
+#include <random>
 #include <vector>
 
 #include "KeyFrame.h"
@@ -110,6 +111,9 @@ class Sim3Solver {
 
   // Indices for random selection
   std::vector<size_t> mvAllIndices;
+  // Seeded from the keyframe ids, the samples drawn for a keyframe pair do
+  // not depend on other solvers running concurrently
+  std::mt19937 mRng;
 
   // Projections
   std::vector<Eigen::Vector2f> mvP1im1;
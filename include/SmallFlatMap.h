@@ -0,0 +1,151 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SMALLFLATMAP_H
+#define SMALLFLATMAP_H
+
+#include <stddef.h>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ORB_SLAM3 {
+
+// Map for a few plain entries, stored contiguously in insertion order. The
+// first N entries live inside the object, so copying a small map is a flat
+// copy that takes no allocation. Lookups are linear, faster than a tree for
+// the sizes it is meant for. Offers the subset of the std::map interface used
+// on map point observations.
+template <typename K, typename V, size_t N>
+class SmallFlatMap {
+ public:
+  typedef std::pair<K, V> value_type;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+
+  static_assert(std::is_trivially_destructible<value_type>::value,
+                "SmallFlatMap never destroys its entries");
+
+  SmallFlatMap() : mpData(Inline()), mnSize(0), mnCapacity(N) {}
+  SmallFlatMap(const SmallFlatMap& other)
+      : mpData(Inline()), mnSize(0), mnCapacity(N) {
+    *this = other;
+  }
+  SmallFlatMap(SmallFlatMap&& other) noexcept
+      : mpData(Inline()), mnSize(0), mnCapacity(N) {
+    *this = std::move(other);
+  }
+  ~SmallFlatMap() {
+    if (mpData != Inline()) ::operator delete(mpData);
+  }
+
+  SmallFlatMap& operator=(const SmallFlatMap& other) {
+    if (this == &other) return *this;
+    mnSize = 0;
+    Reserve(other.mnSize);
+    Copy(other.mpData, other.mnSize, mpData);
+    mnSize = other.mnSize;
+    return *this;
+  }
+  SmallFlatMap& operator=(SmallFlatMap&& other) noexcept {
+    if (this == &other) return *this;
+    if (other.mpData == other.Inline()) {
+      // Inline storage can't be stolen, the copy is at most N entries
+      Copy(other.mpData, other.mnSize, mpData);
+      mnSize = other.mnSize;
+    } else {
+      if (mpData != Inline()) ::operator delete(mpData);
+      mpData = other.mpData;
+      mnSize = other.mnSize;
+      mnCapacity = other.mnCapacity;
+      other.mpData = other.Inline();
+      other.mnCapacity = N;
+    }
+    other.mnSize = 0;
+    return *this;
+  }
+
+  iterator begin() { return mpData; }
+  iterator end() { return mpData + mnSize; }
+  const_iterator begin() const { return mpData; }
+  const_iterator end() const { return mpData + mnSize; }
+
+  size_t size() const { return mnSize; }
+  bool empty() const { return mnSize == 0; }
+  void clear() { mnSize = 0; }
+
+  iterator find(const K& key) {
+    for (size_t i = 0; i < mnSize; i++)
+      if (mpData[i].first == key) return mpData + i;
+    return end();
+  }
+  const_iterator find(const K& key) const {
+    for (size_t i = 0; i < mnSize; i++)
+      if (mpData[i].first == key) return mpData + i;
+    return end();
+  }
+  size_t count(const K& key) const { return find(key) != end() ? 1 : 0; }
+
+  V& operator[](const K& key) {
+    iterator it = find(key);
+    if (it != end()) return it->second;
+    if (mnSize == mnCapacity) Reserve(2 * mnCapacity);
+    value_type* pEntry = new (mpData + mnSize++) value_type(key, V());
+    return pEntry->second;
+  }
+
+  // Keeps the insertion order of the remaining entries
+  iterator erase(iterator it) {
+    for (iterator itNext = it + 1; itNext != end(); ++itNext)
+      *(itNext - 1) = *itNext;
+    mnSize--;
+    return it;
+  }
+  size_t erase(const K& key) {
+    iterator it = find(key);
+    if (it == end()) return 0;
+    erase(it);
+    return 1;
+  }
+
+ private:
+  value_type* Inline() { return reinterpret_cast<value_type*>(mInline); }
+  const value_type* Inline() const {
+    return reinterpret_cast<const value_type*>(mInline);
+  }
+
+  static void Copy(const value_type* pSrc, const size_t n, value_type* pDst) {
+    for (size_t i = 0; i < n; i++) new (pDst + i) value_type(pSrc[i]);
+  }
+
+  void Reserve(const size_t n) {
+    if (n <= mnCapacity) return;
+    value_type* pData =
+        static_cast<value_type*>(::operator new(n * sizeof(value_type)));
+    Copy(mpData, mnSize, pData);
+    if (mpData != Inline()) ::operator delete(mpData);
+    mpData = pData;
+    mnCapacity = n;
+  }
+
+  value_type* mpData;
+  size_t mnSize;
+  size_t mnCapacity;
+  alignas(value_type) unsigned char mInline[N * sizeof(value_type)];
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // SMALLFLATMAP_H
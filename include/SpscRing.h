@@ -0,0 +1,121 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Fixed capacity single-producer / single-consumer ring buffer.
+//
+// Push is called by the sensor callback thread only, every other method by
+// the consumer (tracking) thread only. Neither side takes a lock nor
+// allocates once constructed. The consumer may block in WaitNewData with a
+// timeout, the producer then takes a short lock to wake it up.
+template <typename T>
+class SpscRing {
+ public:
+  // nCapacity is rounded up to a power of two
+  explicit SpscRing(const size_t nCapacity)
+      : mnHead(0), mnTail(0), mnDropped(0), mbWaiting(false) {
+    size_t n = 1;
+    while (n < nCapacity) n <<= 1;
+    mvBuffer.resize(n);
+    mnMask = n - 1;
+  }
+
+  // Producer. Returns false (and drops the sample) if the ring is full.
+  bool Push(const T& item) {
+    const size_t head = mnHead.load(std::memory_order_relaxed);
+    if (head - mnTail.load(std::memory_order_acquire) > mnMask) {
+      mnDropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    mvBuffer[head & mnMask] = item;
+    // Sequentially consistent with the waiter publishing mbWaiting and then
+    // reading the head: either it sees the new element or we see it waiting
+    mnHead.store(head + 1, std::memory_order_seq_cst);
+
+    if (mbWaiting.load(std::memory_order_seq_cst)) {
+      std::unique_lock<std::mutex> lock(mMutexWait);
+      mcvWait.notify_one();
+    }
+    return true;
+  }
+
+  // Consumer
+  size_t Size() const {
+    return mnHead.load(std::memory_order_acquire) -
+           mnTail.load(std::memory_order_relaxed);
+  }
+  bool Empty() const { return Size() == 0; }
+
+  // i-th oldest element, i < Size()
+  const T& At(const size_t i) const {
+    return mvBuffer[(mnTail.load(std::memory_order_relaxed) + i) & mnMask];
+  }
+  const T& Front() const { return At(0); }
+  const T& Back() const { return At(Size() - 1); }
+
+  void Pop(const size_t n = 1) {
+    mnTail.store(mnTail.load(std::memory_order_relaxed) + n,
+                 std::memory_order_release);
+  }
+  void Clear() { Pop(Size()); }
+
+  // Blocks until more than nKnownSize elements are queued or the timeout
+  // expires. Returns true if new data arrived.
+  bool WaitNewData(const size_t nKnownSize,
+                   const std::chrono::microseconds& timeout) {
+    if (Size() > nKnownSize) return true;
+    std::unique_lock<std::mutex> lock(mMutexWait);
+    mbWaiting.store(true, std::memory_order_seq_cst);
+    const bool bNewData = mcvWait.wait_for(lock, timeout, [&]() {
+      return mnHead.load(std::memory_order_seq_cst) -
+                 mnTail.load(std::memory_order_relaxed) >
+             nKnownSize;
+    });
+    mbWaiting.store(false, std::memory_order_relaxed);
+    return bNewData;
+  }
+
+  size_t Capacity() const { return mnMask + 1; }
+  size_t Dropped() const { return mnDropped.load(std::memory_order_relaxed); }
+
+ protected:
+  std::vector<T> mvBuffer;
+  size_t mnMask;
+
+  // Head is written by the producer, tail by the consumer. Both only grow,
+  // kept on separate cache lines to avoid false sharing.
+  alignas(64) std::atomic<size_t> mnHead;
+  alignas(64) std::atomic<size_t> mnTail;
+  std::atomic<size_t> mnDropped;
+
+  std::atomic<bool> mbWaiting;
+  std::mutex mMutexWait;
+  std::condition_variable mcvWait;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // SPSCRING_H
@@ -27,14 +27,17 @@
 #include <unistd.h>
 
 #include <future>
+#include <map>
 #include <opencv2/core/core.hpp>
 #include <string>
 #include <thread>
 
 #include "Atlas.h"
 #include "FrameDrawer.h"
+#include "ICPConstraintCache.h"
 #include "ImuTypes.h"
 #include "KeyFrameDatabase.h"
+#include "KeyFramePayloadStore.h"
 #include "LidarMapping.h"
 #include "LocalMapping.h"
 #include "LoopClosing.h"
@@ -43,6 +46,7 @@
 #include "Settings.h"
 #include "ThreadPool.h"
 #include "Tracking.h"
+#include "TrajectoryRecorder.h"
 #include "Viewer.h"
 namespace ORB_SLAM3 {
 
@@ -91,6 +95,7 @@ class System {
   enum FileType {
     TEXT_FILE = 0,
     BINARY_FILE = 1,
+    CHUNKED_FILE = 2,
   };
 
   struct FrameWrapper {
@@ -262,10 +267,28 @@ class System {
 
   vector<float> GetTrackTimes();
 
+  // Blocks until local mapping and loop closing have drained their keyframe
+  // queues and no global BA is running. Used by offline replays to hand the
+  // frames over one at a time.
+  void WaitForMapping();
+
+  // Span tracing of every thread, see Trace.h. Enabled from the start when
+  // System.TraceFile is set, the trace is then saved at shutdown.
+  void SetTracing(const bool bEnable);
+  bool SaveTrace(const string &filename);
+
+  // Saves the dense global map (RGB-D only) as a PCD file, can be called
+  // while mapping
+  bool SaveGlobalMap(const string &filename);
+
 #ifdef REGISTER_TIMES
   void InsertRectTime(double &time);
   void InsertResizeTime(double &time);
   void InsertTrackTime(double &time);
+
+  // Per-stage timings in ms of the three main threads, keyed by
+  // "thread/stage". Call once the system is shut down.
+  void GetStageTimes(std::map<std::string, vector<double>> &mStageTimes);
 #endif
 
  private:
@@ -305,6 +328,11 @@ class System {
   // The viewer draws the map and the current camera pose. It uses Pangolin.
   Viewer *mpViewer;
   LidarMapping *mpLidarMapping;
+  // Tiered storage of keyframe images and clouds, NULL if disabled
+  KeyFramePayloadStore *mpPayloadStore;
+  ICPConstraintCache *mpICPCache;
+  // Frame trajectory and diagnostics recorded by the tracking
+  TrajectoryRecorder *mpTrajectory;
   FrameDrawer *mpFrameDrawer;
   MapDrawer *mpMapDrawer;
 
@@ -337,12 +365,18 @@ class System {
   std::mutex mMutexTrackedCnt;
   std::mutex mMutexTrackTimes;
   vector<float> vTimesTrack;
+  // Samples returned by GetTrackTimes, all of them if 0
+  size_t mnTrackTimesCapacity;
 
   //
   string mStrLoadAtlasFromFile;
   string mStrSaveAtlasToFile;
 
   string mStrVocabularyFilePath;
+  // FileType used by SaveAtlas/LoadAtlas
+  int mnAtlasFileType;
+  // Chrome trace saved at shutdown, empty if tracing is off
+  string mStrTraceFile;
 
   Settings *settings_;
   std::shared_ptr<hobot::CThreadPool> mthreadPool;
@@ -0,0 +1,92 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace ORB_SLAM3 {
+
+// Cross-thread span tracing written as a Chrome trace (chrome://tracing,
+// ui.perfetto.dev).
+//
+// Every thread appends its spans to its own buffer, no lock is taken on the
+// recording path. Save() reads the published part of every buffer without
+// stopping the writers. Tracing is compiled in and disabled by default, a
+// disabled span costs one relaxed atomic load. Span names and categories must
+// be string literals, only their pointers are stored.
+class Trace {
+ public:
+  static void Enable(const bool bEnable) {
+    sbEnabled.store(bEnable, std::memory_order_relaxed);
+  }
+  static bool IsEnabled() { return sbEnabled.load(std::memory_order_relaxed); }
+
+  // Name of the calling thread in the trace viewer
+  static void SetThreadName(const char* name);
+
+  // Microseconds since the process started
+  static int64_t Now();
+
+  static void Record(const char* name, const char* category,
+                     const int64_t tBegin, const int64_t tEnd);
+
+  // Writes every span recorded so far
+  static bool Save(const std::string& strFile);
+
+ private:
+  static std::atomic<bool> sbEnabled;
+};
+
+class TraceSpan {
+ public:
+  TraceSpan(const char* name, const char* category)
+      : mName(Trace::IsEnabled() ? name : NULL), mCategory(category) {
+    if (mName) mtBegin = Trace::Now();
+  }
+  ~TraceSpan() {
+    if (mName) Trace::Record(mName, mCategory, mtBegin, Trace::Now());
+  }
+
+ private:
+  const char* mName;
+  const char* mCategory;
+  int64_t mtBegin;
+};
+
+// Locks the mutex and records the wait as a "lock" span if it was contended
+template <typename Mutex>
+std::unique_lock<Mutex> TracedLock(Mutex& mutex, const char* name) {
+  std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    TraceSpan span(name, "lock");
+    lock.lock();
+  }
+  return lock;
+}
+
+}  // namespace ORB_SLAM3
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Span covering the rest of the enclosing scope
+#define TRACE_SPAN(name, category) \
+  ORB_SLAM3::TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name, category)
+
+#endif  // TRACE_H
@@ -26,6 +26,7 @@
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
+#include <chrono>
 #include <mutex>
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/eigen.hpp>
@@ -46,7 +47,9 @@
 #include "ORBextractor.h"
 #include "RegistrationGICP.h"
 #include "Settings.h"
+#include "SpscRing.h"
 #include "System.h"
+#include "TrajectoryRecorder.h"
 #include "Viewer.h"
 namespace ORB_SLAM3 {
 
@@ -80,14 +83,14 @@ class Tracking {
                                      const cv::Mat& imRight,
                                      const double& timestamp,
                                      const std::string& filename);
-  Sophus::SE3f GrabImageStereo(Frame& frame);
+  Sophus::SE3f GrabImageStereo(Frame&& frame);
   Sophus::SE3f GrabImageStereo(const cv::Mat& imRectLeft,
                                const cv::Mat& imRectRight,
                                const double& timestamp, string filename);
-  Sophus::SE3f GrabImageRGBD(Frame& frame);
+  Sophus::SE3f GrabImageRGBD(Frame&& frame);
   Sophus::SE3f GrabImageRGBD(const cv::Mat& imRGB, const cv::Mat& imD,
                              const double& timestamp, string filename);
-  Sophus::SE3f GrabImageMonocular(Frame& frame);
+  Sophus::SE3f GrabImageMonocular(Frame&& frame);
   Sophus::SE3f GrabImageMonocular(const cv::Mat& im, const double& timestamp,
                                   string filename);
 
@@ -120,6 +123,9 @@ class Tracking {
   void SetPointCloudMapper(LidarMapping* pLidarMapping) {
     mpLidarMapping = pLidarMapping;
   }
+  void SetTrajectoryRecorder(TrajectoryRecorder* pTrajectory) {
+    mpTrajectory = pTrajectory;
+  }
   //--
   void NewDataset();
   int GetNumberDataset();
@@ -173,13 +179,10 @@ class Tracking {
   std::vector<cv::Point3f> mvIniP3D;
   Frame mInitialFrame;
 
-  // Lists used to recover the full camera trajectory at the end of the
-  // execution. Basically we store the reference keyframe for each frame and its
-  // relative transformation
-  list<Sophus::SE3f> mlRelativeFramePoses;
-  list<KeyFrame*> mlpReferences;
-  list<double> mlFrameTimes;
-  list<bool> mlbLost;
+  // Used to recover the full camera trajectory at the end of the execution.
+  // Basically we store the reference keyframe for each frame and its relative
+  // transformation, along with the per frame diagnostics
+  TrajectoryRecorder* mpTrajectory;
   std::queue<KeyFrame*> local_queue;
   // frames with estimated pose
   int mTrackedFr;
@@ -235,6 +238,13 @@ class Tracking {
   void CreateInitialMapMonocular();
 
   void CheckReplacedInLastFrame();
+  // Drops the culled points still referenced between frames, before the
+  // thread is reported quiescent to the reclaimer
+  void ReleaseBadMapPoints();
+  // ORB of a frame skipped by LazyORBExtraction, extracted when a step needs
+  // descriptors or when optical flow tracked too few points
+  void ExtractDeferredORB();
+  void ExtractDeferredORBIfUncovered();
   bool TrackReferenceKeyFrame();
   void UpdateLastFrame();
   bool inBorder(const cv::Point2f& pt, const cv::Mat& im) const;
@@ -274,18 +284,35 @@ class Tracking {
 
   bool mbMapUpdated;
 
+  // Whether the reprojection errors of the current frame are kept
+  bool mbSampleDiagnostics;
+
   // Imu preintegration from last frame
   IMU::Preintegrated* mpImuPreintegratedFromLastKF;
 
-  // Queue of IMU measurements between frames
-  std::list<IMU::Point> mlQueueImuData;
-  std::vector<Eigen::Vector3f> mlQueueOdomData;
+  // Extracts the IMU samples in [tPrev, tCur] with both endpoints
+  // interpolated. Consumes the samples no longer needed. Returns false if the
+  // ring holds no data for the span.
+  bool ExtractImuSpan(const double tPrev, const double tCur,
+                      std::vector<IMU::Point>& vSpan);
+
+  // IMU and odometry measurements between frames, written by the sensor
+  // thread and read by tracking only
+  SpscRing<IMU::Point> mImuRing;
+  SpscRing<Eigen::Vector3f> mOdomRing;
+
+  // Relocalization candidates of the last lost frames, with the map and the
+  // frame they were queried for
+  std::vector<KeyFrame*> mvpRelocCandidates;
+  Map* mpRelocCandidatesMap;
+  unsigned long mnRelocCandidatesFrameId;
+  // Time a lost frame may spend relocalizing, no limit if 0
+  std::chrono::microseconds mRelocalizationBudget;
 
   // Vector of IMU measurements from previous to current frame (to be filled by
   // PreintegrateIMU)
   std::vector<IMU::Point> mvImuFromLastFrame;
-  std::mutex mMutexImuQueue;
-  std::mutex mMutexOdomQueue;
+  std::vector<IMU::Preintegrated::integrable> mvImuSpan;
   std::mutex mMutexLocalKF;
 
   // Imu calibration parameters
@@ -325,7 +352,7 @@ class Tracking {
   std::vector<KeyFrame*> mvpLocalKeyFrames;
   std::vector<MapPoint*> mvpLocalMapPoints;
   pcl::PointCloud<PointType>::Ptr mpLocalPointCloud;
-  pcl::VoxelGrid<PointType>* voxel;
+  VoxelFilter<PointType>* voxel;
 
   // System
   System* mpSystem;
@@ -427,8 +454,6 @@ class Tracking {
 
  public:
   cv::Mat mImRight;
-  map<int, vector<float>> mFrame2FrameReprojErr;
-  map<int, vector<float>> mFrame2MapReprojErr;
 };
 
 }  // namespace ORB_SLAM3
@@ -0,0 +1,143 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TRAJECTORYRECORDER_H
+#define TRAJECTORYRECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sophus/se3.hpp>
+
+#include "SpscRing.h"
+
+namespace ORB_SLAM3 {
+
+class Atlas;
+class KeyFrame;
+
+// Per frame trajectory and tracking diagnostics kept in bounded memory.
+//
+// A frame pose is stored relative to its reference keyframe, so the
+// corrections of that keyframe by BA, loop closing or map merging still apply
+// to the records in memory when the trajectory is saved. With a capacity the
+// records live in a ring, each new frame evicting the oldest one. If a stream
+// file is set, evicted records are written by a background thread, and
+// Flush() appends the records still in memory at shutdown, so the file covers
+// the whole run even if the ring does not.
+//
+// Streamed poses are expressed like SaveTrajectory, relative to the first
+// keyframe of the current map, but they are resolved when the record is
+// written: the streamed prefix is frozen at that time, and later corrections
+// of its keyframes, or of the origin, are not reflected in the file.
+//
+// Push, Clear and Flush are called by the tracking thread only.
+class TrajectoryRecorder {
+ public:
+  struct Record {
+    Sophus::SE3f Tcr;
+    KeyFrame* pRef;
+    double timestamp;
+    bool bLost;
+  };
+
+  // TUM: "timestamp tx ty tz qx qy qz qw" lines, lost frames are skipped
+  // BINARY: one StreamRecord per frame, lost frames included
+  enum StreamFormat { STREAM_TUM = 0, STREAM_BINARY = 1 };
+
+  struct StreamRecord {
+    double timestamp;
+    float twc[3];
+    float qwc[4];  // x y z w
+    uint32_t bLost;
+  };
+
+  // pAtlas: gives the origin of the streamed poses
+  // nCapacity: records kept in memory, all of them if 0
+  // strStreamFile: evicted records are written there, dropped if empty
+  // nDiagnosticsPeriod: diagnostics kept every n frames, never if 0
+  TrajectoryRecorder(Atlas* pAtlas, const size_t nCapacity,
+                     const std::string& strStreamFile,
+                     const StreamFormat format, const int nDiagnosticsPeriod);
+  ~TrajectoryRecorder();
+
+  void Push(const Record& record);
+
+  size_t Size() const { return mvRecords.size(); }
+  bool Empty() const { return mvRecords.empty(); }
+  // i-th oldest record in memory, i < Size()
+  Record& At(const size_t i) {
+    return mvRecords[(mnHead + i) % mvRecords.size()];
+  }
+  Record& Back() { return At(Size() - 1); }
+  // Records evicted from memory since the last Clear
+  size_t NumEvicted() const { return mnEvicted; }
+
+  // Drops the records in memory, the ones already streamed stay on disk
+  void Clear();
+  // Streams the records in memory and waits until the file is complete
+  void Flush();
+
+  // Whether the diagnostics of this frame are computed and kept
+  bool SampleDiagnostics(const unsigned long frameId) const {
+    return mnDiagnosticsPeriod > 0 && frameId % mnDiagnosticsPeriod == 0;
+  }
+  void AddFrame2FrameReprojErr(const int frameId,
+                               const std::vector<float>& vErr);
+  void AddFrame2MapReprojErr(const int frameId, const std::vector<float>& vErr);
+  const std::map<int, std::vector<float>>& Frame2FrameReprojErr() const {
+    return mFrame2FrameReprojErr;
+  }
+  const std::map<int, std::vector<float>>& Frame2MapReprojErr() const {
+    return mFrame2MapReprojErr;
+  }
+
+ private:
+  void AddReprojErr(std::map<int, std::vector<float>>& mErr, const int frameId,
+                    const std::vector<float>& vErr);
+  // Writer thread
+  void Run();
+  void Write(const Record& record);
+
+  Atlas* mpAtlas;
+  const size_t mnCapacity;
+  const StreamFormat mFormat;
+  const int mnDiagnosticsPeriod;
+
+  std::vector<Record> mvRecords;
+  // Oldest record once the ring is full
+  size_t mnHead;
+  size_t mnEvicted;
+
+  std::map<int, std::vector<float>> mFrame2FrameReprojErr;
+  std::map<int, std::vector<float>> mFrame2MapReprojErr;
+
+  std::ofstream mStream;
+  SpscRing<Record> mQueue;
+  std::thread* mptWriter;
+  std::atomic<bool> mbStop;
+  // Evicted while the queue was full, missing from the stream file
+  size_t mnDropped;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // TRAJECTORYRECORDER_H
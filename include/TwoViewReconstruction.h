@@ -35,8 +35,10 @@ class TwoViewReconstruction {
  public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   // Fix the reference frame
+  // With a confidence in (0, 1) RANSAC stops early once an all inlier
+  // sample has likely been drawn, otherwise it runs all the iterations
   TwoViewReconstruction(const Eigen::Matrix3f &k, float sigma = 1.0,
-                        int iterations = 200);
+                        int iterations = 200, float confidence = 0.f);
 
   // Computes in parallel a fundamental matrix and a homography
   // Selects a model and tries to recover the motion and the structure from
@@ -48,21 +50,19 @@ class TwoViewReconstruction {
                    std::vector<bool> &vbTriangulated);
 
  private:
+  // RANSAC models, see Ransac.h
+  class HomographyModel;
+  class FundamentalModel;
+
   void FindHomography(std::vector<bool> &vbMatchesInliers, float &score,
                       Eigen::Matrix3f &H21);
   void FindFundamental(std::vector<bool> &vbInliers, float &score,
                        Eigen::Matrix3f &F21);
 
-  Eigen::Matrix3f ComputeH21(const std::vector<cv::Point2f> &vP1,
-                             const std::vector<cv::Point2f> &vP2);
-  Eigen::Matrix3f ComputeF21(const std::vector<cv::Point2f> &vP1,
-                             const std::vector<cv::Point2f> &vP2);
-
-  float CheckHomography(const Eigen::Matrix3f &H21, const Eigen::Matrix3f &H12,
-                        std::vector<bool> &vbMatchesInliers, float sigma);
-
-  float CheckFundamental(const Eigen::Matrix3f &F21,
-                         std::vector<bool> &vbMatchesInliers, float sigma);
+  static Eigen::Matrix3f ComputeH21(const std::vector<cv::Point2f> &vP1,
+                                    const std::vector<cv::Point2f> &vP2);
+  static Eigen::Matrix3f ComputeF21(const std::vector<cv::Point2f> &vP1,
+                                    const std::vector<cv::Point2f> &vP2);
 
   bool ReconstructF(std::vector<bool> &vbMatchesInliers, Eigen::Matrix3f &F21,
                     Eigen::Matrix3f &K, Sophus::SE3f &T21,
@@ -101,6 +101,10 @@ class TwoViewReconstruction {
   std::vector<Match> mvMatches12;
   std::vector<bool> mvbMatched1;
 
+  // Pixel coordinates of the matches, one array per coordinate so they are
+  // scored with vector instructions
+  std::vector<float> mvU1, mvV1, mvU2, mvV2;
+
   // Calibration
   Eigen::Matrix3f mK;
 
@@ -109,6 +113,7 @@ class TwoViewReconstruction {
 
   // Ransac max iterations
   int mMaxIterations;
+  float mfConfidence;
 
   // Ransac sets
   std::vector<std::vector<size_t> > mvSets;
@@ -0,0 +1,214 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOXELIZER_H
+#define VOXELIZER_H
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Groups points by voxel through a hash of their voxel coordinates, in
+// linear time. The hashing is split over partitions of the voxel keys that
+// are processed in parallel; voxels come out in partition order, then in
+// order of first point, and the points of a voxel in input order, so the
+// result does not depend on the number of threads.
+//
+// Voxel coordinates are kept in 21 bits per axis, which at a 1 cm leaf covers
+// +-10 km around the origin. Points farther away or not finite are dropped.
+class Voxelizer {
+ public:
+  Voxelizer() { SetLeafSize(0.1f, 0.1f, 0.1f); }
+
+  void SetLeafSize(const float lx, const float ly, const float lz) {
+    mInvLeafSize[0] = 1.0 / lx;
+    mInvLeafSize[1] = 1.0 / ly;
+    mInvLeafSize[2] = 1.0 / lz;
+  }
+
+  // Groups n points, get(i) returns the coordinates of point i as anything
+  // indexed by 0..2
+  template <typename Getter>
+  void Build(const int n, const Getter& get) {
+    mvKeys.resize(n);
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < n; i++) {
+      const auto& p = get(i);
+      mvKeys[i] = Key(p[0], p[1], p[2]);
+    }
+    Group();
+  }
+
+  int NumVoxels() const { return mvVoxelStart.size() - 1; }
+
+  // Points of voxel v, as indices in the input
+  const int* VoxelBegin(const int v) const {
+    return mvPointIndices.data() + mvVoxelStart[v];
+  }
+  const int* VoxelEnd(const int v) const {
+    return mvPointIndices.data() + mvVoxelStart[v + 1];
+  }
+
+  // Key of voxel v, the same for the same voxel in any build with the same
+  // leaf size
+  uint64_t VoxelKey(const int v) const { return mvKeys[*VoxelBegin(v)]; }
+
+  int NumDropped() const { return mvKeys.size() - mvPointIndices.size(); }
+
+ private:
+  static constexpr int kCoordBits = 21;
+  static constexpr uint64_t kInvalidKey = ~uint64_t(0);
+
+  uint64_t Key(const double x, const double y, const double z) const {
+    const double kOffset = 1 << (kCoordBits - 1);
+    const double kRange = 1 << kCoordBits;
+    const double cx = std::floor(x * mInvLeafSize[0]) + kOffset;
+    const double cy = std::floor(y * mInvLeafSize[1]) + kOffset;
+    const double cz = std::floor(z * mInvLeafSize[2]) + kOffset;
+    // Also false for NaN
+    if (!(cx >= 0 && cx < kRange && cy >= 0 && cy < kRange && cz >= 0 &&
+          cz < kRange))
+      return kInvalidKey;
+    return uint64_t(cx) | uint64_t(cy) << kCoordBits |
+           uint64_t(cz) << (2 * kCoordBits);
+  }
+
+  // Turns mvKeys into voxels
+  void Group();
+
+  double mInvLeafSize[3];
+
+  std::vector<uint64_t> mvKeys;
+
+  // Points of voxel v are mvPointIndices[mvVoxelStart[v]] up to
+  // mvPointIndices[mvVoxelStart[v + 1] - 1]
+  std::vector<int> mvVoxelStart;
+  std::vector<int> mvPointIndices;
+};
+
+// How the points of a voxel become one
+enum class VoxelReduction {
+  // The first point of the voxel
+  FIRST,
+  // The mean position, the other fields from the first point
+  CENTROID,
+  // The mean position and color, as pcl::VoxelGrid does
+  MEAN
+};
+
+// Voxel grid filter for PCL clouds on top of Voxelizer, with the interface of
+// pcl::VoxelGrid so it drops in for it. The input and the output may be the
+// same cloud.
+template <typename PointT>
+class VoxelFilter {
+ public:
+  typedef pcl::PointCloud<PointT> PointCloud;
+
+  explicit VoxelFilter(const VoxelReduction reduction = VoxelReduction::MEAN)
+      : mReduction(reduction) {}
+
+  void setLeafSize(const float lx, const float ly, const float lz) {
+    mVoxelizer.SetLeafSize(lx, ly, lz);
+  }
+  void setReduction(const VoxelReduction reduction) { mReduction = reduction; }
+  void setInputCloud(const typename PointCloud::ConstPtr& pCloud) {
+    mpInput = pCloud;
+  }
+
+  void filter(PointCloud& output) {
+    if (!mpInput) return;
+    const PointCloud& input = *mpInput;
+
+    mVoxelizer.Build(input.size(), [&input](const int i) {
+      const PointT& p = input[i];
+      return Eigen::Vector3f(p.x, p.y, p.z);
+    });
+
+    // Built aside, the output may be the input
+    const int nVoxels = mVoxelizer.NumVoxels();
+    typename PointCloud::VectorType vPoints(nVoxels);
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+    for (int v = 0; v < nVoxels; v++)
+      vPoints[v] = Reduce(input, mVoxelizer.VoxelBegin(v),
+                          mVoxelizer.VoxelEnd(v));
+
+    output.header = input.header;
+    output.points.swap(vPoints);
+    output.width = nVoxels;
+    output.height = 1;
+    output.is_dense = true;
+  }
+
+ private:
+  PointT Reduce(const PointCloud& input, const int* pBegin,
+                const int* pEnd) const {
+    PointT point = input[*pBegin];
+    if (mReduction == VoxelReduction::FIRST) return point;
+
+    double sum[3] = {0.0, 0.0, 0.0};
+    double colorSum[4] = {0.0, 0.0, 0.0, 0.0};
+    for (const int* pIdx = pBegin; pIdx != pEnd; pIdx++) {
+      const PointT& p = input[*pIdx];
+      sum[0] += p.x;
+      sum[1] += p.y;
+      sum[2] += p.z;
+      if (mReduction == VoxelReduction::MEAN) AddColor(p, colorSum);
+    }
+
+    const double invN = 1.0 / (pEnd - pBegin);
+    point.x = sum[0] * invN;
+    point.y = sum[1] * invN;
+    point.z = sum[2] * invN;
+    if (mReduction == VoxelReduction::MEAN) SetColor(colorSum, invN, point);
+    return point;
+  }
+
+  // Colorless points only average their position
+  template <typename P>
+  static void AddColor(const P&, double*) {}
+  template <typename P>
+  static void SetColor(const double*, const double, P&) {}
+
+  static void AddColor(const pcl::PointXYZRGBA& p, double* colorSum) {
+    colorSum[0] += p.r;
+    colorSum[1] += p.g;
+    colorSum[2] += p.b;
+    colorSum[3] += p.a;
+  }
+  static void SetColor(const double* colorSum, const double invN,
+                       pcl::PointXYZRGBA& p) {
+    p.r = std::lround(colorSum[0] * invN);
+    p.g = std::lround(colorSum[1] * invN);
+    p.b = std::lround(colorSum[2] * invN);
+    p.a = std::lround(colorSum[3] * invN);
+  }
+
+  Voxelizer mVoxelizer;
+  VoxelReduction mReduction;
+  typename PointCloud::ConstPtr mpInput;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // VOXELIZER_H
@@ -283,7 +283,7 @@ void Atlas::PreSave() {
   RemoveBadMaps();
 }
 
-void Atlas::PostLoad() {
+void Atlas::PostLoad(const bool bRebuildDatabase) {
   map<unsigned int, GeometricCamera*> mpCams;
   for (GeometricCamera* pCam : mvpCameras) {
     mpCams[pCam->GetId()] = pCam;
@@ -293,7 +293,7 @@ void Atlas::PostLoad() {
   unsigned long int numKF = 0, numMP = 0;
   for (Map* pMi : mvpBackupMaps) {
     mspMaps.insert(pMi);
-    pMi->PostLoad(mpKeyFrameDB, mpORBVocabulary, mpCams);
+    pMi->PostLoad(mpKeyFrameDB, mpORBVocabulary, mpCams, bRebuildDatabase);
     numKF += pMi->GetAllKeyFrames().size();
     numMP += pMi->GetAllMapPoints().size();
   }
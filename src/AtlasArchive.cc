@@ -0,0 +1,557 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "AtlasArchive.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#include "Atlas.h"
+#include "KannalaBrandt8.h"
+#include "KeyFrame.h"
+#include "KeyFrameDatabase.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "Pinhole.h"
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+const char kMagic[8] = {'O', 'R', 'B', 'A', 'T', 'L', 'A', 'S'};
+
+typedef std::map<long unsigned int, std::map<long unsigned int, int>>
+    CovisibilityGraph;
+
+// Read-only streambuf over a memory mapped section
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  MemoryStreamBuf(const char* data, size_t size) {
+    char* p = const_cast<char*>(data);
+    setg(p, p, p + size);
+  }
+};
+
+struct SectionJob {
+  AtlasArchive::SectionEntry entry;
+  Map* pMap;
+  size_t begin, end;
+  std::string data;
+};
+
+// Raw KF_DESCRIPTORS section for the keyframes [begin, end) of a map
+std::string EncodeDescriptors(const std::vector<KeyFrame*>& vpKFs,
+                              const std::vector<cv::Mat>& vDescriptors,
+                              const size_t begin, const size_t end) {
+  const uint64_t n = end - begin;
+  std::vector<AtlasArchive::DescriptorEntry> vEntries(n);
+  uint64_t offset =
+      sizeof(uint64_t) + n * sizeof(AtlasArchive::DescriptorEntry);
+  for (size_t i = 0; i < n; ++i) {
+    const cv::Mat& desc = vDescriptors[begin + i];
+    AtlasArchive::DescriptorEntry& entry = vEntries[i];
+    entry.kfId = vpKFs[begin + i]->mnId;
+    entry.rows = desc.rows;
+    entry.cols = desc.cols;
+    entry.type = desc.type();
+    entry.padding = 0;
+    entry.offset = offset;
+    offset += desc.rows * desc.cols * desc.elemSize();
+  }
+
+  std::string data;
+  data.reserve(offset);
+  data.append(reinterpret_cast<const char*>(&n), sizeof(n));
+  data.append(reinterpret_cast<const char*>(vEntries.data()),
+              n * sizeof(AtlasArchive::DescriptorEntry));
+  for (size_t i = 0; i < n; ++i) {
+    const cv::Mat& desc = vDescriptors[begin + i];
+    for (int r = 0; r < desc.rows; ++r)
+      data.append(reinterpret_cast<const char*>(desc.ptr(r)),
+                  desc.cols * desc.elemSize());
+  }
+  return data;
+}
+
+// Points the descriptors of the keyframes in a KF_DESCRIPTORS section into
+// the mapped file, false if the section is malformed
+bool MapDescriptors(const char* pSection, const uint64_t size,
+                    const std::map<long unsigned int, KeyFrame*>& mpKFs) {
+  uint64_t n;
+  if (size < sizeof(n)) return false;
+  memcpy(&n, pSection, sizeof(n));
+  if (n > (size - sizeof(n)) / sizeof(AtlasArchive::DescriptorEntry))
+    return false;
+
+  for (uint64_t i = 0; i < n; ++i) {
+    AtlasArchive::DescriptorEntry entry;
+    memcpy(&entry,
+           pSection + sizeof(n) + i * sizeof(AtlasArchive::DescriptorEntry),
+           sizeof(entry));
+    if (entry.rows < 0 || entry.cols < 0) return false;
+    const uint64_t nBytes = static_cast<uint64_t>(entry.rows) * entry.cols *
+                            CV_ELEM_SIZE(entry.type);
+    if (entry.offset > size || nBytes > size - entry.offset) return false;
+
+    std::map<long unsigned int, KeyFrame*>::const_iterator it =
+        mpKFs.find(entry.kfId);
+    if (it == mpKFs.end()) continue;
+    cv::Mat& desc = const_cast<cv::Mat&>(it->second->mDescriptors);
+    if (nBytes == 0)
+      desc = cv::Mat();
+    else
+      desc = cv::Mat(entry.rows, entry.cols, entry.type,
+                     const_cast<char*>(pSection + entry.offset));
+  }
+  return true;
+}
+
+}  // namespace
+
+template <class Archive>
+void AtlasArchive::SerializeMapHeader(Archive& ar, Map* pMap) {
+  // Same fields as Map::serialize without the KeyFrame/MapPoint vectors,
+  // those go to their own sections
+  ar & pMap->mnId;
+  ar & pMap->mnInitKFid;
+  ar & pMap->mnMaxKFid;
+  ar & pMap->mnBigChangeIdx;
+  ar & pMap->mvBackupKeyFrameOriginsId;
+  ar & pMap->mnBackupKFinitialID;
+  ar & pMap->mnBackupKFlowerID;
+  ar & pMap->mbImuInitialized;
+  ar & pMap->mbIsInertial;
+  ar & pMap->mbIMU_BA1;
+  ar & pMap->mbIMU_BA2;
+}
+
+bool AtlasArchive::Save(Atlas* pAtlas, KeyFrameDatabase* pKFDB,
+                        const std::string& strFileName,
+                        const std::string& strVocabularyName,
+                        const std::string& strVocabularyChecksum) {
+  std::vector<SectionJob> vJobs;
+  std::map<Map*, CovisibilityGraph> mCovisibility;
+  std::map<Map*, std::vector<cv::Mat>> mDescriptors;
+
+  SectionJob job;
+  job.pMap = static_cast<Map*>(NULL);
+  job.begin = job.end = 0;
+  job.entry.mapId = 0;
+  job.entry.type = SECTION_META;
+  vJobs.push_back(job);
+
+  for (Map* pMi : pAtlas->mvpBackupMaps) {
+    job.pMap = pMi;
+    job.entry.mapId = pMi->GetId();
+    job.begin = job.end = 0;
+    job.entry.type = SECTION_MAP_HEADER;
+    vJobs.push_back(job);
+
+    // The covisibility graph is moved out of the keyframes to its own section
+    CovisibilityGraph& graph = mCovisibility[pMi];
+    for (KeyFrame* pKFi : pMi->mvpBackupKeyFrames) {
+      graph[pKFi->mnId].swap(pKFi->mBackupConnectedKeyFrameIdWeights);
+    }
+    job.entry.type = SECTION_COVISIBILITY;
+    vJobs.push_back(job);
+
+    // The descriptors are moved out of the keyframes to raw sections, they
+    // are put back once encoded
+    std::vector<cv::Mat>& vDescriptors = mDescriptors[pMi];
+    for (KeyFrame* pKFi : pMi->mvpBackupKeyFrames) {
+      cv::Mat& desc = const_cast<cv::Mat&>(pKFi->mDescriptors);
+      vDescriptors.push_back(desc);
+      desc = cv::Mat();
+    }
+
+    const size_t nKFs = pMi->mvpBackupKeyFrames.size();
+    for (size_t i = 0; i < nKFs; i += kElementsPerChunk) {
+      job.begin = i;
+      job.end = std::min(nKFs, i + kElementsPerChunk);
+      job.entry.type = SECTION_KEYFRAMES;
+      vJobs.push_back(job);
+      job.entry.type = SECTION_KF_DESCRIPTORS;
+      vJobs.push_back(job);
+    }
+
+    const size_t nMPs = pMi->mvpBackupMapPoints.size();
+    job.entry.type = SECTION_MAPPOINTS;
+    for (size_t i = 0; i < nMPs; i += kElementsPerChunk) {
+      job.begin = i;
+      job.end = std::min(nMPs, i + kElementsPerChunk);
+      vJobs.push_back(job);
+    }
+  }
+
+  pKFDB->PreSave();
+  job.pMap = static_cast<Map*>(NULL);
+  job.entry.mapId = 0;
+  job.begin = job.end = 0;
+  job.entry.type = SECTION_BOW_DATABASE;
+  vJobs.push_back(job);
+
+  auto encode = [&](SectionJob& sj) {
+    if (sj.entry.type == SECTION_KF_DESCRIPTORS) {
+      sj.data = EncodeDescriptors(sj.pMap->mvpBackupKeyFrames,
+                                  mDescriptors.at(sj.pMap), sj.begin, sj.end);
+      return;
+    }
+    std::ostringstream oss(std::ios::binary);
+    {
+      boost::archive::binary_oarchive oa(oss);
+      switch (sj.entry.type) {
+        case SECTION_META: {
+          oa.template register_type<Pinhole>();
+          oa.template register_type<KannalaBrandt8>();
+          std::vector<long unsigned int> vMapIds;
+          for (Map* pMi : pAtlas->mvpBackupMaps)
+            vMapIds.push_back(pMi->GetId());
+          oa << strVocabularyName;
+          oa << strVocabularyChecksum;
+          oa << pAtlas->mvpCameras;
+          oa << Map::nNextId;
+          oa << Frame::nNextId;
+          oa << KeyFrame::nNextId;
+          oa << MapPoint::nNextId;
+          oa << GeometricCamera::nNextId;
+          oa << pAtlas->mnLastInitKFidMap;
+          oa << vMapIds;
+          break;
+        }
+        case SECTION_MAP_HEADER:
+          SerializeMapHeader(oa, sj.pMap);
+          break;
+        case SECTION_COVISIBILITY:
+          oa << mCovisibility.at(sj.pMap);
+          break;
+        case SECTION_KEYFRAMES: {
+          std::vector<KeyFrame*> vpKFs(
+              sj.pMap->mvpBackupKeyFrames.begin() + sj.begin,
+              sj.pMap->mvpBackupKeyFrames.begin() + sj.end);
+          oa << vpKFs;
+          break;
+        }
+        case SECTION_MAPPOINTS: {
+          std::vector<MapPoint*> vpMPs(
+              sj.pMap->mvpBackupMapPoints.begin() + sj.begin,
+              sj.pMap->mvpBackupMapPoints.begin() + sj.end);
+          oa << vpMPs;
+          break;
+        }
+        case SECTION_BOW_DATABASE:
+          oa << *pKFDB;
+          break;
+      }
+    }
+    sj.data = oss.str();
+  };
+
+  // boost::serialization creates its per-type singletons on first use, the
+  // first section of each type is encoded alone before going parallel
+  std::vector<bool> vbTypeSeen(SECTION_KF_DESCRIPTORS + 1, false);
+  std::vector<size_t> vParallelJobs;
+  for (size_t i = 0; i < vJobs.size(); ++i) {
+    if (vbTypeSeen[vJobs[i].entry.type]) {
+      vParallelJobs.push_back(i);
+    } else {
+      vbTypeSeen[vJobs[i].entry.type] = true;
+      encode(vJobs[i]);
+    }
+  }
+  const int nParallelJobs = vParallelJobs.size();
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < nParallelJobs; ++i) {
+    encode(vJobs[vParallelJobs[i]]);
+  }
+
+  for (Map* pMi : pAtlas->mvpBackupMaps) {
+    std::vector<cv::Mat>& vDescriptors = mDescriptors[pMi];
+    for (size_t i = 0; i < pMi->mvpBackupKeyFrames.size(); ++i)
+      const_cast<cv::Mat&>(pMi->mvpBackupKeyFrames[i]->mDescriptors) =
+          vDescriptors[i];
+  }
+
+  std::remove(strFileName.c_str());
+  std::ofstream ofs(strFileName, std::ios::binary);
+  if (!ofs.is_open()) {
+    std::cout << "[AtlasArchive] Unable to open " << strFileName << std::endl;
+    return false;
+  }
+
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.numSections = vJobs.size();
+  header.indexOffset = 0;
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  uint64_t offset = sizeof(header);
+  std::vector<SectionEntry> vIndex;
+  vIndex.reserve(vJobs.size());
+  for (SectionJob& sj : vJobs) {
+    sj.entry.offset = offset;
+    sj.entry.size = sj.data.size();
+    ofs.write(sj.data.data(), sj.data.size());
+    offset += sj.data.size();
+    vIndex.push_back(sj.entry);
+    std::string().swap(sj.data);
+  }
+
+  header.indexOffset = offset;
+  ofs.write(reinterpret_cast<const char*>(vIndex.data()),
+            vIndex.size() * sizeof(SectionEntry));
+  ofs.seekp(0);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.close();
+
+  std::cout << "[AtlasArchive] Saved " << vIndex.size() << " sections, "
+            << offset << " bytes" << std::endl;
+  return true;
+}
+
+Atlas* AtlasArchive::Load(const std::string& strFileName,
+                          KeyFrameDatabase* pKFDB,
+                          std::string& strVocabularyName,
+                          std::string& strVocabularyChecksum) {
+  int fd = open(strFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cout << "Load file not found" << std::endl;
+    return static_cast<Atlas*>(NULL);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+    close(fd);
+    return static_cast<Atlas*>(NULL);
+  }
+  const size_t nFileSize = st.st_size;
+  // Writable so that the keyframe descriptors, which point into the mapping,
+  // can be modified in place. The mapping is private, written pages are
+  // copied and the file is left untouched.
+  void* pMapped =
+      mmap(NULL, nFileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pMapped == MAP_FAILED) {
+    std::cout << "[AtlasArchive] mmap failed for " << strFileName << std::endl;
+    return static_cast<Atlas*>(NULL);
+  }
+  // Unmapped when the last of this function and the loaded atlas drops it
+  std::shared_ptr<const char> pMapping(
+      static_cast<const char*>(pMapped), [nFileSize](const char* p) {
+        munmap(const_cast<char*>(p), nFileSize);
+      });
+  const char* pData = pMapping.get();
+
+  FileHeader header;
+  memcpy(&header, pData, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      header.indexOffset + header.numSections * sizeof(SectionEntry) >
+          nFileSize) {
+    std::cout << "[AtlasArchive] " << strFileName
+              << " is not a chunked atlas (version " << kVersion << ")"
+              << std::endl;
+    return static_cast<Atlas*>(NULL);
+  }
+
+  std::vector<SectionEntry> vIndex(header.numSections);
+  memcpy(vIndex.data(), pData + header.indexOffset,
+         header.numSections * sizeof(SectionEntry));
+  for (const SectionEntry& entry : vIndex) {
+    if (entry.offset + entry.size > header.indexOffset) {
+      std::cout << "[AtlasArchive] Corrupted section index" << std::endl;
+      return static_cast<Atlas*>(NULL);
+    }
+  }
+
+  Atlas* pAtlas = new Atlas();
+  std::map<long unsigned int, Map*> mpMaps;
+  long unsigned int nNextMapId = 0, nNextFrameId = 0, nNextKFId = 0,
+                    nNextMPId = 0, nNextCamId = 0;
+
+  // META and map headers are small, they are decoded first so the map
+  // objects exist before the parallel pass
+  for (const SectionEntry& entry : vIndex) {
+    if (entry.type != SECTION_META && entry.type != SECTION_MAP_HEADER)
+      continue;
+    MemoryStreamBuf buf(pData + entry.offset, entry.size);
+    std::istream is(&buf);
+    boost::archive::binary_iarchive ia(is);
+    if (entry.type == SECTION_META) {
+      ia.template register_type<Pinhole>();
+      ia.template register_type<KannalaBrandt8>();
+      std::vector<long unsigned int> vMapIds;
+      ia >> strVocabularyName;
+      ia >> strVocabularyChecksum;
+      ia >> pAtlas->mvpCameras;
+      ia >> nNextMapId;
+      ia >> nNextFrameId;
+      ia >> nNextKFId;
+      ia >> nNextMPId;
+      ia >> nNextCamId;
+      ia >> pAtlas->mnLastInitKFidMap;
+      ia >> vMapIds;
+    } else {
+      Map* pMap = new Map();
+      SerializeMapHeader(ia, pMap);
+      mpMaps[pMap->mnId] = pMap;
+      pAtlas->mvpBackupMaps.push_back(pMap);
+    }
+  }
+  // Creating the maps moved the static counter, restore the saved ones
+  Map::nNextId = nNextMapId;
+  Frame::nNextId = nNextFrameId;
+  KeyFrame::nNextId = nNextKFId;
+  MapPoint::nNextId = nNextMPId;
+  GeometricCamera::nNextId = nNextCamId;
+
+  std::vector<size_t> vDataSections;
+  for (size_t i = 0; i < vIndex.size(); ++i) {
+    if (vIndex[i].type != SECTION_META && vIndex[i].type != SECTION_MAP_HEADER)
+      vDataSections.push_back(i);
+  }
+
+  // Results are stored per section and merged in file order afterwards, so
+  // the loaded atlas does not depend on the thread scheduling
+  std::vector<std::vector<KeyFrame*>> vvpKFs(vIndex.size());
+  std::vector<std::vector<MapPoint*>> vvpMPs(vIndex.size());
+  std::vector<CovisibilityGraph> vCovisibility(vIndex.size());
+  std::atomic<bool> bError(false);
+
+  auto decode = [&](size_t idx) {
+    const SectionEntry& entry = vIndex[idx];
+    try {
+      MemoryStreamBuf buf(pData + entry.offset, entry.size);
+      std::istream is(&buf);
+      boost::archive::binary_iarchive ia(is);
+      switch (entry.type) {
+        case SECTION_KEYFRAMES:
+          ia >> vvpKFs[idx];
+          break;
+        case SECTION_MAPPOINTS:
+          ia >> vvpMPs[idx];
+          break;
+        case SECTION_COVISIBILITY:
+          ia >> vCovisibility[idx];
+          break;
+        case SECTION_BOW_DATABASE:
+          ia >> *pKFDB;
+          break;
+      }
+    } catch (const std::exception& e) {
+      std::cout << "[AtlasArchive] Error in section " << idx << ": "
+                << e.what() << std::endl;
+      bError = true;
+    }
+  };
+
+  std::vector<bool> vbTypeSeen(SECTION_BOW_DATABASE + 1, false);
+  std::vector<size_t> vParallelSections;
+  for (size_t idx : vDataSections) {
+    if (vIndex[idx].type > SECTION_BOW_DATABASE) continue;
+    if (vbTypeSeen[vIndex[idx].type]) {
+      vParallelSections.push_back(idx);
+    } else {
+      vbTypeSeen[vIndex[idx].type] = true;
+      decode(idx);
+    }
+  }
+  const int nParallelSections = vParallelSections.size();
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < nParallelSections; ++i) {
+    decode(vParallelSections[i]);
+  }
+
+  // The loaded maps are not in the atlas set yet, everything decoded so far
+  // is freed here
+  auto discard = [&]() {
+    for (std::vector<KeyFrame*>& vpKFs : vvpKFs)
+      for (KeyFrame* pKFi : vpKFs) delete pKFi;
+    for (std::vector<MapPoint*>& vpMPs : vvpMPs)
+      for (MapPoint* pMPi : vpMPs) delete pMPi;
+    for (Map* pMi : pAtlas->mvpBackupMaps) delete pMi;
+    for (GeometricCamera* pCam : pAtlas->mvpCameras) delete pCam;
+    delete pAtlas;
+  };
+
+  if (bError) {
+    discard();
+    return static_cast<Atlas*>(NULL);
+  }
+
+  for (size_t idx : vDataSections) {
+    std::map<long unsigned int, Map*>::iterator it =
+        mpMaps.find(vIndex[idx].mapId);
+    if (it == mpMaps.end()) continue;
+    Map* pMap = it->second;
+    if (vIndex[idx].type == SECTION_KEYFRAMES) {
+      pMap->mvpBackupKeyFrames.insert(pMap->mvpBackupKeyFrames.end(),
+                                      vvpKFs[idx].begin(), vvpKFs[idx].end());
+    } else if (vIndex[idx].type == SECTION_MAPPOINTS) {
+      pMap->mvpBackupMapPoints.insert(pMap->mvpBackupMapPoints.end(),
+                                      vvpMPs[idx].begin(), vvpMPs[idx].end());
+    }
+  }
+
+  for (size_t idx : vDataSections) {
+    if (vIndex[idx].type != SECTION_COVISIBILITY) continue;
+    std::map<long unsigned int, Map*>::iterator it =
+        mpMaps.find(vIndex[idx].mapId);
+    if (it == mpMaps.end()) continue;
+    CovisibilityGraph& graph = vCovisibility[idx];
+    for (KeyFrame* pKFi : it->second->mvpBackupKeyFrames) {
+      CovisibilityGraph::iterator itKF = graph.find(pKFi->mnId);
+      if (itKF != graph.end())
+        pKFi->mBackupConnectedKeyFrameIdWeights.swap(itKF->second);
+    }
+  }
+
+  // Keyframe descriptors point into the mapping, nothing is read here
+  std::map<long unsigned int, KeyFrame*> mpKFs;
+  for (Map* pMi : pAtlas->mvpBackupMaps)
+    for (KeyFrame* pKFi : pMi->mvpBackupKeyFrames) mpKFs[pKFi->mnId] = pKFi;
+  for (size_t idx : vDataSections) {
+    if (vIndex[idx].type != SECTION_KF_DESCRIPTORS) continue;
+    if (!MapDescriptors(pData + vIndex[idx].offset, vIndex[idx].size, mpKFs)) {
+      std::cout << "[AtlasArchive] Corrupted descriptors in section " << idx
+                << std::endl;
+      discard();
+      return static_cast<Atlas*>(NULL);
+    }
+  }
+  pAtlas->mpMappedArchive = pMapping;
+
+  return pAtlas;
+}
+
+}  // namespace ORB_SLAM3
@@ -0,0 +1,131 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "EpochReclaimer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+struct RetiredObject {
+  void* p;
+  void (*deleter)(void*);
+  uint64_t nEpoch;
+};
+
+// Last epoch a registered thread was seen quiescent in
+struct Participant {
+  uint64_t nEpoch;
+};
+
+// Retire and Quiescent are called per culled point and per frame, a single
+// lock is cheap enough
+std::mutex gMutex;
+uint64_t gnEpoch = 0;
+std::vector<Participant*> gvpParticipants;
+// Ordered by retirement epoch
+std::deque<RetiredObject> gdRetired;
+thread_local Participant* tlpParticipant = NULL;
+
+// The epoch moves on once every thread has been seen in it, so two advances
+// after a retirement prove every thread passed two quiescent states since
+const uint64_t kGraceEpochs = 3;
+
+void RegisterLocked() {
+  if (tlpParticipant) return;
+  tlpParticipant = new Participant();
+  tlpParticipant->nEpoch = gnEpoch;
+  gvpParticipants.push_back(tlpParticipant);
+}
+
+void TryAdvanceLocked() {
+  for (Participant* pParticipant : gvpParticipants)
+    if (pParticipant->nEpoch != gnEpoch) return;
+  gnEpoch++;
+}
+
+void CollectLocked(std::vector<RetiredObject>& vFree) {
+  while (!gdRetired.empty() &&
+         gdRetired.front().nEpoch + kGraceEpochs <= gnEpoch) {
+    vFree.push_back(gdRetired.front());
+    gdRetired.pop_front();
+  }
+}
+
+void Free(const std::vector<RetiredObject>& vFree) {
+  for (const RetiredObject& object : vFree) object.deleter(object.p);
+}
+
+}  // namespace
+
+std::atomic<bool> EpochReclaimer::sbEnabled(false);
+
+void EpochReclaimer::Register() {
+  std::unique_lock<std::mutex> lock(gMutex);
+  RegisterLocked();
+}
+
+void EpochReclaimer::Unregister() {
+  std::vector<RetiredObject> vFree;
+  {
+    std::unique_lock<std::mutex> lock(gMutex);
+    if (!tlpParticipant) return;
+    gvpParticipants.erase(std::find(gvpParticipants.begin(),
+                                    gvpParticipants.end(), tlpParticipant));
+    delete tlpParticipant;
+    tlpParticipant = NULL;
+    // The others may have been waiting for this thread only
+    TryAdvanceLocked();
+    CollectLocked(vFree);
+  }
+  Free(vFree);
+}
+
+void EpochReclaimer::Quiescent() {
+  if (!IsEnabled()) return;
+  std::vector<RetiredObject> vFree;
+  {
+    std::unique_lock<std::mutex> lock(gMutex);
+    RegisterLocked();
+    tlpParticipant->nEpoch = gnEpoch;
+    TryAdvanceLocked();
+    CollectLocked(vFree);
+  }
+  // Destructors run outside the lock
+  Free(vFree);
+}
+
+size_t EpochReclaimer::Pending() {
+  std::unique_lock<std::mutex> lock(gMutex);
+  return gdRetired.size();
+}
+
+void EpochReclaimer::Retire(void* p, void (*deleter)(void*)) {
+  std::unique_lock<std::mutex> lock(gMutex);
+  RetiredObject object;
+  object.p = p;
+  object.deleter = deleter;
+  object.nEpoch = gnEpoch;
+  gdRetired.push_back(object);
+}
+
+}  // namespace ORB_SLAM3
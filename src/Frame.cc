@@ -122,15 +122,16 @@ Frame::Frame(const Frame &frame)
       mbHasPose(false),
       mbHasVelocity(false) {
   mImGray = frame.mImGray;
-  imageDepth = frame.imageDepth.clone();
+  imageDepth = frame.imageDepth;
   source_points = frame.source_points;
   mpMutexKeyPoints = frame.mpMutexKeyPoints;
   mMutexFeatures = frame.mMutexFeatures;
   track_feature_pts_ = frame.track_feature_pts_;
   frameSize = frame.frameSize;
-  image = frame.image.clone();
+  image = frame.image;
   mpcp_icp = frame.mpcp_icp;
   mnMatchesInliers = frame.mnMatchesInliers;
+  mbDeferredORB = frame.mbDeferredORB;
   for (int i = 0; i < FRAME_GRID_COLS; i++)
     for (int j = 0; j < FRAME_GRID_ROWS; j++) {
       mGrid[i][j] = frame.mGrid[i][j];
@@ -284,10 +285,10 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
     mVw.setZero();
   }
 
-  mpMutexImu = new std::mutex();
-  mMutexPose = new std::mutex();
-  mpMutexKeyPoints = new std::mutex();
-  mMutexFeatures = new std::mutex();
+  mpMutexImu = std::make_shared<std::mutex>();
+  mMutexPose = std::make_shared<std::mutex>();
+  mpMutexKeyPoints = std::make_shared<std::mutex>();
+  mMutexFeatures = std::make_shared<std::mutex>();
   // Set no stereo fisheye information
   Nleft = -1;
   Nright = -1;
@@ -348,12 +349,13 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imRGB,
   source_points = std::make_shared<std::vector<Eigen::Vector4f>>();
   mpPointCloud.reset(new pcl::PointCloud<PointType>);
   mpPointCloudDownsampled.reset(new pcl::PointCloud<PointType>);
-  // ORB extraction
+  // ORB extraction, left to the tracker if optical flow may do without
+  mbDeferredORB = mpSettings->lazyORBExtraction();
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_StartExtORB =
       std::chrono::steady_clock::now();
 #endif
-  ExtractORB(0, imGray, 0, 0);
+  if (!mbDeferredORB) ExtractORB(0, imGray, 0, 0);
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_EndExtORB =
       std::chrono::steady_clock::now();
@@ -394,7 +396,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imRGB,
   }
   N = mvKeys.size();
 
-  if (mvKeys.empty()) return;
+  if (mvKeys.empty() && !mbDeferredORB) return;
 
   UndistortKeyPoints();
 
@@ -439,10 +441,10 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imRGB,
     mVw.setZero();
   }
 
-  mpMutexImu = new std::mutex();
-  mMutexPose = new std::mutex();
-  mpMutexKeyPoints = new std::mutex();
-  mMutexFeatures = new std::mutex();
+  mpMutexImu = std::make_shared<std::mutex>();
+  mMutexPose = std::make_shared<std::mutex>();
+  mpMutexKeyPoints = std::make_shared<std::mutex>();
+  mMutexFeatures = std::make_shared<std::mutex>();
   // Set no stereo fisheye information
   Nleft = -1;
   Nright = -1;
@@ -504,12 +506,13 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
   cv::Size winSize(mnWinsizeLK, mnWinsizeLK);
   cv::buildOpticalFlowPyramid(image, mImGray, winSize, nklt_mImGraylvl);
 
-  // ORB extraction
+  // ORB extraction, left to the tracker if optical flow may do without
+  mbDeferredORB = mpSettings->lazyORBExtraction();
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_StartExtORB =
       std::chrono::steady_clock::now();
 #endif
-  ExtractORB(0, imGray, 0, 1000);
+  if (!mbDeferredORB) ExtractORB(0, imGray, 0, 1000);
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_EndExtORB =
       std::chrono::steady_clock::now();
@@ -521,7 +524,7 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
 #endif
 
   N = mvKeys.size();
-  if (mvKeys.empty()) return;
+  if (mvKeys.empty() && !mbDeferredORB) return;
 
   UndistortKeyPoints();
 
@@ -581,8 +584,8 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
     mVw.setZero();
   }
 
-  mpMutexImu = new std::mutex();
-  mMutexPose = new std::mutex();
+  mpMutexImu = std::make_shared<std::mutex>();
+  mMutexPose = std::make_shared<std::mutex>();
   mvImus.clear();
   if (!mpSettings->useOpticalFlow()) AssignFeaturesToGrid();
 }
@@ -674,6 +677,7 @@ void Frame::AddPts(const vector<cv::KeyPoint> &pts,
 
 
 void Frame::AddFeatures(const bool mono) {
+  mbDeferredORB = false;
   int pt_num = mvKeys.size();
   if (pt_num < 1000) {
     int track_num = mvKeys.size();
@@ -718,6 +722,9 @@ void Frame::AddFeatures(const bool mono) {
 
     if (!mono) {
       ComputeStereoFromRGBD(imageDepth);
+    } else {
+      mvuRight = vector<float>(N, -1);
+      mvDepth = vector<float>(N, -1);
     }
     // Set stereo information
     Nleft = -1;
@@ -731,16 +738,30 @@ void Frame::AddFeatures(const bool mono) {
   }
 }
 
+void Frame::ExtractDeferredORB(const bool mono) {
+  if (!mbDeferredORB) return;
+  const bool bEmpty = mvKeys.empty();
+  AddFeatures(mono);
+  if (bEmpty) {
+    // Same state as a frame extracted in the constructor
+    mvbOutlier = vector<bool>(N, false);
+    mvProjectedKeys = vector<cv::KeyPoint>(N);
+  }
+}
+
 void Frame::AssignFeaturesToGrid() {
   // Fill matrix with points
   const int nCells = FRAME_GRID_COLS * FRAME_GRID_ROWS;
 
   int nReserve = 0.5f * N / (nCells);
 
+  // Called again after optical flow or extraction added keypoints
   for (unsigned int i = 0; i < FRAME_GRID_COLS; i++)
     for (unsigned int j = 0; j < FRAME_GRID_ROWS; j++) {
+      mGrid[i][j].clear();
       mGrid[i][j].reserve(nReserve);
       if (Nleft != -1) {
+        mGridRight[i][j].clear();
         mGridRight[i][j].reserve(nReserve);
       }
     }
@@ -1091,7 +1112,7 @@ void Frame::ComputeBoW() {
 }
 
 void Frame::UndistortKeyPoints() {
-  if (mDistCoef.at<float>(0) == 0.0) {
+  if (mDistCoef.at<float>(0) == 0.0 || mvKeys.empty()) {
     mvKeysUn = mvKeys;
     return;
   }
@@ -1150,6 +1171,21 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft) {
   }
 }
 
+// L1 distance between two (2w+1)x(2w+1) patches, each taken relative to its
+// center intensity. Plain integer loops, vectorized by the compiler.
+static int PatchSAD(const uchar *pL, const size_t stepL, const uchar *pR,
+                    const size_t stepR, const int w) {
+  const int centerL = pL[w * stepL + w];
+  const int centerR = pR[w * stepR + w];
+  const int offset = centerR - centerL;
+
+  int sad = 0;
+  for (int y = 0; y <= 2 * w; y++, pL += stepL, pR += stepR)
+    for (int x = 0; x <= 2 * w; x++) sad += abs(pL[x] - pR[x] + offset);
+
+  return sad;
+}
+
 void Frame::ComputeStereoMatches() {
   mvuRight = vector<float>(N, -1.0f);
   mvDepth = vector<float>(N, -1.0f);
@@ -1158,41 +1194,57 @@ void Frame::ComputeStereoMatches() {
 
   const int nRows = mpORBextractorLeft->mvImagePyramid[0].rows;
 
-  // Assign keypoints to row table
-  vector<vector<size_t>> vRowIndices(nRows, vector<size_t>());
-
-  for (int i = 0; i < nRows; i++) vRowIndices[i].reserve(200);
-
+  // Assign keypoints to row table, flattened: the right keypoints of row y
+  // are vRowKeys[vRowStart[y]] to vRowKeys[vRowStart[y + 1] - 1], by index
   const int Nr = mvKeysRight.size();
 
+  vector<int> vMinRow(Nr), vMaxRow(Nr);
+  vector<int> vRowStart(nRows + 1, 0);
+
   for (int iR = 0; iR < Nr; iR++) {
     const cv::KeyPoint &kp = mvKeysRight[iR];
     const float &kpY = kp.pt.y;
     const float r = 2.0f * mvScaleFactors[mvKeysRight[iR].octave];
-    const int maxr = ceil(kpY + r);
-    const int minr = floor(kpY - r);
+    vMaxRow[iR] = min(nRows - 1, (int)ceil(kpY + r));
+    vMinRow[iR] = max(0, (int)floor(kpY - r));
 
-    for (int yi = minr; yi <= maxr; yi++) vRowIndices[yi].push_back(iR);
+    for (int yi = vMinRow[iR]; yi <= vMaxRow[iR]; yi++) vRowStart[yi + 1]++;
   }
 
+  for (int yi = 0; yi < nRows; yi++) vRowStart[yi + 1] += vRowStart[yi];
+
+  vector<int> vRowKeys(vRowStart[nRows]);
+  vector<int> vRowFill(vRowStart.begin(), vRowStart.end() - 1);
+  for (int iR = 0; iR < Nr; iR++)
+    for (int yi = vMinRow[iR]; yi <= vMaxRow[iR]; yi++)
+      vRowKeys[vRowFill[yi]++] = iR;
+
   // Set limits for search
   const float minZ = mb;
   const float minD = 0;
   const float maxD = mbf / minZ;
 
-  // For each left keypoint search a match in the right image
-  vector<pair<int, int>> vDistIdx;
-  vDistIdx.reserve(N);
+  // SAD of the match of each left keypoint, -1 if unmatched
+  vector<int> vMatchDist(N, -1);
 
+  // For each left keypoint search a match in the right image. Every
+  // keypoint only writes its own entries.
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
   for (int iL = 0; iL < N; iL++) {
     const cv::KeyPoint &kpL = mvKeys[iL];
     const int &levelL = kpL.octave;
     const float &vL = kpL.pt.y;
     const float &uL = kpL.pt.x;
 
-    const vector<size_t> &vCandidates = vRowIndices[vL];
+    const int row = vL;
+    if (row < 0 || row >= nRows) continue;
 
-    if (vCandidates.empty()) continue;
+    const int *pCandidates = vRowKeys.data() + vRowStart[row];
+    const int nCandidates = vRowStart[row + 1] - vRowStart[row];
+
+    if (nCandidates == 0) continue;
 
     const float minU = uL - maxD;
     const float maxU = uL - minD;
@@ -1202,11 +1254,11 @@ void Frame::ComputeStereoMatches() {
     int bestDist = ORBmatcher::TH_HIGH;
     size_t bestIdxR = 0;
 
-    const cv::Mat &dL = mDescriptors.row(iL);
+    const uchar *dL = mDescriptors.ptr<uchar>(iL);
 
     // Compare descriptor to right keypoints
-    for (size_t iC = 0; iC < vCandidates.size(); iC++) {
-      const size_t iR = vCandidates[iC];
+    for (int iC = 0; iC < nCandidates; iC++) {
+      const size_t iR = pCandidates[iC];
       const cv::KeyPoint &kpR = mvKeysRight[iR];
 
       if (kpR.octave < levelL - 1 || kpR.octave > levelL + 1) continue;
@@ -1214,7 +1266,7 @@ void Frame::ComputeStereoMatches() {
       const float &uR = kpR.pt.x;
 
       if (uR >= minU && uR <= maxU) {
-        const cv::Mat &dR = mDescriptorsRight.row(iR);
+        const uchar *dR = mDescriptorsRight.ptr<uchar>(iR);
         const int dist = ORBmatcher::DescriptorDistance(dL, dR);
 
         if (dist < bestDist) {
@@ -1235,30 +1287,23 @@ void Frame::ComputeStereoMatches() {
 
       // sliding window search
       const int w = 5;
-      cv::Mat IL = mpORBextractorLeft->mvImagePyramid[kpL.octave]
-                       .rowRange(scaledvL - w, scaledvL + w + 1)
-                       .colRange(scaleduL - w, scaleduL + w + 1);
+      const cv::Mat &imL = mpORBextractorLeft->mvImagePyramid[kpL.octave];
+      const cv::Mat &imR = mpORBextractorRight->mvImagePyramid[kpL.octave];
 
       int bestDist = INT_MAX;
       int bestincR = 0;
       const int L = 5;
-      vector<float> vDists;
-      vDists.resize(2 * L + 1);
+      int vDists[2 * L + 1];
 
-      const float iniu = scaleduR0 + L - w;
+      const float iniu = scaleduR0 - L - w;
       const float endu = scaleduR0 + L + w + 1;
-      if (iniu < 0 ||
-          endu >= mpORBextractorRight->mvImagePyramid[kpL.octave].cols)
-        continue;
+      if (iniu < 0 || endu >= imR.cols) continue;
+
+      const uchar *pL = imL.ptr<uchar>((int)scaledvL - w) + (int)scaleduL - w;
+      const uchar *pR = imR.ptr<uchar>((int)scaledvL - w) + (int)scaleduR0 - w;
 
       for (int incR = -L; incR <= +L; incR++) {
-        cv::Mat IR =
-            mpORBextractorRight->mvImagePyramid[kpL.octave]
-                .rowRange(scaledvL - w, scaledvL + w + 1)
-                .colRange(scaleduR0 + incR - w, scaleduR0 + incR + w + 1);
-        IR.convertTo(IR, CV_16S);
-        IR = IR - IR.at<short>(w, w);
-        float dist = cv::norm(IL, IR, cv::NORM_L1);
+        const int dist = PatchSAD(pL, imL.step, pR + incR, imR.step, w);
         if (dist < bestDist) {
           bestDist = dist;
           bestincR = incR;
@@ -1292,11 +1337,19 @@ void Frame::ComputeStereoMatches() {
         }
         mvDepth[iL] = mbf / disparity;
         mvuRight[iL] = bestuR;
-        vDistIdx.push_back(pair<int, int>(bestDist, iL));
+        vMatchDist[iL] = bestDist;
       }
     }
   }
 
+  vector<pair<int, int>> vDistIdx;
+  vDistIdx.reserve(N);
+  for (int iL = 0; iL < N; iL++)
+    if (vMatchDist[iL] >= 0)
+      vDistIdx.push_back(pair<int, int>(vMatchDist[iL], iL));
+
+  if (vDistIdx.empty()) return;
+
   sort(vDistIdx.begin(), vDistIdx.end());
   const float median = vDistIdx[vDistIdx.size() / 2].first;
   const float thDist = 1.5f * 1.4f * median;
@@ -1494,8 +1547,8 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
 
   AssignFeaturesToGrid();
 
-  mpMutexImu = new std::mutex();
-  mMutexPose = new std::mutex();
+  mpMutexImu = std::make_shared<std::mutex>();
+  mMutexPose = std::make_shared<std::mutex>();
 
   UndistortKeyPoints();
 }
@@ -1522,34 +1575,38 @@ void Frame::ComputeStereoFishEyeMatches() {
 
   BFmatcher.knnMatch(stereoDescLeft, stereoDescRight, matches, 2);
 
-  int nMatches = 0;
-  int descMatches = 0;
-
-  // Check matches using Lowe's ratio
-  for (vector<vector<cv::DMatch>>::iterator it = matches.begin();
-       it != matches.end(); ++it) {
-    if ((*it).size() >= 2 && (*it)[0].distance < (*it)[1].distance * 0.7) {
-      // For every good match, check parallax and reprojection error to discard
-      // spurious matches
-      Eigen::Vector3f p3D;
-      descMatches++;
-      float
-          sigma1 = mvLevelSigma2[mvKeys[(*it)[0].queryIdx + monoLeft].octave],
-          sigma2 =
-              mvLevelSigma2[mvKeysRight[(*it)[0].trainIdx + monoRight].octave];
-      float depth = static_cast<KannalaBrandt8 *>(mpCamera)->TriangulateMatches(
-          mpCamera2, mvKeys[(*it)[0].queryIdx + monoLeft],
-          mvKeysRight[(*it)[0].trainIdx + monoRight], mRlr, mtlr, sigma1,
-          sigma2, p3D);
-      if (depth > 0.0001f) {
-        mvLeftToRightMatch[(*it)[0].queryIdx + monoLeft] =
-            (*it)[0].trainIdx + monoRight;
-        mvRightToLeftMatch[(*it)[0].trainIdx + monoRight] =
-            (*it)[0].queryIdx + monoLeft;
-        mvStereo3Dpoints[(*it)[0].queryIdx + monoLeft] = p3D;
-        mvDepth[(*it)[0].queryIdx + monoLeft] = depth;
-        nMatches++;
-      }
+  // Check matches using Lowe's ratio. For every good match, check parallax
+  // and reprojection error to discard spurious matches. Triangulated in
+  // parallel, then applied in order so a right keypoint matched twice keeps
+  // its last match.
+  const int nCandidates = matches.size();
+  vector<float> vDepths(nCandidates, -1.0f);
+  vector<Eigen::Vector3f> vp3D(nCandidates);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < nCandidates; i++) {
+    const vector<cv::DMatch> &vMatch = matches[i];
+    if (vMatch.size() < 2 || vMatch[0].distance >= vMatch[1].distance * 0.7)
+      continue;
+
+    const cv::KeyPoint &kpL = mvKeys[vMatch[0].queryIdx + monoLeft];
+    const cv::KeyPoint &kpR = mvKeysRight[vMatch[0].trainIdx + monoRight];
+    float sigma1 = mvLevelSigma2[kpL.octave],
+          sigma2 = mvLevelSigma2[kpR.octave];
+    vDepths[i] = static_cast<KannalaBrandt8 *>(mpCamera)->TriangulateMatches(
+        mpCamera2, kpL, kpR, mRlr, mtlr, sigma1, sigma2, vp3D[i]);
+  }
+
+  for (int i = 0; i < nCandidates; i++) {
+    if (vDepths[i] > 0.0001f) {
+      const int iL = matches[i][0].queryIdx + monoLeft;
+      const int iR = matches[i][0].trainIdx + monoRight;
+      mvLeftToRightMatch[iL] = iR;
+      mvRightToLeftMatch[iR] = iL;
+      mvStereo3Dpoints[iL] = vp3D[i];
+      mvDepth[iL] = vDepths[i];
     }
   }
 }
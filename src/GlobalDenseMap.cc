@@ -0,0 +1,195 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "GlobalDenseMap.h"
+
+#include <cmath>
+#include <fstream>
+
+#include "KeyFrame.h"
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+// Depth cut of the keyframe clouds, the farthest a point is from its camera
+const float kMaxDepth = 10.f;
+
+const size_t kChunkPoints = 1 << 16;
+
+// Layout of a PointXYZRGBA in a binary PCD
+struct PCDRecord {
+  float x, y, z;
+  uint32_t rgba;
+};
+
+}  // namespace
+
+GlobalDenseMap::GlobalDenseMap(const float resolution)
+    : mfResolution(resolution) {
+  mVoxelizer.SetLeafSize(resolution, resolution, resolution);
+}
+
+int GlobalDenseMap::Update(const std::vector<KeyFrame *> &vpKFs) {
+  std::unique_lock<std::mutex> lock(mMutex);
+  int nIntegrated = 0;
+  for (KeyFrame *pKF : vpKFs) {
+    auto it = mmIntegratedPoses.find(pKF);
+    const bool bIntegrated = it != mmIntegratedPoses.end();
+    if (pKF->isBad() && !bIntegrated) continue;
+
+    const Sophus::SE3f Twc = pKF->GetPoseInverse();
+    if (bIntegrated && !pKF->isBad() && !Moved(it->second, Twc)) continue;
+
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pCloud =
+        pKF->GetPointCloudDownsampled();
+    if (!pCloud) continue;
+
+    if (bIntegrated) {
+      Accumulate(*pCloud, it->second, -1);
+      mmIntegratedPoses.erase(it);
+    }
+    if (pKF->isBad()) continue;
+
+    Accumulate(*pCloud, Twc, 1);
+    mmIntegratedPoses[pKF] = Twc;
+    nIntegrated++;
+  }
+  return nIntegrated;
+}
+
+void GlobalDenseMap::Clear() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  mmVoxels.clear();
+  mmIntegratedPoses.clear();
+}
+
+size_t GlobalDenseMap::NumPoints() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  return mmVoxels.size();
+}
+
+bool GlobalDenseMap::Save(const std::string &filename) {
+  std::unique_lock<std::mutex> lock(mMutex);
+  std::ofstream f(filename, std::ios::binary);
+  if (!f.is_open()) return false;
+
+  const size_t N = mmVoxels.size();
+  f << "# .PCD v0.7 - Point Cloud Data file format\n"
+    << "VERSION 0.7\n"
+    << "FIELDS x y z rgba\n"
+    << "SIZE 4 4 4 4\n"
+    << "TYPE F F F U\n"
+    << "COUNT 1 1 1 1\n"
+    << "WIDTH " << N << "\n"
+    << "HEIGHT 1\n"
+    << "VIEWPOINT 0 0 0 1 0 0 0\n"
+    << "POINTS " << N << "\n"
+    << "DATA binary\n";
+
+  std::vector<PCDRecord> vChunk;
+  vChunk.reserve(kChunkPoints);
+  for (const auto &voxel : mmVoxels) {
+    const Voxel &v = voxel.second;
+    const double invN = 1.0 / v.n;
+    PCDRecord record;
+    record.x = v.sum[0] * invN;
+    record.y = v.sum[1] * invN;
+    record.z = v.sum[2] * invN;
+    const uint32_t r = std::lround(v.colorSum[0] * invN);
+    const uint32_t g = std::lround(v.colorSum[1] * invN);
+    const uint32_t b = std::lround(v.colorSum[2] * invN);
+    record.rgba = 0xff000000u | r << 16 | g << 8 | b;
+    vChunk.push_back(record);
+
+    if (vChunk.size() == kChunkPoints) {
+      f.write(reinterpret_cast<const char *>(vChunk.data()),
+              vChunk.size() * sizeof(PCDRecord));
+      vChunk.clear();
+    }
+  }
+  f.write(reinterpret_cast<const char *>(vChunk.data()),
+          vChunk.size() * sizeof(PCDRecord));
+
+  return f.good();
+}
+
+void GlobalDenseMap::Accumulate(
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloud, const Sophus::SE3f &Twc,
+    const int sign) {
+  const int N = cloud.size();
+  std::vector<Eigen::Vector3f> vPoints(N);
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < N; i++)
+    vPoints[i] = Twc * Eigen::Vector3f(cloud[i].x, cloud[i].y, cloud[i].z);
+
+  // Same points, same voxels and sums: a removal undoes its integration
+  mVoxelizer.Build(N, [&vPoints](const int i) -> const Eigen::Vector3f & {
+    return vPoints[i];
+  });
+
+  for (int v = 0, nVoxels = mVoxelizer.NumVoxels(); v < nVoxels; v++) {
+    Voxel delta = {{0.0, 0.0, 0.0}, {0, 0, 0}, 0};
+    const int *pEnd = mVoxelizer.VoxelEnd(v);
+    for (const int *pIdx = mVoxelizer.VoxelBegin(v); pIdx != pEnd; pIdx++) {
+      const Eigen::Vector3f &x3D = vPoints[*pIdx];
+      const pcl::PointXYZRGBA &p = cloud[*pIdx];
+      delta.sum[0] += x3D[0];
+      delta.sum[1] += x3D[1];
+      delta.sum[2] += x3D[2];
+      delta.colorSum[0] += p.r;
+      delta.colorSum[1] += p.g;
+      delta.colorSum[2] += p.b;
+      delta.n++;
+    }
+
+    const uint64_t key = mVoxelizer.VoxelKey(v);
+    if (sign > 0) {
+      Voxel &voxel =
+          mmVoxels.emplace(key, Voxel{{0.0, 0.0, 0.0}, {0, 0, 0}, 0})
+              .first->second;
+      for (int k = 0; k < 3; k++) {
+        voxel.sum[k] += delta.sum[k];
+        voxel.colorSum[k] += delta.colorSum[k];
+      }
+      voxel.n += delta.n;
+    } else {
+      auto it = mmVoxels.find(key);
+      if (it == mmVoxels.end()) continue;
+      Voxel &voxel = it->second;
+      if (voxel.n <= delta.n) {
+        mmVoxels.erase(it);
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        voxel.sum[k] -= delta.sum[k];
+        voxel.colorSum[k] -= delta.colorSum[k];
+      }
+      voxel.n -= delta.n;
+    }
+  }
+}
+
+bool GlobalDenseMap::Moved(const Sophus::SE3f &Twc0,
+                           const Sophus::SE3f &Twc1) const {
+  const Sophus::SE3f T01 = Twc0.inverse() * Twc1;
+  // Bound on the displacement of the farthest point of the cloud
+  const float displacement =
+      T01.translation().norm() + T01.so3().log().norm() * kMaxDepth;
+  return displacement > 0.5f * mfResolution;
+}
+
+}  // namespace ORB_SLAM3
@@ -0,0 +1,167 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ICPConstraintCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "KeyFrame.h"
+#include "Trace.h"
+
+namespace ORB_SLAM3 {
+
+// A cached constraint is reused if the initial guess of the caller is within
+// this distance of it, otherwise the pair is registered again from the guess
+static const double kMaxTranslationGap = 0.3;  // m
+static const double kMaxRotationGap = 0.17;    // rad, ~10 deg
+// Same inlier threshold the optimizations require to add the ICP edge
+static const size_t kMinInliers = 100;
+// Keys are ordered by target keyframe id, the oldest pairs are dropped first.
+// Consecutive pairs are requested once per keyframe, so this keeps the
+// constraints of the last few thousand keyframes.
+static const size_t kMaxConstraints = 5000;
+
+ICPConstraintCache::ICPConstraintCache(const int nThreads)
+    : mnHits(0), mnMisses(0), mnAsync(0) {
+  mpThreadPool = std::make_shared<hobot::CThreadPool>();
+  mpThreadPool->CreateThread(std::max(nThreads, 1));
+}
+
+ICPConstraintCache::~ICPConstraintCache() {
+  mpThreadPool->ClearTask();
+  mpThreadPool.reset();
+}
+
+ICPConstraint ICPConstraintCache::Get(
+    KeyFrame* pTargetKF, KeyFrame* pSourceKF,
+    const Eigen::Isometry3d& init_T_target_source) {
+  const Key key(pTargetKF->mnId, pSourceKF->mnId);
+  {
+    std::unique_lock<std::mutex> lock(mMutexCache);
+    while (msPending.count(key)) mcvPending.wait(lock);
+
+    std::map<Key, ICPConstraint>::iterator it = mmConstraints.find(key);
+    if (it != mmConstraints.end() &&
+        IsCompatible(it->second, init_T_target_source)) {
+      mnHits++;
+      return it->second;
+    }
+    mnMisses++;
+    msPending.insert(key);
+  }
+
+  ICPConstraint constraint =
+      Register(pTargetKF, pSourceKF, init_T_target_source);
+  Store(key, constraint);
+  return constraint;
+}
+
+void ICPConstraintCache::RequestAsync(
+    KeyFrame* pTargetKF, KeyFrame* pSourceKF,
+    const Eigen::Isometry3d& init_T_target_source) {
+  const Key key(pTargetKF->mnId, pSourceKF->mnId);
+  {
+    std::unique_lock<std::mutex> lock(mMutexCache);
+    if (msPending.count(key) || mmConstraints.count(key)) return;
+    msPending.insert(key);
+    mnAsync++;
+  }
+
+  mpThreadPool->PostTask([this, key, pTargetKF, pSourceKF,
+                          init_T_target_source]() {
+    Trace::SetThreadName("ICPCache");
+    ICPConstraint constraint =
+        Register(pTargetKF, pSourceKF, init_T_target_source);
+    Store(key, constraint);
+  });
+}
+
+void ICPConstraintCache::Invalidate(KeyFrame* pKF) {
+  const long unsigned int id = pKF->mnId;
+  std::unique_lock<std::mutex> lock(mMutexCache);
+  for (std::map<Key, ICPConstraint>::iterator it = mmConstraints.begin();
+       it != mmConstraints.end();) {
+    if (it->first.first == id || it->first.second == id)
+      it = mmConstraints.erase(it);
+    else
+      it++;
+  }
+  for (const Key& key : msPending) {
+    if (key.first == id || key.second == id) msCancelled.insert(key);
+  }
+}
+
+void ICPConstraintCache::PrintStats() {
+  std::unique_lock<std::mutex> lock(mMutexCache);
+  std::cout << "ICP constraint cache: " << mmConstraints.size()
+            << " constraints, " << mnHits << " hits, " << mnMisses
+            << " misses, " << mnAsync << " async" << std::endl;
+}
+
+ICPConstraint ICPConstraintCache::Register(
+    KeyFrame* pTargetKF, KeyFrame* pSourceKF,
+    const Eigen::Isometry3d& init_T_target_source) {
+  TRACE_SPAN("RegisterKeyFramePair", "icp");
+  // RegistrationGICP keeps no state, one instance serves every thread
+  static RegistrationGICP registration;
+
+  // A cloud that could not be reloaded from the payload store is null, the
+  // constraint is then left unconverged and the callers skip the edge
+  ICPConstraint constraint;
+  std::shared_ptr<std::vector<Eigen::Vector4f>> pTargetPoints =
+      pTargetKF->GetSourcePoints();
+  std::shared_ptr<std::vector<Eigen::Vector4f>> pSourcePoints =
+      pSourceKF->GetSourcePoints();
+  if (!pTargetPoints || !pSourcePoints || pTargetPoints->empty() ||
+      pSourcePoints->empty())
+    return constraint;
+
+  RegistrationResult result = registration.RegisterPointClouds(
+      *pTargetPoints, *pSourcePoints, init_T_target_source);
+  constraint.T_target_source = result.T_target_source;
+  constraint.num_inliers = result.num_inliers;
+  constraint.error = result.error;
+  constraint.converged = result.converged;
+  return constraint;
+}
+
+bool ICPConstraintCache::IsCompatible(
+    const ICPConstraint& constraint,
+    const Eigen::Isometry3d& init_T_target_source) {
+  const Eigen::Isometry3d delta =
+      constraint.T_target_source.inverse() * init_T_target_source;
+  const double angle = Eigen::AngleAxisd(delta.linear()).angle();
+  return delta.translation().norm() < kMaxTranslationGap &&
+         std::abs(angle) < kMaxRotationGap;
+}
+
+void ICPConstraintCache::Store(const Key& key,
+                               const ICPConstraint& constraint) {
+  {
+    std::unique_lock<std::mutex> lock(mMutexCache);
+    msPending.erase(key);
+    const bool bCancelled = msCancelled.erase(key) > 0;
+    if (!bCancelled && constraint.converged &&
+        constraint.num_inliers > kMinInliers) {
+      mmConstraints[key] = constraint;
+      while (mmConstraints.size() > kMaxConstraints)
+        mmConstraints.erase(mmConstraints.begin());
+    }
+  }
+  mcvPending.notify_all();
+}
+
+}  // namespace ORB_SLAM3
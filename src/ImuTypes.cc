@@ -32,12 +32,41 @@ namespace IMU {
 
 const float eps = 1e-4;
 
+// Samples integrated between two re-orthonormalizations of dR in a batch
+const int kRenormalizePeriod = 16;
+
 Eigen::Matrix3f NormalizeRotation(const Eigen::Matrix3f &R) {
   Eigen::JacobiSVD<Eigen::Matrix3f> svd(
       R, Eigen::ComputeFullU | Eigen::ComputeFullV);
   return svd.matrixU() * svd.matrixV().transpose();
 }
 
+// Cheap alternative to NormalizeRotation for matrices that only drift from
+// SO(3) by rounding errors
+static Eigen::Matrix3f RenormalizeRotation(const Eigen::Matrix3f &R) {
+  return Eigen::Quaternionf(R).normalized().toRotationMatrix();
+}
+
+// Exponential map and right jacobian of v, sharing the trigonometric terms
+static void ExpAndRightJacobianSO3(const Eigen::Vector3f &v,
+                                   Eigen::Matrix3f &expR,
+                                   Eigen::Matrix3f &rightJ) {
+  const float d2 = v.squaredNorm();
+  const Eigen::Matrix3f W = Sophus::SO3f::hat(v);
+  if (d2 < eps * eps) {
+    expR = Eigen::Matrix3f::Identity() + W;
+    rightJ.setIdentity();
+  } else {
+    const float d = sqrt(d2);
+    const float s = sin(d);
+    const float c = cos(d);
+    const Eigen::Matrix3f WW = W * W;
+    expR = Eigen::Matrix3f::Identity() + W * (s / d) + WW * ((1.0f - c) / d2);
+    rightJ = Eigen::Matrix3f::Identity() - W * ((1.0f - c) / d2) +
+             WW * ((d - s) / (d2 * d));
+  }
+}
+
 Eigen::Matrix3f RightJacobianSO3(const float &x, const float &y,
                                  const float &z) {
   Eigen::Matrix3f I;
@@ -175,71 +204,129 @@ void Preintegrated::Initialize(const Bias &b_) {
 
 void Preintegrated::Reintegrate() {
   std::unique_lock<std::mutex> lock(mMutex);
-  const std::vector<integrable> aux = mvMeasurements;
+  std::vector<integrable> aux;
+  aux.swap(mvMeasurements);
   Initialize(bu);
-  for (size_t i = 0; i < aux.size(); i++)
-    IntegrateNewMeasurement(aux[i].a, aux[i].w, aux[i].t);
+  IntegrateNewMeasurements(aux);
 }
 
 void Preintegrated::IntegrateNewMeasurement(const Eigen::Vector3f &acceleration,
                                             const Eigen::Vector3f &angVel,
                                             const float &dt) {
   mvMeasurements.push_back(integrable(acceleration, angVel, dt));
+  Propagate(acceleration, angVel, dt);
+  dR = RenormalizeRotation(dR);
+}
+
+void Preintegrated::IntegrateNewMeasurements(
+    const std::vector<integrable> &vMeasurements) {
+  mvMeasurements.reserve(mvMeasurements.size() + vMeasurements.size());
+  for (size_t i = 0; i < vMeasurements.size(); i++) {
+    const integrable &m = vMeasurements[i];
+    mvMeasurements.push_back(m);
+    Propagate(m.a, m.w, m.t);
+    if ((i + 1) % kRenormalizePeriod == 0) dR = RenormalizeRotation(dR);
+  }
+  if (vMeasurements.size() % kRenormalizePeriod != 0)
+    dR = RenormalizeRotation(dR);
+}
 
+void Preintegrated::Propagate(const Eigen::Vector3f &acceleration,
+                              const Eigen::Vector3f &angVel, const float dt) {
   // Position is updated firstly, as it depends on previously computed velocity
   // and rotation. Velocity is updated secondly, as it depends on previously
   // computed rotation. Rotation is the last to be updated.
 
-  // Matrices to compute covariance
-  Eigen::Matrix<float, 9, 9> A;
-  A.setIdentity();
-  Eigen::Matrix<float, 9, 6> B;
-  B.setZero();
-
   Eigen::Vector3f acc, accW;
   acc << acceleration(0) - b.bax, acceleration(1) - b.bay,
       acceleration(2) - b.baz;
   accW << angVel(0) - b.bwx, angVel(1) - b.bwy, angVel(2) - b.bwz;
 
-  avgA = (dT * avgA + dR * acc * dt) / (dT + dt);
+  const float dt2 = dt * dt;
+  const Eigen::Vector3f dRacc = dR * acc;
+
+  avgA = (dT * avgA + dRacc * dt) / (dT + dt);
   avgW = (dT * avgW + accW * dt) / (dT + dt);
 
   // Update delta position dP and velocity dV (rely on no-updated delta
   // rotation)
-  dP = dP + dV * dt + 0.5f * dR * acc * dt * dt;
-  dV = dV + dR * acc * dt;
-
-  // Compute velocity and position parts of matrices A and B (rely on
-  // non-updated delta rotation)
-  Eigen::Matrix<float, 3, 3> Wacc = Sophus::SO3f::hat(acc);
-
-  A.block<3, 3>(3, 0) = -dR * dt * Wacc;
-  A.block<3, 3>(6, 0) = -0.5f * dR * dt * dt * Wacc;
-  A.block<3, 3>(6, 3) = Eigen::DiagonalMatrix<float, 3>(dt, dt, dt);
-  B.block<3, 3>(3, 3) = dR * dt;
-  B.block<3, 3>(6, 3) = 0.5f * dR * dt * dt;
+  dP += dV * dt + 0.5f * dt2 * dRacc;
+  dV += dRacc * dt;
+
+  // Non-trivial blocks of the propagation matrices (rely on non-updated delta
+  // rotation), with M = dR * dt * [acc]x and h = dt / 2
+  //   A = [ dRi^T     0     0 ]        B = [ Jr*dt     0       ]
+  //       [ -M        I     0 ]            [ 0         dR*dt   ]
+  //       [ -h*M      dt*I  I ]            [ 0         h*dR*dt ]
+  const Eigen::Matrix3f dRdt = dR * dt;
+  const Eigen::Matrix3f M = dRdt * Sophus::SO3f::hat(acc);
+  const float h = 0.5f * dt;
+  // Accelerometer noise rotated into the preintegration frame
+  const Eigen::Matrix3f Sa =
+      dR * Nga.diagonal().tail<3>().asDiagonal() * dR.transpose();
 
   // Update position and velocity jacobians wrt bias correction
-  JPa = JPa + JVa * dt - 0.5f * dR * dt * dt;
-  JPg = JPg + JVg * dt - 0.5f * dR * dt * dt * Wacc * JRg;
-  JVa = JVa - dR * dt;
-  JVg = JVg - dR * dt * Wacc * JRg;
+  const Eigen::Matrix3f MJRg = M * JRg;
+  JPa += JVa * dt - h * dRdt;
+  JPg += JVg * dt - h * MJRg;
+  JVa -= dRdt;
+  JVg -= MJRg;
 
   // Update delta rotation
-  IntegratedRotation dRi(angVel, b, dt);
-  dR = NormalizeRotation(dR * dRi.deltaR);
-
-  // Compute rotation parts of matrices A and B
-  A.block<3, 3>(0, 0) = dRi.deltaR.transpose();
-  B.block<3, 3>(0, 0) = dRi.rightJ * dt;
-
-  // Update covariance
-  C.block<9, 9>(0, 0) =
-      A * C.block<9, 9>(0, 0) * A.transpose() + B * Nga * B.transpose();
+  Eigen::Matrix3f deltaR, rightJ;
+  ExpAndRightJacobianSO3(accW * dt, deltaR, rightJ);
+  dR = dR * deltaR;
+
+  // Update covariance C = A * C * A^T + B * Nga * B^T block by block, only
+  // the upper triangle is computed
+  const Eigen::Matrix3f CRR = C.block<3, 3>(0, 0);
+  const Eigen::Matrix3f CRV = C.block<3, 3>(0, 3);
+  const Eigen::Matrix3f CRP = C.block<3, 3>(0, 6);
+  const Eigen::Matrix3f CVV = C.block<3, 3>(3, 3);
+  const Eigen::Matrix3f CVP = C.block<3, 3>(3, 6);
+  const Eigen::Matrix3f CPP = C.block<3, 3>(6, 6);
+
+  // Block rows of A * C
+  const Eigen::Matrix3f MCRR = M * CRR;
+  const Eigen::Matrix3f MCRV = M * CRV;
+  const Eigen::Matrix3f MCRP = M * CRP;
+  const Eigen::Matrix3f XRR = deltaR.transpose() * CRR;
+  const Eigen::Matrix3f XRV = deltaR.transpose() * CRV;
+  const Eigen::Matrix3f XRP = deltaR.transpose() * CRP;
+  const Eigen::Matrix3f XVR = CRV.transpose() - MCRR;
+  const Eigen::Matrix3f XVV = CVV - MCRV;
+  const Eigen::Matrix3f XVP = CVP - MCRP;
+  const Eigen::Matrix3f XPR = CRP.transpose() + dt * CRV.transpose() - h * MCRR;
+  const Eigen::Matrix3f XPV = CVP.transpose() + dt * CVV - h * MCRV;
+  const Eigen::Matrix3f XPP = CPP + dt * CVP - h * MCRP;
+
+  const Eigen::Matrix3f XRRMt = XRR * M.transpose();
+  const Eigen::Matrix3f XVRMt = XVR * M.transpose();
+  const Eigen::Matrix3f XPRMt = XPR * M.transpose();
+  const Eigen::Matrix3f JrDt = rightJ * dt;
+
+  const Eigen::Matrix3f nRR =
+      XRR * deltaR +
+      JrDt * Nga.diagonal().head<3>().asDiagonal() * JrDt.transpose();
+  const Eigen::Matrix3f nRV = XRV - XRRMt;
+  const Eigen::Matrix3f nRP = XRP + dt * XRV - h * XRRMt;
+  const Eigen::Matrix3f nVV = XVV - XVRMt + dt2 * Sa;
+  const Eigen::Matrix3f nVP = XVP + dt * XVV - h * XVRMt + h * dt2 * Sa;
+  const Eigen::Matrix3f nPP = XPP + dt * XPV - h * XPRMt + h * h * dt2 * Sa;
+
+  C.block<3, 3>(0, 0) = nRR;
+  C.block<3, 3>(0, 3) = nRV;
+  C.block<3, 3>(0, 6) = nRP;
+  C.block<3, 3>(3, 3) = nVV;
+  C.block<3, 3>(3, 6) = nVP;
+  C.block<3, 3>(6, 6) = nPP;
+  C.block<3, 3>(3, 0) = nRV.transpose();
+  C.block<3, 3>(6, 0) = nRP.transpose();
+  C.block<3, 3>(6, 3) = nVP.transpose();
   C.block<6, 6>(9, 9) += NgaWalk;
 
   // Update rotation jacobian wrt bias correction
-  JRg = dRi.deltaR.transpose() * JRg - dRi.rightJ * dt;
+  JRg = deltaR.transpose() * JRg - rightJ * dt;
 
   // Total integrated time
   dT += dt;
@@ -259,13 +346,13 @@ void Preintegrated::MergePrevious(Preintegrated *pPrev) {
   bav.baz = bu.baz;
 
   const std::vector<integrable> aux1 = pPrev->mvMeasurements;
-  const std::vector<integrable> aux2 = mvMeasurements;
+  std::vector<integrable> aux2;
+  aux2.swap(mvMeasurements);
 
   Initialize(bav);
-  for (size_t i = 0; i < aux1.size(); i++)
-    IntegrateNewMeasurement(aux1[i].a, aux1[i].w, aux1[i].t);
-  for (size_t i = 0; i < aux2.size(); i++)
-    IntegrateNewMeasurement(aux2[i].a, aux2[i].w, aux2[i].t);
+  mvMeasurements.reserve(aux1.size() + aux2.size());
+  IntegrateNewMeasurements(aux1);
+  IntegrateNewMeasurements(aux2);
 }
 
 void Preintegrated::SetNewBias(const Bias &bu_) {
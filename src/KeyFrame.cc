@@ -21,15 +21,27 @@
 
 #include "KeyFrame.h"
 
+#include <algorithm>
 #include <mutex>
 
 #include "Converter.h"
+#include "EpochReclaimer.h"
 #include "ImuTypes.h"
+#include "KeyFramePayloadStore.h"
 
 namespace ORB_SLAM3 {
 
 long unsigned int KeyFrame::nNextId = 0;
 
+// The ordered connections are not filtered when sorted, the getters drop the
+// bad keyframes from their copy without holding the connections lock
+static vector<KeyFrame *> &EraseBadKeyFrames(vector<KeyFrame *> &vpKFs) {
+  vpKFs.erase(remove_if(vpKFs.begin(), vpKFs.end(),
+                        [](KeyFrame *pKF) { return pKF->isBad(); }),
+              vpKFs.end());
+  return vpKFs;
+}
+
 KeyFrame::KeyFrame()
     : mnFrameId(0),
       mTimeStamp(0),
@@ -78,6 +90,8 @@ KeyFrame::KeyFrame()
       mnMaxY(0),
       mPrevKF(static_cast<KeyFrame *>(NULL)),
       mNextKF(static_cast<KeyFrame *>(NULL)),
+      mnConnectionsVersion(0),
+      mnOrderedConnectionsVersion(0),
       mbFirstConnection(true),
       mpParent(NULL),
       mbNotErase(false),
@@ -89,7 +103,9 @@ KeyFrame::KeyFrame()
       NLeft(0),
       NRight(0),
       mnNumberOfOpt(0),
-      mbHasVelocity(false) {}
+      mbHasVelocity(false) {
+  mpPayloadStore = NULL;
+}
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
     : bImu(pMap->isImuInitialized()),
@@ -147,6 +163,8 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
       mvpMapPoints(F.mvpMapPoints),
       mpKeyFrameDB(pKFDB),
       mpORBvocabulary(F.mpORBvocabulary),
+      mnConnectionsVersion(0),
+      mnOrderedConnectionsVersion(0),
       mbFirstConnection(true),
       mpParent(NULL),
       mDistCoef(F.mDistCoef),
@@ -170,6 +188,7 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
       mTrl(F.GetRelativePoseTrl()),
       mnNumberOfOpt(0),
       mbHasVelocity(false) {
+  mpPayloadStore = NULL;
   mImGray = F.mImGray;
   image = F.image.clone();
   frameSize = F.frameSize;
@@ -299,40 +318,81 @@ bool KeyFrame::isVelocitySet() {
 }
 
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight) {
+  unique_lock<mutex> lock(mMutexConnections);
+  map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.find(pKF);
+  if (mit == mConnectedKeyFrameWeights.end())
+    mConnectedKeyFrameWeights[pKF] = weight;
+  else if (mit->second != weight)
+    mit->second = weight;
+  else
+    return;
+  // Sorted again by the next reader, a keyframe gets many connections in a
+  // row while local mapping fuses its points
+  mnConnectionsVersion++;
+}
+
+void KeyFrame::UpdateBestCovisibles() {
+  vector<pair<int, KeyFrame *>> vPairs;
+  unsigned long nVersion;
   {
     unique_lock<mutex> lock(mMutexConnections);
-    if (!mConnectedKeyFrameWeights.count(pKF))
-      mConnectedKeyFrameWeights[pKF] = weight;
-    else if (mConnectedKeyFrameWeights[pKF] != weight)
-      mConnectedKeyFrameWeights[pKF] = weight;
-    else
-      return;
+    vPairs.reserve(mConnectedKeyFrameWeights.size());
+    for (map<KeyFrame *, int>::iterator
+             mit = mConnectedKeyFrameWeights.begin(),
+             mend = mConnectedKeyFrameWeights.end();
+         mit != mend; mit++)
+      vPairs.push_back(make_pair(mit->second, mit->first));
+    nVersion = mnConnectionsVersion;
   }
 
-  UpdateBestCovisibles();
-}
+  // The other keyframes are checked without holding the connections
+  sort(vPairs.begin(), vPairs.end());
+  vector<KeyFrame *> vpKFs;
+  vector<int> vWs;
+  vpKFs.reserve(vPairs.size());
+  vWs.reserve(vPairs.size());
+  for (int i = vPairs.size() - 1; i >= 0; i--) {
+    if (!vPairs[i].second->isBad()) {
+      vpKFs.push_back(vPairs[i].second);
+      vWs.push_back(vPairs[i].first);
+    }
+  }
 
-void KeyFrame::UpdateBestCovisibles() {
   unique_lock<mutex> lock(mMutexConnections);
+  // Changed meanwhile, left to the lazy sort
+  if (nVersion != mnConnectionsVersion) return;
+  mvpOrderedConnectedKeyFrames.swap(vpKFs);
+  mvOrderedWeights.swap(vWs);
+  mnOrderedConnectionsVersion = nVersion;
+}
+
+void KeyFrame::SortConnections() {
+  if (mnOrderedConnectionsVersion == mnConnectionsVersion) return;
+
   vector<pair<int, KeyFrame *>> vPairs;
   vPairs.reserve(mConnectedKeyFrameWeights.size());
   for (map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(),
                                       mend = mConnectedKeyFrameWeights.end();
        mit != mend; mit++)
     vPairs.push_back(make_pair(mit->second, mit->first));
-
   sort(vPairs.begin(), vPairs.end());
-  list<KeyFrame *> lKFs;
-  list<int> lWs;
+
+  // Bad keyframes erase their connections before they are flagged, they are
+  // not checked here since their lock may be held by the caller
+  mvpOrderedConnectedKeyFrames.resize(vPairs.size());
+  mvOrderedWeights.resize(vPairs.size());
   for (size_t i = 0, iend = vPairs.size(); i < iend; i++) {
-    if (!vPairs[i].second->isBad()) {
-      lKFs.push_front(vPairs[i].second);
-      lWs.push_front(vPairs[i].first);
-    }
+    mvpOrderedConnectedKeyFrames[i] = vPairs[iend - 1 - i].second;
+    mvOrderedWeights[i] = vPairs[iend - 1 - i].first;
   }
+  mnOrderedConnectionsVersion = mnConnectionsVersion;
+}
 
-  mvpOrderedConnectedKeyFrames = vector<KeyFrame *>(lKFs.begin(), lKFs.end());
-  mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+void KeyFrame::ChangeCovisibility(KeyFrame *pKF, const int n) {
+  unique_lock<mutex> lock(mMutexCovisibility);
+  int &count = mCovisibilityCounts[pKF];
+  count += n;
+  if (count == 0) mCovisibilityCounts.erase(pKF);
 }
 
 set<KeyFrame *> KeyFrame::GetConnectedKeyFrames() {
@@ -345,37 +405,51 @@ set<KeyFrame *> KeyFrame::GetConnectedKeyFrames() {
 }
 
 vector<KeyFrame *> KeyFrame::GetVectorCovisibleKeyFrames() {
-  unique_lock<mutex> lock(mMutexConnections);
-  return mvpOrderedConnectedKeyFrames;
+  vector<KeyFrame *> vpKFs;
+  {
+    unique_lock<mutex> lock(mMutexConnections);
+    SortConnections();
+    vpKFs = mvpOrderedConnectedKeyFrames;
+  }
+  return EraseBadKeyFrames(vpKFs);
 }
 
 vector<KeyFrame *> KeyFrame::GetBestCovisibilityKeyFrames(const int &N) {
-  unique_lock<mutex> lock(mMutexConnections);
-  if ((int)mvpOrderedConnectedKeyFrames.size() < N)
-    return mvpOrderedConnectedKeyFrames;
-  else
-    return vector<KeyFrame *>(mvpOrderedConnectedKeyFrames.begin(),
-                              mvpOrderedConnectedKeyFrames.begin() + N);
+  vector<KeyFrame *> vpKFs;
+  {
+    unique_lock<mutex> lock(mMutexConnections);
+    SortConnections();
+    vpKFs = mvpOrderedConnectedKeyFrames;
+  }
+  // Filtered before truncating, so up to N good keyframes are returned
+  EraseBadKeyFrames(vpKFs);
+  if ((int)vpKFs.size() > N) vpKFs.resize(N);
+  return vpKFs;
 }
 
 vector<KeyFrame *> KeyFrame::GetCovisiblesByWeight(const int &w) {
-  unique_lock<mutex> lock(mMutexConnections);
+  vector<KeyFrame *> vpKFs;
+  {
+    unique_lock<mutex> lock(mMutexConnections);
+    SortConnections();
 
-  if (mvpOrderedConnectedKeyFrames.empty()) {
-    return vector<KeyFrame *>();
-  }
+    if (mvpOrderedConnectedKeyFrames.empty()) {
+      return vector<KeyFrame *>();
+    }
 
-  vector<int>::iterator it =
-      upper_bound(mvOrderedWeights.begin(), mvOrderedWeights.end(), w,
-                  KeyFrame::weightComp);
+    vector<int>::iterator it =
+        upper_bound(mvOrderedWeights.begin(), mvOrderedWeights.end(), w,
+                    KeyFrame::weightComp);
 
-  if (it == mvOrderedWeights.end() && mvOrderedWeights.back() < w) {
-    return vector<KeyFrame *>();
-  } else {
-    int n = it - mvOrderedWeights.begin();
-    return vector<KeyFrame *>(mvpOrderedConnectedKeyFrames.begin(),
-                              mvpOrderedConnectedKeyFrames.begin() + n);
+    if (it == mvOrderedWeights.end() && mvOrderedWeights.back() < w) {
+      return vector<KeyFrame *>();
+    } else {
+      int n = it - mvOrderedWeights.begin();
+      vpKFs.assign(mvpOrderedConnectedKeyFrames.begin(),
+                   mvpOrderedConnectedKeyFrames.begin() + n);
+    }
   }
+  return EraseBadKeyFrames(vpKFs);
 }
 
 int KeyFrame::GetWeight(KeyFrame *pKF) {
@@ -513,33 +587,20 @@ MapPoint *KeyFrame::GetMapPoint(const size_t &idx) {
 void KeyFrame::UpdateConnections(bool upParent) {
   map<KeyFrame *, int> KFcounter;
 
-  vector<MapPoint *> vpMP;
-
+  // The map points seen in other keyframes are counted as their observations
+  // change, only the keyframes that no longer count are dropped here
   {
-    unique_lock<mutex> lockMPs(mMutexFeatures);
-    vpMP = mvpMapPoints;
+    unique_lock<mutex> lock(mMutexCovisibility);
+    KFcounter = mCovisibilityCounts;
   }
-
-  // For all map points in keyframe check in which other keyframes are they seen
-  // Increase counter for those keyframes
-  for (vector<MapPoint *>::iterator vit = vpMP.begin(), vend = vpMP.end();
-       vit != vend; vit++) {
-    MapPoint *pMP = *vit;
-
-    if (!pMP) continue;
-
-    if (pMP->isBad()) continue;
-
-    map<KeyFrame *, tuple<int, int>> observations = pMP->GetObservations();
-
-    for (map<KeyFrame *, tuple<int, int>>::iterator mit = observations.begin(),
-                                                    mend = observations.end();
-         mit != mend; mit++) {
-      if (mit->first->mnId == mnId || mit->first->isBad() ||
-          mit->first->GetMap() != mpMap)
-        continue;
-      KFcounter[mit->first]++;
-    }
+  for (map<KeyFrame *, int>::iterator mit = KFcounter.begin(),
+                                      mend = KFcounter.end();
+       mit != mend;) {
+    if (mit->second <= 0 || mit->first->mnId == mnId ||
+        mit->first->isBad() || mit->first->GetMap() != mpMap)
+      mit = KFcounter.erase(mit);
+    else
+      mit++;
   }
 
   // This should not happen
@@ -587,12 +648,15 @@ void KeyFrame::UpdateConnections(bool upParent) {
     lWs.push_front(vPairs[i].first);
   }
 
+  map<KeyFrame *, int> mPrevConnections;
   {
     unique_lock<mutex> lockCon(mMutexConnections);
 
+    mPrevConnections.swap(mConnectedKeyFrameWeights);
     mConnectedKeyFrameWeights = KFcounter;
     mvpOrderedConnectedKeyFrames = vector<KeyFrame *>(lKFs.begin(), lKFs.end());
     mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+    mnOrderedConnectionsVersion = ++mnConnectionsVersion;
 
     if (mbFirstConnection && mnId != mpMap->GetInitKFid()) {
       mpParent = mvpOrderedConnectedKeyFrames.front();
@@ -600,6 +664,14 @@ void KeyFrame::UpdateConnections(bool upParent) {
       mbFirstConnection = false;
     }
   }
+
+  // Keep the graph symmetric, the keyframes dropped here forget this one
+  const set<KeyFrame *> spConnected(lKFs.begin(), lKFs.end());
+  for (map<KeyFrame *, int>::iterator mit = mPrevConnections.begin(),
+                                      mend = mPrevConnections.end();
+       mit != mend; mit++) {
+    if (!spConnected.count(mit->first)) mit->first->EraseConnection(this);
+  }
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF) {
@@ -701,9 +773,15 @@ void KeyFrame::SetBadFlag() {
     mit->first->EraseConnection(this);
   }
 
+  // Once this keyframe is no longer an observation, culling a point does not
+  // clear its slot here. Reclaimed points would be left dangling, so the
+  // slots are cleared first.
+  const bool bClearMatches = EpochReclaimer::IsEnabled();
   for (size_t i = 0; i < mvpMapPoints.size(); i++) {
-    if (mvpMapPoints[i]) {
-      mvpMapPoints[i]->EraseObservation(this);
+    MapPoint *pMP = mvpMapPoints[i];
+    if (pMP) {
+      if (bClearMatches) EraseMapPointMatch(i);
+      pMP->EraseObservation(this);
     }
   }
 
@@ -713,6 +791,8 @@ void KeyFrame::SetBadFlag() {
 
     mConnectedKeyFrameWeights.clear();
     mvpOrderedConnectedKeyFrames.clear();
+    mvOrderedWeights.clear();
+    mnOrderedConnectionsVersion = ++mnConnectionsVersion;
 
     // Update Spanning Tree
     set<KeyFrame *> sParentCandidates;
@@ -787,16 +867,8 @@ bool KeyFrame::isBad() {
 }
 
 void KeyFrame::EraseConnection(KeyFrame *pKF) {
-  bool bUpdate = false;
-  {
-    unique_lock<mutex> lock(mMutexConnections);
-    if (mConnectedKeyFrameWeights.count(pKF)) {
-      mConnectedKeyFrameWeights.erase(pKF);
-      bUpdate = true;
-    }
-  }
-
-  if (bUpdate) UpdateBestCovisibles();
+  unique_lock<mutex> lock(mMutexConnections);
+  if (mConnectedKeyFrameWeights.erase(pKF)) mnConnectionsVersion++;
 }
 
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y,
@@ -1226,4 +1298,34 @@ void KeyFrame::SetKeyFrameDatabase(KeyFrameDatabase *pKFDB) {
   mpKeyFrameDB = pKFDB;
 }
 
+cv::Mat KeyFrame::GetImage() {
+  KeyFramePayloadStore *pStore = mpPayloadStore;
+  if (pStore) return pStore->GetImage(this);
+  return image;
+}
+
+cv::Mat KeyFrame::GetImageRGB() {
+  KeyFramePayloadStore *pStore = mpPayloadStore;
+  if (pStore) return pStore->GetImageRGB(this);
+  return imRGB;
+}
+
+cv::Mat KeyFrame::GetImageDepth() {
+  KeyFramePayloadStore *pStore = mpPayloadStore;
+  if (pStore) return pStore->GetImageDepth(this);
+  return imDepth;
+}
+
+std::shared_ptr<std::vector<Eigen::Vector4f>> KeyFrame::GetSourcePoints() {
+  KeyFramePayloadStore *pStore = mpPayloadStore;
+  if (pStore) return pStore->GetSourcePoints(this);
+  return source_points;
+}
+
+pcl::PointCloud<PointType>::Ptr KeyFrame::GetPointCloudDownsampled() {
+  KeyFramePayloadStore *pStore = mpPayloadStore;
+  if (pStore) return pStore->GetPointCloudDownsampled(this);
+  return mpPointCloudDownsampled;
+}
+
 }  // namespace ORB_SLAM3
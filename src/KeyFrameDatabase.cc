@@ -21,6 +21,7 @@
 
 #include "KeyFrameDatabase.h"
 
+#include <algorithm>
 #include <mutex>
 
 #include "KeyFrame.h"
@@ -826,6 +827,37 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame* F,
   return vpRelocCandidates;
 }
 
+void KeyFrameDatabase::PreSave() {
+  unique_lock<mutex> lock(mMutex);
+
+  // Save the inverted file by keyframe id, bad keyframes are dropped
+  mvBackupInvertedFileId.clear();
+  mvBackupInvertedFileId.resize(mvInvertedFile.size());
+  for (size_t i = 0, iend = mvInvertedFile.size(); i < iend; ++i) {
+    for (KeyFrame* pKFi : mvInvertedFile[i]) {
+      if (!pKFi || pKFi->isBad()) continue;
+      mvBackupInvertedFileId[i].push_back(pKFi->mnId);
+    }
+  }
+}
+
+void KeyFrameDatabase::PostLoad(map<long unsigned int, KeyFrame*> mpKFid) {
+  unique_lock<mutex> lock(mMutex);
+
+  mvInvertedFile.clear();
+  mvInvertedFile.resize(mpVoc->size());
+  const size_t nWords =
+      std::min(mvBackupInvertedFileId.size(), mvInvertedFile.size());
+  for (size_t i = 0; i < nWords; ++i) {
+    for (long unsigned int nKFid : mvBackupInvertedFileId[i]) {
+      map<long unsigned int, KeyFrame*>::const_iterator it = mpKFid.find(nKFid);
+      // Keyframes of maps that were not saved are skipped
+      if (it != mpKFid.end()) mvInvertedFile[i].push_back(it->second);
+    }
+  }
+  mvBackupInvertedFileId.clear();
+}
+
 void KeyFrameDatabase::SetORBVocabulary(ORBVocabulary* pORBVoc) {
   ORBVocabulary** ptr;
   ptr = (ORBVocabulary**)(&mpVoc);
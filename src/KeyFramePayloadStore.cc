@@ -0,0 +1,483 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "KeyFramePayloadStore.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace ORB_SLAM3 {
+
+// Fast PNG level, cold keyframes are demoted from the mapping thread
+static const int kPngCompression = 1;
+
+KeyFramePayloadStore::KeyFramePayloadStore(const float fMemoryBudgetMB,
+                                           const int nLocalWindow,
+                                           const std::string& strCacheDir)
+    : mnMemoryBudget(
+          static_cast<size_t>(std::max(fMemoryBudgetMB, 0.f) * 1024 * 1024)),
+      mnLocalWindow(std::max(nLocalWindow, 0)),
+      mStrCacheDir(strCacheDir) {
+  mStats = Stats();
+  if (!mStrCacheDir.empty() && !boost::filesystem::exists(mStrCacheDir)) {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(mStrCacheDir, ec);
+    if (ec) {
+      std::cout << "Payload cache directory " << mStrCacheDir
+                << " can not be created, spilling disabled" << std::endl;
+      mStrCacheDir.clear();
+    }
+  }
+}
+
+KeyFramePayloadStore::~KeyFramePayloadStore() {
+  for (auto& entry : mmEntries) {
+    if (!entry.second->strFile.empty())
+      remove(entry.second->strFile.c_str());
+    delete entry.second;
+  }
+  mmEntries.clear();
+}
+
+void KeyFramePayloadStore::Update(KeyFrame* pCurrentKF) {
+  if (!pCurrentKF) return;
+  Register(pCurrentKF);
+
+  std::vector<std::pair<KeyFrame*, Entry*>> vCandidates;
+  {
+    std::set<KeyFrame*> spLocal;
+    CollectLocalWindow(pCurrentKF, spLocal);
+
+    std::unique_lock<std::mutex> lock(mMutexStore);
+    if (mStats.nRawBytes + mStats.nCompressedBytes <= mnMemoryBudget) return;
+    vCandidates.reserve(mlLRU.size());
+    for (KeyFrame* pKF : mlLRU) {
+      if (spLocal.count(pKF)) continue;
+      vCandidates.push_back(std::make_pair(pKF, mmEntries[pKF]));
+    }
+  }
+
+  // Compressing the images is cheap and usually enough, keyframes are only
+  // spilled to disk if the PNG buffers alone exceed the budget
+  const int nPasses = mStrCacheDir.empty() ? 1 : 2;
+  for (int pass = 0; pass < nPasses; pass++) {
+    for (auto& candidate : vCandidates) {
+      {
+        std::unique_lock<std::mutex> lock(mMutexStore);
+        if (mStats.nRawBytes + mStats.nCompressedBytes <= mnMemoryBudget)
+          return;
+      }
+
+      KeyFrame* pKF = candidate.first;
+      Entry* pEntry = candidate.second;
+      std::unique_lock<std::mutex> lockPayload(pKF->mMutexPayload);
+      if (pass == 0) {
+        if (pEntry->tier == TIER_HOT) Compress(pKF, pEntry);
+      } else {
+        if (pEntry->tier == TIER_COMPRESSED)
+          Spill(pKF, pEntry);
+        else if (pEntry->tier == TIER_SPILLED && pEntry->bCloudsResident)
+          DropClouds(pKF, pEntry);
+      }
+    }
+  }
+}
+
+cv::Mat KeyFramePayloadStore::GetImage(KeyFrame* pKF) {
+  return GetImageSlot(pKF, SLOT_IMAGE);
+}
+
+cv::Mat KeyFramePayloadStore::GetImageRGB(KeyFrame* pKF) {
+  return GetImageSlot(pKF, SLOT_RGB);
+}
+
+cv::Mat KeyFramePayloadStore::GetImageDepth(KeyFrame* pKF) {
+  return GetImageSlot(pKF, SLOT_DEPTH);
+}
+
+std::shared_ptr<std::vector<Eigen::Vector4f>>
+KeyFramePayloadStore::GetSourcePoints(KeyFrame* pKF) {
+  std::unique_lock<std::mutex> lock(pKF->mMutexPayload);
+  Entry* pEntry = Access(pKF, true);
+  if (pEntry && !pEntry->bCloudsResident) ReloadClouds(pKF, pEntry);
+  return pKF->source_points;
+}
+
+pcl::PointCloud<PointType>::Ptr KeyFramePayloadStore::GetPointCloudDownsampled(
+    KeyFrame* pKF) {
+  std::unique_lock<std::mutex> lock(pKF->mMutexPayload);
+  Entry* pEntry = Access(pKF, true);
+  if (pEntry && !pEntry->bCloudsResident) ReloadClouds(pKF, pEntry);
+  return pKF->mpPointCloudDownsampled;
+}
+
+KeyFramePayloadStore::Stats KeyFramePayloadStore::GetStats() {
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  return mStats;
+}
+
+void KeyFramePayloadStore::PrintStats() {
+  Stats stats = GetStats();
+  const double toMB = 1.0 / (1024.0 * 1024.0);
+  std::cout << "KeyFrame payload store:" << std::endl;
+  std::cout << "\t-KeyFrames: " << stats.nKeyFrames << std::endl;
+  std::cout << "\t-Hits / misses: " << stats.nHits << " / " << stats.nMisses
+            << std::endl;
+  std::cout << "\t-Compressed / spilled / reloaded: " << stats.nCompressed
+            << " / " << stats.nSpilled << " / " << stats.nReloaded
+            << std::endl;
+  std::cout << "\t-Raw / compressed / disk MB: " << stats.nRawBytes * toMB
+            << " / " << stats.nCompressedBytes * toMB << " / "
+            << stats.nDiskBytes * toMB << std::endl;
+}
+
+void KeyFramePayloadStore::Register(KeyFrame* pKF) {
+  std::unique_lock<std::mutex> lockPayload(pKF->mMutexPayload);
+  {
+    std::unique_lock<std::mutex> lock(mMutexStore);
+    std::map<KeyFrame*, Entry*>::iterator it = mmEntries.find(pKF);
+    if (it != mmEntries.end()) {
+      mlLRU.splice(mlLRU.end(), mlLRU, it->second->itLRU);
+      return;
+    }
+  }
+
+  Entry* pEntry = new Entry();
+  pEntry->nRawBytes = ImageBytes(pKF) + CloudBytes(pKF);
+  if (!mStrCacheDir.empty())
+    pEntry->strFile =
+        mStrCacheDir + "/kf_" + std::to_string(pKF->mnId) + ".payload";
+
+  {
+    std::unique_lock<std::mutex> lock(mMutexStore);
+    pEntry->itLRU = mlLRU.insert(mlLRU.end(), pKF);
+    mmEntries[pKF] = pEntry;
+    mStats.nKeyFrames++;
+    mStats.nRawBytes += pEntry->nRawBytes;
+  }
+  pKF->mpPayloadStore = this;
+}
+
+void KeyFramePayloadStore::CollectLocalWindow(KeyFrame* pCurrentKF,
+                                              std::set<KeyFrame*>& spLocal) {
+  spLocal.insert(pCurrentKF);
+  std::vector<KeyFrame*> vpCovisible =
+      pCurrentKF->GetBestCovisibilityKeyFrames(mnLocalWindow);
+  spLocal.insert(vpCovisible.begin(), vpCovisible.end());
+
+  // Inertial and ICP edges chain consecutive keyframes
+  KeyFrame* pKF = pCurrentKF->mPrevKF;
+  for (int i = 0; i < mnLocalWindow && pKF; i++) {
+    spLocal.insert(pKF);
+    pKF = pKF->mPrevKF;
+  }
+}
+
+cv::Mat KeyFramePayloadStore::GetImageSlot(KeyFrame* pKF, const int slot) {
+  std::unique_lock<std::mutex> lock(pKF->mMutexPayload);
+  Entry* pEntry = Access(pKF, false);
+  if (!pEntry || pEntry->tier == TIER_HOT) return *ImageMember(pKF, slot);
+
+  // Images are decoded for the caller only, the keyframe stays demoted
+  if (pEntry->tier == TIER_COMPRESSED) return Unpack(pEntry->images[slot]);
+
+  PackedImage vImages[NUM_SLOTS];
+  if (!ReadFile(pEntry->strFile, vImages, NULL)) {
+    std::cout << "Payload of KF " << pKF->mnId << " can not be read from "
+              << pEntry->strFile << std::endl;
+    return cv::Mat();
+  }
+  return Unpack(vImages[slot]);
+}
+
+KeyFramePayloadStore::Entry* KeyFramePayloadStore::Access(KeyFrame* pKF,
+                                                          const bool bClouds) {
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  std::map<KeyFrame*, Entry*>::iterator it = mmEntries.find(pKF);
+  if (it == mmEntries.end()) return NULL;
+
+  const Entry* pEntry = it->second;
+  const bool bResident =
+      bClouds ? pEntry->bCloudsResident : pEntry->tier == TIER_HOT;
+  if (bResident)
+    mStats.nHits++;
+  else
+    mStats.nMisses++;
+  mlLRU.splice(mlLRU.end(), mlLRU, it->second->itLRU);
+  return it->second;
+}
+
+void KeyFramePayloadStore::Compress(KeyFrame* pKF, Entry* pEntry) {
+  const size_t nImageBytes = ImageBytes(pKF);
+  size_t nCompressedBytes = 0;
+  for (int slot = 0; slot < NUM_SLOTS; slot++) {
+    cv::Mat* pIm = ImageMember(pKF, slot);
+    Pack(*pIm, pEntry->images[slot]);
+    nCompressedBytes += pEntry->images[slot].buffer.size();
+    *pIm = cv::Mat();
+  }
+  // The optical flow pyramid is only used while the frame is tracked
+  pKF->mImGray.clear();
+
+  pEntry->tier = TIER_COMPRESSED;
+  pEntry->nRawBytes -= nImageBytes;
+  pEntry->nCompressedBytes = nCompressedBytes;
+
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  mStats.nCompressed++;
+  mStats.nRawBytes -= nImageBytes;
+  mStats.nCompressedBytes += nCompressedBytes;
+}
+
+bool KeyFramePayloadStore::Spill(KeyFrame* pKF, Entry* pEntry) {
+  size_t nDiskBytes = 0;
+  if (!WriteFile(pEntry->strFile, pEntry, pKF, nDiskBytes)) {
+    std::cout << "Payload of KF " << pKF->mnId << " can not be written to "
+              << pEntry->strFile << std::endl;
+    remove(pEntry->strFile.c_str());
+    return false;
+  }
+
+  const size_t nCompressedBytes = pEntry->nCompressedBytes;
+  for (int slot = 0; slot < NUM_SLOTS; slot++)
+    std::vector<uchar>().swap(pEntry->images[slot].buffer);
+  pEntry->tier = TIER_SPILLED;
+  pEntry->nCompressedBytes = 0;
+  pEntry->nDiskBytes = nDiskBytes;
+
+  {
+    std::unique_lock<std::mutex> lock(mMutexStore);
+    mStats.nSpilled++;
+    mStats.nCompressedBytes -= nCompressedBytes;
+    mStats.nDiskBytes += nDiskBytes;
+  }
+
+  DropClouds(pKF, pEntry);
+  return true;
+}
+
+void KeyFramePayloadStore::DropClouds(KeyFrame* pKF, Entry* pEntry) {
+  // The disk copy is written once, clouds of a keyframe never change
+  const size_t nCloudBytes = CloudBytes(pKF);
+  pKF->source_points.reset();
+  pKF->mpPointCloudDownsampled.reset();
+  pEntry->bCloudsResident = false;
+  pEntry->nRawBytes -= nCloudBytes;
+
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  mStats.nRawBytes -= nCloudBytes;
+}
+
+bool KeyFramePayloadStore::ReloadClouds(KeyFrame* pKF, Entry* pEntry) {
+  if (!ReadFile(pEntry->strFile, NULL, pKF)) {
+    std::cout << "Payload of KF " << pKF->mnId << " can not be read from "
+              << pEntry->strFile << std::endl;
+    return false;
+  }
+
+  const size_t nCloudBytes = CloudBytes(pKF);
+  pEntry->bCloudsResident = true;
+  pEntry->nRawBytes += nCloudBytes;
+
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  mStats.nReloaded++;
+  mStats.nRawBytes += nCloudBytes;
+  return true;
+}
+
+cv::Mat* KeyFramePayloadStore::ImageMember(KeyFrame* pKF, const int slot) {
+  if (slot == SLOT_RGB) return &pKF->imRGB;
+  if (slot == SLOT_DEPTH) return &pKF->imDepth;
+  return &pKF->image;
+}
+
+size_t KeyFramePayloadStore::ImageBytes(KeyFrame* pKF) {
+  size_t nBytes = 0;
+  for (int slot = 0; slot < NUM_SLOTS; slot++) {
+    cv::Mat* pIm = ImageMember(pKF, slot);
+    nBytes += pIm->total() * pIm->elemSize();
+  }
+  for (const cv::Mat& level : pKF->mImGray)
+    nBytes += level.total() * level.elemSize();
+  return nBytes;
+}
+
+size_t KeyFramePayloadStore::CloudBytes(KeyFrame* pKF) {
+  size_t nBytes = 0;
+  if (pKF->source_points)
+    nBytes += pKF->source_points->size() * sizeof(Eigen::Vector4f);
+  if (pKF->mpPointCloudDownsampled)
+    nBytes += pKF->mpPointCloudDownsampled->size() * sizeof(PointType);
+  return nBytes;
+}
+
+void KeyFramePayloadStore::Pack(const cv::Mat& im, PackedImage& packed) {
+  packed = PackedImage();
+  if (im.empty()) return;
+
+  packed.rows = im.rows;
+  packed.cols = im.cols;
+  packed.type = im.type();
+
+  const std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION,
+                                   kPngCompression};
+  const int depth = im.depth();
+  const int channels = im.channels();
+  if ((depth == CV_8U || depth == CV_16U) &&
+      (channels == 1 || channels == 3 || channels == 4)) {
+    if (cv::imencode(".png", im, packed.buffer, params)) {
+      packed.encoding = PackedImage::PNG;
+      return;
+    }
+  } else if (im.type() == CV_32FC1) {
+    // Float depth is losslessly stored reinterpreting each value as RGBA
+    cv::Mat continuous = im.isContinuous() ? im : im.clone();
+    cv::Mat rgba(continuous.rows, continuous.cols, CV_8UC4, continuous.data);
+    if (cv::imencode(".png", rgba, packed.buffer, params)) {
+      packed.encoding = PackedImage::PNG_FLOAT;
+      return;
+    }
+  }
+
+  cv::Mat continuous = im.isContinuous() ? im : im.clone();
+  const uchar* pData = continuous.ptr<uchar>();
+  packed.buffer.assign(pData,
+                       pData + continuous.total() * continuous.elemSize());
+  packed.encoding = PackedImage::RAW;
+}
+
+cv::Mat KeyFramePayloadStore::Unpack(const PackedImage& packed) {
+  switch (packed.encoding) {
+    case PackedImage::PNG:
+      return cv::imdecode(packed.buffer, cv::IMREAD_UNCHANGED);
+    case PackedImage::PNG_FLOAT: {
+      cv::Mat rgba = cv::imdecode(packed.buffer, cv::IMREAD_UNCHANGED);
+      if (rgba.rows != packed.rows || rgba.cols != packed.cols ||
+          rgba.type() != CV_8UC4)
+        return cv::Mat();
+      return cv::Mat(packed.rows, packed.cols, CV_32FC1, rgba.data).clone();
+    }
+    case PackedImage::RAW:
+      return cv::Mat(packed.rows, packed.cols, packed.type,
+                     const_cast<uchar*>(packed.buffer.data()))
+          .clone();
+    default:
+      return cv::Mat();
+  }
+}
+
+bool KeyFramePayloadStore::WriteFile(const std::string& strFile,
+                                     const Entry* pEntry, KeyFrame* pKF,
+                                     size_t& nBytes) {
+  std::ofstream f(strFile.c_str(), std::ios::binary | std::ios::trunc);
+  if (!f.is_open()) return false;
+
+  for (int slot = 0; slot < NUM_SLOTS; slot++) {
+    const PackedImage& packed = pEntry->images[slot];
+    const int32_t header[4] = {packed.encoding, packed.rows, packed.cols,
+                               packed.type};
+    const uint64_t size = packed.buffer.size();
+    f.write(reinterpret_cast<const char*>(header), sizeof(header));
+    f.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    f.write(reinterpret_cast<const char*>(packed.buffer.data()), size);
+  }
+
+  // -1 encodes a null cloud
+  const int64_t nSource =
+      pKF->source_points ? (int64_t)pKF->source_points->size() : -1;
+  f.write(reinterpret_cast<const char*>(&nSource), sizeof(nSource));
+  if (nSource > 0)
+    f.write(reinterpret_cast<const char*>(pKF->source_points->data()),
+            nSource * sizeof(Eigen::Vector4f));
+
+  const int64_t nCloud = pKF->mpPointCloudDownsampled
+                             ? (int64_t)pKF->mpPointCloudDownsampled->size()
+                             : -1;
+  f.write(reinterpret_cast<const char*>(&nCloud), sizeof(nCloud));
+  if (nCloud >= 0) {
+    const pcl::PointCloud<PointType>& cloud = *pKF->mpPointCloudDownsampled;
+    const uint32_t layout[3] = {cloud.width, cloud.height,
+                                (uint32_t)cloud.is_dense};
+    f.write(reinterpret_cast<const char*>(layout), sizeof(layout));
+    if (nCloud > 0)
+      f.write(reinterpret_cast<const char*>(cloud.points.data()),
+              nCloud * sizeof(PointType));
+  }
+
+  nBytes = f.tellp();
+  return f.good();
+}
+
+bool KeyFramePayloadStore::ReadFile(const std::string& strFile,
+                                    PackedImage* pImages, KeyFrame* pKF) {
+  std::ifstream f(strFile.c_str(), std::ios::binary);
+  if (!f.is_open()) return false;
+
+  for (int slot = 0; slot < NUM_SLOTS; slot++) {
+    int32_t header[4];
+    uint64_t size;
+    f.read(reinterpret_cast<char*>(header), sizeof(header));
+    f.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!f.good()) return false;
+    if (!pImages) {
+      f.seekg(size, std::ios::cur);
+      continue;
+    }
+    PackedImage& packed = pImages[slot];
+    packed.encoding = header[0];
+    packed.rows = header[1];
+    packed.cols = header[2];
+    packed.type = header[3];
+    packed.buffer.resize(size);
+    f.read(reinterpret_cast<char*>(packed.buffer.data()), size);
+  }
+  if (!pKF) return f.good();
+
+  int64_t nSource;
+  f.read(reinterpret_cast<char*>(&nSource), sizeof(nSource));
+  std::shared_ptr<std::vector<Eigen::Vector4f>> pSource;
+  if (nSource >= 0) {
+    pSource = std::make_shared<std::vector<Eigen::Vector4f>>(nSource);
+    f.read(reinterpret_cast<char*>(pSource->data()),
+           nSource * sizeof(Eigen::Vector4f));
+  }
+
+  int64_t nCloud;
+  f.read(reinterpret_cast<char*>(&nCloud), sizeof(nCloud));
+  pcl::PointCloud<PointType>::Ptr pCloud;
+  if (nCloud >= 0) {
+    uint32_t layout[3];
+    f.read(reinterpret_cast<char*>(layout), sizeof(layout));
+    pCloud.reset(new pcl::PointCloud<PointType>());
+    pCloud->points.resize(nCloud);
+    f.read(reinterpret_cast<char*>(pCloud->points.data()),
+           nCloud * sizeof(PointType));
+    pCloud->width = layout[0];
+    pCloud->height = layout[1];
+    pCloud->is_dense = layout[2] != 0;
+  }
+  if (!f.good()) return false;
+
+  pKF->source_points = pSource;
+  pKF->mpPointCloudDownsampled = pCloud;
+  return true;
+}
+
+}  // namespace ORB_SLAM3
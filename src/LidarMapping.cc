@@ -25,10 +25,12 @@
 #include <pcl/visualization/cloud_viewer.h>
 #include <sys/time.h>
 
+#include <chrono>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "Converter.h"
 #include "System.h"
+#include "Trace.h"
 namespace ORB_SLAM3 {
 // int currentloopcount = 0;
 LidarMapping::LidarMapping(double global_resolution_, double local_resolution_,
@@ -40,15 +42,12 @@ LidarMapping::LidarMapping(double global_resolution_, double local_resolution_,
   this->thresh = thresh_;
   this->save_path = save_path_;
   statistical_filter = new pcl::StatisticalOutlierRemoval<PointType>(true);
-  voxel_global = new pcl::VoxelGrid<PointType>();
-  voxel_local = new pcl::VoxelGrid<PointType>();
+  mpGlobalDenseMap = new GlobalDenseMap(global_resolution);
+  voxel_local = new VoxelFilter<PointType>();
   statistical_filter->setMeanK(meank);
   statistical_filter->setStddevMulThresh(thresh);
-  voxel_global->setLeafSize(global_resolution, global_resolution,
-                            global_resolution);
   voxel_local->setLeafSize(local_resolution, local_resolution,
                            local_resolution);
-  globalMap = pcl::PointCloud<PointType>::Ptr(new pcl::PointCloud<PointType>);
   localMap = pcl::PointCloud<PointType>::Ptr(new pcl::PointCloud<PointType>);
 
   viewerThread = make_shared<thread>(bind(&LidarMapping::viewer, this));
@@ -63,38 +62,39 @@ void LidarMapping::shutdown() {
   viewerThread->join();
 }
 
-void LidarMapping::Clear() {
-  std::unique_lock<std::mutex> lck(mMutexGlobalMap);
-  globalMap.reset(new pcl::PointCloud<PointType>);
-}
+void LidarMapping::Clear() { mpGlobalDenseMap->Clear(); }
 
 
 void LidarMapping::insertKeyFrame(KeyFrame *kf) {
   // cout << "receive a keyframe, 第" << kf->mnId << "个" << endl;
-  if (kf->imRGB.empty()) return;
+  if (kf->GetImageRGB().empty()) return;
   unique_lock<mutex> lck(keyframeMutex);
   mlNewKeyFrames.emplace_back(kf);
   mlAllKeyFrames.emplace_back(kf);
   insert_kf = true;
   if (mlNewKeyFrames.size() > 30) mlNewKeyFrames.pop_front();
+  keyFrameUpdated.notify_one();
 }
 
 void LidarMapping::generatePointCloud(KeyFrame *kf)  //,Eigen::Isometry3d T
 {
+  TRACE_SPAN("GeneratePointCloud", "dense_mapping");
   pcl::PointCloud<PointType>::Ptr pPointCloud(new pcl::PointCloud<PointType>);
+  cv::Mat imDepth = kf->GetImageDepth();
+  cv::Mat imRGB = kf->GetImageRGB();
   // point cloud is null ptr
-  for (int m = 0; m < kf->imDepth.rows; m += 3) {
-    for (int n = 0; n < kf->imDepth.cols; n += 3) {
-      float d = kf->imDepth.ptr<float>(m)[n];
+  for (int m = 0; m < imDepth.rows; m += 3) {
+    for (int n = 0; n < imDepth.cols; n += 3) {
+      float d = imDepth.ptr<float>(m)[n];
       if (d < 0.05 || d > 10) continue;
       PointType p;
       p.z = d;
       p.x = (n - kf->cx) * p.z / kf->fx;
       p.y = (m - kf->cy) * p.z / kf->fy;
 
-      p.b = kf->imRGB.ptr<uchar>(m)[n * 3];
-      p.g = kf->imRGB.ptr<uchar>(m)[n * 3 + 1];
-      p.r = kf->imRGB.ptr<uchar>(m)[n * 3 + 2];
+      p.b = imRGB.ptr<uchar>(m)[n * 3];
+      p.g = imRGB.ptr<uchar>(m)[n * 3 + 1];
+      p.r = imRGB.ptr<uchar>(m)[n * 3 + 2];
 
       pPointCloud->points.push_back(p);
     }
@@ -128,6 +128,7 @@ void LidarMapping::transformPointCloud(pcl::PointCloud<PointType>::Ptr cloudIn,
 
 void LidarMapping::SetTracker(Tracking *pTracker) { mpTracker = pTracker; }
 void LidarMapping::viewer() {
+  Trace::SetThreadName("DenseMapping");
   int nCurKeyFrames, nPreKeyFrames = 0;
   while (1) {
     {
@@ -142,14 +143,21 @@ void LidarMapping::viewer() {
     }
     int N;
     std::list<KeyFrame *> lNewKeyFrames;
+    vector<KeyFrame *> vpAllKeyFrames;
     vector<KeyFrame *> lNewLocalKeyFrames = mpTracker->GetLocalKeyFrames();
     {
       unique_lock<mutex> lck(keyframeMutex);
+      // Bounded so the shutdown flag is still polled
+      keyFrameUpdated.wait_for(lck, std::chrono::milliseconds(100), [this]() {
+        return insert_kf || mbMapChanged;
+      });
       N = mlNewKeyFrames.size();
       // 没有新的关键帧
-      if (!insert_kf) continue;
+      if (!insert_kf && !mbMapChanged) continue;
       insert_kf = false;
+      mbMapChanged = false;
       lNewKeyFrames = mlNewKeyFrames;
+      vpAllKeyFrames.assign(mlAllKeyFrames.begin(), mlAllKeyFrames.end());
       // if (N == 0)
       //   continue;
       // else {
@@ -157,29 +165,34 @@ void LidarMapping::viewer() {
       // }
     }
 
-    double generatePointCloudTime = 0, transformPointCloudTime = 0;
-    std::unique_lock<std::mutex> lck(mMutexLocalMap);
-    localMap->clear();
-    for (auto pKF : lNewKeyFrames) {
-      if (pKF->isBad()) continue;
-      if (pKF->mpPointCloudDownsampled == nullptr) continue;
-      pcl::PointCloud<PointType>::Ptr p(new pcl::PointCloud<PointType>);
-      transformPointCloud((pKF->mpPointCloudDownsampled), (p),
-                          Converter::toMatrix4d(pKF->GetPoseInverse()));
-
-      {
-        std::unique_lock<std::mutex> lck(mMutexGlobalMap);
-        // *globalMap += *p;
+    {
+      TRACE_SPAN("UpdateLocalMap", "dense_mapping");
+      double generatePointCloudTime = 0, transformPointCloudTime = 0;
+      std::unique_lock<std::mutex> lck(mMutexLocalMap);
+      localMap->clear();
+      for (auto pKF : lNewKeyFrames) {
+        if (pKF->isBad()) continue;
+        pcl::PointCloud<PointType>::Ptr pCloud =
+            pKF->GetPointCloudDownsampled();
+        if (pCloud == nullptr) continue;
+        pcl::PointCloud<PointType>::Ptr p(new pcl::PointCloud<PointType>);
+        transformPointCloud((pCloud), (p),
+                            Converter::toMatrix4d(pKF->GetPoseInverse()));
+
         *localMap += *p;
+        // gettimeofday(&finish,NULL);//初始化结束时间
+        // transformPointCloudTime += finish.tv_sec - start.tv_sec +
+        // (finish.tv_usec - start.tv_usec)/1000000.0;
       }
-      // gettimeofday(&finish,NULL);//初始化结束时间
-      // transformPointCloudTime += finish.tv_sec - start.tv_sec +
-      // (finish.tv_usec - start.tv_usec)/1000000.0;
-    }
 
+      voxel_local->setInputCloud(localMap);
+      voxel_local->filter(*localMap);
+    }
 
-    voxel_local->setInputCloud(localMap);
-    voxel_local->filter(*localMap);
+    // Integrates the new keyframes and follows the corrected poses, outside
+    // of the local map lock
+    TRACE_SPAN("UpdateGlobalMap", "dense_mapping");
+    mpGlobalDenseMap->Update(vpAllKeyFrames);
   }
   save();
 }
@@ -192,25 +205,31 @@ void LidarMapping::ClearLocalMap() {
   localMap->clear();
 }
 void LidarMapping::save() {
-  std::unique_lock<std::mutex> lck(mMutexGlobalMap);
-  for (auto pKF : mlAllKeyFrames) {
-    if (pKF->isBad()) continue;
-    if (pKF->mpPointCloudDownsampled == nullptr) continue;
-    pcl::PointCloud<PointType>::Ptr p(new pcl::PointCloud<PointType>);
-    transformPointCloud((pKF->mpPointCloudDownsampled), (p),
-                        Converter::toMatrix4d(pKF->GetPoseInverse()));
-
-    {
-      *globalMap += *p;
-    }
+  TRACE_SPAN("SaveGlobalMap", "dense_mapping");
+  vector<KeyFrame *> vpAllKeyFrames;
+  {
+    unique_lock<mutex> lck(keyframeMutex);
+    vpAllKeyFrames.assign(mlAllKeyFrames.begin(), mlAllKeyFrames.end());
   }
-  voxel_global->setInputCloud(globalMap);
-  voxel_global->filter(*globalMap);
-  if (!globalMap->empty())
-    pcl::io::savePCDFile(save_path + "/globalMap.pcd", *globalMap);
+  mpGlobalDenseMap->Update(vpAllKeyFrames);
+  if (mpGlobalDenseMap->NumPoints() > 0)
+    SaveGlobalMap(save_path + "/globalMap.pcd");
   cout << "globalMap save finished" << endl;
 }
+bool LidarMapping::SaveGlobalMap(const string &filename) {
+  if (mpGlobalDenseMap->Save(filename)) return true;
+  cerr << "Failed to save the global map to " << filename << endl;
+  return false;
+}
 void LidarMapping::updatecloud(Map &curMap) {
+  // Poses were corrected, the dense mapping thread re-integrates the moved
+  // keyframes into the global map
+  {
+    unique_lock<mutex> lck(keyframeMutex);
+    mbMapChanged = true;
+  }
+  keyFrameUpdated.notify_one();
+
   // std::unique_lock<std::mutex> lck(updateMutex);
 
   // mabIsUpdating = true;
@@ -23,17 +23,32 @@
 
 #include <omp.h>
 
+#include <algorithm>
 #include <chrono>
 #include <mutex>
 
 #include "Converter.h"
+#include "EpochReclaimer.h"
 #include "GeometricTools.h"
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
+#include "Trace.h"
 #include "methods.h"
 namespace ORB_SLAM3 {
 
+namespace {
+
+// Point triangulated from a match between the current keyframe and one of
+// its neighbors, turned into a map point once all the neighbors are searched
+struct TriangulatedMatch {
+  int idx1;
+  int idx2;
+  Eigen::Vector3f x3D;
+};
+
+}  // namespace
+
 LocalMapping::LocalMapping(System* pSys, Atlas* pAtlas, Settings* settings,
                            const float bMonocular, bool bInertial,
                            const string& _strSeqName)
@@ -51,6 +66,7 @@ LocalMapping::LocalMapping(System* pSys, Atlas* pAtlas, Settings* settings,
       mbStopRequested(false),
       mbNotStop(false),
       mbAcceptKeyFrames(true),
+      mnIdleIterations(0),
       mIdxInit(0),
       mScale(1.0),
       mInitSect(0),
@@ -62,6 +78,8 @@ LocalMapping::LocalMapping(System* pSys, Atlas* pAtlas, Settings* settings,
   mnMatchesInliers = 0;
   bStop = false;
   mbBadImu = false;
+  mpPayloadStore = NULL;
+  mpICPCache = NULL;
 
   mTinit = 0.f;
 
@@ -87,6 +105,8 @@ void LocalMapping::SetLoopCloser(LoopClosing* pLoopCloser) {
 void LocalMapping::SetTracker(Tracking* pTracker) { mpTracker = pTracker; }
 
 void LocalMapping::Run() {
+  Trace::SetThreadName("LocalMapping");
+  EpochParticipant epochParticipant;
   mbFinished = false;
   std::unique_lock<std::mutex> lock(mtx);
   bStop = false;
@@ -106,6 +126,7 @@ void LocalMapping::Run() {
 
     // Check if there are keyframes in the queue
     if (CheckNewKeyFrames() && !mbBadImu) {
+      TRACE_SPAN("KeyFrame", "local_mapping");
 #ifdef REGISTER_TIMES
       double timeLBA_ms = 0;
       double timeKFCulling_ms = 0;
@@ -155,6 +176,9 @@ void LocalMapping::Run() {
       // }
       CreateNewMapPoints();
       mbAbortBA = false;
+      // Points seen by the new keyframe, before they are fused into the
+      // neighbors
+      UpdatePendingMapPoints();
       if (!CheckNewKeyFrames()) {
         // Find more matches in neighbor keyframes and fuse point duplications
         SearchInNeighbors();
@@ -380,6 +404,9 @@ void LocalMapping::Run() {
           mpLidarMapping->insertKeyFrame(pKF);
       }
 
+      // Demote the payload of keyframes that left the local window
+      if (mpPayloadStore) mpPayloadStore->Update(mpCurrentKeyFrame);
+
 #ifdef REGISTER_TIMES
       std::chrono::steady_clock::time_point time_EndLocalMap =
           std::chrono::steady_clock::now();
@@ -400,6 +427,12 @@ void LocalMapping::Run() {
 
     ResetIfRequested();
 
+    // Queued keyframes may still point to culled points
+    if (EpochReclaimer::IsEnabled() && !CheckNewKeyFrames()) {
+      ReleaseBadMapPoints();
+      EpochReclaimer::Quiescent();
+    }
+
     // Tracking will see that Local Mapping is busy
     SetAcceptKeyFrames(true);
 
@@ -423,12 +456,16 @@ bool LocalMapping::CheckNewKeyFrames() {
 }
 
 void LocalMapping::ProcessNewKeyFrame() {
+  TRACE_SPAN("ProcessNewKeyFrame", "local_mapping");
   {
     unique_lock<mutex> lock(mMutexNewKFs);
     mpCurrentKeyFrame = mlNewKeyFrames.front();
     mlNewKeyFrames.pop_front();
   }
 
+  // Registered in the background while the keyframe is processed
+  RequestICPConstraint(mpCurrentKeyFrame);
+
   // Compute Bags of Words structures
   mpCurrentKeyFrame->ComputeBoW();
 
@@ -442,13 +479,15 @@ void LocalMapping::ProcessNewKeyFrame() {
       if (!pMP->isBad()) {
         if (!pMP->IsInKeyFrame(mpCurrentKeyFrame)) {
           pMP->AddObservation(mpCurrentKeyFrame, i);
-          pMP->UpdateNormalAndDepth();
-          pMP->ComputeDistinctiveDescriptors();
+          mvpPendingMapPoints.push_back(pMP);
         } else  // this can only happen for new stereo points inserted by the
                 // Tracking
         {
           mlpRecentAddedMapPoints.push_back(pMP);
         }
+      } else {
+        // Culled since the keyframe was created
+        mpCurrentKeyFrame->EraseMapPointMatch(i);
       }
     }
   }
@@ -460,11 +499,24 @@ void LocalMapping::ProcessNewKeyFrame() {
   mpAtlas->AddKeyFrame(mpCurrentKeyFrame);
 }
 
+void LocalMapping::RequestICPConstraint(KeyFrame* pKF) {
+  if (!mpICPCache || !pKF->mPrevKF) return;
+  if (!mpSettings->enableICPLocalBA() && !mpSettings->enableICPLoop()) return;
+
+  KeyFrame* pPrevKF = pKF->mPrevKF;
+  Sophus::SE3d Tji =
+      (pPrevKF->GetPose() * pKF->GetPoseInverse()).cast<double>();
+  Eigen::Isometry3d init_T(Tji.matrix());
+  mpICPCache->RequestAsync(pPrevKF, pKF, init_T);
+}
+
 void LocalMapping::EmptyQueue() {
   while (CheckNewKeyFrames()) ProcessNewKeyFrame();
+  UpdatePendingMapPoints();
 }
 
 void LocalMapping::MapPointCulling() {
+  TRACE_SPAN("MapPointCulling", "local_mapping");
   // Check Recent Added MapPoints
   list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
   const unsigned long int nCurrentKFid = mpCurrentKeyFrame->mnId;
@@ -500,6 +552,7 @@ void LocalMapping::MapPointCulling() {
 }
 
 void LocalMapping::CreateNewMapPointsNew() {
+  TRACE_SPAN("CreateNewMapPoints", "local_mapping");
   const float& fx1 = mpCurrentKeyFrame->fx;
   const float& fy1 = mpCurrentKeyFrame->fy;
   const float& cx1 = mpCurrentKeyFrame->cx;
@@ -801,6 +854,7 @@ cv::Mat LocalMapping::ComputeF12(KeyFrame*& pKF1, KeyFrame*& pKF2) {
   return mat;
 }
 void LocalMapping::CreateNewMapPoints() {
+  TRACE_SPAN("CreateNewMapPoints", "local_mapping");
   // Retrieve neighbor keyframes in covisibility graph
   int nn = 10;
   // For stereo inertial case
@@ -821,14 +875,8 @@ void LocalMapping::CreateNewMapPoints() {
 
   float th = 0.6f;
 
-  ORBmatcher matcher(th, false);
-
-  Sophus::SE3<float> sophTcw1 = mpCurrentKeyFrame->GetPose();
-  Eigen::Matrix<float, 3, 4> eigTcw1 = sophTcw1.matrix3x4();
-  Eigen::Matrix<float, 3, 3> Rcw1 = eigTcw1.block<3, 3>(0, 0);
-  Eigen::Matrix<float, 3, 3> Rwc1 = Rcw1.transpose();
-  Eigen::Vector3f tcw1 = sophTcw1.translation();
-  Eigen::Vector3f Ow1 = mpCurrentKeyFrame->GetCameraCenter();
+  const Sophus::SE3<float> sophTcw1Left = mpCurrentKeyFrame->GetPose();
+  const Eigen::Vector3f Ow1Left = mpCurrentKeyFrame->GetCameraCenter();
 
   const float& fx1 = mpCurrentKeyFrame->fx;
   const float& fy1 = mpCurrentKeyFrame->fy;
@@ -838,15 +886,41 @@ void LocalMapping::CreateNewMapPoints() {
   const float& invfy1 = mpCurrentKeyFrame->invfy;
 
   const float ratioFactor = 1.5f * mpCurrentKeyFrame->mfScaleFactor;
-  int countStereo = 0;
-  int countStereoGoodProj = 0;
-  int countStereoAttempt = 0;
-  int totalStereoPts = 0;
-  // Search matches with epipolar restriction and triangulate
-  for (size_t i = 0; i < vpNeighKFs.size(); i++) {
-    if (i > 0 && CheckNewKeyFrames()) return;
+  const bool bCoarse = mbInertial &&
+                       mpTracker->mState == Tracking::RECENTLY_LOST &&
+                       mpCurrentKeyFrame->GetMap()->GetIniertialBA2();
+
+  // Search matches with epipolar restriction and triangulate. The neighbors
+  // are matched and triangulated in parallel, each into its own list, and
+  // the map points are created afterwards in the order of the neighbors.
+  // Unlike the sequential loop, every search sees the keyframe before any
+  // of the new points, so a keypoint an earlier neighbor triangulates can
+  // still take an idx2 that another keypoint would have matched. Those
+  // matches are dropped in the merge, which may create a few points less.
+  const int nNeighKFs = vpNeighKFs.size();
+  vector<vector<TriangulatedMatch>> vvTriangulated(nNeighKFs);
+  vector<unsigned char> vbInterrupted(nNeighKFs, false);
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < nNeighKFs; i++) {
+    if (i > 0 && CheckNewKeyFrames()) {
+      vbInterrupted[i] = true;
+      continue;
+    }
 
     KeyFrame* pKF2 = vpNeighKFs[i];
+    vector<TriangulatedMatch>& vTriangulated = vvTriangulated[i];
+    ORBmatcher matcher(th, false);
+
+    // The matches between stereo fisheye cameras may switch them to the
+    // right camera
+    Sophus::SE3<float> sophTcw1 = sophTcw1Left;
+    Eigen::Matrix<float, 3, 4> eigTcw1 = sophTcw1.matrix3x4();
+    Eigen::Matrix<float, 3, 3> Rcw1 = eigTcw1.block<3, 3>(0, 0);
+    Eigen::Matrix<float, 3, 3> Rwc1 = Rcw1.transpose();
+    Eigen::Vector3f tcw1 = sophTcw1.translation();
+    Eigen::Vector3f Ow1 = Ow1Left;
 
     GeometricCamera *pCamera1 = mpCurrentKeyFrame->mpCamera,
                     *pCamera2 = pKF2->mpCamera;
@@ -867,8 +941,6 @@ void LocalMapping::CreateNewMapPoints() {
 
     // Search matches that fullfil epipolar constraint
     vector<pair<size_t, size_t>> vMatchedIndices;
-    bool bCoarse = mbInertial && mpTracker->mState == Tracking::RECENTLY_LOST &&
-                   mpCurrentKeyFrame->GetMap()->GetIniertialBA2();
     matcher.SearchForTriangulation(mpCurrentKeyFrame, pKF2, vMatchedIndices,
                                    false, bCoarse);
     // bool bCoarse = mbInertial && mpTracker->mState ==
@@ -995,8 +1067,6 @@ void LocalMapping::CreateNewMapPoints() {
       else if (bStereo2)
         cosParallaxStereo2 = cos(2 * atan2(pKF2->mb / 2, pKF2->mvDepth[idx2]));
 
-      if (bStereo1 || bStereo2) totalStereoPts++;
-
       cosParallaxStereo = min(cosParallaxStereo1, cosParallaxStereo2);
 
       Eigen::Vector3f x3D;
@@ -1009,19 +1079,15 @@ void LocalMapping::CreateNewMapPoints() {
         goodProj = GeometricTools::Triangulate(xn1, xn2, eigTcw1, eigTcw2, x3D);
         if (!goodProj) continue;
       } else if (bStereo1 && cosParallaxStereo1 < cosParallaxStereo2) {
-        countStereoAttempt++;
         bPointStereo = true;
         goodProj = mpCurrentKeyFrame->UnprojectStereo(idx1, x3D);
       } else if (bStereo2 && cosParallaxStereo2 < cosParallaxStereo1) {
-        countStereoAttempt++;
         bPointStereo = true;
         goodProj = pKF2->UnprojectStereo(idx2, x3D);
       } else {
         continue;  // No stereo and very low parallax
       }
 
-      if (goodProj && bPointStereo) countStereoGoodProj++;
-
       if (!goodProj) continue;
 
       // Check triangulation in front of cameras
@@ -1100,9 +1166,26 @@ void LocalMapping::CreateNewMapPoints() {
         continue;
 
       // Triangulation is succesfull
-      MapPoint* pMP =
-          new MapPoint(x3D, mpCurrentKeyFrame, mpAtlas->GetCurrentMap());
-      if (bPointStereo) countStereo++;
+      TriangulatedMatch triangulated;
+      triangulated.idx1 = idx1;
+      triangulated.idx2 = idx2;
+      triangulated.x3D = x3D;
+      vTriangulated.push_back(triangulated);
+    }
+  }
+
+  for (int i = 0; i < nNeighKFs; i++) {
+    if (vbInterrupted[i]) return;
+
+    KeyFrame* pKF2 = vpNeighKFs[i];
+    for (const TriangulatedMatch& triangulated : vvTriangulated[i]) {
+      const int idx1 = triangulated.idx1;
+      const int idx2 = triangulated.idx2;
+      // Already triangulated with an earlier neighbor
+      if (mpCurrentKeyFrame->GetMapPoint(idx1)) continue;
+
+      MapPoint* pMP = new MapPoint(triangulated.x3D, mpCurrentKeyFrame,
+                                   mpAtlas->GetCurrentMap());
 
       pMP->AddObservation(mpCurrentKeyFrame, idx1);
       pMP->AddObservation(pKF2, idx2);
@@ -1127,6 +1210,7 @@ void LocalMapping::CreateNewMapPoints() {
 }
 
 void LocalMapping::SearchInNeighbors() {
+  TRACE_SPAN("SearchInNeighbors", "local_mapping");
   // Retrieve neighbor keyframes
   int nn = 10;
   if (mbMonocular) nn = 30;
@@ -1176,16 +1260,30 @@ void LocalMapping::SearchInNeighbors() {
     }
   }
 
-  // Search matches by projection from current KF in target KFs
+  // Search matches by projection from current KF in target KFs. The target
+  // KFs are searched in parallel, then fused in order so that points fused
+  // in a slot by an earlier KF are seen by the later ones.
   ORBmatcher matcher;
   vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-  for (vector<KeyFrame*>::iterator vit = vpTargetKFs.begin(),
-                                   vend = vpTargetKFs.end();
-       vit != vend; vit++) {
-    KeyFrame* pKFi = *vit;
-
-    matcher.Fuse(pKFi, vpMapPointMatches);
-    if (pKFi->NLeft != -1) matcher.Fuse(pKFi, vpMapPointMatches, true);
+  const int nTargetKFs = vpTargetKFs.size();
+  vector<vector<int>> vvnFuseIdx(nTargetKFs);
+  vector<vector<int>> vvnFuseIdxRight(nTargetKFs);
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < nTargetKFs; i++) {
+    KeyFrame* pKFi = vpTargetKFs[i];
+    ORBmatcher matcheri;
+    matcheri.SearchForFusion(pKFi, vpMapPointMatches, vvnFuseIdx[i]);
+    if (pKFi->NLeft != -1)
+      matcheri.SearchForFusion(pKFi, vpMapPointMatches, vvnFuseIdxRight[i],
+                               3.0, true);
+  }
+  for (int i = 0; i < nTargetKFs; i++) {
+    KeyFrame* pKFi = vpTargetKFs[i];
+    matcher.FuseMatches(pKFi, vpMapPointMatches, vvnFuseIdx[i]);
+    if (pKFi->NLeft != -1)
+      matcher.FuseMatches(pKFi, vpMapPointMatches, vvnFuseIdxRight[i]);
   }
 
   if (mbAbortBA) return;
@@ -1223,16 +1321,41 @@ void LocalMapping::SearchInNeighbors() {
     MapPoint* pMP = vpMapPointMatches[i];
     if (pMP) {
       if (!pMP->isBad()) {
-        pMP->ComputeDistinctiveDescriptors();
-        pMP->UpdateNormalAndDepth();
+        mvpPendingMapPoints.push_back(pMP);
       }
     }
   }
+  UpdatePendingMapPoints();
 
   // Update connections in covisibility graph
   mpCurrentKeyFrame->UpdateConnections();
 }
 
+void LocalMapping::ReleaseBadMapPoints() {
+  mlpRecentAddedMapPoints.remove_if(
+      [](MapPoint* pMP) { return pMP->isBad(); });
+}
+
+void LocalMapping::UpdatePendingMapPoints() {
+  TRACE_SPAN("UpdatePendingMapPoints", "local_mapping");
+  std::sort(mvpPendingMapPoints.begin(), mvpPendingMapPoints.end());
+  mvpPendingMapPoints.erase(
+      std::unique(mvpPendingMapPoints.begin(), mvpPendingMapPoints.end()),
+      mvpPendingMapPoints.end());
+
+  const int nPoints = mvpPendingMapPoints.size();
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < nPoints; i++) {
+    MapPoint* pMP = mvpPendingMapPoints[i];
+    if (pMP->isBad()) continue;
+    pMP->UpdateNormalAndDepth();
+    pMP->ComputeDistinctiveDescriptors();
+  }
+  mvpPendingMapPoints.clear();
+}
+
 void LocalMapping::RequestStop() {
   unique_lock<mutex> lock(mMutexStop);
   mbStopRequested = true;
@@ -1283,8 +1406,19 @@ bool LocalMapping::AcceptKeyFrames() {
 }
 
 void LocalMapping::SetAcceptKeyFrames(bool flag) {
+  {
+    unique_lock<mutex> lock(mMutexAccept);
+    mbAcceptKeyFrames = flag;
+    if (flag) mnIdleIterations++;
+  }
+  if (flag) mcvIdle.notify_all();
+}
+
+void LocalMapping::WaitIdle(const std::chrono::milliseconds& timeout) {
   unique_lock<mutex> lock(mMutexAccept);
-  mbAcceptKeyFrames = flag;
+  const size_t nIterations = mnIdleIterations;
+  mcvIdle.wait_for(lock, timeout,
+                   [&]() { return mnIdleIterations != nIterations; });
 }
 
 bool LocalMapping::SetNotStop(bool flag) {
@@ -1299,7 +1433,50 @@ bool LocalMapping::SetNotStop(bool flag) {
 
 void LocalMapping::InterruptBA() { mbAbortBA = true; }
 
+bool LocalMapping::IsRedundantKeyFrame(KeyFrame* pKF,
+                                       const float redundant_th) {
+  if ((pKF->mnId == pKF->GetMap()->GetInitKFid()) || pKF->isBad())
+    return false;
+  const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+
+  int nObs = 3;
+  const int thObs = nObs;
+  int nRedundantObservations = 0;
+  int nMPs = 0;
+  for (size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
+    MapPoint* pMP = vpMapPoints[i];
+    if (pMP) {
+      if (!pMP->isBad()) {
+        if (!mbMonocular) {
+          //                      if(pKF->mvDepth[i]>pKF->mThDepth ||
+          //                      pKF->mvDepth[i]<0)
+          if ((pKF->NLeft == -1 || i < pKF->NLeft) &&
+              (pKF->mvDepth[i] > pKF->mThDepth || pKF->mvDepth[i] < 0))
+            continue;
+          continue;
+        }
+
+        nMPs++;
+        if (pMP->Observations() > thObs) {
+          const int& scaleLevel =
+              (pKF->NLeft == -1) ? pKF->mvKeysUn[i].octave
+              : (i < pKF->NLeft) ? pKF->mvKeys[i].octave
+                                 : pKF->mvKeysRight[i - pKF->NLeft].octave;
+          // Other keyframes seeing it in the same or finer scale, counted
+          // by the map point as its observations change
+          if (pMP->ObservationsUpToLevel(scaleLevel + 1, pKF) > thObs) {
+            nRedundantObservations++;
+          }
+        }
+      }
+    }
+  }
+
+  return nRedundantObservations > redundant_th * nMPs;
+}
+
 void LocalMapping::KeyFrameCulling() {
+  TRACE_SPAN("KeyFrameCulling", "local_mapping");
   // Check redundant keyframes (only local keyframes)
   // A keyframe is considered redundant if the 90% of the MapPoints it sees, are
   // seen in at least other 3 keyframes (in the same or finer scale) We only
@@ -1332,79 +1509,29 @@ void LocalMapping::KeyFrameCulling() {
     last_ID = aux_KF->mnId;
   }
 
-  for (vector<KeyFrame*>::iterator vit = vpLocalKeyFrames.begin(),
-                                   vend = vpLocalKeyFrames.end();
-       vit != vend; vit++) {
+  // The redundancy of the keyframes that may be visited is checked in
+  // parallel. Culling a keyframe removes its observations, so the ones after
+  // it are checked again.
+  const int nCandidates =
+      std::min<int>(vpLocalKeyFrames.size(), mbAbortBA ? 21 : 101);
+  vector<unsigned char> vbRedundant(nCandidates, false);
+  auto CheckRedundancy = [&](const int nFirst) {
+    TRACE_SPAN("CheckRedundancy", "local_mapping");
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = nFirst; i < nCandidates; i++)
+      vbRedundant[i] = IsRedundantKeyFrame(vpLocalKeyFrames[i], redundant_th);
+  };
+  CheckRedundancy(0);
+
+  for (int i = 0; i < nCandidates; i++) {
     count++;
-    KeyFrame* pKF = *vit;
+    KeyFrame* pKF = vpLocalKeyFrames[i];
 
     if ((pKF->mnId == pKF->GetMap()->GetInitKFid()) || pKF->isBad()) continue;
-    const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
-
-    int nObs = 3;
-    const int thObs = nObs;
-    int nRedundantObservations = 0;
-    int nMPs = 0;
-    for (size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
-      MapPoint* pMP = vpMapPoints[i];
-      if (pMP) {
-        if (!pMP->isBad()) {
-          if (!mbMonocular) {
-            //                      if(pKF->mvDepth[i]>pKF->mThDepth ||
-            //                      pKF->mvDepth[i]<0)
-            if ((pKF->NLeft == -1 || i < pKF->NLeft) &&
-                (pKF->mvDepth[i] > pKF->mThDepth || pKF->mvDepth[i] < 0))
-              continue;
-            continue;
-          }
-
-          nMPs++;
-          if (pMP->Observations() > thObs) {
-            const int& scaleLevel =
-                (pKF->NLeft == -1) ? pKF->mvKeysUn[i].octave
-                : (i < pKF->NLeft) ? pKF->mvKeys[i].octave
-                                   : pKF->mvKeysRight[i - pKF->NLeft].octave;
-            const map<KeyFrame*, tuple<int, int>> observations =
-                pMP->GetObservations();
-            int nObs = 0;
-            for (map<KeyFrame*, tuple<int, int>>::const_iterator
-                     mit = observations.begin(),
-                     mend = observations.end();
-                 mit != mend; mit++) {
-              KeyFrame* pKFi = mit->first;
-              if (pKFi == pKF) continue;
-              tuple<int, int> indexes = mit->second;
-              int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
-              int scaleLeveli = -1;
-              if (pKFi->NLeft == -1)
-                scaleLeveli = pKFi->mvKeysUn[leftIndex].octave;
-              else {
-                if (leftIndex != -1) {
-                  scaleLeveli = pKFi->mvKeys[leftIndex].octave;
-                }
-                if (rightIndex != -1) {
-                  int rightLevel =
-                      pKFi->mvKeysRight[rightIndex - pKFi->NLeft].octave;
-                  scaleLeveli = (scaleLeveli == -1 || scaleLeveli > rightLevel)
-                                    ? rightLevel
-                                    : scaleLeveli;
-                }
-              }
 
-              if (scaleLeveli <= scaleLevel + 1) {
-                nObs++;
-                if (nObs > thObs) break;
-              }
-            }
-            if (nObs > thObs) {
-              nRedundantObservations++;
-            }
-          }
-        }
-      }
-    }
-
-    if (nRedundantObservations > redundant_th * nMPs) {
+    if (vbRedundant[i]) {
       if (mbInertial) {
         if (mpAtlas->KeyFramesInMap() <= Nd) continue;
 
@@ -1418,6 +1545,7 @@ void LocalMapping::KeyFrameCulling() {
                 pKF->mpImuPreintegrated);
             pKF->mNextKF->mPrevKF = pKF->mPrevKF;
             pKF->mPrevKF->mNextKF = pKF->mNextKF;
+            RequestICPConstraint(pKF->mNextKF);
             pKF->mNextKF = NULL;
             pKF->mPrevKF = NULL;
             pKF->SetBadFlag();
@@ -1429,6 +1557,7 @@ void LocalMapping::KeyFrameCulling() {
                 pKF->mpImuPreintegrated);
             pKF->mNextKF->mPrevKF = pKF->mPrevKF;
             pKF->mPrevKF->mNextKF = pKF->mNextKF;
+            RequestICPConstraint(pKF->mNextKF);
             pKF->mNextKF = NULL;
             pKF->mPrevKF = NULL;
             pKF->SetBadFlag();
@@ -1437,6 +1566,10 @@ void LocalMapping::KeyFrameCulling() {
       } else {
         pKF->SetBadFlag();
       }
+      if (pKF->isBad()) {
+        if (mpICPCache) mpICPCache->Invalidate(pKF);
+        CheckRedundancy(i + 1);
+      }
     }
     if ((count > 20 && mbAbortBA) || count > 100) {
       break;
@@ -1493,6 +1626,7 @@ void LocalMapping::ResetIfRequested() {
       cout << "LM: Reseting Atlas in Local Mapping..." << endl;
       mlNewKeyFrames.clear();
       mlpRecentAddedMapPoints.clear();
+      mvpPendingMapPoints.clear();
       mbResetRequested = false;
       mbResetRequestedActiveMap = false;
 
@@ -1512,6 +1646,7 @@ void LocalMapping::ResetIfRequested() {
       cout << "LM: Reseting current map in Local Mapping..." << endl;
       mlNewKeyFrames.clear();
       mlpRecentAddedMapPoints.clear();
+      mvpPendingMapPoints.clear();
 
       // Inertial parameters
       mTinit = 0.f;
@@ -1551,6 +1686,7 @@ bool LocalMapping::isFinished() {
 
 void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA,
                                  bool bFastInit) {
+  TRACE_SPAN("InitializeIMU", "local_mapping");
   if (mbResetRequested) return;
 
   float minTime;
@@ -1649,7 +1785,8 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA,
 
   // Before this line we are not changing the map
   {
-    unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+    unique_lock<mutex> lock =
+        TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
     if ((fabs(mScale - 1.f) > 0.00001) || !mbMonocular) {
       Sophus::SE3f Twg(mRwg.cast<float>().transpose(), Eigen::Vector3f::Zero());
       mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, mScale, true);
@@ -1689,7 +1826,8 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA,
                      Verbose::VERBOSITY_NORMAL);
 
   // Get Map Mutex
-  unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+  unique_lock<mutex> lock =
+      TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
 
   unsigned long GBAid = mpCurrentKeyFrame->mnId;
 
@@ -1919,7 +2057,8 @@ void LocalMapping::VigInit(float priorG, float priorA, bool bFIBA) {
           mRwg = Sophus::SO3f::exp(vzg).matrix().cast<double>();
           Sophus::SE3f Twg(mRwg.cast<float>().transpose(),
                            Eigen::Vector3f::Zero());
-          unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+          unique_lock<mutex> lock = TracedLock(
+              mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
           mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, scale, true);
           mpTracker->UpdateFrameIMU(scale, b_, mpCurrentKeyFrame);
           mTinit = mpCurrentKeyFrame->mTimeStamp - mFirstTs;
@@ -1929,7 +2068,8 @@ void LocalMapping::VigInit(float priorG, float priorA, bool bFIBA) {
 
           Sophus::SE3f Twg(R, Eigen::Vector3f::Zero());
 
-          unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+          unique_lock<mutex> lock = TracedLock(
+              mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
           mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, scale, true);
           mpTracker->UpdateFrameIMU(scale, b_, mpCurrentKeyFrame);
         }
@@ -1956,7 +2096,8 @@ void LocalMapping::VigInit(float priorG, float priorA, bool bFIBA) {
           return;
         }
 
-        unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+        unique_lock<mutex> lock =
+            TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
         Sophus::SE3f Twg(mRwg.cast<float>().transpose(),
                          Eigen::Vector3f::Zero());
         mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, mScale, true);
@@ -1991,7 +2132,8 @@ void LocalMapping::VigInit(float priorG, float priorA, bool bFIBA) {
 
       {
         // Get Map Mutex
-        unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+        unique_lock<mutex> lock =
+            TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
 
         unsigned long GBAid = mpCurrentKeyFrame->mnId;
 
@@ -2253,7 +2395,8 @@ void LocalMapping::IMUAlign(float priorG, float priorA, bool bFIBA) {
           mRwg = Sophus::SO3f::exp(vzg).matrix().cast<double>();
           Sophus::SE3f Twg(mRwg.cast<float>().transpose(),
                            Eigen::Vector3f::Zero());
-          unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+          unique_lock<mutex> lock = TracedLock(
+              mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
           mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, scale, true);
           mpTracker->UpdateFrameIMU(scale, b_, mpCurrentKeyFrame);
           mTinit = mpCurrentKeyFrame->mTimeStamp - mFirstTs;
@@ -2263,7 +2406,8 @@ void LocalMapping::IMUAlign(float priorG, float priorA, bool bFIBA) {
 
           Sophus::SE3f Twg(R, Eigen::Vector3f::Zero());
 
-          unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+          unique_lock<mutex> lock = TracedLock(
+              mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
           mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, scale, true);
           mpTracker->UpdateFrameIMU(scale, b_, mpCurrentKeyFrame);
         }
@@ -2290,7 +2434,8 @@ void LocalMapping::IMUAlign(float priorG, float priorA, bool bFIBA) {
           return;
         }
 
-        unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+        unique_lock<mutex> lock =
+            TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
         Sophus::SE3f Twg(mRwg.cast<float>().transpose(),
                          Eigen::Vector3f::Zero());
         mpAtlas->GetCurrentMap()->ApplyScaledRotation(Twg, mScale, true);
@@ -2325,7 +2470,8 @@ void LocalMapping::IMUAlign(float priorG, float priorA, bool bFIBA) {
 
       {
         // Get Map Mutex
-        unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+        unique_lock<mutex> lock =
+            TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
 
         unsigned long GBAid = mpCurrentKeyFrame->mnId;
 
@@ -2444,6 +2590,7 @@ void LocalMapping::IMUAlign(float priorG, float priorA, bool bFIBA) {
 }
 
 void LocalMapping::ScaleRefinement() {
+  TRACE_SPAN("ScaleRefinement", "local_mapping");
   // Minimum number of keyframes to compute a solution
   // Minimum time (seconds) between first and last keyframe to compute a
   // solution. Make the difference between monocular and stereo
@@ -2484,7 +2631,8 @@ void LocalMapping::ScaleRefinement() {
 
   Sophus::SO3d so3wg(mRwg);
   // Before this line we are not changing the map
-  unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+  unique_lock<mutex> lock =
+      TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
   std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
   if ((fabs(mScale - 1.f) > 0.002) || !mbMonocular) {
     Sophus::SE3f Tgw(mRwg.cast<float>().transpose(), Eigen::Vector3f::Zero());
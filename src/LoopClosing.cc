@@ -21,14 +21,17 @@
 
 #include "LoopClosing.h"
 
+#include <atomic>
 #include <mutex>
 #include <thread>
 
 #include "Converter.h"
+#include "EpochReclaimer.h"
 #include "G2oTypes.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
 #include "Sim3Solver.h"
+#include "Trace.h"
 
 namespace ORB_SLAM3 {
 
@@ -94,6 +97,17 @@ LoopClosing::LoopClosing(Atlas* pAtlas, KeyFrameDatabase* pDB,
   mstrFolderSubTraj = "SubTrajectories/";
   mnNumCorrection = 0;
   mnCorrectionGBA = 0;
+
+  mbIncrementalGBA = false;
+  mfGBAMinTranslation = 0.05f;
+  mfGBAMinRotation = 0.01f;
+  mnGBAHalo = 10;
+  if (mpSettings) {
+    mbIncrementalGBA = mpSettings->incrementalGBA();
+    mfGBAMinTranslation = mpSettings->incrementalGBAMinTranslation();
+    mfGBAMinRotation = mpSettings->incrementalGBAMinRotation();
+    mnGBAHalo = mpSettings->incrementalGBAHalo();
+  }
 }
 
 void LoopClosing::SetTracker(Tracking* pTracker) { mpTracker = pTracker; }
@@ -103,6 +117,8 @@ void LoopClosing::SetLocalMapper(LocalMapping* pLocalMapper) {
 }
 
 void LoopClosing::Run() {
+  Trace::SetThreadName("LoopClosing");
+  EpochParticipant epochParticipant;
   mbFinished = false;
   mbUseICPConstraint = mpSettings->enableICPLoop();
   while (1) {
@@ -110,6 +126,7 @@ void LoopClosing::Run() {
     //----------------------------
 
     if (CheckNewKeyFrames()) {
+      TRACE_SPAN("KeyFrame", "loop_closing");
       if (mpLastCurrentKF) {
         mpLastCurrentKF->mvpLoopCandKFs.clear();
         mpLastCurrentKF->mvpMergeCandKFs.clear();
@@ -330,6 +347,9 @@ void LoopClosing::Run() {
 
     ResetIfRequested();
 
+    // The candidates kept between keyframes are searched again before use
+    EpochReclaimer::Quiescent();
+
     if (CheckFinish()) {
       break;
     }
@@ -351,6 +371,7 @@ bool LoopClosing::CheckNewKeyFrames() {
 }
 
 bool LoopClosing::NewDetectCommonRegions() {
+  TRACE_SPAN("DetectCommonRegions", "loop_closing");
   // To deactivate placerecognition. No loopclosing nor merging will be
   // performed
   if (!mbActiveLC) return false;
@@ -628,326 +649,250 @@ bool LoopClosing::DetectCommonRegionsFromBoW(
     std::vector<KeyFrame*>& vpBowCand, KeyFrame*& pMatchedKF2,
     KeyFrame*& pLastCurrentKF, g2o::Sim3& g2oScw, int& nNumCoincidences,
     std::vector<MapPoint*>& vpMPs, std::vector<MapPoint*>& vpMatchedMPs) {
+  TRACE_SPAN("DetectCommonRegionsFromBoW", "loop_closing");
+  set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
+
+  // Candidates are sorted by BoW score and verified in parallel. Once a
+  // candidate is accepted, the ones ranked after it are skipped or aborted at
+  // their next stage, the lowest accepted index is always fully verified.
+  const int numCandidates = vpBowCand.size();
+  std::vector<BoWCandidate, Eigen::aligned_allocator<BoWCandidate> >
+      vCandidates(numCandidates);
+  std::atomic<int> nAcceptedIdx(numCandidates);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < numCandidates; ++i) {
+    if (nAcceptedIdx.load() < i) continue;
+
+    if (VerifyBoWCandidate(vpBowCand[i], spConnectedKeyFrames, i, nAcceptedIdx,
+                           vCandidates[i])) {
+      int nIdx = nAcceptedIdx.load();
+      while (i < nIdx && !nAcceptedIdx.compare_exchange_weak(nIdx, i)) {
+      }
+    }
+  }
+
+  // Deterministic merge: the best ranked accepted candidate, otherwise the one
+  // with most reprojection matches (best ranked on ties)
+  int nBestIdx = -1;
+  if (nAcceptedIdx.load() < numCandidates) {
+    nBestIdx = nAcceptedIdx.load();
+  } else {
+    for (int i = 0; i < numCandidates; ++i) {
+      if (vCandidates[i].nProjOptMatches > 0 &&
+          (nBestIdx < 0 || vCandidates[i].nProjOptMatches >
+                               vCandidates[nBestIdx].nProjOptMatches))
+        nBestIdx = i;
+    }
+  }
+
+  if (nBestIdx >= 0) {
+    BoWCandidate& best = vCandidates[nBestIdx];
+    pLastCurrentKF = mpCurrentKF;
+    nNumCoincidences = best.nNumCoincidences;
+    pMatchedKF2 = best.pMatchedKF;
+    pMatchedKF2->SetNotErase();
+    g2oScw = best.gScw;
+    vpMPs = best.vpMapPoints;
+    vpMatchedMPs = best.vpMatchedMPs;
+
+    return nNumCoincidences >= 3;
+  }
+  return false;
+}
+
+bool LoopClosing::VerifyBoWCandidate(KeyFrame* pKFi,
+                                     const set<KeyFrame*>& spConnectedKeyFrames,
+                                     const int nIdx,
+                                     const std::atomic<int>& nAcceptedIdx,
+                                     BoWCandidate& candidate) {
   int nBoWMatches = 20;
   int nBoWInliers = 15;
   int nSim3Inliers = 20;
   int nProjMatches = 50;
   int nProjOptMatches = 80;
 
-  set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
-
   int nNumCovisibles = 10;
 
   ORBmatcher matcherBoW(0.9, true);
   ORBmatcher matcher(0.75, true);
-  // ORBmatcher matcher(0.8, true);
-
-  // Varibles to select the best numbe
-  KeyFrame* pBestMatchedKF;
-  int nBestMatchesReproj = 0;
-  int nBestNumCoindicendes = 0;
-  g2o::Sim3 g2oBestScw;
-  std::vector<MapPoint*> vpBestMapPoints;
-  std::vector<MapPoint*> vpBestMatchedMapPoints;
-
-  int numCandidates = vpBowCand.size();
-  vector<int> vnStage(numCandidates, 0);
-  vector<int> vnMatchesStage(numCandidates, 0);
-
-  int index = 0;
-  // Verbose::PrintMess("BoW candidates: There are " +
-  // to_string(vpBowCand.size()) + " possible candidates ",
-  // Verbose::VERBOSITY_DEBUG);
-  for (KeyFrame* pKFi : vpBowCand) {
-    if (!pKFi || pKFi->isBad()) continue;
 
-    // std::cout << "KF candidate: " << pKFi->mnId << std::endl;
-    // Current KF against KF with covisibles version
-    std::vector<KeyFrame*> vpCovKFi =
-        pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
-    if (vpCovKFi.empty()) {
-      std::cout << "Covisible list empty" << std::endl;
-      vpCovKFi.push_back(pKFi);
-    } else {
-      vpCovKFi.push_back(vpCovKFi[0]);
-      vpCovKFi[0] = pKFi;
-    }
-
-    bool bAbortByNearKF = false;
-    for (int j = 0; j < vpCovKFi.size(); ++j) {
-      if (spConnectedKeyFrames.find(vpCovKFi[j]) !=
-          spConnectedKeyFrames.end()) {
-        bAbortByNearKF = true;
-        break;
-      }
-    }
-    if (bAbortByNearKF) {
-      // std::cout << "Check BoW aborted because is close to the matched
-      // one " << std::endl;
-      continue;
-    }
-    // std::cout << "Check BoW continue because is far to the matched one "
-    // << std::endl;
-
-    std::vector<std::vector<MapPoint*>> vvpMatchedMPs;
-    vvpMatchedMPs.resize(vpCovKFi.size());
-    std::set<MapPoint*> spMatchedMPi;
-    int numBoWMatches = 0;
-
-    KeyFrame* pMostBoWMatchesKF = pKFi;
-    int nMostBoWNumMatches = 0;
-
-    std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(
-        mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-    std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(
-        mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
-
-    int nIndexMostBoWMatchesKF = 0;
-    for (int j = 0; j < vpCovKFi.size(); ++j) {
-      if (!vpCovKFi[j] || vpCovKFi[j]->isBad()) continue;
-
-      int num =
-          matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
-      if (num > nMostBoWNumMatches) {
-        nMostBoWNumMatches = num;
-        nIndexMostBoWMatchesKF = j;
-      }
-    }
+  if (!pKFi || pKFi->isBad()) return false;
 
-    for (int j = 0; j < vpCovKFi.size(); ++j) {
-      for (int k = 0; k < vvpMatchedMPs[j].size(); ++k) {
-        MapPoint* pMPi_j = vvpMatchedMPs[j][k];
-        if (!pMPi_j || pMPi_j->isBad()) continue;
-
-        if (spMatchedMPi.find(pMPi_j) == spMatchedMPi.end()) {
-          spMatchedMPi.insert(pMPi_j);
-          numBoWMatches++;
+  // Current KF against KF with covisibles version
+  std::vector<KeyFrame*> vpCovKFi =
+      pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
+  if (vpCovKFi.empty()) {
+    std::cout << "Covisible list empty" << std::endl;
+    vpCovKFi.push_back(pKFi);
+  } else {
+    vpCovKFi.push_back(vpCovKFi[0]);
+    vpCovKFi[0] = pKFi;
+  }
 
-          vpMatchedPoints[k] = pMPi_j;
-          vpKeyFrameMatchedMP[k] = vpCovKFi[j];
-        }
-      }
-    }
+  for (int j = 0; j < vpCovKFi.size(); ++j) {
+    if (spConnectedKeyFrames.find(vpCovKFi[j]) != spConnectedKeyFrames.end())
+      return false;
+  }
 
-    // pMostBoWMatchesKF = vpCovKFi[pMostBoWMatchesKF];
+  std::vector<std::vector<MapPoint*>> vvpMatchedMPs;
+  vvpMatchedMPs.resize(vpCovKFi.size());
+  std::set<MapPoint*> spMatchedMPi;
+  int numBoWMatches = 0;
 
-    if (numBoWMatches >= nBoWMatches)  // TODO pick a good threshold
-    {
-      // Geometric validation
-      bool bFixedScale = mbFixScale;
-      if (mpTracker->mSensor == System::IMU_MONOCULAR &&
-          !mpCurrentKF->GetMap()->GetIniertialBA2())
-        bFixedScale = false;
-
-      Sim3Solver solver =
-          Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints,
-                     bFixedScale, vpKeyFrameMatchedMP);
-      solver.SetRansacParameters(0.99, nBoWInliers,
-                                 300);  // at least 15 inliers
-
-      bool bNoMore = false;
-      vector<bool> vbInliers;
-      int nInliers;
-      bool bConverge = false;
-      Eigen::Matrix4f mTcm;
-      while (!bConverge && !bNoMore) {
-        mTcm = solver.iterate(20, bNoMore, vbInliers, nInliers, bConverge);
-        // Verbose::PrintMess("BoW guess: Solver achieve " +
-        // to_string(nInliers) + " geometrical inliers among " +
-        // to_string(nBoWInliers) + " BoW matches",
-        // Verbose::VERBOSITY_DEBUG);
-      }
+  KeyFrame* pMostBoWMatchesKF = pKFi;
 
-      if (bConverge) {
-        // std::cout << "Check BoW: SolverSim3 converged" << std::endl;
-
-        // Verbose::PrintMess("BoW guess: Convergende with " +
-        // to_string(nInliers) + " geometrical inliers among " +
-        // to_string(nBoWInliers) + " BoW matches",
-        // Verbose::VERBOSITY_DEBUG);
-        //  Match by reprojection
-        vpCovKFi.clear();
-        vpCovKFi =
-            pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-        vpCovKFi.push_back(pMostBoWMatchesKF);
-        set<KeyFrame*> spCheckKFs(vpCovKFi.begin(), vpCovKFi.end());
-
-        // std::cout << "There are " << vpCovKFi.size() <<" near KFs" <<
-        // std::endl;
-
-        set<MapPoint*> spMapPoints;
-        vector<MapPoint*> vpMapPoints;
-        vector<KeyFrame*> vpKeyFrames;
-        for (KeyFrame* pCovKFi : vpCovKFi) {
-          for (MapPoint* pCovMPij : pCovKFi->GetMapPointMatches()) {
-            if (!pCovMPij || pCovMPij->isBad()) continue;
-
-            if (spMapPoints.find(pCovMPij) == spMapPoints.end()) {
-              spMapPoints.insert(pCovMPij);
-              vpMapPoints.push_back(pCovMPij);
-              vpKeyFrames.push_back(pCovKFi);
-            }
-          }
-        }
+  std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(
+      mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+  std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(
+      mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
 
-        // std::cout << "There are " << vpKeyFrames.size() <<" KFs which
-        // view all the mappoints" << std::endl;
-
-        g2o::Sim3 gScm(solver.GetEstimatedRotation().cast<double>(),
-                       solver.GetEstimatedTranslation().cast<double>(),
-                       (double)solver.GetEstimatedScale());
-        g2o::Sim3 gSmw(pMostBoWMatchesKF->GetRotation().cast<double>(),
-                       pMostBoWMatchesKF->GetTranslation().cast<double>(), 1.0);
-        g2o::Sim3 gScw = gScm * gSmw;  // Similarity matrix of current
-                                       // from the world position
-        Sophus::Sim3f mScw = Converter::toSophus(gScw);
-
-        vector<MapPoint*> vpMatchedMP;
-        vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(),
-                           static_cast<MapPoint*>(NULL));
-        vector<KeyFrame*> vpMatchedKF;
-        vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(),
-                           static_cast<KeyFrame*>(NULL));
-        int numProjMatches = matcher.SearchByProjection(
-            mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP,
-            vpMatchedKF, 8, 1.5);
-        // cout <<"BoW: " << numProjMatches << " matches between " <<
-        // vpMapPoints.size() << " points with coarse Sim3" << endl;
-
-        if (numProjMatches >= nProjMatches) {
-          // Optimize Sim3 transformation with every matches
-          Eigen::Matrix<double, 7, 7> mHessian7x7;
-
-          bool bFixedScale = mbFixScale;
-          if (mpTracker->mSensor == System::IMU_MONOCULAR &&
-              !mpCurrentKF->GetMap()->GetIniertialBA2())
-            bFixedScale = false;
-
-          int numOptMatches =
-              Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10,
-                                      mbFixScale, mHessian7x7, true);
-
-          if (numOptMatches >= nSim3Inliers) {
-            g2o::Sim3 gSmw(pMostBoWMatchesKF->GetRotation().cast<double>(),
-                           pMostBoWMatchesKF->GetTranslation().cast<double>(),
-                           1.0);
-            g2o::Sim3 gScw = gScm * gSmw;  // Similarity matrix of current from
-                                           // the world position
-            Sophus::Sim3f mScw = Converter::toSophus(gScw);
-
-            vector<MapPoint*> vpMatchedMP;
-            vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(),
-                               static_cast<MapPoint*>(NULL));
-            int numProjOptMatches = matcher.SearchByProjection(
-                mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
-
-            if (numProjOptMatches >= nProjOptMatches) {
-              int max_x = -1, min_x = 1000000;
-              int max_y = -1, min_y = 1000000;
-              for (MapPoint* pMPi : vpMatchedMP) {
-                if (!pMPi || pMPi->isBad()) {
-                  continue;
-                }
+  for (int j = 0; j < vpCovKFi.size(); ++j) {
+    if (!vpCovKFi[j] || vpCovKFi[j]->isBad()) continue;
 
-                tuple<size_t, size_t> indexes = pMPi->GetIndexInKeyFrame(pKFi);
-                int index = get<0>(indexes);
-                if (index >= 0) {
-                  int coord_x = pKFi->mvKeysUn[index].pt.x;
-                  if (coord_x < min_x) {
-                    min_x = coord_x;
-                  }
-                  if (coord_x > max_x) {
-                    max_x = coord_x;
-                  }
-                  int coord_y = pKFi->mvKeysUn[index].pt.y;
-                  if (coord_y < min_y) {
-                    min_y = coord_y;
-                  }
-                  if (coord_y > max_y) {
-                    max_y = coord_y;
-                  }
-                }
-              }
+    matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
+  }
 
-              int nNumKFs = 0;
-              // vpMatchedMPs = vpMatchedMP;
-              // vpMPs = vpMapPoints;
-              //  Check the Sim3 transformation with the current
-              //  KeyFrame covisibles
-              vector<KeyFrame*> vpCurrentCovKFs =
-                  mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-
-              int j = 0;
-              while (nNumKFs < 3 && j < vpCurrentCovKFs.size()) {
-                KeyFrame* pKFj = vpCurrentCovKFs[j];
-                Sophus::SE3d mTjc =
-                    (pKFj->GetPose() * mpCurrentKF->GetPoseInverse())
-                        .cast<double>();
-                g2o::Sim3 gSjc(mTjc.unit_quaternion(), mTjc.translation(), 1.0);
-                g2o::Sim3 gSjw = gSjc * gScw;
-                int numProjMatches_j = 0;
-                vector<MapPoint*> vpMatchedMPs_j;
-                bool bValid = DetectCommonRegionsFromLastKF(
-                    pKFj, pMostBoWMatchesKF, gSjw, numProjMatches_j,
-                    vpMapPoints, vpMatchedMPs_j);
-
-                if (bValid) {
-                  Sophus::SE3f Tc_w = mpCurrentKF->GetPose();
-                  Sophus::SE3f Tw_cj = pKFj->GetPoseInverse();
-                  Sophus::SE3f Tc_cj = Tc_w * Tw_cj;
-                  Eigen::Vector3f vector_dist = Tc_cj.translation();
-                  nNumKFs++;
-                }
-                j++;
-              }
+  for (int j = 0; j < vpCovKFi.size(); ++j) {
+    for (int k = 0; k < vvpMatchedMPs[j].size(); ++k) {
+      MapPoint* pMPi_j = vvpMatchedMPs[j][k];
+      if (!pMPi_j || pMPi_j->isBad()) continue;
 
-              if (nNumKFs < 3) {
-                vnStage[index] = 8;
-                vnMatchesStage[index] = nNumKFs;
-              }
+      if (spMatchedMPi.find(pMPi_j) == spMatchedMPi.end()) {
+        spMatchedMPi.insert(pMPi_j);
+        numBoWMatches++;
 
-              if (nBestMatchesReproj < numProjOptMatches) {
-                nBestMatchesReproj = numProjOptMatches;
-                nBestNumCoindicendes = nNumKFs;
-                pBestMatchedKF = pMostBoWMatchesKF;
-                g2oBestScw = gScw;
-                vpBestMapPoints = vpMapPoints;
-                vpBestMatchedMapPoints = vpMatchedMP;
-              }
-            }
-          }
-        }
+        vpMatchedPoints[k] = pMPi_j;
+        vpKeyFrameMatchedMP[k] = vpCovKFi[j];
       }
-      /*else
-      {
-          Verbose::PrintMess("BoW candidate: it don't match with the
-      current one", Verbose::VERBOSITY_DEBUG);
-      }*/
     }
-    index++;
   }
 
-  if (nBestMatchesReproj > 0) {
-    pLastCurrentKF = mpCurrentKF;
-    nNumCoincidences = nBestNumCoindicendes;
-    pMatchedKF2 = pBestMatchedKF;
-    pMatchedKF2->SetNotErase();
-    g2oScw = g2oBestScw;
-    vpMPs = vpBestMapPoints;
-    vpMatchedMPs = vpBestMatchedMapPoints;
+  if (numBoWMatches < nBoWMatches)  // TODO pick a good threshold
+    return false;
+  if (nAcceptedIdx.load() < nIdx) return false;
 
-    return nNumCoincidences >= 3;
-  } else {
-    int maxStage = -1;
-    int maxMatched;
-    for (int i = 0; i < vnStage.size(); ++i) {
-      if (vnStage[i] > maxStage) {
-        maxStage = vnStage[i];
-        maxMatched = vnMatchesStage[i];
+  // Geometric validation
+  bool bFixedScale = mbFixScale;
+  if (mpTracker->mSensor == System::IMU_MONOCULAR &&
+      !mpCurrentKF->GetMap()->GetIniertialBA2())
+    bFixedScale = false;
+
+  Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF,
+                                 vpMatchedPoints, bFixedScale,
+                                 vpKeyFrameMatchedMP);
+  solver.SetRansacParameters(0.99, nBoWInliers, 300);  // at least 15 inliers
+
+  bool bNoMore = false;
+  vector<bool> vbInliers;
+  int nInliers;
+  bool bConverge = false;
+  Eigen::Matrix4f mTcm;
+  while (!bConverge && !bNoMore) {
+    mTcm = solver.iterate(20, bNoMore, vbInliers, nInliers, bConverge);
+  }
+
+  if (!bConverge) return false;
+  if (nAcceptedIdx.load() < nIdx) return false;
+
+  //  Match by reprojection
+  vpCovKFi.clear();
+  vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+  vpCovKFi.push_back(pMostBoWMatchesKF);
+
+  set<MapPoint*> spMapPoints;
+  vector<MapPoint*> vpMapPoints;
+  vector<KeyFrame*> vpKeyFrames;
+  for (KeyFrame* pCovKFi : vpCovKFi) {
+    for (MapPoint* pCovMPij : pCovKFi->GetMapPointMatches()) {
+      if (!pCovMPij || pCovMPij->isBad()) continue;
+
+      if (spMapPoints.find(pCovMPij) == spMapPoints.end()) {
+        spMapPoints.insert(pCovMPij);
+        vpMapPoints.push_back(pCovMPij);
+        vpKeyFrames.push_back(pCovKFi);
       }
     }
   }
-  return false;
+
+  g2o::Sim3 gScm(solver.GetEstimatedRotation().cast<double>(),
+                 solver.GetEstimatedTranslation().cast<double>(),
+                 (double)solver.GetEstimatedScale());
+  g2o::Sim3 gSmw(pMostBoWMatchesKF->GetRotation().cast<double>(),
+                 pMostBoWMatchesKF->GetTranslation().cast<double>(), 1.0);
+  g2o::Sim3 gScw = gScm * gSmw;  // Similarity matrix of current
+                                 // from the world position
+  Sophus::Sim3f mScw = Converter::toSophus(gScw);
+
+  vector<MapPoint*> vpMatchedMP;
+  vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(),
+                     static_cast<MapPoint*>(NULL));
+  vector<KeyFrame*> vpMatchedKF;
+  vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(),
+                     static_cast<KeyFrame*>(NULL));
+  int numProjMatches =
+      matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames,
+                                 vpMatchedMP, vpMatchedKF, 8, 1.5);
+
+  if (numProjMatches < nProjMatches) return false;
+
+  // Optimize Sim3 transformation with every matches
+  Eigen::Matrix<double, 7, 7> mHessian7x7;
+
+  int numOptMatches =
+      Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10,
+                              mbFixScale, mHessian7x7, true);
+
+  if (numOptMatches < nSim3Inliers) return false;
+  if (nAcceptedIdx.load() < nIdx) return false;
+
+  gSmw = g2o::Sim3(pMostBoWMatchesKF->GetRotation().cast<double>(),
+                   pMostBoWMatchesKF->GetTranslation().cast<double>(), 1.0);
+  gScw = gScm * gSmw;  // Similarity matrix of current from the world position
+  mScw = Converter::toSophus(gScw);
+
+  vpMatchedMP.assign(mpCurrentKF->GetMapPointMatches().size(),
+                     static_cast<MapPoint*>(NULL));
+  int numProjOptMatches = matcher.SearchByProjection(
+      mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
+
+  if (numProjOptMatches < nProjOptMatches) return false;
+
+  //  Check the Sim3 transformation with the current KeyFrame covisibles
+  int nNumKFs = 0;
+  vector<KeyFrame*> vpCurrentCovKFs =
+      mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+
+  int j = 0;
+  while (nNumKFs < 3 && j < vpCurrentCovKFs.size()) {
+    if (nAcceptedIdx.load() < nIdx) return false;
+
+    KeyFrame* pKFj = vpCurrentCovKFs[j];
+    Sophus::SE3d mTjc =
+        (pKFj->GetPose() * mpCurrentKF->GetPoseInverse()).cast<double>();
+    g2o::Sim3 gSjc(mTjc.unit_quaternion(), mTjc.translation(), 1.0);
+    g2o::Sim3 gSjw = gSjc * gScw;
+    int numProjMatches_j = 0;
+    vector<MapPoint*> vpMatchedMPs_j;
+    bool bValid =
+        DetectCommonRegionsFromLastKF(pKFj, pMostBoWMatchesKF, gSjw,
+                                      numProjMatches_j, vpMapPoints,
+                                      vpMatchedMPs_j);
+
+    if (bValid) nNumKFs++;
+    j++;
+  }
+
+  candidate.pMatchedKF = pMostBoWMatchesKF;
+  candidate.gScw = gScw;
+  candidate.vpMapPoints = vpMapPoints;
+  candidate.vpMatchedMPs = vpMatchedMP;
+  candidate.nProjOptMatches = numProjOptMatches;
+  candidate.nNumCoincidences = nNumKFs;
+
+  return nNumKFs >= 3;
 }
 
 bool LoopClosing::DetectCommonRegionsFromLastKF(
@@ -1020,6 +965,7 @@ int LoopClosing::FindMatchesByProjection(
 }
 
 void LoopClosing::CorrectLoop() {
+  TRACE_SPAN("CorrectLoop", "loop_closing");
   // cout << "Loop detected!" << endl;
   // Send a stop signal to Local Mapping
   // Avoid new keyframes are inserted while correcting the loop
@@ -1066,6 +1012,19 @@ void LoopClosing::CorrectLoop() {
   //   mpLocalMapper->Release();
   //   return;
   // }
+  // Poses before the correction, to find the region of the incremental GBA
+  Map* pLoopMap = mpCurrentKF->GetMap();
+  const bool bIncrementalGBA =
+      mbIncrementalGBA && !pLoopMap->isImuInitialized();
+  vector<pair<KeyFrame*, Sophus::SE3f> > vPosesBefCorrection;
+  if (bIncrementalGBA) {
+    vector<KeyFrame*> vpLoopMapKFs = pLoopMap->GetAllKeyFrames();
+    vPosesBefCorrection.reserve(vpLoopMapKFs.size());
+    for (KeyFrame* pKFi : vpLoopMapKFs)
+      if (!pKFi->isBad())
+        vPosesBefCorrection.push_back(make_pair(pKFi, pKFi->GetPose()));
+  }
+
   KeyFrameAndPose CorrectedSim3, NonCorrectedSim3;
   CorrectedSim3[mpCurrentKF] = mg2oLoopScw;
   Sophus::SE3f Twc = mpCurrentKF->GetPoseInverse();
@@ -1080,8 +1039,6 @@ void LoopClosing::CorrectLoop() {
                             mg2oLoopScw.translation() / mg2oLoopScw.scale());
   mpCurrentKF->SetPose(correctedTcw.cast<float>());
 
-  Map* pLoopMap = mpCurrentKF->GetMap();
-
 #ifdef REGISTER_TIMES
   /*KeyFrame* pKF = mpCurrentKF;
   int numKFinLoop = 0;
@@ -1098,7 +1055,8 @@ void LoopClosing::CorrectLoop() {
 
   {
     // Get Map Mutex
-    unique_lock<mutex> lock(pLoopMap->mMutexMapUpdate);
+    unique_lock<mutex> lock =
+        TracedLock(pLoopMap->mMutexMapUpdate, "MapUpdate");
 
     const bool bImuInit = pLoopMap->isImuInitialized();
     cout << "Correcting keyframes" << endl;
@@ -1279,6 +1237,8 @@ void LoopClosing::CorrectLoop() {
     cout << "Map updated!" << endl;
   }
 
+  if (bIncrementalGBA) AddGBARegion(pLoopMap, vPosesBefCorrection);
+
   // Add loop edge
   mpLoopMatchedKF->AddLoopEdge(mpCurrentKF);
   mpCurrentKF->AddLoopEdge(mpLoopMatchedKF);
@@ -1293,7 +1253,7 @@ void LoopClosing::CorrectLoop() {
     mnCorrectionGBA = mnNumCorrection;
 
     mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this,
-                             pLoopMap, mpCurrentKF->mnId);
+                             pLoopMap, mpCurrentKF->mnId, bIncrementalGBA);
   }
 
   // Loop closed. Release Local Mapping.
@@ -1305,6 +1265,7 @@ void LoopClosing::CorrectLoop() {
 }
 
 void LoopClosing::MergeLocal() {
+  TRACE_SPAN("MergeLocal", "loop_closing");
   int numTemporalKFs =
       25;  // Temporal KFs in the local window if the map is inertial.
 
@@ -1592,12 +1553,12 @@ void LoopClosing::MergeLocal() {
   }*/
 
   {
-    unique_lock<mutex> currentLock(
-        pCurrentMap->mMutexMapUpdate);  // We update the current map with the
-                                        // Merge information
-    unique_lock<mutex> mergeLock(
-        pMergeMap->mMutexMapUpdate);  // We remove the Kfs and MPs in the
-                                      // merged area from the old map
+    // We update the current map with the Merge information
+    unique_lock<mutex> currentLock =
+        TracedLock(pCurrentMap->mMutexMapUpdate, "MapUpdate");
+    // We remove the Kfs and MPs in the merged area from the old map
+    unique_lock<mutex> mergeLock =
+        TracedLock(pMergeMap->mMutexMapUpdate, "MapUpdate");
 
     // std::cout << "Merge local window: " << spLocalWindowKFs.size() <<
     // std::endl; std::cout << "[Merge]: init merging maps " << std::endl;
@@ -1743,9 +1704,9 @@ void LoopClosing::MergeLocal() {
   if (vpCurrentMapKFs.size() == 0) {
   } else {
     if (mpTracker->mSensor == System::MONOCULAR) {
-      unique_lock<mutex> currentLock(
-          pCurrentMap->mMutexMapUpdate);  // We update the current map with
-                                          // the Merge information
+      // We update the current map with the Merge information
+      unique_lock<mutex> currentLock =
+          TracedLock(pCurrentMap->mMutexMapUpdate, "MapUpdate");
 
       for (KeyFrame* pKFi : vpCurrentMapKFs) {
         if (!pKFi || pKFi->isBad() || pKFi->GetMap() != pCurrentMap) {
@@ -1820,12 +1781,12 @@ void LoopClosing::MergeLocal() {
 
     {
       // Get Merge Map Mutex
-      unique_lock<mutex> currentLock(
-          pCurrentMap->mMutexMapUpdate);  // We update the current map with
-                                          // the Merge information
-      unique_lock<mutex> mergeLock(
-          pMergeMap->mMutexMapUpdate);  // We remove the Kfs and MPs in the
-                                        // merged area from the old map
+      // We update the current map with the Merge information
+      unique_lock<mutex> currentLock =
+          TracedLock(pCurrentMap->mMutexMapUpdate, "MapUpdate");
+      // We remove the Kfs and MPs in the merged area from the old map
+      unique_lock<mutex> mergeLock =
+          TracedLock(pMergeMap->mMutexMapUpdate, "MapUpdate");
 
       // std::cout << "Merge outside KFs: " << vpCurrentMapKFs.size() <<
       // std::endl;
@@ -1879,7 +1840,7 @@ void LoopClosing::MergeLocal() {
     mbFinishedGBA = false;
     mbStopGBA = false;
     mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this,
-                             pMergeMap, mpCurrentKF->mnId);
+                             pMergeMap, mpCurrentKF->mnId, false);
   }
 
   mpMergeMatchedKF->AddMergeEdge(mpCurrentKF);
@@ -1892,6 +1853,7 @@ void LoopClosing::MergeLocal() {
 }
 
 void LoopClosing::MergeLocal2() {
+  TRACE_SPAN("MergeLocal2", "loop_closing");
   // cout << "Merge detected!!!!" << endl;
 
   int numTemporalKFs = 11;  // TODO (set by parameter): Temporal KFs in the
@@ -1943,7 +1905,8 @@ void LoopClosing::MergeLocal2() {
     Sophus::SE3f T_on(mSold_new.rotation().cast<float>(),
                       mSold_new.translation().cast<float>());
 
-    unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+    unique_lock<mutex> lock =
+        TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
 
     // cout << "KFs before empty: " <<
     // mpAtlas->GetCurrentMap()->KeyFramesInMap() << endl;
@@ -1977,7 +1940,8 @@ void LoopClosing::MergeLocal2() {
     ba << 0., 0., 0.;
     Optimizer::InertialOptimization(pCurrentMap, bg, ba);
     IMU::Bias b(ba[0], ba[1], ba[2], bg[0], bg[1], bg[2]);
-    unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+    unique_lock<mutex> lock =
+        TracedLock(mpAtlas->GetCurrentMap()->mMutexMapUpdate, "MapUpdate");
     mpTracker->UpdateFrameIMU(1.0f, b, mpTracker->GetLastKeyFrame());
 
     // Set map initialized
@@ -1994,12 +1958,12 @@ void LoopClosing::MergeLocal2() {
   // cout << "updating current map" << endl;
   {
     // Get Merge Map Mutex (This section stops tracking!!)
-    unique_lock<mutex> currentLock(
-        pCurrentMap->mMutexMapUpdate);  // We update the current map with the
-                                        // Merge information
-    unique_lock<mutex> mergeLock(
-        pMergeMap->mMutexMapUpdate);  // We remove the Kfs and MPs in the
-                                      // merged area from the old map
+    // We update the current map with the Merge information
+    unique_lock<mutex> currentLock =
+        TracedLock(pCurrentMap->mMutexMapUpdate, "MapUpdate");
+    // We remove the Kfs and MPs in the merged area from the old map
+    unique_lock<mutex> mergeLock =
+        TracedLock(pMergeMap->mMutexMapUpdate, "MapUpdate");
 
     vector<KeyFrame*> vpMergeMapKFs = pMergeMap->GetAllKeyFrames();
     vector<MapPoint*> vpMergeMapMPs = pMergeMap->GetAllMapPoints();
@@ -2194,7 +2158,7 @@ void LoopClosing::CheckObservations(set<KeyFrame*>& spKFsMap1,
         continue;
       }
 
-      map<KeyFrame*, tuple<int, int>> mMPijObs = pMPij->GetObservations();
+      MapPoint::ObservationMap mMPijObs = pMPij->GetObservations();
       for (KeyFrame* pKFi2 : spKFsMap2) {
         if (mMPijObs.find(pKFi2) != mMPijObs.end()) {
           if (mMatchedMP.find(pKFi2) != mMatchedMP.end()) {
@@ -2245,7 +2209,7 @@ void LoopClosing::SearchAndFuse(const KeyFrameAndPose& CorrectedPosesMap,
     int numFused = matcher.Fuse(pKFi, Scw, vpMapPoints, 4, vpReplacePoints);
 
     // Get Map Mutex
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
     const int nLP = vpMapPoints.size();
     for (int i = 0; i < nLP; i++) {
       MapPoint* pRep = vpReplacePoints[i];
@@ -2286,7 +2250,7 @@ void LoopClosing::SearchAndFuse(const vector<KeyFrame*>& vConectedKFs,
     matcher.Fuse(pKF, Scw, vpMapPoints, 4, vpReplacePoints);
 
     // Get Map Mutex
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
     const int nLP = vpMapPoints.size();
     for (int i = 0; i < nLP; i++) {
       MapPoint* pRep = vpReplacePoints[i];
@@ -2339,6 +2303,10 @@ void LoopClosing::ResetIfRequested() {
     cout << "Loop closer reset requested..." << endl;
     mlpLoopKeyFrameQueue.clear();
     mLastLoopKFid = 0;  // TODO old variable, it is not use in the new algorithm
+    {
+      unique_lock<mutex> lock2(mMutexGBA);
+      mspGBARegionKFs.clear();
+    }
     mbResetRequested = false;
     mbResetActiveMapRequested = false;
   } else if (mbResetActiveMapRequested) {
@@ -2357,8 +2325,56 @@ void LoopClosing::ResetIfRequested() {
   }
 }
 
+void LoopClosing::AddGBARegion(
+    Map* pMap,
+    const vector<pair<KeyFrame*, Sophus::SE3f> >& vPosesBefCorrection) {
+  int nMoved = 0;
+  unique_lock<mutex> lock(mMutexGBA);
+  for (const pair<KeyFrame*, Sophus::SE3f>& poseBef : vPosesBefCorrection) {
+    KeyFrame* pKFi = poseBef.first;
+    if (pKFi->isBad() || pKFi->GetMap() != pMap) continue;
+
+    const Sophus::SE3f Tcorr = pKFi->GetPose() * poseBef.second.inverse();
+    if (Tcorr.translation().norm() > mfGBAMinTranslation ||
+        Tcorr.so3().log().norm() > mfGBAMinRotation) {
+      mspGBARegionKFs.insert(pKFi);
+      nMoved++;
+    }
+  }
+  Verbose::PrintMess("Incremental GBA: " + to_string(nMoved) + " of " +
+                         to_string(vPosesBefCorrection.size()) +
+                         " KFs moved by the correction",
+                     Verbose::VERBOSITY_NORMAL);
+}
+
+void LoopClosing::CollectGBARegion(Map* pMap, vector<KeyFrame*>& vpRegionKFs,
+                                   vector<KeyFrame*>& vpFixedKFs) {
+  set<KeyFrame*> spRegionKFs;
+  {
+    unique_lock<mutex> lock(mMutexGBA);
+    for (KeyFrame* pKFi : mspGBARegionKFs)
+      if (!pKFi->isBad() && pKFi->GetMap() == pMap) spRegionKFs.insert(pKFi);
+  }
+
+  set<KeyFrame*> spFixedKFs;
+  for (KeyFrame* pKFi : spRegionKFs) {
+    for (KeyFrame* pCovKF : pKFi->GetBestCovisibilityKeyFrames(mnGBAHalo)) {
+      if (pCovKF->isBad() || pCovKF->GetMap() != pMap) continue;
+      if (!spRegionKFs.count(pCovKF)) spFixedKFs.insert(pCovKF);
+    }
+  }
+
+  vpRegionKFs.assign(spRegionKFs.begin(), spRegionKFs.end());
+  vpFixedKFs.assign(spFixedKFs.begin(), spFixedKFs.end());
+}
+
 void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap,
-                                            unsigned long nLoopKF) {
+                                            unsigned long nLoopKF,
+                                            const bool bIncremental) {
+  Trace::SetThreadName("GlobalBA");
+  TRACE_SPAN("GlobalBundleAdjustment", "gba");
+  // Holds the map points of the whole map until it returns
+  EpochParticipant epochParticipant;
   Verbose::PrintMess("Starting Global Bundle Adjustment",
                      Verbose::VERBOSITY_NORMAL);
 
@@ -2367,20 +2383,46 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap,
       std::chrono::steady_clock::now();
 
   nFGBA_exec += 1;
-
-  vnGBAKFs.push_back(pActiveMap->GetAllKeyFrames().size());
-  vnGBAMPs.push_back(pActiveMap->GetAllMapPoints().size());
 #endif
 
   const bool bImuInit = pActiveMap->isImuInitialized();
+  const bool bRegion = bIncremental && !bImuInit;
+
+  vector<KeyFrame*> vpRegionKFs, vpFixedKFs;
+  int nRegionMPs = 0;
+  if (bRegion) {
+    CollectGBARegion(pActiveMap, vpRegionKFs, vpFixedKFs);
+    if (vpRegionKFs.empty()) {
+      Verbose::PrintMess("Incremental GBA: no keyframe to refine",
+                         Verbose::VERBOSITY_NORMAL);
+      unique_lock<mutex> lock(mMutexGBA);
+      mbFinishedGBA = true;
+      mbRunningGBA = false;
+      return;
+    }
 
-  if (!bImuInit)
+    Optimizer::RegionBundleAdjustment(vpRegionKFs, vpFixedKFs, 10, &mbStopGBA,
+                                      nLoopKF, nRegionMPs);
+    std::cout << "Incremental GBA: optimized " << vpRegionKFs.size()
+              << " KFs and " << nRegionMPs << " MPs, " << vpFixedKFs.size()
+              << " fixed KFs (map has " << pActiveMap->KeyFramesInMap()
+              << " KFs, " << pActiveMap->MapPointsInMap() << " MPs)"
+              << std::endl;
+  } else if (!bImuInit)
     Optimizer::GlobalBundleAdjustemnt(pActiveMap, 10, &mbStopGBA, nLoopKF,
                                       false);
   else
     Optimizer::FullInertialBA(pActiveMap, 7, false, nLoopKF, &mbStopGBA);
 
 #ifdef REGISTER_TIMES
+  if (bRegion) {
+    vnGBAKFs.push_back(vpRegionKFs.size());
+    vnGBAMPs.push_back(nRegionMPs);
+  } else {
+    vnGBAKFs.push_back(pActiveMap->GetAllKeyFrames().size());
+    vnGBAMPs.push_back(pActiveMap->GetAllMapPoints().size());
+  }
+
   std::chrono::steady_clock::time_point time_EndGBA =
       std::chrono::steady_clock::now();
 
@@ -2422,7 +2464,8 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap,
       }
 
       // Get Map Mutex
-      unique_lock<mutex> lock(pActiveMap->mMutexMapUpdate);
+      unique_lock<mutex> lock =
+          TracedLock(pActiveMap->mMutexMapUpdate, "MapUpdate");
       // cout << "LC: Update Map Mutex adquired" << endl;
 
       // pActiveMap->PrintEssentialGraph();
@@ -2430,6 +2473,20 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap,
       list<KeyFrame*> lpKFtoCheck(pActiveMap->mvpKeyFrameOrigins.begin(),
                                   pActiveMap->mvpKeyFrameOrigins.end());
 
+      if (bRegion) {
+        // Origins outside the region keep their pose, the untouched part of
+        // the spanning tree is then carried along rigidly
+        for (KeyFrame* pKF : lpKFtoCheck) {
+          if (pKF->mnBAGlobalForKF == nLoopKF) continue;
+          pKF->mTcwGBA = pKF->GetPose();
+          if (pKF->isVelocitySet()) pKF->mVwbGBA = pKF->GetVelocity();
+          pKF->mBiasGBA = pKF->GetImuBias();
+          pKF->mnBAGlobalForKF = nLoopKF;
+        }
+
+        for (KeyFrame* pKF : vpRegionKFs) mspGBARegionKFs.erase(pKF);
+      }
+
       while (!lpKFtoCheck.empty()) {
         KeyFrame* pKF = lpKFtoCheck.front();
         const set<KeyFrame*> sChilds = pKF->GetChilds();
@@ -60,6 +60,7 @@ MLPnPsolver::MLPnPsolver(const Frame &F,
       mnIterations(0),
       mnBestInliers(0),
       N(0),
+      mRng(static_cast<unsigned int>(F.mnId)),
       mpCamera(F.mpCamera) {
   mvpMapPointMatches = vpMapPointMatches;
   mvBearingVecs.reserve(F.mvpMapPoints.size());
@@ -133,7 +134,8 @@ bool MLPnPsolver::iterate(int nIterations, bool &bNoMore,
 
     // Get min set of points
     for (short i = 0; i < mRansacMinSet; ++i) {
-      int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size() - 1);
+      int randi = std::uniform_int_distribution<int>(
+          0, vAvailableIndices.size() - 1)(mRng);
 
       int idx = vAvailableIndices[randi];
 
@@ -21,6 +21,7 @@
 
 #include "Map.h"
 
+#include <memory>
 #include <mutex>
 
 namespace ORB_SLAM3 {
@@ -79,7 +80,7 @@ Map::~Map() {
 }
 
 void Map::AddKeyFrame(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   if (mspKeyFrames.empty()) {
     cout << "First KF:" << pKF->mnId << "; Map init KF:" << mnInitKFid << endl;
     mnInitKFid = pKF->mnId;
@@ -87,6 +88,7 @@ void Map::AddKeyFrame(KeyFrame* pKF) {
     mpKFlowerID = pKF;
   }
   mspKeyFrames.insert(pKF);
+  mpKeyFrameSnapshot.reset();
   if (pKF->mnId > mnMaxKFid) {
     mnMaxKFid = pKF->mnId;
   }
@@ -96,31 +98,31 @@ void Map::AddKeyFrame(KeyFrame* pKF) {
 }
 
 void Map::AddMapPoint(MapPoint* pMP) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mspMapPoints.insert(pMP);
+  mpMapPointSnapshot.reset();
 }
 
 void Map::SetImuInitialized() {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mbImuInitialized = true;
 }
 
 bool Map::isImuInitialized() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mbImuInitialized;
 }
 
 void Map::EraseMapPoint(MapPoint* pMP) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mspMapPoints.erase(pMP);
-
-  // TODO: This only erase the pointer.
-  // Delete the MapPoint
+  mpMapPointSnapshot.reset();
 }
 
 void Map::EraseKeyFrame(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mspKeyFrames.erase(pKF);
+  mpKeyFrameSnapshot.reset();
   if (mspKeyFrames.size() > 0) {
     if (pKF->mnId == mpKFlowerID->mnId) {
       vector<KeyFrame*> vpKFs =
@@ -137,58 +139,80 @@ void Map::EraseKeyFrame(KeyFrame* pKF) {
 }
 
 void Map::SetReferenceMapPoints(const vector<MapPoint*>& vpMPs) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mvpReferenceMapPoints = vpMPs;
 }
 
 void Map::InformNewBigChange() {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mnBigChangeIdx++;
 }
 
 int Map::GetLastBigChangeIdx() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mnBigChangeIdx;
 }
 
 vector<KeyFrame*> Map::GetAllKeyFrames() {
-  unique_lock<mutex> lock(mMutexMap);
-  return vector<KeyFrame*>(mspKeyFrames.begin(), mspKeyFrames.end());
+  return *GetKeyFrameSnapshot();
 }
 
 vector<MapPoint*> Map::GetAllMapPoints() {
-  unique_lock<mutex> lock(mMutexMap);
-  return vector<MapPoint*>(mspMapPoints.begin(), mspMapPoints.end());
+  return *GetMapPointSnapshot();
+}
+
+Map::KeyFrameSnapshot Map::GetKeyFrameSnapshot() {
+  {
+    shared_lock<shared_mutex> lock(mMutexMap);
+    if (mpKeyFrameSnapshot) return mpKeyFrameSnapshot;
+  }
+  unique_lock<shared_mutex> lock(mMutexMap);
+  if (!mpKeyFrameSnapshot)
+    mpKeyFrameSnapshot = make_shared<const vector<KeyFrame*>>(
+        mspKeyFrames.begin(), mspKeyFrames.end());
+  return mpKeyFrameSnapshot;
+}
+
+Map::MapPointSnapshot Map::GetMapPointSnapshot() {
+  {
+    shared_lock<shared_mutex> lock(mMutexMap);
+    if (mpMapPointSnapshot) return mpMapPointSnapshot;
+  }
+  unique_lock<shared_mutex> lock(mMutexMap);
+  if (!mpMapPointSnapshot)
+    mpMapPointSnapshot = make_shared<const vector<MapPoint*>>(
+        mspMapPoints.begin(), mspMapPoints.end());
+  return mpMapPointSnapshot;
 }
 
 long unsigned int Map::MapPointsInMap() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mspMapPoints.size();
 }
 
 long unsigned int Map::KeyFramesInMap() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mspKeyFrames.size();
 }
 
 vector<MapPoint*> Map::GetReferenceMapPoints() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mvpReferenceMapPoints;
 }
 
 long unsigned int Map::GetId() { return mnId; }
 long unsigned int Map::GetInitKFid() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mnInitKFid;
 }
 
 void Map::SetInitKFid(long unsigned int initKFif) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mnInitKFid = initKFif;
 }
 
 long unsigned int Map::GetMaxKFid() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mnMaxKFid;
 }
 
@@ -202,7 +226,7 @@ void Map::clear() {
   //    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(),
   //    send=mspMapPoints.end(); sit!=send; sit++)
   //        delete *sit;
-  // unique_lock<mutex> lock(mMutexMap);
+  // unique_lock<shared_mutex> lock(mMutexMap);
   // unique_lock<mutex> lock2(mMutexMapUpdate);
   for (set<KeyFrame*>::iterator sit = mspKeyFrames.begin(),
                                 send = mspKeyFrames.end();
@@ -214,6 +238,8 @@ void Map::clear() {
 
   mspMapPoints.clear();
   mspKeyFrames.clear();
+  mpMapPointSnapshot.reset();
+  mpKeyFrameSnapshot.reset();
   mnMaxKFid = mnInitKFid;
   mbImuInitialized = false;
   mvpReferenceMapPoints.clear();
@@ -230,7 +256,7 @@ bool Map::IsBad() { return mbBad; }
 
 void Map::ApplyScaledRotation(const Sophus::SE3f& T, const float s,
                               const bool bScaledVel) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
 
   // Body position (IMU) of first keyframe is fixed to (0,0,0)
   Sophus::SE3f Tyw = T;
@@ -261,39 +287,39 @@ void Map::ApplyScaledRotation(const Sophus::SE3f& T, const float s,
 }
 
 void Map::SetInertialSensor() {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mbIsInertial = true;
 }
 
 bool Map::IsInertial() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mbIsInertial;
 }
 
 void Map::SetIniertialBA1() {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mbIMU_BA1 = true;
 }
 
 void Map::SetIniertialBA2() {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mbIMU_BA2 = true;
 }
 
 bool Map::GetIniertialBA1() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mbIMU_BA1;
 }
 
 bool Map::GetIniertialBA2() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mbIMU_BA2;
 }
 
 void Map::ChangeId(long unsigned int nId) { mnId = nId; }
 
 unsigned int Map::GetLowerKFID() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   if (mpKFlowerID) {
     return mpKFlowerID->mnId;
   }
@@ -301,22 +327,22 @@ unsigned int Map::GetLowerKFID() {
 }
 
 int Map::GetMapChangeIndex() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mnMapChange;
 }
 
 void Map::IncreaseChangeIndex() {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mnMapChange++;
 }
 
 int Map::GetLastMapChange() {
-  unique_lock<mutex> lock(mMutexMap);
+  shared_lock<shared_mutex> lock(mMutexMap);
   return mnMapChangeNotified;
 }
 
 void Map::SetLastMapChange(int currentChangeId) {
-  unique_lock<mutex> lock(mMutexMap);
+  unique_lock<shared_mutex> lock(mMutexMap);
   mnMapChangeNotified = currentChangeId;
 }
 
@@ -332,9 +358,9 @@ void Map::PreSave(std::set<GeometricCamera*>& spCams) {
     if (pMPi->GetObservations().size() == 0) {
       nMPWithoutObs++;
     }
-    map<KeyFrame*, std::tuple<int, int>> mpObs = pMPi->GetObservations();
-    for (map<KeyFrame*, std::tuple<int, int>>::iterator it = mpObs.begin(),
-                                                        end = mpObs.end();
+    MapPoint::ObservationMap mpObs = pMPi->GetObservations();
+    for (MapPoint::ObservationMap::iterator it = mpObs.begin(),
+                                            end = mpObs.end();
          it != end; ++it) {
       if (it->first->GetMap() != this || it->first->isBad()) {
         pMPi->EraseObservation(it->first);
@@ -455,11 +481,13 @@ void Map::PostLoad(
     KeyFrameDatabase* pKFDB,
     ORBVocabulary*
         pORBVoc /*, map<long unsigned int, KeyFrame*>& mpKeyFrameId*/,
-    map<unsigned int, GeometricCamera*>& mpCams) {
+    map<unsigned int, GeometricCamera*>& mpCams, const bool bAddToDatabase) {
   std::copy(mvpBackupMapPoints.begin(), mvpBackupMapPoints.end(),
             std::inserter(mspMapPoints, mspMapPoints.begin()));
   std::copy(mvpBackupKeyFrames.begin(), mvpBackupKeyFrames.end(),
             std::inserter(mspKeyFrames, mspKeyFrames.begin()));
+  mpMapPointSnapshot.reset();
+  mpKeyFrameSnapshot.reset();
 
   map<long unsigned int, MapPoint*> mpMapPointId;
   for (MapPoint* pMPi : mspMapPoints) {
@@ -490,7 +518,7 @@ void Map::PostLoad(
     if (!pKFi || pKFi->isBad()) continue;
 
     pKFi->PostLoad(mpKeyFrameId, mpMapPointId, mpCams);
-    pKFDB->add(pKFi);
+    if (bAddToDatabase) pKFDB->add(pKFi);
   }
 
   if (mnBackupKFinitialID != -1) {
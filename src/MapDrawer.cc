@@ -137,7 +137,9 @@ void MapDrawer::DrawMapPoints() {
   Map *pActiveMap = mpAtlas->GetCurrentMap();
   if (!pActiveMap) return;
 
-  const vector<MapPoint *> &vpMPs = pActiveMap->GetAllMapPoints();
+  // Shared with the other readers, no copy while the map does not change
+  const Map::MapPointSnapshot pMPs = pActiveMap->GetMapPointSnapshot();
+  const vector<MapPoint *> &vpMPs = *pMPs;
   const vector<MapPoint *> &vpRefMPs = pActiveMap->GetReferenceMapPoints();
 
   set<MapPoint *> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
@@ -183,7 +185,8 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph,
 
   if (!pActiveMap) return;
 
-  const vector<KeyFrame *> vpKFs = pActiveMap->GetAllKeyFrames();
+  const Map::KeyFrameSnapshot pKFs = pActiveMap->GetKeyFrameSnapshot();
+  const vector<KeyFrame *> &vpKFs = *pKFs;
 
   if (bDrawKF) {
     for (size_t i = 0; i < vpKFs.size(); i++) {
@@ -315,7 +318,8 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph,
     for (Map *pMap : vpMaps) {
       if (pMap == pActiveMap) continue;
 
-      vector<KeyFrame *> vpKFs = pMap->GetAllKeyFrames();
+      const Map::KeyFrameSnapshot pKFs = pMap->GetKeyFrameSnapshot();
+      const vector<KeyFrame *> &vpKFs = *pKFs;
 
       for (size_t i = 0; i < vpKFs.size(); i++) {
         KeyFrame *pKF = vpKFs[i];
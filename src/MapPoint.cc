@@ -21,13 +21,72 @@
 
 #include "MapPoint.h"
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
 #include <mutex>
 
+#include "EpochReclaimer.h"
 #include "ORBmatcher.h"
 
 namespace ORB_SLAM3 {
 
+namespace {
+
+// Adds n to the covisibility of pKF with every other keyframe in obs, both
+// ways
+void ChangeCovisibility(KeyFrame* pKF, const MapPoint::ObservationMap& obs,
+                        const int n) {
+  for (MapPoint::ObservationMap::const_iterator mit = obs.begin(),
+                                                mend = obs.end();
+       mit != mend; mit++) {
+    if (mit->first == pKF) continue;
+    pKF->ChangeCovisibility(mit->first, n);
+    mit->first->ChangeCovisibility(pKF, n);
+  }
+}
+
+// Adds n to the covisibility of every pair of keyframes in obs
+void ChangeCovisibility(const MapPoint::ObservationMap& obs, const int n) {
+  for (MapPoint::ObservationMap::const_iterator mit = obs.begin(),
+                                                mend = obs.end();
+       mit != mend; mit++) {
+    for (MapPoint::ObservationMap::const_iterator mit2 = std::next(mit);
+         mit2 != mend; mit2++) {
+      mit->first->ChangeCovisibility(mit2->first, n);
+      mit2->first->ChangeCovisibility(mit->first, n);
+    }
+  }
+}
+
+// Finest scale level at which pKF sees the point
+int ObservationLevel(KeyFrame* pKF, const tuple<int, int>& indexes) {
+  const int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+  if (pKF->NLeft == -1) return pKF->mvKeysUn[leftIndex].octave;
+
+  int level = -1;
+  if (leftIndex != -1) level = pKF->mvKeys[leftIndex].octave;
+  if (rightIndex != -1) {
+    const int rightLevel = pKF->mvKeysRight[rightIndex - pKF->NLeft].octave;
+    if (level == -1 || level > rightLevel) level = rightLevel;
+  }
+  return level;
+}
+
+void ChangeObservationsPerLevel(vector<int>& vnPerLevel, const int level,
+                                const int n) {
+  if (level < 0) return;
+  if (level >= static_cast<int>(vnPerLevel.size()))
+    vnPerLevel.resize(level + 1, 0);
+  vnPerLevel[level] += n;
+}
+
+}  // namespace
+
 long unsigned int MapPoint::nNextId = 0;
+int MapPoint::nMaxDescriptorSamples = 0;
 mutex MapPoint::mGlobalMutex;
 
 MapPoint::MapPoint()
@@ -190,45 +249,60 @@ Eigen::Vector3f MapPoint::GetNormal() {
 }
 
 KeyFrame* MapPoint::GetReferenceKeyFrame() {
-  unique_lock<mutex> lock(mMutexFeatures);
+  shared_lock<shared_mutex> lock(mMutexFeatures);
   return mpRefKF;
 }
 void MapPoint::SetTrackFeature(KeyFrame* pKFini,
                                std::shared_ptr<feature_pt> track_feature) {
-  unique_lock<mutex> lock(mMutexFeatures);
+  unique_lock<shared_mutex> lock(mMutexFeatures);
   feature = track_feature;
   feature->first_kf = pKFini;
   feature->is_3d = true;
   feature->mp = this;
 }
 void MapPoint::AddObservation(KeyFrame* pKF, int idx) {
-  unique_lock<mutex> lock(mMutexFeatures);
-  tuple<int, int> indexes;
+  // Keyframes that saw the point before a new one, snapshot together with
+  // the insertion so concurrent observers count each pair once
+  ObservationMap obs;
+  {
+    unique_lock<shared_mutex> lock(mMutexFeatures);
+    tuple<int, int> indexes;
+
+    const bool bNew = !mObservations.count(pKF);
+    if (!bNew) {
+      indexes = mObservations[pKF];
+      ChangeObservationsPerLevel(mvnObservationsPerLevel,
+                                 ObservationLevel(pKF, indexes), -1);
+    } else {
+      indexes = tuple<int, int>(-1, -1);
+    }
 
-  if (mObservations.count(pKF)) {
-    indexes = mObservations[pKF];
-  } else {
-    indexes = tuple<int, int>(-1, -1);
-  }
+    if (pKF->NLeft != -1 && idx >= pKF->NLeft) {
+      get<1>(indexes) = idx;
+    } else {
+      get<0>(indexes) = idx;
+    }
 
-  if (pKF->NLeft != -1 && idx >= pKF->NLeft) {
-    get<1>(indexes) = idx;
-  } else {
-    get<0>(indexes) = idx;
-  }
+    mObservations[pKF] = indexes;
+    ChangeObservationsPerLevel(mvnObservationsPerLevel,
+                               ObservationLevel(pKF, indexes), 1);
+    if (bNew) obs = mObservations;
 
-  mObservations[pKF] = indexes;
+    if (!pKF->mpCamera2 && pKF->mvuRight[idx] >= 0)
+      nObs += 2;
+    else
+      nObs++;
+  }
 
-  if (!pKF->mpCamera2 && pKF->mvuRight[idx] >= 0)
-    nObs += 2;
-  else
-    nObs++;
+  ChangeCovisibility(pKF, obs, 1);
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF) {
   bool bBad = false;
+  bool bErased = false;
+  ObservationMap obs;
   {
-    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<shared_mutex> lock(mMutexFeatures);
     if (mObservations.count(pKF)) {
       tuple<int, int> indexes = mObservations[pKF];
       int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
@@ -243,15 +317,21 @@ void MapPoint::EraseObservation(KeyFrame* pKF) {
         nObs--;
       }
 
+      ChangeObservationsPerLevel(mvnObservationsPerLevel,
+                                 ObservationLevel(pKF, indexes), -1);
       mObservations.erase(pKF);
+      bErased = true;
+      obs = mObservations;
 
-      if (mpRefKF == pKF) mpRefKF = mObservations.begin()->first;
+      if (mpRefKF == pKF && !mObservations.empty())
+        mpRefKF = mObservations.begin()->first;
 
       // If only 2 observations or less, discard point
       if (nObs <= 2) bBad = true;
     }
   }
 
+  if (bErased) ChangeCovisibility(pKF, obs, -1);
   if (bBad) SetBadFlag();
 }
 
@@ -259,27 +339,46 @@ void MapPoint::EraseObservation(KeyFrame* pKF) {
 //     unique_lock<mutex> lock(mMutexFeaturesUpdate);
 
 // }
-std::map<KeyFrame*, std::tuple<int, int>> MapPoint::GetObservations() {
-  unique_lock<mutex> lock(mMutexFeatures);
+MapPoint::ObservationMap MapPoint::GetObservations() {
+  shared_lock<shared_mutex> lock(mMutexFeatures);
   return mObservations;
 }
 
-int MapPoint::Observations() {
-  unique_lock<mutex> lock(mMutexFeatures);
-  return nObs;
+int MapPoint::Observations() { return nObs.load(std::memory_order_relaxed); }
+
+int MapPoint::ObservationsUpToLevel(const int nLevel, KeyFrame* pKF) {
+  shared_lock<shared_mutex> lock(mMutexFeatures);
+  int n = 0;
+  const int nLevels = mvnObservationsPerLevel.size();
+  for (int level = 0; level <= nLevel && level < nLevels; level++)
+    n += mvnObservationsPerLevel[level];
+
+  ObservationMap::const_iterator mit = mObservations.find(pKF);
+  if (mit != mObservations.end()) {
+    const int level = ObservationLevel(pKF, mit->second);
+    if (level >= 0 && level <= nLevel) n--;
+  }
+  return n;
 }
 
 void MapPoint::SetBadFlag() {
-  map<KeyFrame*, tuple<int, int>> obs;
+  ObservationMap obs;
+  bool bWasBad;
   {
-    unique_lock<mutex> lock1(mMutexFeatures);
+    unique_lock<shared_mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
+    bWasBad = mbBad;
     mbBad = true;
-    obs = mObservations;
+    obs = std::move(mObservations);
     mObservations.clear();
+    mvnObservationsPerLevel.clear();
+  }
+  {
+    unique_lock<mutex> lock(mMutexDescriptorSamples);
+    mDescriptorSamples = DescriptorSamples();
   }
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = obs.begin(),
-                                                 mend = obs.end();
+  ChangeCovisibility(obs, -1);
+  for (ObservationMap::iterator mit = obs.begin(), mend = obs.end();
        mit != mend; mit++) {
     KeyFrame* pKF = mit->first;
     int leftIndex = get<0>(mit->second), rightIndex = get<1>(mit->second);
@@ -292,10 +391,12 @@ void MapPoint::SetBadFlag() {
   }
 
   mpMap->EraseMapPoint(this);
+  // Freed once no thread can still hold it
+  if (!bWasBad) EpochReclaimer::Retire(this);
 }
 
 MapPoint* MapPoint::GetReplaced() {
-  unique_lock<mutex> lock1(mMutexFeatures);
+  shared_lock<shared_mutex> lock1(mMutexFeatures);
   unique_lock<mutex> lock2(mMutexPos);
   return mpReplaced;
 }
@@ -304,20 +405,28 @@ void MapPoint::Replace(MapPoint* pMP) {
   if (pMP->mnId == this->mnId) return;
 
   int nvisible, nfound;
-  map<KeyFrame*, tuple<int, int>> obs;
+  ObservationMap obs;
+  bool bWasBad;
   {
-    unique_lock<mutex> lock1(mMutexFeatures);
+    unique_lock<shared_mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
-    obs = mObservations;
+    obs = std::move(mObservations);
     mObservations.clear();
+    mvnObservationsPerLevel.clear();
+    bWasBad = mbBad;
     mbBad = true;
     nvisible = mnVisible;
     nfound = mnFound;
     mpReplaced = pMP;
   }
+  {
+    unique_lock<mutex> lock(mMutexDescriptorSamples);
+    mDescriptorSamples = DescriptorSamples();
+  }
+  // The observations moved to pMP are counted again as they are added
+  ChangeCovisibility(obs, -1);
 
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = obs.begin(),
-                                                 mend = obs.end();
+  for (ObservationMap::iterator mit = obs.begin(), mend = obs.end();
        mit != mend; mit++) {
     // Replace measurement in keyframe
     KeyFrame* pKF = mit->first;
@@ -348,10 +457,11 @@ void MapPoint::Replace(MapPoint* pMP) {
   pMP->ComputeDistinctiveDescriptors();
 
   mpMap->EraseMapPoint(this);
+  if (!bWasBad) EpochReclaimer::Retire(this);
 }
 
 bool MapPoint::isBad() {
-  unique_lock<mutex> lock1(mMutexFeatures, std::defer_lock);
+  shared_lock<shared_mutex> lock1(mMutexFeatures, std::defer_lock);
   unique_lock<mutex> lock2(mMutexPos, std::defer_lock);
   lock(lock1, lock2);
 
@@ -359,38 +469,37 @@ bool MapPoint::isBad() {
 }
 
 void MapPoint::IncreaseVisible(int n) {
-  unique_lock<mutex> lock(mMutexFeatures);
+  unique_lock<shared_mutex> lock(mMutexFeatures);
   mnVisible += n;
 }
 
 void MapPoint::IncreaseFound(int n) {
-  unique_lock<mutex> lock(mMutexFeatures);
+  unique_lock<shared_mutex> lock(mMutexFeatures);
   mnFound += n;
 }
 
 float MapPoint::GetFoundRatio() {
-  unique_lock<mutex> lock(mMutexFeatures);
+  shared_lock<shared_mutex> lock(mMutexFeatures);
   return static_cast<float>(mnFound) / mnVisible;
 }
 
 void MapPoint::ComputeDistinctiveDescriptors() {
-  // Retrieve all observed descriptors
-  vector<cv::Mat> vDescriptors;
-
-  map<KeyFrame*, tuple<int, int>> observations;
+  ObservationMap observations;
 
   {
-    unique_lock<mutex> lock1(mMutexFeatures);
+    shared_lock<shared_mutex> lock1(mMutexFeatures);
     if (mbBad) return;
     observations = mObservations;
   }
 
   if (observations.empty()) return;
 
-  vDescriptors.reserve(observations.size());
+  // Retrieve all observed descriptors
+  vector<pair<KeyFrame*, int>> vKeys;
+  vKeys.reserve(2 * observations.size());
 
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                 mend = observations.end();
+  for (ObservationMap::iterator mit = observations.begin(),
+                                mend = observations.end();
        mit != mend; mit++) {
     KeyFrame* pKF = mit->first;
     if (!pKF) continue;
@@ -398,42 +507,91 @@ void MapPoint::ComputeDistinctiveDescriptors() {
       tuple<int, int> indexes = mit->second;
       int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
 
-      if (leftIndex != -1&& leftIndex < pKF->mDescriptors.rows) {
-        vDescriptors.push_back(pKF->mDescriptors.row(leftIndex));
+      if (leftIndex != -1 && leftIndex < pKF->mDescriptors.rows) {
+        vKeys.push_back(make_pair(pKF, leftIndex));
       }
-      if (rightIndex != -1&& rightIndex < pKF->mDescriptors.rows) {
-        vDescriptors.push_back(pKF->mDescriptors.row(rightIndex));
+      if (rightIndex != -1 && rightIndex < pKF->mDescriptors.rows) {
+        vKeys.push_back(make_pair(pKF, rightIndex));
       }
     }
   }
 
-  if (vDescriptors.empty()) {
+  if (vKeys.empty()) {
     std::cerr << "Error: vDescriptors is empty!" << std::endl;
     return;
   }
 
-  // Compute distances between them
-  const size_t N = vDescriptors.size();
+  // Evenly spaced subset for very well observed points
+  const size_t nMaxSamples = nMaxDescriptorSamples;
+  if (nMaxSamples > 0 && vKeys.size() > nMaxSamples) {
+    vector<pair<KeyFrame*, int>> vSubset(nMaxSamples);
+    for (size_t i = 0; i < nMaxSamples; i++)
+      vSubset[i] = vKeys[i * vKeys.size() / nMaxSamples];
+    vKeys.swap(vSubset);
+  }
 
-  float Distances[N][N];
+  // Published under the samples lock, so concurrent updates store their
+  // descriptors in the order they updated the samples
+  unique_lock<mutex> lock(mMutexDescriptorSamples);
+  cv::Mat best = mDescriptorSamples.Update(vKeys);
+  unique_lock<shared_mutex> lock2(mMutexFeatures);
+  mDescriptor = best;
+}
+
+cv::Mat MapPoint::DescriptorSamples::Update(
+    const vector<pair<KeyFrame*, int>>& vNewKeys) {
+  const size_t N = vNewKeys.size();
+  const size_t nOld = vKeys.size();
+
+  // Samples kept from the previous call
+  vector<int> vOldIdx(N, -1);
+  for (size_t i = 0; i < N; i++) {
+    for (size_t j = 0; j < nOld; j++) {
+      if (vKeys[j] == vNewKeys[i]) {
+        vOldIdx[i] = j;
+        break;
+      }
+    }
+  }
+
+  cv::Mat newDescriptors(N, 32, CV_8U);
   for (size_t i = 0; i < N; i++) {
-    Distances[i][i] = 0;
+    if (vOldIdx[i] >= 0)
+      descriptors.row(vOldIdx[i]).copyTo(newDescriptors.row(i));
+    else
+      vNewKeys[i].first->mDescriptors.row(vNewKeys[i].second).copyTo(
+          newDescriptors.row(i));
+  }
+
+  // Only pairs involving a new sample are matched
+  vector<uint16_t> vNewDistances(N * N);
+  for (size_t i = 0; i < N; i++) {
+    vNewDistances[i * N + i] = 0;
     for (size_t j = i + 1; j < N; j++) {
-      if (j == N) continue;
-      int distij =
-          ORBmatcher::DescriptorDistance(vDescriptors[i], vDescriptors[j]);
-      Distances[i][j] = distij;
-      Distances[j][i] = distij;
+      int distij;
+      if (vOldIdx[i] >= 0 && vOldIdx[j] >= 0)
+        distij = vDistances[vOldIdx[i] * nOld + vOldIdx[j]];
+      else
+        distij = ORBmatcher::DescriptorDistance(newDescriptors.row(i),
+                                                newDescriptors.row(j));
+      vNewDistances[i * N + j] = distij;
+      vNewDistances[j * N + i] = distij;
     }
   }
 
+  vKeys = vNewKeys;
+  descriptors = newDescriptors;
+  vDistances.swap(vNewDistances);
+
   // Take the descriptor with least median distance to the rest
   int BestMedian = INT_MAX;
   int BestIdx = 0;
+  vector<uint16_t> vDists(N);
   for (size_t i = 0; i < N; i++) {
-    vector<int> vDists(Distances[i], Distances[i] + N);
-    sort(vDists.begin(), vDists.end());
-    int median = vDists[0.5 * (N - 1)];
+    vDists.assign(vDistances.begin() + i * N, vDistances.begin() + (i + 1) * N);
+    vector<uint16_t>::iterator itMedian = vDists.begin() + (N - 1) / 2;
+    nth_element(vDists.begin(), itMedian, vDists.end());
+    int median = *itMedian;
 
     if (median < BestMedian) {
       BestMedian = median;
@@ -441,36 +599,34 @@ void MapPoint::ComputeDistinctiveDescriptors() {
     }
   }
 
-  {
-    unique_lock<mutex> lock(mMutexFeatures);
-    mDescriptor = vDescriptors[BestIdx].clone();
-  }
+  return descriptors.row(BestIdx).clone();
 }
 
 cv::Mat MapPoint::GetDescriptor() {
-  unique_lock<mutex> lock(mMutexFeatures);
+  shared_lock<shared_mutex> lock(mMutexFeatures);
   return mDescriptor.clone();
 }
 
 tuple<int, int> MapPoint::GetIndexInKeyFrame(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutexFeatures);
-  if (mObservations.count(pKF))
-    return mObservations[pKF];
+  shared_lock<shared_mutex> lock(mMutexFeatures);
+  ObservationMap::const_iterator it = mObservations.find(pKF);
+  if (it != mObservations.end())
+    return it->second;
   else
     return tuple<int, int>(-1, -1);
 }
 
 bool MapPoint::IsInKeyFrame(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutexFeatures);
+  shared_lock<shared_mutex> lock(mMutexFeatures);
   return (mObservations.count(pKF));
 }
 
 void MapPoint::UpdateNormalAndDepth() {
-  map<KeyFrame*, tuple<int, int>> observations;
+  ObservationMap observations;
   KeyFrame* pRefKF;
   Eigen::Vector3f Pos;
   {
-    unique_lock<mutex> lock1(mMutexFeatures);
+    shared_lock<shared_mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
     if (mbBad) return;
     observations = mObservations;
@@ -483,8 +639,8 @@ void MapPoint::UpdateNormalAndDepth() {
   Eigen::Vector3f normal;
   normal.setZero();
   int n = 0;
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                 mend = observations.end();
+  for (ObservationMap::iterator mit = observations.begin(),
+                                mend = observations.end();
        mit != mend; mit++) {
     KeyFrame* pKF = mit->first;
 
@@ -580,8 +736,8 @@ int MapPoint::PredictScale(const float& currentDist, Frame* pF) {
 
 void MapPoint::PrintObservations() {
   cout << "MP_OBS: MP " << mnId << endl;
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = mObservations.begin(),
-                                                 mend = mObservations.end();
+  for (ObservationMap::iterator mit = mObservations.begin(),
+                                mend = mObservations.end();
        mit != mend; mit++) {
     KeyFrame* pKFi = mit->first;
     tuple<int, int> indexes = mit->second;
@@ -609,12 +765,10 @@ void MapPoint::PreSave(set<KeyFrame*>& spKF, set<MapPoint*>& spMP) {
   mBackupObservationsId1.clear();
   mBackupObservationsId2.clear();
   // Save the id and position in each KF who view it
-  std::map<KeyFrame*, std::tuple<int, int>> tmp_mObservations;
-  tmp_mObservations.insert(mObservations.begin(), mObservations.end());
+  const ObservationMap tmp_mObservations = mObservations;
 
-  for (std::map<KeyFrame*, std::tuple<int, int>>::const_iterator
-           it = tmp_mObservations.begin(),
-           end = tmp_mObservations.end();
+  for (ObservationMap::const_iterator it = tmp_mObservations.begin(),
+                                      end = tmp_mObservations.end();
        it != end; ++it) {
     KeyFrame* pKFi = it->first;
     if (spKF.find(pKFi) != spKF.end()) {
@@ -677,6 +831,7 @@ void MapPoint::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid,
   }
 
   mObservations.clear();
+  mvnObservationsPerLevel.clear();
 
   for (map<long unsigned int, int>::const_iterator
            it = mBackupObservationsId1.begin(),
@@ -688,8 +843,11 @@ void MapPoint::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid,
     std::tuple<int, int> indexes = tuple<int, int>(it->second, it2->second);
     if (pKFi) {
       mObservations[pKFi] = indexes;
+      ChangeObservationsPerLevel(mvnObservationsPerLevel,
+                                 ObservationLevel(pKFi, indexes), 1);
     }
   }
+  ChangeCovisibility(mObservations, 1);
 
   mBackupObservationsId1.clear();
   mBackupObservationsId2.clear();
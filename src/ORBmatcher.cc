@@ -1377,6 +1377,15 @@ int ORBmatcher::SearchForTriangulation(
 
 int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
                      const float th, const bool bRight) {
+  vector<int> vnFuseIdx;
+  SearchForFusion(pKF, vpMapPoints, vnFuseIdx, th, bRight);
+  return FuseMatches(pKF, vpMapPoints, vnFuseIdx);
+}
+
+void ORBmatcher::SearchForFusion(KeyFrame *pKF,
+                                 const vector<MapPoint *> &vpMapPoints,
+                                 vector<int> &vnFuseIdx, const float th,
+                                 const bool bRight) {
   GeometricCamera *pCamera;
   Sophus::SE3f Tcw;
   Eigen::Vector3f Ow;
@@ -1397,48 +1406,30 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
   const float &cy = pKF->cy;
   const float &bf = pKF->mbf;
 
-  int nFused = 0;
-
   const int nMPs = vpMapPoints.size();
+  vnFuseIdx.assign(nMPs, -1);
 
-  // For debbuging
-  int count_notMP = 0, count_bad = 0, count_isinKF = 0, count_negdepth = 0,
-      count_notinim = 0, count_dist = 0, count_normal = 0, count_notidx = 0,
-      count_thcheck = 0;
+  // Each point is matched on its own, the map is only read
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
   for (int i = 0; i < nMPs; i++) {
     MapPoint *pMP = vpMapPoints[i];
 
-    if (!pMP) {
-      count_notMP++;
-      continue;
-    }
-
-    if (pMP->isBad()) {
-      count_bad++;
-      continue;
-    } else if (pMP->IsInKeyFrame(pKF)) {
-      count_isinKF++;
-      continue;
-    }
+    if (!pMP || pMP->isBad() || pMP->IsInKeyFrame(pKF)) continue;
 
     Eigen::Vector3f p3Dw = pMP->GetWorldPos();
     Eigen::Vector3f p3Dc = Tcw * p3Dw;
 
     // Depth must be positive
-    if (p3Dc(2) < 0.0f) {
-      count_negdepth++;
-      continue;
-    }
+    if (p3Dc(2) < 0.0f) continue;
 
     const float invz = 1 / p3Dc(2);
 
     const Eigen::Vector2f uv = pCamera->project(p3Dc);
 
     // Point must be inside the image
-    if (!pKF->IsInImage(uv(0), uv(1))) {
-      count_notinim++;
-      continue;
-    }
+    if (!pKF->IsInImage(uv(0), uv(1))) continue;
 
     const float ur = uv(0) - bf * invz;
 
@@ -1448,18 +1439,12 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
     const float dist3D = PO.norm();
 
     // Depth must be inside the scale pyramid of the image
-    if (dist3D < minDistance || dist3D > maxDistance) {
-      count_dist++;
-      continue;
-    }
+    if (dist3D < minDistance || dist3D > maxDistance) continue;
 
     // Viewing angle must be less than 60 deg
     Eigen::Vector3f Pn = pMP->GetNormal();
 
-    if (PO.dot(Pn) < 0.5 * dist3D) {
-      count_normal++;
-      continue;
-    }
+    if (PO.dot(Pn) < 0.5 * dist3D) continue;
 
     int nPredictedLevel = pMP->PredictScale(dist3D, pKF);
 
@@ -1469,10 +1454,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
     const vector<size_t> vIndices =
         pKF->GetFeaturesInArea(uv(0), uv(1), radius, bRight);
 
-    if (vIndices.empty()) {
-      count_notidx++;
-      continue;
-    }
+    if (vIndices.empty()) continue;
 
     // Match to the most similar keypoint in the radius
 
@@ -1525,23 +1507,38 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
       }
     }
 
+    if (bestDist <= TH_LOW) vnFuseIdx[i] = bestIdx;
+  }
+}
+
+int ORBmatcher::FuseMatches(KeyFrame *pKF,
+                            const vector<MapPoint *> &vpMapPoints,
+                            const vector<int> &vnFuseIdx) {
+  int nFused = 0;
+
+  // Earlier fusions may have replaced a point or filled the slot, both are
+  // checked again in order
+  for (size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
+    const int bestIdx = vnFuseIdx[i];
+    if (bestIdx < 0) continue;
+
+    MapPoint *pMP = vpMapPoints[i];
+    if (pMP->isBad() || pMP->IsInKeyFrame(pKF)) continue;
+
     // If there is already a MapPoint replace otherwise add new measurement
-    if (bestDist <= TH_LOW) {
-      MapPoint *pMPinKF = pKF->GetMapPoint(bestIdx);
-      if (pMPinKF) {
-        if (!pMPinKF->isBad()) {
-          if (pMPinKF->Observations() > pMP->Observations())
-            pMP->Replace(pMPinKF);
-          else
-            pMPinKF->Replace(pMP);
-        }
-      } else {
-        pMP->AddObservation(pKF, bestIdx);
-        pKF->AddMapPoint(pMP, bestIdx);
+    MapPoint *pMPinKF = pKF->GetMapPoint(bestIdx);
+    if (pMPinKF) {
+      if (!pMPinKF->isBad()) {
+        if (pMPinKF->Observations() > pMP->Observations())
+          pMP->Replace(pMPinKF);
+        else
+          pMPinKF->Replace(pMP);
       }
-      nFused++;
-    } else
-      count_thcheck++;
+    } else {
+      pMP->AddObservation(pKF, bestIdx);
+      pKF->AddMapPoint(pMP, bestIdx);
+    }
+    nFused++;
   }
 
   return nFused;
@@ -2534,8 +2531,12 @@ void ORBmatcher::ComputeThreeMaxima(vector<int> *histo, const int L, int &ind1,
 // Bit set count operation from
 // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
 int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b) {
-  const int *pa = a.ptr<int32_t>();
-  const int *pb = b.ptr<int32_t>();
+  return DescriptorDistance(a.ptr<uchar>(), b.ptr<uchar>());
+}
+
+int ORBmatcher::DescriptorDistance(const uchar *a, const uchar *b) {
+  const int *pa = reinterpret_cast<const int32_t *>(a);
+  const int *pb = reinterpret_cast<const int32_t *>(b);
 
   int dist = 0;
 
@@ -30,6 +30,7 @@
 #include "Converter.h"
 #include "G2oTypes.h"
 #include "OptimizableTypes.h"
+#include "Trace.h"
 #include "Thirdparty/g2o/g2o/core/block_solver.h"
 #include "Thirdparty/g2o/g2o/core/optimization_algorithm_gauss_newton.h"
 #include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
@@ -40,6 +41,20 @@
 #include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
 
 namespace ORB_SLAM3 {
+ICPConstraintCache* Optimizer::mpICPCache =
+    static_cast<ICPConstraintCache*>(NULL);
+
+void Optimizer::SetICPConstraintCache(ICPConstraintCache* pICPCache) {
+  mpICPCache = pICPCache;
+}
+
+ICPConstraint Optimizer::RegisterKeyFramePair(KeyFrame* pTargetKF,
+                                              KeyFrame* pSourceKF,
+                                              const Eigen::Isometry3d& init_T) {
+  if (mpICPCache) return mpICPCache->Get(pTargetKF, pSourceKF, init_T);
+  return ICPConstraintCache::Register(pTargetKF, pSourceKF, init_T);
+}
+
 bool sortByVal(const pair<MapPoint*, int>& a, const pair<MapPoint*, int>& b) {
   return (a.second < b.second);
 }
@@ -53,10 +68,47 @@ void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations,
   BundleAdjustment(vpKFs, vpMP, nIterations, pbStopFlag, nLoopKF, bRobust);
 }
 
+void Optimizer::RegionBundleAdjustment(const vector<KeyFrame*>& vpKFs,
+                                       const vector<KeyFrame*>& vpFixedKFs,
+                                       int nIterations, bool* pbStopFlag,
+                                       const unsigned long nLoopKF,
+                                       int& nOptMPs) {
+  nOptMPs = 0;
+  if (vpKFs.empty()) return;
+
+  set<KeyFrame*> spFixedKFs(vpFixedKFs.begin(), vpFixedKFs.end());
+  vector<KeyFrame*> vpAllKFs(vpKFs);
+  vpAllKFs.insert(vpAllKFs.end(), vpFixedKFs.begin(), vpFixedKFs.end());
+
+  // Without fixed neighbours the oldest keyframe anchors the gauge
+  if (spFixedKFs.empty()) {
+    KeyFrame* pOldestKF = vpKFs[0];
+    for (KeyFrame* pKFi : vpKFs)
+      if (pKFi->mnId < pOldestKF->mnId) pOldestKF = pKFi;
+    spFixedKFs.insert(pOldestKF);
+  }
+
+  set<MapPoint*> spMPs;
+  vector<MapPoint*> vpMPs;
+  for (KeyFrame* pKFi : vpKFs) {
+    if (pKFi->isBad()) continue;
+    for (MapPoint* pMP : pKFi->GetMapPointMatches()) {
+      if (!pMP || pMP->isBad()) continue;
+      if (spMPs.insert(pMP).second) vpMPs.push_back(pMP);
+    }
+  }
+  nOptMPs = vpMPs.size();
+
+  BundleAdjustment(vpAllKFs, vpMPs, nIterations, pbStopFlag, nLoopKF, false,
+                   &spFixedKFs);
+}
+
 void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
                                  const vector<MapPoint*>& vpMP, int nIterations,
                                  bool* pbStopFlag, const unsigned long nLoopKF,
-                                 const bool bRobust) {
+                                 const bool bRobust,
+                                 const set<KeyFrame*>* pspFixedKFs) {
+  TRACE_SPAN("BundleAdjustment", "optimizer");
   vector<bool> vbNotIncludedMP;
   vbNotIncludedMP.resize(vpMP.size());
 
@@ -118,7 +170,8 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
     vSE3->setEstimate(g2o::SE3Quat(Tcw.unit_quaternion().cast<double>(),
                                    Tcw.translation().cast<double>()));
     vSE3->setId(pKF->mnId);
-    vSE3->setFixed(pKF->mnId == pMap->GetInitKFid());
+    vSE3->setFixed(pKF->mnId == pMap->GetInitKFid() ||
+                   (pspFixedKFs && pspFixedKFs->count(pKF)));
     optimizer.addVertex(vSE3);
     if (pKF->mnId > maxKFid) maxKFid = pKF->mnId;
   }
@@ -137,12 +190,11 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     int nEdges = 0;
     // SET EDGES
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator mit =
-             observations.begin();
+    for (MapPoint::ObservationMap::const_iterator mit = observations.begin();
          mit != observations.end(); mit++) {
       KeyFrame* pKF = mit->first;
       if (pKF->isBad() || pKF->mnId > maxKFid) continue;
@@ -170,7 +222,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
         e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
         if (bRobust) {
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuber2D);
         }
@@ -203,7 +255,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
         e->setInformation(Info);
 
         if (bRobust) {
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuber3D);
         }
@@ -242,7 +294,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
           const float& invSigma2 = pKF->mvInvLevelSigma2[kp.octave];
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuber2D);
 
@@ -367,6 +419,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
                                bool* pbStopFlag, bool bInit, float priorG,
                                float priorA, Eigen::VectorXd* vSingVal,
                                bool* bHess) {
+  TRACE_SPAN("FullInertialBA", "optimizer");
   long unsigned int maxKFid = pMap->GetMaxKFid();
   const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
   const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
@@ -499,7 +552,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
         ei->setVertex(4, dynamic_cast<g2o::OptimizableGraph::Vertex*>(VP2));
         ei->setVertex(5, dynamic_cast<g2o::OptimizableGraph::Vertex*>(VV2));
 
-        g2o::RobustKernelHuber* rki = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rki = new PooledRobustKernelHuber;
         ei->setRobustKernel(rki);
         rki->setDelta(sqrt(16.0));
 
@@ -570,12 +623,12 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     bool bAllFixed = true;
 
     // Set edges
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationMap::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -610,7 +663,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
 
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -639,7 +692,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
 
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -671,7 +724,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
             const float invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(thHuberMono);
 
@@ -832,7 +885,7 @@ int Optimizer::PoseOptimization(Frame* pFrame,
             const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaMono);
 
@@ -867,7 +920,7 @@ int Optimizer::PoseOptimization(Frame* pFrame,
             Eigen::Matrix3d Info = Eigen::Matrix3d::Identity() * invSigma2;
             e->setInformation(Info);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaStereo);
 
@@ -907,7 +960,7 @@ int Optimizer::PoseOptimization(Frame* pFrame,
             const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaMono);
 
@@ -936,7 +989,7 @@ int Optimizer::PoseOptimization(Frame* pFrame,
             const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaMono);
 
@@ -1102,14 +1155,13 @@ void Optimizer::LocalVisualLidarBA(
     KeyFrame* pKF, pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMapDS,
     bool* pbStopFlag, bool pbICPFlag, Map* pMap, int& num_fixedKF,
     int& num_OptKF, int& num_MPs, int& num_edges) {
+  TRACE_SPAN("LocalVisualLidarBA", "optimizer");
   // Local KeyFrames: First Breath Search from Current Keyframe
   list<KeyFrame*> lLocalKeyFrames;
 
   lLocalKeyFrames.push_back(pKF);
   pKF->mnBALocalForKF = pKF->mnId;
   Map* pCurrentMap = pKF->GetMap();
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   const vector<KeyFrame*> vNeighKFs = pKF->GetVectorCovisibleKeyFrames();
   for (int i = 0, iend = vNeighKFs.size(); i < iend; i++) {
     KeyFrame* pKFi = vNeighKFs[i];
@@ -1149,9 +1201,9 @@ void Optimizer::LocalVisualLidarBA(
   for (list<MapPoint*>::iterator lit = lLocalMapPoints.begin(),
                                  lend = lLocalMapPoints.end();
        lit != lend; lit++) {
-    map<KeyFrame*, tuple<int, int>> observations = (*lit)->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    MapPoint::ObservationMap observations = (*lit)->GetObservations();
+    for (MapPoint::ObservationMap::iterator mit = observations.begin(),
+                                            mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -1297,8 +1349,8 @@ void Optimizer::LocalVisualLidarBA(
         g2o::VertexSim3Expmap* vCurrKF =
             dynamic_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(pKFi->mnId));
         if (!vPrevKF || !vCurrKF) continue;
-        RegistrationResult result = mpRegistration->RegisterPointClouds(
-            *(pKFi->mPrevKF->source_points), *(pKFi->source_points), init_T);
+        ICPConstraint result =
+            RegisterKeyFramePair(pKFi->mPrevKF, pKFi, init_T);
         Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
         g2o::Sim3 icp_sim3 =
             g2o::Sim3(relative_pose_icp.block<3, 3>(0, 0),
@@ -1313,7 +1365,7 @@ void Optimizer::LocalVisualLidarBA(
           eICP->setMeasurement(icp_sim3);
           eICP->computeError();
           // std::cout << "icp relative pose error:" << eICP->error() << endl;
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           eICP->setRobustKernel(rk);
           rk->setDelta(thHuberICP);
           optimizer.addEdge(eICP);
@@ -1347,7 +1399,7 @@ void Optimizer::LocalVisualLidarBA(
         Eigen::Matrix<double, 1, 1> information;
         information(0, 0) = 1e2;
         edge->setInformation(information);
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         edge->setVertex(0, static_cast<g2o::VertexSim3Expmap*>(
@@ -1372,10 +1424,10 @@ void Optimizer::LocalVisualLidarBA(
     optimizer.addVertex(vPoint);
     nPoints++;
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     // Set edges
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationMap::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -1402,7 +1454,7 @@ void Optimizer::LocalVisualLidarBA(
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -1435,7 +1487,7 @@ void Optimizer::LocalVisualLidarBA(
           Eigen::Matrix3d Info = Eigen::Matrix3d::Identity() * invSigma2;
           e->setInformation(Info);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -1476,7 +1528,7 @@ void Optimizer::LocalVisualLidarBA(
             const float& invSigma2 = pKFi->mvInvLevelSigma2[kp.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(thHuberMono);
 
@@ -1547,7 +1599,7 @@ void Optimizer::LocalVisualLidarBA(
   }
 
   // Get Map Mutex
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
 
   if (!vToErase.empty()) {
     for (size_t i = 0; i < vToErase.size(); i++) {
@@ -1589,14 +1641,13 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
                                       bool pbICPFlag, Map* pMap,
                                       int& num_fixedKF, int& num_OptKF,
                                       int& num_MPs, int& num_edges) {
+  TRACE_SPAN("LocalBundleAdjustment", "optimizer");
   // Local KeyFrames: First Breath Search from Current Keyframe
   list<KeyFrame*> lLocalKeyFrames;
 
   lLocalKeyFrames.push_back(pKF);
   pKF->mnBALocalForKF = pKF->mnId;
   Map* pCurrentMap = pKF->GetMap();
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   const vector<KeyFrame*> vNeighKFs = pKF->GetVectorCovisibleKeyFrames();
   for (int i = 0, iend = vNeighKFs.size(); i < iend; i++) {
     KeyFrame* pKFi = vNeighKFs[i];
@@ -1636,9 +1687,9 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
   for (list<MapPoint*>::iterator lit = lLocalMapPoints.begin(),
                                  lend = lLocalMapPoints.end();
        lit != lend; lit++) {
-    map<KeyFrame*, tuple<int, int>> observations = (*lit)->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    MapPoint::ObservationMap observations = (*lit)->GetObservations();
+    for (MapPoint::ObservationMap::iterator mit = observations.begin(),
+                                            mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -1786,8 +1837,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
         g2o::VertexSim3Expmap* vCurrKF =
             dynamic_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(pKFi->mnId));
         if (!vPrevKF || !vCurrKF) continue;
-        RegistrationResult result = mpRegistration->RegisterPointClouds(
-            *(pKFi->mPrevKF->source_points), *(pKFi->source_points), init_T);
+        ICPConstraint result =
+            RegisterKeyFramePair(pKFi->mPrevKF, pKFi, init_T);
         Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
         g2o::Sim3 icp_sim3 =
             g2o::Sim3(relative_pose_icp.block<3, 3>(0, 0),
@@ -1802,7 +1853,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
           eICP->setMeasurement(icp_sim3);
           eICP->computeError();
           // std::cout << "icp relative pose error:" << eICP->error() << endl;
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           eICP->setRobustKernel(rk);
           rk->setDelta(thHuberICP);
           optimizer.addEdge(eICP);
@@ -1825,10 +1876,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
     optimizer.addVertex(vPoint);
     nPoints++;
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     // Set edges
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationMap::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -1855,7 +1906,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -1888,7 +1939,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
           Eigen::Matrix3d Info = Eigen::Matrix3d::Identity() * invSigma2;
           e->setInformation(Info);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -1929,7 +1980,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
             const float& invSigma2 = pKFi->mvInvLevelSigma2[kp.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(thHuberMono);
 
@@ -2000,7 +2051,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
   }
 
   // Get Map Mutex
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
 
   if (!vToErase.empty()) {
     for (size_t i = 0; i < vToErase.size(); i++) {
@@ -2045,6 +2096,7 @@ void Optimizer::OptimizeEssentialGraph(
     const LoopClosing::KeyFrameAndPose& CorrectedSim3,
     const map<KeyFrame*, set<KeyFrame*>>& LoopConnections,
     const bool& bFixScale, const bool& bUseICPConstraint) {
+  TRACE_SPAN("OptimizeEssentialGraph", "optimizer");
   // Setup optimizer
   g2o::SparseOptimizer optimizer;
   optimizer.setVerbose(false);
@@ -2053,8 +2105,6 @@ void Optimizer::OptimizeEssentialGraph(
   g2o::BlockSolver_7_3* solver_ptr = new g2o::BlockSolver_7_3(linearSolver);
   g2o::OptimizationAlgorithmLevenberg* solver =
       new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   solver->setUserLambdaInit(1e-16);
   optimizer.setAlgorithm(solver);
 
@@ -2268,8 +2318,7 @@ void Optimizer::OptimizeEssentialGraph(
           init_T.linear() = Sli.rotation().toRotationMatrix();
           init_T.translation() = Sli.translation() / Sli.scale();
 
-          RegistrationResult result = mpRegistration->RegisterPointClouds(
-              *(pLKF->source_points), *(pKF->source_points), init_T);
+          ICPConstraint result = RegisterKeyFramePair(pLKF, pKF, init_T);
           Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
           g2o::Sim3 icp_sim3 =
               g2o::Sim3(relative_pose_icp.block<3, 3>(0, 0),
@@ -2363,7 +2412,7 @@ void Optimizer::OptimizeEssentialGraph(
 
   optimizer.computeActiveErrors();
   cout << "OptimizeEssentialGraph done" << endl;
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
   // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
   cout << "SE3 Pose Recovering" << endl;
   for (size_t i = 0; i < vpKFs.size(); i++) {
@@ -2418,6 +2467,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
                                        vector<KeyFrame*>& vpNonFixedKFs,
                                        vector<MapPoint*>& vpNonCorrectedMPs,
                                        const bool& bUseICPConstraint) {
+  TRACE_SPAN("OptimizeEssentialGraph", "optimizer");
   Verbose::PrintMess("Opt_Essential: There are " +
                          to_string(vpFixedKFs.size()) +
                          " KFs fixed in the merged map",
@@ -2442,8 +2492,6 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
   g2o::BlockSolver_7_3* solver_ptr = new g2o::BlockSolver_7_3(linearSolver);
   g2o::OptimizationAlgorithmLevenberg* solver =
       new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   solver->setUserLambdaInit(1e-16);
   optimizer.setAlgorithm(solver);
 
@@ -2644,8 +2692,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
             init_T.linear() = Sli.rotation().toRotationMatrix();
             init_T.translation() = Sli.translation() / Sli.scale();
 
-            RegistrationResult result = mpRegistration->RegisterPointClouds(
-                *(pLKF->source_points), *(pKFi->source_points), init_T);
+            ICPConstraint result = RegisterKeyFramePair(pLKF, pKFi, init_T);
             Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
             g2o::Sim3 icp_sim3 =
                 g2o::Sim3(relative_pose_icp.block<3, 3>(0, 0),
@@ -2706,8 +2753,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
               init_T.linear() = Sni.rotation().toRotationMatrix();
               init_T.translation() = Sni.translation() / Sni.scale();
 
-              RegistrationResult result = mpRegistration->RegisterPointClouds(
-                  *(pKFn->source_points), *(pKFi->source_points), init_T);
+              ICPConstraint result = RegisterKeyFramePair(pKFn, pKFi, init_T);
               Eigen::Matrix4d relative_pose_icp =
                   result.T_target_source.matrix();
               g2o::Sim3 icp_sim3 =
@@ -2741,7 +2787,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF,
   optimizer.initializeOptimization();
   optimizer.optimize(20);
 
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
 
   // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
   for (KeyFrame* pKFi : vpNonFixedKFs) {
@@ -2933,7 +2979,7 @@ int Optimizer::OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2,
     const float& invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
     e12->setInformation(Eigen::Matrix2d::Identity() * invSigmaSquare1);
 
-    g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
+    g2o::RobustKernelHuber* rk1 = new PooledRobustKernelHuber;
     e12->setRobustKernel(rk1);
     rk1->setDelta(deltaHuber);
     optimizer.addEdge(e12);
@@ -2971,7 +3017,7 @@ int Optimizer::OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2,
     float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
     e21->setInformation(Eigen::Matrix2d::Identity() * invSigmaSquare2);
 
-    g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
+    g2o::RobustKernelHuber* rk2 = new PooledRobustKernelHuber;
     e21->setRobustKernel(rk2);
     rk2->setDelta(deltaHuber);
     optimizer.addEdge(e21);
@@ -3057,6 +3103,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
                                 Map* pMap, int& num_fixedKF, int& num_OptKF,
                                 int& num_MPs, int& num_edges, bool bLarge,
                                 bool bRecInit) {
+  TRACE_SPAN("LocalInertialBA", "optimizer");
   Map* pCurrentMap = pKF->GetMap();
 
   int maxOpt = 10;
@@ -3071,8 +3118,6 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
   vector<KeyFrame*> vpOptimizableKFs;
   const vector<KeyFrame*> vpNeighsKFs = pKF->GetVectorCovisibleKeyFrames();
   list<KeyFrame*> lpOptVisKFs;
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   vpOptimizableKFs.reserve(Nd);
   vpOptimizableKFs.push_back(pKF);
   pKF->mnBALocalForKF = pKF->mnId;
@@ -3146,9 +3191,9 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
   for (list<MapPoint*>::iterator lit = lLocalMapPoints.begin(),
                                  lend = lLocalMapPoints.end();
        lit != lend; lit++) {
-    map<KeyFrame*, tuple<int, int>> observations = (*lit)->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    MapPoint::ObservationMap observations = (*lit)->GetObservations();
+    for (MapPoint::ObservationMap::iterator mit = observations.begin(),
+                                            mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -3288,8 +3333,8 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
         VertexPose* vKF =
             static_cast<VertexPose*>(optimizer.vertex(pKFi->mnId));
         if (!vPrevKF || !vKF) continue;
-        RegistrationResult result = mpRegistration->RegisterPointClouds(
-            *(pKFi->mPrevKF->source_points), *(pKFi->source_points), init_T);
+        ICPConstraint result =
+            RegisterKeyFramePair(pKFi->mPrevKF, pKFi, init_T);
         Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
         Eigen::Matrix4d delta_pose = relative_pose_icp * Tcjci.inverse();
         float delta_dist = sqrt(delta_pose.block<3, 1>(0, 3).x() *
@@ -3311,7 +3356,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
           eICP->computeError();
           // std::cout << "icp relative pose error:" << eICP->error() << endl;
           optimizer.addEdge(eICP);
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           eICP->setRobustKernel(rk);
           rk->setDelta(thHuberICP);
           veICP.push_back(eICP);
@@ -3371,7 +3416,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
       // the local window and the first fixed keyframe out. The information
       // matrix for this measurement is also downweighted. This is done to
       // avoid accumulating error due to fixing variables.
-      g2o::RobustKernelHuber* rki = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rki = new PooledRobustKernelHuber;
       vei[i]->setRobustKernel(rki);
       if (i == N - 1) vei[i]->setInformation(vei[i]->information() * 1e-2);
       rki->setDelta(sqrt(16.0));
@@ -3454,10 +3499,10 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
     vPoint->setId(id);
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     // Create visual constraints
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationMap::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -3494,7 +3539,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -3527,7 +3572,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -3563,7 +3608,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
             const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave] / unc2;
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(thHuberMono);
 
@@ -3626,7 +3671,7 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, bool pbICPFlag,
   }
 
   // Get Map Mutex and erase outliers
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
 
   // TODO: Some convergence problems have been detected here
   if ((2 * err < err_end || isnan(err) || isnan(err_end)) && !bLarge)  // bGN)
@@ -3705,6 +3750,7 @@ void Optimizer::LocalVisualLidarInertialBA(
     KeyFrame* pKF, pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMapDS,
     bool* pbStopFlag, bool pbICPFlag, Map* pMap, int& num_fixedKF,
     int& num_OptKF, int& num_MPs, int& num_edges, bool bLarge, bool bRecInit) {
+  TRACE_SPAN("LocalVisualLidarInertialBA", "optimizer");
   Map* pCurrentMap = pKF->GetMap();
 
   int maxOpt = 10;
@@ -3719,8 +3765,6 @@ void Optimizer::LocalVisualLidarInertialBA(
   vector<KeyFrame*> vpOptimizableKFs;
   const vector<KeyFrame*> vpNeighsKFs = pKF->GetVectorCovisibleKeyFrames();
   list<KeyFrame*> lpOptVisKFs;
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   vpOptimizableKFs.reserve(Nd);
   vpOptimizableKFs.push_back(pKF);
   pKF->mnBALocalForKF = pKF->mnId;
@@ -3794,9 +3838,9 @@ void Optimizer::LocalVisualLidarInertialBA(
   for (list<MapPoint*>::iterator lit = lLocalMapPoints.begin(),
                                  lend = lLocalMapPoints.end();
        lit != lend; lit++) {
-    map<KeyFrame*, tuple<int, int>> observations = (*lit)->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    MapPoint::ObservationMap observations = (*lit)->GetObservations();
+    for (MapPoint::ObservationMap::iterator mit = observations.begin(),
+                                            mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -3936,8 +3980,8 @@ void Optimizer::LocalVisualLidarInertialBA(
         VertexPose* vKF =
             static_cast<VertexPose*>(optimizer.vertex(pKFi->mnId));
         if (!vPrevKF || !vKF) continue;
-        RegistrationResult result = mpRegistration->RegisterPointClouds(
-            *(pKFi->mPrevKF->source_points), *(pKFi->source_points), init_T);
+        ICPConstraint result =
+            RegisterKeyFramePair(pKFi->mPrevKF, pKFi, init_T);
         Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
         Eigen::Matrix4d delta_pose = relative_pose_icp * Tcjci.inverse();
         float delta_dist = sqrt(delta_pose.block<3, 1>(0, 3).x() *
@@ -3959,7 +4003,7 @@ void Optimizer::LocalVisualLidarInertialBA(
           eICP->computeError();
           // std::cout << "icp relative pose error:" << eICP->error() << endl;
           optimizer.addEdge(eICP);
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           eICP->setRobustKernel(rk);
           rk->setDelta(thHuberICP);
           veICP.push_back(eICP);
@@ -3988,7 +4032,7 @@ void Optimizer::LocalVisualLidarInertialBA(
         Eigen::Matrix<double, 1, 1> information;
         information(0, 0) = 1e2;
         edge->setInformation(information);
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         VertexPose* vKF =
@@ -4013,7 +4057,7 @@ void Optimizer::LocalVisualLidarInertialBA(
       Eigen::Matrix<double, 1, 1> information;
       information(0, 0) = 100.0;
       edge->setInformation(information);
-      g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
       rk->setDelta(thHuberLidar);
       edge->setRobustKernel(rk);
       VertexPose* vKF = static_cast<VertexPose*>(optimizer.vertex(pKFi->mnId));
@@ -4076,7 +4120,7 @@ void Optimizer::LocalVisualLidarInertialBA(
       // the local window and the first fixed keyframe out. The information
       // matrix for this measurement is also downweighted. This is done to
       // avoid accumulating error due to fixing variables.
-      g2o::RobustKernelHuber* rki = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rki = new PooledRobustKernelHuber;
       vei[i]->setRobustKernel(rki);
       if (i == N - 1) vei[i]->setInformation(vei[i]->information() * 1e-2);
       rki->setDelta(sqrt(16.0));
@@ -4159,10 +4203,10 @@ void Optimizer::LocalVisualLidarInertialBA(
     vPoint->setId(id);
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     // Create visual constraints
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationMap::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -4199,7 +4243,7 @@ void Optimizer::LocalVisualLidarInertialBA(
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -4232,7 +4276,7 @@ void Optimizer::LocalVisualLidarInertialBA(
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -4268,7 +4312,7 @@ void Optimizer::LocalVisualLidarInertialBA(
             const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave] / unc2;
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(thHuberMono);
 
@@ -4331,7 +4375,7 @@ void Optimizer::LocalVisualLidarInertialBA(
   }
 
   // Get Map Mutex and erase outliers
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
 
   // TODO: Some convergence problems have been detected here
   if ((2 * err < err_end || isnan(err) || isnan(err_end)) && !bLarge)  // bGN)
@@ -4919,7 +4963,7 @@ void Optimizer::InertialOptimization(Map* pMap, Eigen::Matrix3d& Rwg,
       ei->setVertex(5, dynamic_cast<g2o::OptimizableGraph::Vertex*>(VV2));
       ei->setVertex(6, dynamic_cast<g2o::OptimizableGraph::Vertex*>(VGDir));
       ei->setVertex(7, dynamic_cast<g2o::OptimizableGraph::Vertex*>(VS));
-      g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
       ei->setRobustKernel(rk);
       rk->setDelta(1.f);
       optimizer.addEdge(ei);
@@ -4943,6 +4987,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
                                       vector<KeyFrame*> vpAdjustKF,
                                       vector<KeyFrame*> vpFixedKF,
                                       bool* pbStopFlag) {
+  TRACE_SPAN("LocalBundleAdjustment", "optimizer");
   bool bShowImages = false;
 
   vector<MapPoint*> vpMPs;
@@ -5074,12 +5119,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations =
-        pMPi->GetObservations();
+    const MapPoint::ObservationMap observations = pMPi->GetObservations();
     int nEdges = 0;
     // SET EDGES
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator mit =
-             observations.begin();
+    for (MapPoint::ObservationMap::const_iterator mit = observations.begin();
          mit != observations.end(); mit++) {
       KeyFrame* pKF = mit->first;
       if (pKF->isBad() || pKF->mnId > maxKFid ||
@@ -5107,7 +5150,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
         const float& invSigma2 = pKF->mvInvLevelSigma2[kpUn.octave];
         e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         e->setRobustKernel(rk);
         rk->setDelta(thHuber2D);
 
@@ -5138,7 +5181,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
         Eigen::Matrix3d Info = Eigen::Matrix3d::Identity() * invSigma2;
         e->setInformation(Info);
 
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         e->setRobustKernel(rk);
         rk->setDelta(thHuber3D);
 
@@ -5256,7 +5299,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
                      Verbose::VERBOSITY_DEBUG);
 
   // Get Map Mutex
-  unique_lock<mutex> lock(pMainKF->GetMap()->mMutexMapUpdate);
+  unique_lock<mutex> lock =
+      TracedLock(pMainKF->GetMap()->mMutexMapUpdate, "MapUpdate");
 
   if (!vToErase.empty()) {
     for (size_t i = 0; i < vToErase.size(); i++) {
@@ -5270,10 +5314,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
     MapPoint* pMPi = vpMPs[i];
     if (pMPi->isBad()) continue;
 
-    const map<KeyFrame*, tuple<int, int>> observations =
-        pMPi->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator mit =
-             observations.begin();
+    const MapPoint::ObservationMap observations = pMPi->GetObservations();
+    for (MapPoint::ObservationMap::const_iterator mit = observations.begin();
          mit != observations.end(); mit++) {
       KeyFrame* pKF = mit->first;
       if (pKF->isBad() || pKF->mnId > maxKFid ||
@@ -5365,6 +5407,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
 void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
                                 bool* pbStopFlag, Map* pMap,
                                 LoopClosing::KeyFrameAndPose& corrPoses) {
+  TRACE_SPAN("MergeInertialBA", "optimizer");
   const int Nd = 6;
   const unsigned long maxKFid = pCurrKF->mnId;
 
@@ -5470,11 +5513,10 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
   for (vector<pair<MapPoint*, int>>::iterator lit = pairs.begin(),
                                               lend = pairs.end();
        lit != lend; lit++, i++) {
-    map<KeyFrame*, tuple<int, int>> observations =
-        lit->first->GetObservations();
+    MapPoint::ObservationMap observations = lit->first->GetObservations();
     if (i >= maxCovKF) break;
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    for (MapPoint::ObservationMap::iterator mit = observations.begin(),
+                                            mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -5631,7 +5673,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
       vei[i]->setVertex(5, dynamic_cast<g2o::OptimizableGraph::Vertex*>(VV2));
 
       // TODO Uncomment
-      g2o::RobustKernelHuber* rki = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rki = new PooledRobustKernelHuber;
       vei[i]->setRobustKernel(rki);
       rki->setDelta(sqrt(16.92));
       optimizer.addEdge(vei[i]);
@@ -5705,10 +5747,10 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationMap observations = pMP->GetObservations();
 
     // Create visual constraints
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationMap::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -5744,7 +5786,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
           optimizer.addEdge(e);
@@ -5767,7 +5809,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
           const float& invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -5819,7 +5861,7 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
   }
 
   // Get Map Mutex and erase outliers
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
   if (!vToErase.empty()) {
     for (size_t i = 0; i < vToErase.size(); i++) {
       KeyFrame* pKFi = vToErase[i].first;
@@ -5983,7 +6025,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -6013,7 +6055,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(
           const float& invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -6043,7 +6085,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -6084,7 +6126,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(
   ei->setVertex(3, VAk);
   ei->setVertex(4, VP);
   ei->setVertex(5, VV);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   ei->setRobustKernel(rk);
   rk->setDelta(6.0);
   optimizer.addEdge(ei);
@@ -6134,7 +6176,7 @@ int Optimizer::PoseInertialOptimizationLastKeyFrame(
     float avgReprojectionError = 0.0f;
     float chi2IMU = ei->chi2();
     if (chi2IMU > 15.0) {
-      g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
       rk->setDelta(2.0);
       ei->setRobustKernel(rk);
       ei->setInformation(ei->information() * 1e-2);
@@ -6371,7 +6413,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -6401,7 +6443,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
           const float& invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -6431,7 +6473,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -6472,7 +6514,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
   ei->setVertex(3, VAk);
   ei->setVertex(4, VP);
   ei->setVertex(5, VV);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   ei->setRobustKernel(rk);
   rk->setDelta(6.0);
   optimizer.addEdge(ei);
@@ -6536,7 +6578,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
     valid_edge = 0;
     float chi2IMU = ei->chi2();
     if (chi2IMU > 15.0) {
-      g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
       rk->setDelta(2.0);
       ei->setRobustKernel(rk);
       ei->setInformation(ei->information() * 1e-2);
@@ -6549,7 +6591,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
         if (abs(pFrame->mTimeStamp - pKF->mTimeStamp > 0.8)) {
           edge->setInformation(information * 1e2);
         }
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         edge->setVertex(0, VP);
@@ -6845,7 +6887,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -6875,7 +6917,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(
           const float& invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -6905,7 +6947,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -6949,7 +6991,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(
   ei->setVertex(3, VAk);
   ei->setVertex(4, VP);
   ei->setVertex(5, VV);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   ei->setRobustKernel(rk);
   rk->setDelta(6.0);
   optimizer.addEdge(ei);
@@ -6982,7 +7024,7 @@ int Optimizer::PoseInertialOptimizationLastFrame(
   ep->setVertex(1, VVk);
   ep->setVertex(2, VGk);
   ep->setVertex(3, VAk);
-  g2o::RobustKernelHuber* rkp = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rkp = new PooledRobustKernelHuber;
   ep->setRobustKernel(rkp);
   rkp->setDelta(5);
   optimizer.addEdge(ep);
@@ -7258,7 +7300,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -7288,7 +7330,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
           const float& invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -7318,7 +7360,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -7363,7 +7405,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
   ei->setVertex(4, VP);
   ei->setVertex(5, VV);
   optimizer.addEdge(ei);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   ei->setRobustKernel(rk);
   rk->setDelta(6.0);
 
@@ -7395,7 +7437,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
   ep->setVertex(1, VVk);
   ep->setVertex(2, VGk);
   ep->setVertex(3, VAk);
-  g2o::RobustKernelHuber* rkp = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rkp = new PooledRobustKernelHuber;
   ep->setRobustKernel(rkp);
   rkp->setDelta(5);
   optimizer.addEdge(ep);
@@ -7444,7 +7486,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
     valid_edge = 0;
     float chi2IMU = ei->chi2();
     if (chi2IMU > 15.0) {
-      g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
       rk->setDelta(2.0);
       ei->setRobustKernel(rk);
       ei->setInformation(ei->information() * 1e-2);
@@ -7455,7 +7497,7 @@ int Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
         Eigen::Matrix<double, 1, 1> information;
         information(0, 0) = 1e2;
         edge->setInformation(information);
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         edge->setVertex(0, VP);
@@ -7767,7 +7809,7 @@ int Optimizer::PoseLidarVisualOptimization(
             const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaMono);
 
@@ -7800,7 +7842,7 @@ int Optimizer::PoseLidarVisualOptimization(
             Eigen::Matrix3d Info = Eigen::Matrix3d::Identity() * invSigma2;
             e->setInformation(Info);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaStereo);
 
@@ -7840,7 +7882,7 @@ int Optimizer::PoseLidarVisualOptimization(
             const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaMono);
 
@@ -7869,7 +7911,7 @@ int Optimizer::PoseLidarVisualOptimization(
             const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
             e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+            g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
             e->setRobustKernel(rk);
             rk->setDelta(deltaMono);
 
@@ -7925,7 +7967,7 @@ int Optimizer::PoseLidarVisualOptimization(
         Eigen::Matrix<double, 1, 1> information;
         information(0, 0) = 1e2;
         edge->setInformation(information);
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         edge->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(
@@ -8108,7 +8150,7 @@ void Optimizer::PoseLidarOptimization(
         Eigen::Matrix<double, 1, 1> information;
         information(0, 0) = 1e2;
         edge->setInformation(information);
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         edge->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(
@@ -8225,7 +8267,7 @@ void Optimizer::PoseLidarInertialOptimizationLastFrame(
   ei->setVertex(3, VAk);
   ei->setVertex(4, VP);
   ei->setVertex(5, VV);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   ei->setRobustKernel(rk);
   rk->setDelta(6.0);
   optimizer.addEdge(ei);
@@ -8258,7 +8300,7 @@ void Optimizer::PoseLidarInertialOptimizationLastFrame(
   ep->setVertex(1, VVk);
   ep->setVertex(2, VGk);
   ep->setVertex(3, VAk);
-  g2o::RobustKernelHuber* rkp = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rkp = new PooledRobustKernelHuber;
   ep->setRobustKernel(rkp);
   rkp->setDelta(5);
   optimizer.addEdge(ep);
@@ -8290,7 +8332,7 @@ void Optimizer::PoseLidarInertialOptimizationLastFrame(
         Eigen::Matrix<double, 1, 1> information;
         information(0, 0) = 1e2;
         edge->setInformation(information);
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(thHuberLidar);
         edge->setRobustKernel(rk);
         edge->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(
@@ -8335,15 +8377,24 @@ void Optimizer::PoseLidarInertialOptimizationLastFrame(
   pFrame->mImuBias = IMU::Bias(b[3], b[4], b[5], b[0], b[1], b[2]);
 }
 
+static pcl::PointCloud<PointType>::Ptr GetDownsampledCloud(Frame* pFrame) {
+  return pFrame->mpPointCloudDownsampled;
+}
+
+// Keyframes outside the payload store window have their cloud spilled, the
+// accessor reloads it
+static pcl::PointCloud<PointType>::Ptr GetDownsampledCloud(KeyFrame* pKF) {
+  return pKF->GetPointCloudDownsampled();
+}
+
 template <typename EdgeType, typename FrameType>
 vector<EdgeType*> Optimizer::GenerateLidarEdge(
     FrameType* pFrame, Eigen::Matrix4d initPose,
     pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMapDS,
     pcl::KdTreeFLANN<PointType>::Ptr kdtreeSurfFromMap) {
-  if (!pFrame->mpPointCloudDownsampled ||
-      pFrame->mpPointCloudDownsampled->size() < 50)
-    return vector<EdgeType*>();
-  size_t laserCloudGroundLastDSNum = pFrame->mpPointCloudDownsampled->size();
+  const pcl::PointCloud<PointType>::Ptr pCloud = GetDownsampledCloud(pFrame);
+  if (!pCloud || pCloud->size() < 50) return vector<EdgeType*>();
+  size_t laserCloudGroundLastDSNum = pCloud->size();
   std::vector<EdgeType*> vpEdgesLidarPoint2Plane;
   vpEdgesLidarPoint2Plane.resize(laserCloudGroundLastDSNum, nullptr);
   // 预先分配矩阵，避免在循环中动态分配内存
@@ -8359,7 +8410,7 @@ vector<EdgeType*> Optimizer::GenerateLidarEdge(
     std::vector<int> pointSearchInd;
     std::vector<float> pointSearchSqDis;
 
-    pointOri = pFrame->mpPointCloudDownsampled->points[i];
+    pointOri = pCloud->points[i];
     pointAssociateToMap(&pointOri, &pointSel, initPose);
     kdtreeSurfFromMap->nearestKSearch(pointSel, 5, pointSearchInd,
                                       pointSearchSqDis);
@@ -8420,6 +8471,16 @@ vector<EdgeType*> Optimizer::GenerateLidarEdge(
   return vpEdgesLidarPoint2Plane;
 }
 
+// Also used outside this file (slam_microbench)
+template vector<EdgeSE3LidarPoint2Plane*>
+Optimizer::GenerateLidarEdge<EdgeSE3LidarPoint2Plane, Frame>(
+    Frame*, Eigen::Matrix4d, pcl::PointCloud<PointType>::Ptr,
+    pcl::KdTreeFLANN<PointType>::Ptr);
+template vector<EdgeLidarPoint2Plane*>
+Optimizer::GenerateLidarEdge<EdgeLidarPoint2Plane, Frame>(
+    Frame*, Eigen::Matrix4d, pcl::PointCloud<PointType>::Ptr,
+    pcl::KdTreeFLANN<PointType>::Ptr);
+
 int Optimizer::PoseInertialICPOptimizationLastFrame(
     Frame* pFrame, bool bRecInit, const bool bFrame2FrameReprojError,
     const bool bFrame2MapReprojError) {
@@ -8512,7 +8573,7 @@ int Optimizer::PoseInertialICPOptimizationLastFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -8542,7 +8603,7 @@ int Optimizer::PoseInertialICPOptimizationLastFrame(
           const float& invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -8572,7 +8633,7 @@ int Optimizer::PoseInertialICPOptimizationLastFrame(
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -8649,7 +8710,7 @@ int Optimizer::PoseInertialICPOptimizationLastFrame(
   Info.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
   Info.block<3, 3>(3, 3) = Eigen::Matrix3d::Identity();
   eicp->setInformation(Info);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   eicp->setRobustKernel(rk);
   rk->setDelta(thHuberICP);
   optimizer.addEdge(eicp);
@@ -8665,7 +8726,7 @@ int Optimizer::PoseInertialICPOptimizationLastFrame(
   ep->setVertex(1, VVk);
   ep->setVertex(2, VGk);
   ep->setVertex(3, VAk);
-  g2o::RobustKernelHuber* rkp = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rkp = new PooledRobustKernelHuber;
   ep->setRobustKernel(rkp);
   rkp->setDelta(5);
   optimizer.addEdge(ep);
@@ -8952,7 +9013,7 @@ int Optimizer::PoseICPOptimizationLastFrame(Frame* pFrame, bool bRecInit,
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -8982,7 +9043,7 @@ int Optimizer::PoseICPOptimizationLastFrame(Frame* pFrame, bool bRecInit,
           const float& invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix3d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberStereo);
 
@@ -9012,7 +9073,7 @@ int Optimizer::PoseICPOptimizationLastFrame(Frame* pFrame, bool bRecInit,
           const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave] / unc2;
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-          g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+          g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(thHuberMono);
 
@@ -9046,7 +9107,7 @@ int Optimizer::PoseICPOptimizationLastFrame(Frame* pFrame, bool bRecInit,
   Info.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity() * 1e8;
   Info.block<3, 3>(3, 3) = Eigen::Matrix3d::Identity() * 1e8;
   ei->setInformation(Info);
-  g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+  g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
   ei->setRobustKernel(rk);
   rk->setDelta(thHuberICP);
 
@@ -9062,7 +9123,7 @@ int Optimizer::PoseICPOptimizationLastFrame(Frame* pFrame, bool bRecInit,
     // 边缘化先验位姿
     ep = new EdgePriorPoseICP(pFp->mpcp_icp);
     ep->setVertex(0, VPk);
-    g2o::RobustKernelHuber* rkp = new g2o::RobustKernelHuber;
+    g2o::RobustKernelHuber* rkp = new PooledRobustKernelHuber;
     ep->setRobustKernel(rkp);
     rkp->setDelta(5);
     optimizer.addEdge(ep);
@@ -9281,8 +9342,6 @@ void Optimizer::OptimizeEssentialGraph4DoF(
   vector<VertexPose4DoF*> vpVertices(nMaxKFid + 1);
 
   // ICP
-  std::shared_ptr<RegistrationGICP> mpRegistration =
-      std::make_shared<RegistrationGICP>();
   const int minFeat = 100;
   // Set KeyFrame vertices
   for (size_t i = 0, iend = vpKFs.size(); i < iend; i++) {
@@ -9352,7 +9411,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(
       Tij.block<3, 3>(0, 0) = Sij.rotation().toRotationMatrix();
       Tij.block<3, 1>(0, 3) = Sij.translation();
       Tij(3, 3) = 1.;
-      g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+      g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
       rk->setDelta(1.0);
       Edge4DoF* e = new Edge4DoF(Tij);
       e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(
@@ -9475,7 +9534,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(
         e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(
                             optimizer.vertex(pLKF->mnId)));
         e->information() = matLambda;
-        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+        g2o::RobustKernelHuber* rk = new PooledRobustKernelHuber;
         rk->setDelta(1.0);
         e->setRobustKernel(rk);
         optimizer.addEdge(e);
@@ -9485,8 +9544,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(
           Eigen::Isometry3d init_T = Eigen::Isometry3d::Identity();
           // 回环帧到当前帧的变换
           init_T.matrix() = Til.cast<double>();
-          RegistrationResult result = mpRegistration->RegisterPointClouds(
-              *(pKF->source_points), *(pLKF->source_points), init_T);
+          ICPConstraint result = RegisterKeyFramePair(pKF, pLKF, init_T);
           Eigen::Matrix4d relative_pose_icp = result.T_target_source.matrix();
           if (result.converged && result.num_inliers > 100 &&
               (result.error / result.num_inliers) < 0.1) {
@@ -9552,7 +9610,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(
   optimizer.computeActiveErrors();
   optimizer.optimize(20);
 
-  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+  unique_lock<mutex> lock = TracedLock(pMap->mMutexMapUpdate, "MapUpdate");
 
   // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
   for (size_t i = 0; i < vpKFs.size(); i++) {
@@ -1,4 +1,43 @@
 #include "RegistrationGICP.h"
+
+#include <small_gicp/util/normal_estimation_omp.hpp>
+
+namespace {
+
+// Voxel centroids of the points, with the kdtree and the covariances GICP
+// needs. small_gicp::align() does the same with its sort based downsampling.
+std::pair<PointCloud::Ptr, std::shared_ptr<KdTree<PointCloud>>> Preprocess(
+    const std::vector<Eigen::Vector4f>& points, const double resolution,
+    const int num_threads) {
+  ORB_SLAM3::Voxelizer voxelizer;
+  voxelizer.SetLeafSize(resolution, resolution, resolution);
+  voxelizer.Build(points.size(),
+                  [&points](const int i) -> const Eigen::Vector4f& {
+                    return points[i];
+                  });
+
+  const int nVoxels = voxelizer.NumVoxels();
+  PointCloud::Ptr downsampled = std::make_shared<PointCloud>();
+  downsampled->resize(nVoxels);
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+  for (int v = 0; v < nVoxels; v++) {
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    const int* pEnd = voxelizer.VoxelEnd(v);
+    for (const int* pIdx = voxelizer.VoxelBegin(v); pIdx != pEnd; pIdx++)
+      sum += points[*pIdx].head<3>().cast<double>();
+    const double n = pEnd - voxelizer.VoxelBegin(v);
+    downsampled->point(v) << sum / n, 1.0;
+  }
+
+  auto kdtree = std::make_shared<KdTree<PointCloud>>(downsampled);
+  estimate_normals_covariances_omp(*downsampled, *kdtree, 10, num_threads);
+  return {downsampled, kdtree};
+}
+
+}  // namespace
+
 RegistrationGICP::RegistrationGICP(/* args */) {}
 RegistrationGICP::~RegistrationGICP() {}
 
@@ -14,8 +53,12 @@ RegistrationResult RegistrationGICP::RegisterPointClouds(
             // threshold)
   setting.type = setting.RegistrationType::GICP;
   Eigen::Isometry3d init_T_target = init_T_target_source;
+  auto [target, target_tree] = Preprocess(
+      target_points, setting.downsampling_resolution, setting.num_threads);
+  auto [source, source_tree] = Preprocess(
+      source_points, setting.downsampling_resolution, setting.num_threads);
   RegistrationResult result =
-      align(target_points, source_points, init_T_target, setting);
+      align(*target, *source, *target_tree, init_T_target, setting);
   return result;
 }
 bool RegistrationGICP::NDTRegistration(
@@ -25,7 +68,7 @@ bool RegistrationGICP::NDTRegistration(
     Eigen::Matrix4f& final_transform) {
   pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_source_cloud(
       new pcl::PointCloud<pcl::PointXYZ>());
-  pcl::VoxelGrid<pcl::PointXYZ> voxel_grid;
+  ORB_SLAM3::VoxelFilter<pcl::PointXYZ> voxel_grid;
   voxel_grid.setLeafSize(0.05, 0.05, 0.05);
   voxel_grid.setInputCloud(source_cloud);
   voxel_grid.filter(*filtered_source_cloud);
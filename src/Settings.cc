@@ -198,6 +198,14 @@ void Settings::readCamera1(cv::FileStorage& fSettings) {
       readParameter<string>(fSettings, "Camera.type", found);
   mCameraModel_ = readParameter<string>(fSettings, "Camera.type", found);
   enableOpticalFlow_ = readParameter<int>(fSettings, "UseOpticalFlow", found);
+  // With optical flow, extract ORB only for keyframes, initialization,
+  // relocalization or when too few points are tracked
+  lazyORBExtraction_ =
+      readParameter<int>(fSettings, "LazyORBExtraction", found, false);
+  if (!found) lazyORBExtraction_ = 0;
+  lazyORBMinTracked_ =
+      readParameter<int>(fSettings, "LazyORBMinTracked", found, false);
+  if (!found) lazyORBMinTracked_ = 300;
   enableClahe_ = readParameter<int>(fSettings, "UseClahe", found);
   kfInsertInterval_ =
       readParameter<float>(fSettings, "KFInsertInterval", found);
@@ -559,6 +567,10 @@ void Settings::readLoadAndSave(cv::FileStorage& fSettings) {
                                      found, false);
   sSaveto_ =
       readParameter<string>(fSettings, "System.SaveAtlasToFile", found, false);
+  // 0: text, 1: binary (default), 2: chunked
+  atlasFileType_ =
+      readParameter<int>(fSettings, "System.AtlasFileType", found, false);
+  if (!found) atlasFileType_ = 1;
 }
 
 void Settings::readOtherParameters(cv::FileStorage& fSettings) {
@@ -568,6 +580,70 @@ void Settings::readOtherParameters(cv::FileStorage& fSettings) {
       readParameter<float>(fSettings, "System.thFarPoints", found, false);
   extractor_tpye_ =
       readParameter<std::string>(fSettings, "ORBextractor.type", found, false);
+
+  // Keyframe payload tiering, disabled by default
+  payloadStoreEnable_ =
+      readParameter<int>(fSettings, "PayloadStore.Enable", found, false);
+  if (!found) payloadStoreEnable_ = 0;
+  payloadMemoryBudget_ =
+      readParameter<float>(fSettings, "PayloadStore.MemoryBudgetMB", found,
+                           false);
+  if (!found) payloadMemoryBudget_ = 1024.f;
+  payloadLocalWindow_ =
+      readParameter<int>(fSettings, "PayloadStore.LocalWindow", found, false);
+  if (!found) payloadLocalWindow_ = 30;
+  payloadCacheDir_ = readParameter<std::string>(
+      fSettings, "PayloadStore.CacheDir", found, false);
+
+  // Global BA after a loop limited to the keyframes moved by the correction
+  incrementalGBA_ =
+      readParameter<int>(fSettings, "LoopClosing.IncrementalGBA", found, false);
+  if (!found) incrementalGBA_ = 0;
+  incrementalGBAMinTranslation_ = readParameter<float>(
+      fSettings, "LoopClosing.IncrementalGBAMinTranslation", found, false);
+  if (!found) incrementalGBAMinTranslation_ = 0.05f;
+  incrementalGBAMinRotation_ = readParameter<float>(
+      fSettings, "LoopClosing.IncrementalGBAMinRotation", found, false);
+  if (!found) incrementalGBAMinRotation_ = 0.01f;
+  incrementalGBAHalo_ = readParameter<int>(
+      fSettings, "LoopClosing.IncrementalGBAHalo", found, false);
+  if (!found) incrementalGBAHalo_ = 10;
+
+  // Chrome trace written at shutdown, tracing is off if empty
+  traceFile_ =
+      readParameter<std::string>(fSettings, "System.TraceFile", found, false);
+
+  // Frames of trajectory and diagnostics kept in memory, all of them if 0
+  trajectoryCapacity_ =
+      readParameter<int>(fSettings, "System.TrajectoryCapacity", found, false);
+  if (!found) trajectoryCapacity_ = 0;
+  // Frames evicted from memory are streamed there, dropped if empty
+  trajectoryFile_ = readParameter<std::string>(
+      fSettings, "System.TrajectoryFile", found, false);
+  // 0: TUM text (default), 1: binary
+  trajectoryFileFormat_ = readParameter<int>(
+      fSettings, "System.TrajectoryFileFormat", found, false);
+  if (!found) trajectoryFileFormat_ = 0;
+  // Reprojection errors kept every n frames, never if 0
+  diagnosticsPeriod_ =
+      readParameter<int>(fSettings, "System.DiagnosticsPeriod", found, false);
+  if (!found) diagnosticsPeriod_ = 1;
+
+  // Max time (ms) a lost frame spends relocalizing, no limit if 0
+  relocalizationBudget_ = readParameter<float>(
+      fSettings, "Tracking.RelocalizationBudgetMs", found, false);
+  if (!found) relocalizationBudget_ = 0.f;
+
+  // Observations a map point picks its distinctive descriptor among, 0 for
+  // all of them as in ORB-SLAM3
+  mapPointMaxDescriptorSamples_ = readParameter<int>(
+      fSettings, "MapPoint.MaxDescriptorSamples", found, false);
+  if (!found) mapPointMaxDescriptorSamples_ = 0;
+
+  // Free culled map points once no thread can hold them, they leak otherwise
+  reclaimCulledMapPoints_ =
+      readParameter<int>(fSettings, "Map.ReclaimCulledPoints", found, false);
+  if (!found) reclaimCulledMapPoints_ = 0;
 }
 
 void Settings::precomputeRectificationMaps() {
@@ -751,6 +827,9 @@ ostream& operator<<(std::ostream& output, const Settings& settings) {
   output << "\t-LK window size " << settings.lkWinsize_ << endl;
   output << "\t-Whether use optical flow " << settings.enableOpticalFlow_
          << endl;
+  if (settings.enableOpticalFlow_ && settings.lazyORBExtraction_)
+    output << "\t-Lazy ORB extraction below tracked points "
+           << settings.lazyORBMinTracked_ << endl;
   output << "\t-Whether use CLAHE " << settings.enableClahe_ << endl;
   output << "\t-Threshold for F matrix " << settings.F_THRESHOLD_ << endl;
   output << "\t-Threshold for mask " << settings.MASK_THRESHOLD_ << endl;
@@ -761,6 +840,42 @@ ostream& operator<<(std::ostream& output, const Settings& settings) {
          << endl;
   output << "\t-Whether use point cloud observation " << settings.useLidarObs_
          << endl;
+  output << "\t-Atlas file type " << settings.atlasFileType_ << endl;
+  if (settings.payloadStoreEnable_) {
+    output << "\t-KeyFrame payload budget (MB) "
+           << settings.payloadMemoryBudget_ << endl;
+    output << "\t-KeyFrame payload local window "
+           << settings.payloadLocalWindow_ << endl;
+    output << "\t-KeyFrame payload cache dir " << settings.payloadCacheDir_
+           << endl;
+  }
+  if (settings.incrementalGBA_) {
+    output << "\t-Incremental GBA min translation (m) "
+           << settings.incrementalGBAMinTranslation_ << endl;
+    output << "\t-Incremental GBA min rotation (rad) "
+           << settings.incrementalGBAMinRotation_ << endl;
+    output << "\t-Incremental GBA halo " << settings.incrementalGBAHalo_
+           << endl;
+  }
+  if (!settings.traceFile_.empty())
+    output << "\t-Trace file " << settings.traceFile_ << endl;
+  if (settings.trajectoryCapacity_ > 0)
+    output << "\t-Trajectory capacity (frames) "
+           << settings.trajectoryCapacity_ << endl;
+  if (!settings.trajectoryFile_.empty())
+    output << "\t-Trajectory file " << settings.trajectoryFile_
+           << (settings.trajectoryFileFormat_ == 1 ? " (binary)" : " (TUM)")
+           << endl;
+  output << "\t-Diagnostics period (frames) " << settings.diagnosticsPeriod_
+         << endl;
+  if (settings.relocalizationBudget_ > 0)
+    output << "\t-Relocalization budget (ms) "
+           << settings.relocalizationBudget_ << endl;
+  if (settings.mapPointMaxDescriptorSamples_ > 0)
+    output << "\t-MapPoint max descriptor samples "
+           << settings.mapPointMaxDescriptorSamples_ << endl;
+  output << "\t-Reclaim culled map points "
+         << (settings.reclaimCulledMapPoints_ ? "true" : "false") << endl;
   return output;
 }
 };  // namespace ORB_SLAM3
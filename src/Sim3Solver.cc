@@ -27,7 +27,6 @@
 
 #include "KeyFrame.h"
 #include "ORBmatcher.h"
-#include "Thirdparty/DBoW2/DUtils/Random.h"
 
 namespace ORB_SLAM3 {
 
@@ -49,6 +48,10 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2,
   mpKF1 = pKF1;
   mpKF2 = pKF2;
 
+  std::seed_seq seed{static_cast<unsigned int>(pKF1->mnId),
+                     static_cast<unsigned int>(pKF2->mnId)};
+  mRng.seed(seed);
+
   vector<MapPoint *> vpKeyFrameMP1 = pKF1->GetMapPointMatches();
 
   mN1 = vpMatched12.size();
@@ -167,7 +170,8 @@ Eigen::Matrix4f Sim3Solver::iterate(int nIterations, bool &bNoMore,
 
     // Get min set of points
     for (short i = 0; i < 3; ++i) {
-      int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size() - 1);
+      int randi = std::uniform_int_distribution<int>(
+          0, vAvailableIndices.size() - 1)(mRng);
 
       int idx = vAvailableIndices[randi];
 
@@ -234,7 +238,8 @@ Eigen::Matrix4f Sim3Solver::iterate(int nIterations, bool &bNoMore,
 
     // Get min set of points
     for (short i = 0; i < 3; ++i) {
-      int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size() - 1);
+      int randi = std::uniform_int_distribution<int>(
+          0, vAvailableIndices.size() - 1)(mRng);
 
       int idx = vAvailableIndices[randi];
 
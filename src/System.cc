@@ -36,7 +36,11 @@
 #include <iomanip>
 #include <thread>
 
+#include "AtlasArchive.h"
 #include "Converter.h"
+#include "EpochReclaimer.h"
+#include "Optimizer.h"
+#include "Trace.h"
 
 namespace ORB_SLAM3 {
 
@@ -47,11 +51,13 @@ System::System(const string &strVocFile, const string &strSettingsFile,
                const string &strSequence, const string &save_dir)
     : mSensor(sensor),
       mpViewer(static_cast<Viewer *>(NULL)),
+      mpLidarMapping(static_cast<LidarMapping *>(NULL)),
       mbReset(false),
       mbResetActiveMap(false),
       mbActivateLocalizationMode(false),
       mbDeactivateLocalizationMode(false),
-      mbShutDown(false) {
+      mbShutDown(false),
+      mnAtlasFileType(BINARY_FILE) {
   // Output welcome message
   cout << endl
        << "ORB-SLAM3 Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, "
@@ -100,6 +106,7 @@ System::System(const string &strVocFile, const string &strSettingsFile,
     }
     // mStrLoadAtlasFromFile = settings_->atlasLoadFile();
     mStrSaveAtlasToFile = save_dir + "/" + settings_->atlasSaveFile();
+    mnAtlasFileType = settings_->atlasFileType();
 
     cout << (*settings_) << endl;
     // std::cout << "here is okk" <<std::endl;
@@ -116,6 +123,11 @@ System::System(const string &strVocFile, const string &strSettingsFile,
       mStrSaveAtlasToFile = save_dir + "/" + (string)node;
       cout << "Save Atlas to: " << mStrSaveAtlasToFile << endl;
     }
+
+    node = fsSettings["System.AtlasFileType"];
+    if (!node.empty() && node.isInt()) {
+      mnAtlasFileType = (int)node;
+    }
   }
 
   // std::cout << "here is ok2" <<std::endl;
@@ -173,7 +185,7 @@ System::System(const string &strVocFile, const string &strSettingsFile,
     // clock_t start = clock();
     cout << "Initialization of Atlas from file: " << mStrLoadAtlasFromFile
          << endl;
-    bool isRead = LoadAtlas(FileType::BINARY_FILE);
+    bool isRead = LoadAtlas(mnAtlasFileType);
 
     if (!isRead) {
       cout << "Error to load the file, please try with other session file or "
@@ -201,6 +213,11 @@ System::System(const string &strVocFile, const string &strSettingsFile,
   if (mSensor == IMU_STEREO || mSensor == IMU_MONOCULAR || mSensor == IMU_RGBD)
     mpAtlas->SetInertialSensor();
 
+  if (settings_) {
+    MapPoint::nMaxDescriptorSamples = settings_->mapPointMaxDescriptorSamples();
+    EpochReclaimer::Enable(settings_->reclaimCulledMapPoints());
+  }
+
   // Create Drawers. These are used by the Viewer
   mpFrameDrawer = new FrameDrawer(mpAtlas);
   mpMapDrawer = new MapDrawer(mpAtlas, strSettingsFile, settings_);
@@ -214,6 +231,29 @@ System::System(const string &strVocFile, const string &strSettingsFile,
                            mpAtlas, mpKeyFrameDatabase, strSettingsFile,
                            mSensor, settings_, strSequence);
 
+  // Bounded memory recording of the trajectory, all frames are kept by
+  // default
+  size_t nTrajectoryCapacity = 0;
+  string strTrajectoryFile;
+  TrajectoryRecorder::StreamFormat trajectoryFormat =
+      TrajectoryRecorder::STREAM_TUM;
+  int nDiagnosticsPeriod = 1;
+  if (settings_) {
+    nTrajectoryCapacity = std::max(settings_->trajectoryCapacity(), 0);
+    strTrajectoryFile = settings_->trajectoryFile();
+    if (!strTrajectoryFile.empty() && strTrajectoryFile[0] != '/' &&
+        !save_dir.empty())
+      strTrajectoryFile = save_dir + "/" + strTrajectoryFile;
+    if (settings_->trajectoryFileFormat() == 1)
+      trajectoryFormat = TrajectoryRecorder::STREAM_BINARY;
+    nDiagnosticsPeriod = settings_->diagnosticsPeriod();
+  }
+  mpTrajectory =
+      new TrajectoryRecorder(mpAtlas, nTrajectoryCapacity, strTrajectoryFile,
+                             trajectoryFormat, nDiagnosticsPeriod);
+  mpTracker->SetTrajectoryRecorder(mpTrajectory);
+  mnTrackTimesCapacity = nTrajectoryCapacity;
+
   // Initialize the Local Mapping thread and launch
   mpLocalMapper = new LocalMapping(
       this, mpAtlas, settings_,
@@ -233,6 +273,32 @@ System::System(const string &strVocFile, const string &strSettingsFile,
   } else
     mpLocalMapper->mbFarPoints = false;
 
+  // Shared by the local BAs (LocalMapping) and the essential graph
+  // optimizations (LoopClosing)
+  mpICPCache = new ICPConstraintCache();
+  mpLocalMapper->SetICPConstraintCache(mpICPCache);
+  Optimizer::SetICPConstraintCache(mpICPCache);
+
+  mpPayloadStore = static_cast<KeyFramePayloadStore *>(NULL);
+  if (settings_ && settings_->payloadStoreEnable()) {
+    string strCacheDir = settings_->payloadCacheDir();
+    if (!strCacheDir.empty() && strCacheDir[0] != '/')
+      strCacheDir = save_dir + "/" + strCacheDir;
+    mpPayloadStore = new KeyFramePayloadStore(
+        settings_->payloadMemoryBudget(), settings_->payloadLocalWindow(),
+        strCacheDir);
+    mpLocalMapper->SetPayloadStore(mpPayloadStore);
+  }
+
+  // Span tracing, can also be toggled at runtime with SetTracing
+  Trace::SetThreadName("Tracking");
+  if (settings_ && !settings_->traceFile().empty()) {
+    mStrTraceFile = settings_->traceFile();
+    if (mStrTraceFile[0] != '/' && !save_dir.empty())
+      mStrTraceFile = save_dir + "/" + mStrTraceFile;
+    Trace::Enable(true);
+  }
+
   // Initialize the Loop Closing thread and launch
   //  mSensor!=MONOCULAR && mSensor!=IMU_MONOCULAR
   mpLoopCloser =
@@ -302,12 +368,42 @@ void print_fps() {
 }
 vector<float> System::GetTrackTimes() {
   std::unique_lock<std::mutex> lck(mMutexTrackTimes);
-  return vTimesTrack;
+  if (mnTrackTimesCapacity == 0 || vTimesTrack.size() <= mnTrackTimesCapacity)
+    return vTimesTrack;
+  return vector<float>(vTimesTrack.end() - mnTrackTimesCapacity,
+                       vTimesTrack.end());
+}
+
+void System::SetTracing(const bool bEnable) { Trace::Enable(bEnable); }
+
+bool System::SaveTrace(const string &filename) {
+  return Trace::Save(filename);
+}
+
+bool System::SaveGlobalMap(const string &filename) {
+  if (!mpLidarMapping) {
+    cerr << "No dense mapping for this sensor, global map not saved" << endl;
+    return false;
+  }
+  return mpLidarMapping->SaveGlobalMap(filename);
+}
+
+void System::WaitForMapping() {
+  while (mpLocalMapper->KeyframesInQueue() > 0 ||
+         !mpLocalMapper->AcceptKeyFrames() ||
+         mpLoopCloser->KeyframesInQueue() > 0 ||
+         mpLoopCloser->isRunningGBA()) {
+    if (mpLocalMapper->isFinished()) break;
+    // Woken up after each iteration of local mapping, the loop closer only
+    // needs to be polled while local mapping is idle
+    mpLocalMapper->WaitIdle(std::chrono::milliseconds(5));
+  }
 }
 void System::CreateFrameAndPush(
     const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp,
     const std::string &filename, const std::vector<IMU::Point> &ImuMeas,const std::vector<Eigen::Vector3f> &OdomMeas,
     std::shared_ptr<std::promise<Sophus::SE3f>> PosePromise) {
+  Trace::SetThreadName("FramePool");
   cv::Mat imLeftToFeed, imRightToFeed;
   if (settings_ && settings_->needToRectify()) {
     cv::Mat M1l = settings_->M1l();
@@ -342,6 +438,7 @@ void System::NotifyProcessingComplete() {
 }
 void System::CreateTrackFrameThread() {
   auto TrackFrame = [this]() {
+    Trace::SetThreadName("Tracking");
     int fps = 0;
     float sum = 0.0;
     auto last_p = std::chrono::high_resolution_clock::now();
@@ -386,6 +483,11 @@ void System::CreateTrackFrameThread() {
         std::unique_lock<std::mutex> track_lock(mMutexTrackTimes);
         double track_time = dura / 1000.0f;  // ms -> s
         vTimesTrack.emplace_back(track_time);
+        // Drops the oldest samples in batches, amortized constant time
+        if (mnTrackTimesCapacity > 0 &&
+            vTimesTrack.size() >= 2 * mnTrackTimesCapacity)
+          vTimesTrack.erase(vTimesTrack.begin(),
+                            vTimesTrack.begin() + mnTrackTimesCapacity);
         track_lock.unlock();
         if (dura >= 10) {
           last_p = now_p;
@@ -439,7 +541,8 @@ Sophus::SE3f System::TrackStereo(std::shared_ptr<FrameWrapper> framewrapper) {
       mpTracker->GrabImuData(framewrapper->mImuMeas[i_imu]);
     }
   }
-  Sophus::SE3f Tcw = mpTracker->GrabImageStereo(*framewrapper->mFrame);
+  Sophus::SE3f Tcw =
+      mpTracker->GrabImageStereo(std::move(*framewrapper->mFrame));
 
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
@@ -647,7 +750,8 @@ Sophus::SE3f System::TrackRGBD(shared_ptr<FrameWrapper> framewrapper) {
       }
     }
   }
-  Sophus::SE3f Tcw = mpTracker->GrabImageRGBD(*framewrapper->mFrame);
+  Sophus::SE3f Tcw =
+      mpTracker->GrabImageRGBD(std::move(*framewrapper->mFrame));
 
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
@@ -818,7 +922,8 @@ Sophus::SE3f System::TrackMonocular(
       mpTracker->GrabImuData(framewrapper->mImuMeas[i_imu]);
     }
   }
-  Sophus::SE3f Tcw = mpTracker->GrabImageMonocular(*framewrapper->mFrame);
+  Sophus::SE3f Tcw =
+      mpTracker->GrabImageMonocular(std::move(*framewrapper->mFrame));
 
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
@@ -966,15 +1071,27 @@ void System::Shutdown(std::string save_dir) {
     }
     usleep(5000);
   }
+
+  // Poses are final, completes the trajectory file with the frames in memory
+  mpTrajectory->Flush();
+  if (mpTrajectory->NumEvicted() > 0)
+    cout << "The saved trajectories miss the first "
+         << mpTrajectory->NumEvicted()
+         << " frames, evicted from memory by System.TrajectoryCapacity"
+         << endl;
   // mStrSaveAtlasToFile = save_dir + "/" + mStrSaveAtlasToFile;
   if (!mStrSaveAtlasToFile.empty()) {
     Verbose::PrintMess("Atlas saving to file " + mStrSaveAtlasToFile,
                        Verbose::VERBOSITY_NORMAL);
-    SaveAtlas(FileType::BINARY_FILE);
+    SaveAtlas(mnAtlasFileType);
   }
 
   // if (mpViewer) pangolin::BindToContext("Horizon-SLAM: Map Viewer");
 
+  if (mpPayloadStore) mpPayloadStore->PrintStats();
+  mpICPCache->PrintStats();
+  if (!mStrTraceFile.empty()) Trace::Save(mStrTraceFile);
+
 #ifdef REGISTER_TIMES
   mpTracker->PrintTimeStats(save_dir);
 #endif
@@ -984,6 +1101,38 @@ void System::Shutdown(std::string save_dir) {
 void System::InsertRectTime(double &time) {}
 void System::InsertResizeTime(double &time) {}
 void System::InsertTrackTime(double &time) {}
+
+void System::GetStageTimes(
+    std::map<std::string, vector<double>> &mStageTimes) {
+  mStageTimes.clear();
+  mStageTimes["tracking/resize_image"] = mpTracker->vdResizeImage_ms;
+  mStageTimes["tracking/orb_extraction"] = mpTracker->vdORBExtract_ms;
+  mStageTimes["tracking/stereo_matching"] = mpTracker->vdStereoMatch_ms;
+  mStageTimes["tracking/imu_integration"] = mpTracker->vdIMUInteg_ms;
+  mStageTimes["tracking/pose_prediction"] = mpTracker->vdPosePred_ms;
+  mStageTimes["tracking/local_map_tracking"] = mpTracker->vdLMTrack_ms;
+  mStageTimes["tracking/new_keyframe"] = mpTracker->vdNewKF_ms;
+  mStageTimes["tracking/total"] = mpTracker->vdTrackTotal_ms;
+
+  mStageTimes["local_mapping/keyframe_insertion"] =
+      mpLocalMapper->vdKFInsert_ms;
+  mStageTimes["local_mapping/mappoint_culling"] = mpLocalMapper->vdMPCulling_ms;
+  mStageTimes["local_mapping/mappoint_creation"] =
+      mpLocalMapper->vdMPCreation_ms;
+  mStageTimes["local_mapping/local_ba"] = mpLocalMapper->vdLBA_ms;
+  mStageTimes["local_mapping/keyframe_culling"] = mpLocalMapper->vdKFCulling_ms;
+  mStageTimes["local_mapping/total"] = mpLocalMapper->vdLMTotal_ms;
+
+  mStageTimes["loop_closing/database_query"] = mpLoopCloser->vdDataQuery_ms;
+  mStageTimes["loop_closing/sim3_estimation"] = mpLoopCloser->vdEstSim3_ms;
+  mStageTimes["loop_closing/place_recognition"] = mpLoopCloser->vdPRTotal_ms;
+  mStageTimes["loop_closing/loop_fusion"] = mpLoopCloser->vdLoopFusion_ms;
+  mStageTimes["loop_closing/essential_graph"] = mpLoopCloser->vdLoopOptEss_ms;
+  mStageTimes["loop_closing/loop_total"] = mpLoopCloser->vdLoopTotal_ms;
+  mStageTimes["loop_closing/merge_total"] = mpLoopCloser->vdMergeTotal_ms;
+  mStageTimes["loop_closing/global_ba"] = mpLoopCloser->vdGBA_ms;
+  mStageTimes["loop_closing/global_ba_total"] = mpLoopCloser->vdFGBATotal_ms;
+}
 #endif
 bool System::isShutDown() {
   unique_lock<mutex> lock(mMutexReset);
@@ -1009,18 +1158,14 @@ void System::SaveTrajectory(const string &filename) {
   // concatenate the relative transformation. Frames not localized (tracking
   // failure) are not saved.
 
-  // For each frame we have a reference keyframe (lRit), the timestamp (lT) and
-  // a flag which is true when tracking failed (lbL).
-  list<ORB_SLAM3::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
-  list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-  list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-  for (list<Sophus::SE3f>::iterator
-           lit = mpTracker->mlRelativeFramePoses.begin(),
-           lend = mpTracker->mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lT++, lbL++) {
-    if (*lbL) continue;
+  // For each frame we have a reference keyframe, the timestamp and a flag
+  // which is true when tracking failed.
+  TrajectoryRecorder *pTrajectory = mpTracker->mpTrajectory;
+  for (size_t i = 0; i < pTrajectory->Size(); i++) {
+    const TrajectoryRecorder::Record &record = pTrajectory->At(i);
+    if (record.bLost) continue;
 
-    KeyFrame *pKF = *lRit;
+    KeyFrame *pKF = record.pRef;
 
     Sophus::SE3f Trw;
     // cv::Mat Trw = cv::Mat::eye(4,4,CV_32F);
@@ -1034,14 +1179,14 @@ void System::SaveTrajectory(const string &filename) {
 
     Trw = Trw * pKF->GetPose() * Two;
 
-    Sophus::SE3f Tcw = (*lit) * Trw;
+    Sophus::SE3f Tcw = record.Tcr * Trw;
     Sophus::SE3f Twc = Tcw.inverse();
     Eigen::Vector3f twc = Twc.translation();  // cameara to world
     Eigen::Quaternionf q = Twc.unit_quaternion();
 
-    f << setprecision(6) << *lT << " " << setprecision(9) << twc(0) << " "
-      << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " " << q.z()
-      << " " << q.w() << endl;
+    f << setprecision(6) << record.timestamp << " " << setprecision(9) << twc(0)
+      << " " << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " "
+      << q.z() << " " << q.w() << endl;
   }
   f.close();
   cout << endl << "trajectory saved!" << endl;
@@ -1053,7 +1198,7 @@ void System::SaveFrame2FrameReprojErr(const string &filename) {
   ofstream f;
   f.open(filename.c_str());
   f << fixed;
-  for (auto &frame : mpTracker->mFrame2FrameReprojErr) {
+  for (auto &frame : mpTracker->mpTrajectory->Frame2FrameReprojErr()) {
     int id = frame.first;
     vector<float> err = frame.second;
     f << id << " ";
@@ -1070,7 +1215,7 @@ void System::SaveFrame2MapReprojErr(const string &filename) {
   ofstream f;
   f.open(filename.c_str());
   f << fixed;
-  for (auto &frame : mpTracker->mFrame2MapReprojErr) {
+  for (auto &frame : mpTracker->mpTrajectory->Frame2MapReprojErr()) {
     int id = frame.first;
     vector<float> err = frame.second;
     f << id << " ";
@@ -1105,18 +1250,14 @@ void System::SaveTrajectoryTUM(const string &filename) {
   // concatenate the relative transformation. Frames not localized (tracking
   // failure) are not saved.
 
-  // For each frame we have a reference keyframe (lRit), the timestamp (lT) and
-  // a flag which is true when tracking failed (lbL).
-  list<ORB_SLAM3::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
-  list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-  list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-  for (list<Sophus::SE3f>::iterator
-           lit = mpTracker->mlRelativeFramePoses.begin(),
-           lend = mpTracker->mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lT++, lbL++) {
-    if (*lbL) continue;
+  // For each frame we have a reference keyframe, the timestamp and a flag
+  // which is true when tracking failed.
+  TrajectoryRecorder *pTrajectory = mpTracker->mpTrajectory;
+  for (size_t i = 0; i < pTrajectory->Size(); i++) {
+    const TrajectoryRecorder::Record &record = pTrajectory->At(i);
+    if (record.bLost) continue;
 
-    KeyFrame *pKF = *lRit;
+    KeyFrame *pKF = record.pRef;
 
     Sophus::SE3f Trw;
 
@@ -1129,15 +1270,15 @@ void System::SaveTrajectoryTUM(const string &filename) {
     // pKF-GetPose()
     Trw = Trw * pKF->GetPose() * Two;
 
-    Sophus::SE3f Tcw = (*lit) * Trw;
+    Sophus::SE3f Tcw = record.Tcr * Trw;
     Sophus::SE3f Twc = Tcw.inverse();
 
     Eigen::Vector3f twc = Twc.translation();  // cameara to world
     Eigen::Quaternionf q = Twc.unit_quaternion();
 
-    f << setprecision(4) << (*lT) * 1e3 << " " << setprecision(9) << twc(0)
-      << " " << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " "
-      << q.z() << " " << q.w() << endl;
+    f << setprecision(4) << record.timestamp * 1e3 << " " << setprecision(9)
+      << twc(0) << " " << twc(1) << " " << twc(2) << " " << q.x() << " "
+      << q.y() << " " << q.z() << " " << q.w() << endl;
   }
   f.close();
   // cout << endl << "trajectory saved!" << endl;
@@ -1210,18 +1351,14 @@ void System::SaveTrajectoryTUM2(const string &filename) {
   // concatenate the relative transformation. Frames not localized (tracking
   // failure) are not saved.
 
-  // For each frame we have a reference keyframe (lRit), the timestamp (lT) and
-  // a flag which is true when tracking failed (lbL).
-  list<ORB_SLAM3::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
-  list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-  list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-  for (list<Sophus::SE3f>::iterator
-           lit = mpTracker->mlRelativeFramePoses.begin(),
-           lend = mpTracker->mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lT++, lbL++) {
-    if (*lbL) continue;
+  // For each frame we have a reference keyframe, the timestamp and a flag
+  // which is true when tracking failed.
+  TrajectoryRecorder *pTrajectory = mpTracker->mpTrajectory;
+  for (size_t i = 0; i < pTrajectory->Size(); i++) {
+    const TrajectoryRecorder::Record &record = pTrajectory->At(i);
+    if (record.bLost) continue;
 
-    KeyFrame *pKF = *lRit;
+    KeyFrame *pKF = record.pRef;
 
     Sophus::SE3f Trw;
 
@@ -1234,15 +1371,15 @@ void System::SaveTrajectoryTUM2(const string &filename) {
     // pKF-GetPose()
     Trw = Trw * pKF->GetPose() * Two;
 
-    Sophus::SE3f Tcw = (*lit) * Trw;
+    Sophus::SE3f Tcw = record.Tcr * Trw;
     Sophus::SE3f Twc = Tcw.inverse();
 
     Eigen::Vector3f twc = Twc.translation();  // cameara to world
     Eigen::Quaternionf q = Twc.unit_quaternion();
 
-    f << setprecision(4) << (*lT) << " " << setprecision(9) << twc(0) << " "
-      << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " " << q.z()
-      << " " << q.w() << endl;
+    f << setprecision(4) << record.timestamp << " " << setprecision(9) << twc(0)
+      << " " << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " "
+      << q.z() << " " << q.w() << endl;
   }
   f.close();
   // cout << endl << "trajectory saved!" << endl;
@@ -1388,25 +1525,15 @@ void System::SaveTrajectoryEuRoC(const string &filename) {
   // concatenate the relative transformation. Frames not localized (tracking
   // failure) are not saved.
 
-  // For each frame we have a reference keyframe (lRit), the timestamp (lT) and
-  // a flag which is true when tracking failed (lbL).
-  list<ORB_SLAM3::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
-  list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-  list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-
-  // cout << "size mlpReferences: " << mpTracker->mlpReferences.size() << endl;
-  // cout << "size mlRelativeFramePoses: " <<
-  // mpTracker->mlRelativeFramePoses.size() << endl; cout << "size
-  // mpTracker->mlFrameTimes: " << mpTracker->mlFrameTimes.size() << endl; cout
-  // << "size mpTracker->mlbLost: " << mpTracker->mlbLost.size() << endl;
-
-  for (auto lit = mpTracker->mlRelativeFramePoses.begin(),
-            lend = mpTracker->mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lT++, lbL++) {
+  // For each frame we have a reference keyframe, the timestamp and a flag
+  // which is true when tracking failed.
+  TrajectoryRecorder *pTrajectory = mpTracker->mpTrajectory;
+  for (size_t i = 0; i < pTrajectory->Size(); i++) {
+    const TrajectoryRecorder::Record &record = pTrajectory->At(i);
     // cout << "1" << endl;
-    if (*lbL) continue;
+    if (record.bLost) continue;
 
-    KeyFrame *pKF = *lRit;
+    KeyFrame *pKF = record.pRef;
     // cout << "KF: " << pKF->mnId << endl;
 
     Sophus::SE3f Trw;
@@ -1438,19 +1565,19 @@ void System::SaveTrajectoryEuRoC(const string &filename) {
 
     if (mSensor == IMU_MONOCULAR || mSensor == IMU_STEREO ||
         mSensor == IMU_RGBD) {
-      Sophus::SE3f Twb = (pKF->mImuCalib.mTbc * (*lit) * Trw).inverse();
+      Sophus::SE3f Twb = (pKF->mImuCalib.mTbc * record.Tcr * Trw).inverse();
       Eigen::Quaternionf q = Twb.unit_quaternion();
       Eigen::Vector3f twb = Twb.translation();
-      f << setprecision(6) << 1e9 * (*lT) << " " << setprecision(9) << twb(0)
-        << " " << twb(1) << " " << twb(2) << " " << q.x() << " " << q.y() << " "
-        << q.z() << " " << q.w() << endl;
+      f << setprecision(6) << 1e9 * record.timestamp << " " << setprecision(9)
+        << twb(0) << " " << twb(1) << " " << twb(2) << " " << q.x() << " "
+        << q.y() << " " << q.z() << " " << q.w() << endl;
     } else {
-      Sophus::SE3f Twc = ((*lit) * Trw).inverse();
+      Sophus::SE3f Twc = (record.Tcr * Trw).inverse();
       Eigen::Quaternionf q = Twc.unit_quaternion();
       Eigen::Vector3f twc = Twc.translation();
-      f << setprecision(6) << 1e9 * (*lT) << " " << setprecision(9) << twc(0)
-        << " " << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " "
-        << q.z() << " " << q.w() << endl;
+      f << setprecision(6) << 1e9 * record.timestamp << " " << setprecision(9)
+        << twc(0) << " " << twc(1) << " " << twc(2) << " " << q.x() << " "
+        << q.y() << " " << q.z() << " " << q.w() << endl;
     }
 
     // cout << "5" << endl;
@@ -1494,25 +1621,15 @@ void System::SaveTrajectoryEuRoC(const string &filename, Map *pMap) {
   // concatenate the relative transformation. Frames not localized (tracking
   // failure) are not saved.
 
-  // For each frame we have a reference keyframe (lRit), the timestamp (lT) and
-  // a flag which is true when tracking failed (lbL).
-  list<ORB_SLAM3::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
-  list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-  list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-
-  // cout << "size mlpReferences: " << mpTracker->mlpReferences.size() << endl;
-  // cout << "size mlRelativeFramePoses: " <<
-  // mpTracker->mlRelativeFramePoses.size() << endl; cout << "size
-  // mpTracker->mlFrameTimes: " << mpTracker->mlFrameTimes.size() << endl; cout
-  // << "size mpTracker->mlbLost: " << mpTracker->mlbLost.size() << endl;
-
-  for (auto lit = mpTracker->mlRelativeFramePoses.begin(),
-            lend = mpTracker->mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lT++, lbL++) {
+  // For each frame we have a reference keyframe, the timestamp and a flag
+  // which is true when tracking failed.
+  TrajectoryRecorder *pTrajectory = mpTracker->mpTrajectory;
+  for (size_t i = 0; i < pTrajectory->Size(); i++) {
+    const TrajectoryRecorder::Record &record = pTrajectory->At(i);
     // cout << "1" << endl;
-    if (*lbL) continue;
+    if (record.bLost) continue;
 
-    KeyFrame *pKF = *lRit;
+    KeyFrame *pKF = record.pRef;
     // cout << "KF: " << pKF->mnId << endl;
 
     Sophus::SE3f Trw;
@@ -1544,19 +1661,19 @@ void System::SaveTrajectoryEuRoC(const string &filename, Map *pMap) {
 
     if (mSensor == IMU_MONOCULAR || mSensor == IMU_STEREO ||
         mSensor == IMU_RGBD) {
-      Sophus::SE3f Twb = (pKF->mImuCalib.mTbc * (*lit) * Trw).inverse();
+      Sophus::SE3f Twb = (pKF->mImuCalib.mTbc * record.Tcr * Trw).inverse();
       Eigen::Quaternionf q = Twb.unit_quaternion();
       Eigen::Vector3f twb = Twb.translation();
-      f << setprecision(6) << 1e9 * (*lT) << " " << setprecision(9) << twb(0)
-        << " " << twb(1) << " " << twb(2) << " " << q.x() << " " << q.y() << " "
-        << q.z() << " " << q.w() << endl;
+      f << setprecision(6) << 1e9 * record.timestamp << " " << setprecision(9)
+        << twb(0) << " " << twb(1) << " " << twb(2) << " " << q.x() << " "
+        << q.y() << " " << q.z() << " " << q.w() << endl;
     } else {
-      Sophus::SE3f Twc = ((*lit) * Trw).inverse();
+      Sophus::SE3f Twc = (record.Tcr * Trw).inverse();
       Eigen::Quaternionf q = Twc.unit_quaternion();
       Eigen::Vector3f twc = Twc.translation();
-      f << setprecision(6) << 1e9 * (*lT) << " " << setprecision(9) << twc(0)
-        << " " << twc(1) << " " << twc(2) << " " << q.x() << " " << q.y() << " "
-        << q.z() << " " << q.w() << endl;
+      f << setprecision(6) << 1e9 * record.timestamp << " " << setprecision(9)
+        << twc(0) << " " << twc(1) << " " << twc(2) << " " << q.x() << " "
+        << q.y() << " " << q.z() << " " << q.w() << endl;
     }
 
     // cout << "5" << endl;
@@ -1936,15 +2053,12 @@ void System::SaveTrajectoryKITTI(const string &filename) {
   // concatenate the relative transformation. Frames not localized (tracking
   // failure) are not saved.
 
-  // For each frame we have a reference keyframe (lRit), the timestamp (lT) and
-  // a flag which is true when tracking failed (lbL).
-  list<ORB_SLAM3::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
-  list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-  for (list<Sophus::SE3f>::iterator
-           lit = mpTracker->mlRelativeFramePoses.begin(),
-           lend = mpTracker->mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lT++) {
-    ORB_SLAM3::KeyFrame *pKF = *lRit;
+  // For each frame we have a reference keyframe, the timestamp and a flag
+  // which is true when tracking failed.
+  TrajectoryRecorder *pTrajectory = mpTracker->mpTrajectory;
+  for (size_t i = 0; i < pTrajectory->Size(); i++) {
+    const TrajectoryRecorder::Record &record = pTrajectory->At(i);
+    ORB_SLAM3::KeyFrame *pKF = record.pRef;
 
     Sophus::SE3f Trw;
 
@@ -1957,7 +2071,7 @@ void System::SaveTrajectoryKITTI(const string &filename) {
 
     Trw = Trw * pKF->GetPose() * Tow;
 
-    Sophus::SE3f Tcw = (*lit) * Trw;
+    Sophus::SE3f Tcw = record.Tcr * Trw;
     Sophus::SE3f Twc = Tcw.inverse();
     Eigen::Matrix3f Rwc = Twc.rotationMatrix();
     Eigen::Vector3f twc = Twc.translation();
@@ -2109,7 +2223,8 @@ void System::SaveAtlas(int type) {
     // string pathSaveFileName = "./";
     string pathSaveFileName = "";
     pathSaveFileName = pathSaveFileName.append(mStrSaveAtlasToFile);
-    pathSaveFileName = pathSaveFileName.append(".osa");
+    pathSaveFileName =
+        pathSaveFileName.append(type == CHUNKED_FILE ? ".osc" : ".osa");
 
     std::cout << "pathSaveFileName: " << pathSaveFileName << std::endl;
 
@@ -2139,6 +2254,12 @@ void System::SaveAtlas(int type) {
       oa << strVocabularyChecksum;
       oa << mpAtlas;
       cout << "End to write save binary file" << endl;
+    } else if (type == CHUNKED_FILE)  // Chunked file
+    {
+      cout << "Starting to write the save chunked file" << endl;
+      AtlasArchive::Save(mpAtlas, mpKeyFrameDatabase, pathSaveFileName,
+                         strVocabularyName, strVocabularyChecksum);
+      cout << "End to write save chunked file" << endl;
     }
   }
 }
@@ -2149,7 +2270,8 @@ bool System::LoadAtlas(int type) {
 
   string pathLoadFileName = "";
   pathLoadFileName = pathLoadFileName.append(mStrLoadAtlasFromFile);
-  pathLoadFileName = pathLoadFileName.append(".osa");
+  pathLoadFileName =
+      pathLoadFileName.append(type == CHUNKED_FILE ? ".osc" : ".osa");
 
   if (type == TEXT_FILE)  // File text
   {
@@ -2179,6 +2301,14 @@ bool System::LoadAtlas(int type) {
     ia >> mpAtlas;
     cout << "End to load the save binary file" << endl;
     isRead = true;
+  } else if (type == CHUNKED_FILE)  // Chunked file
+  {
+    cout << "Starting to read the save chunked file" << endl;
+    mpAtlas = AtlasArchive::Load(pathLoadFileName, mpKeyFrameDatabase,
+                                 strFileVoc, strVocChecksum);
+    if (!mpAtlas) return false;
+    cout << "End to load the save chunked file" << endl;
+    isRead = true;
   }
 
   if (isRead) {
@@ -2196,7 +2326,16 @@ bool System::LoadAtlas(int type) {
 
     mpAtlas->SetKeyFrameDababase(mpKeyFrameDatabase);
     mpAtlas->SetORBVocabulary(mpVocabulary);
-    mpAtlas->PostLoad();
+    mpAtlas->PostLoad(type != CHUNKED_FILE);
+
+    // The chunked file carries the inverted file of the database
+    if (type == CHUNKED_FILE) {
+      map<long unsigned int, KeyFrame *> mpKFid;
+      for (Map *pMi : mpAtlas->GetAllMaps()) {
+        for (KeyFrame *pKFi : pMi->GetAllKeyFrames()) mpKFid[pKFi->mnId] = pKFi;
+      }
+      mpKeyFrameDatabase->PostLoad(mpKFid);
+    }
 
     return true;
   }
@@ -0,0 +1,225 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Trace.h"
+
+#include <stddef.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  const char* category;
+  int64_t ts;
+  int64_t dur;
+};
+
+// Events are written by the owner thread only and published through nCount.
+// All the events of a chunk belong to the same thread, tid only changes
+// while the chunk is empty.
+struct TraceChunk {
+  static const size_t kSize = 4096;
+  TraceEvent events[kSize];
+  std::atomic<size_t> nCount;
+  std::atomic<int> tid;
+  std::atomic<const char*> name;
+  std::atomic<TraceChunk*> pNext;
+
+  TraceChunk(const int id, const char* threadName)
+      : nCount(0), tid(id), name(threadName), pNext(NULL) {}
+};
+
+// Buffers are linked in a global list and never freed, so Save() may walk
+// them while their threads keep recording or have exited. The buffer of an
+// exited thread is handed to the next new thread, which keeps appending to
+// it under a new tid, so short lived threads (pools, OpenMP) do not grow the
+// trace memory past the number of threads alive at once.
+struct ThreadBuffer {
+  // Past this a thread drops its spans, ~32 MB per thread
+  static const size_t kMaxChunks = 256;
+
+  TraceChunk* pFirst;
+  TraceChunk* pLast;
+  size_t nChunks;
+  // Thread currently owning the buffer, only accessed by that thread
+  int tid;
+  const char* name;
+  std::atomic<size_t> nDropped;
+  std::atomic<bool> bInUse;
+  ThreadBuffer* pNext;
+
+  explicit ThreadBuffer(const int id)
+      : pFirst(new TraceChunk(id, NULL)),
+        nChunks(1),
+        tid(id),
+        name(NULL),
+        nDropped(0),
+        bInUse(true),
+        pNext(NULL) {
+    pLast = pFirst;
+  }
+};
+
+// Gives the buffer back when its thread exits
+struct ThreadBufferOwner {
+  ThreadBuffer* pBuffer;
+
+  ThreadBufferOwner() : pBuffer(NULL) {}
+  ~ThreadBufferOwner() {
+    if (pBuffer) pBuffer->bInUse.store(false, std::memory_order_release);
+  }
+};
+
+const std::chrono::steady_clock::time_point gTraceEpoch =
+    std::chrono::steady_clock::now();
+std::atomic<ThreadBuffer*> gpBuffers(NULL);
+std::atomic<int> gnThreads(0);
+thread_local ThreadBufferOwner tlOwner;
+
+ThreadBuffer* GetThreadBuffer() {
+  if (tlOwner.pBuffer) return tlOwner.pBuffer;
+
+  // Reuse the buffer of an exited thread if there is one
+  for (ThreadBuffer* pBuffer = gpBuffers.load(std::memory_order_acquire);
+       pBuffer; pBuffer = pBuffer->pNext) {
+    bool bInUse = false;
+    if (pBuffer->bInUse.compare_exchange_strong(bInUse, true,
+                                                std::memory_order_acquire)) {
+      // A new thread, its spans must not be merged with the previous owner's
+      pBuffer->tid = gnThreads.fetch_add(1);
+      pBuffer->name = NULL;
+      TraceChunk* pChunk = pBuffer->pLast;
+      if (pChunk->nCount.load(std::memory_order_relaxed) == 0) {
+        pChunk->tid.store(pBuffer->tid, std::memory_order_relaxed);
+        pChunk->name.store(NULL, std::memory_order_relaxed);
+      }
+      tlOwner.pBuffer = pBuffer;
+      return pBuffer;
+    }
+  }
+
+  ThreadBuffer* pBuffer = new ThreadBuffer(gnThreads.fetch_add(1));
+  ThreadBuffer* pHead = gpBuffers.load(std::memory_order_relaxed);
+  do {
+    pBuffer->pNext = pHead;
+  } while (!gpBuffers.compare_exchange_weak(pHead, pBuffer,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+  tlOwner.pBuffer = pBuffer;
+  return pBuffer;
+}
+
+}  // namespace
+
+std::atomic<bool> Trace::sbEnabled(false);
+
+void Trace::SetThreadName(const char* name) {
+  ThreadBuffer* pBuffer = GetThreadBuffer();
+  pBuffer->name = name;
+  TraceChunk* pChunk = pBuffer->pLast;
+  if (pChunk->tid.load(std::memory_order_relaxed) == pBuffer->tid)
+    pChunk->name.store(name, std::memory_order_release);
+}
+
+int64_t Trace::Now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - gTraceEpoch)
+      .count();
+}
+
+void Trace::Record(const char* name, const char* category,
+                   const int64_t tBegin, const int64_t tEnd) {
+  ThreadBuffer* pBuffer = GetThreadBuffer();
+  TraceChunk* pChunk = pBuffer->pLast;
+  size_t n = pChunk->nCount.load(std::memory_order_relaxed);
+  // Full, or filled by the previous owner of the buffer
+  if (n == TraceChunk::kSize ||
+      pChunk->tid.load(std::memory_order_relaxed) != pBuffer->tid) {
+    if (pBuffer->nChunks == ThreadBuffer::kMaxChunks) {
+      pBuffer->nDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    TraceChunk* pNewChunk = new TraceChunk(pBuffer->tid, pBuffer->name);
+    pChunk->pNext.store(pNewChunk, std::memory_order_release);
+    pBuffer->pLast = pNewChunk;
+    pBuffer->nChunks++;
+    pChunk = pNewChunk;
+    n = 0;
+  }
+  TraceEvent& event = pChunk->events[n];
+  event.name = name;
+  event.category = category;
+  event.ts = tBegin;
+  event.dur = tEnd - tBegin;
+  pChunk->nCount.store(n + 1, std::memory_order_release);
+}
+
+bool Trace::Save(const std::string& strFile) {
+  std::ofstream f(strFile.c_str());
+  if (!f.is_open()) {
+    std::cerr << "Failed to open trace file " << strFile << std::endl;
+    return false;
+  }
+
+  const int pid = getpid();
+  size_t nEvents = 0, nDropped = 0;
+  bool bFirst = true;
+  f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  // A thread names all its chunks, but only the last one may have the name
+  // if it was set late
+  std::map<int, const char*> mThreadNames;
+  for (ThreadBuffer* pBuffer = gpBuffers.load(std::memory_order_acquire);
+       pBuffer; pBuffer = pBuffer->pNext) {
+    for (TraceChunk* pChunk = pBuffer->pFirst; pChunk;
+         pChunk = pChunk->pNext.load(std::memory_order_acquire)) {
+      const size_t n = pChunk->nCount.load(std::memory_order_acquire);
+      if (n == 0) continue;
+      const int tid = pChunk->tid.load(std::memory_order_relaxed);
+      const char* threadName = pChunk->name.load(std::memory_order_acquire);
+      if (threadName) mThreadNames[tid] = threadName;
+      for (size_t i = 0; i < n; i++) {
+        const TraceEvent& event = pChunk->events[i];
+        f << (bFirst ? "" : ",") << "\n{\"name\":\"" << event.name
+          << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":"
+          << event.ts << ",\"dur\":" << event.dur << ",\"pid\":" << pid
+          << ",\"tid\":" << tid << "}";
+        bFirst = false;
+      }
+      nEvents += n;
+    }
+    nDropped += pBuffer->nDropped.load(std::memory_order_relaxed);
+  }
+  for (const auto& threadName : mThreadNames) {
+    f << (bFirst ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\","
+      << "\"pid\":" << pid << ",\"tid\":" << threadName.first
+      << ",\"args\":{\"name\":\"" << threadName.second << "\"}}";
+    bFirst = false;
+  }
+  f << "\n]}\n";
+  f.close();
+
+  std::cout << "Trace saved to " << strFile << ": " << nEvents << " spans, "
+            << nDropped << " dropped" << std::endl;
+  return true;
+}
+
+}  // namespace ORB_SLAM3
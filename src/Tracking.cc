@@ -23,12 +23,15 @@
 
 #include <omp.h>
 
+#include <atomic>
 #include <boost/filesystem.hpp>
 #include <chrono>
 #include <iostream>
+#include <memory>
 #include <mutex>
 
 #include "Converter.h"
+#include "EpochReclaimer.h"
 #include "FrameDrawer.h"
 #include "G2oTypes.h"
 #include "GeometricTools.h"
@@ -37,20 +40,31 @@
 #include "ORBmatcher.h"
 #include "Optimizer.h"
 #include "Pinhole.h"
+#include "Trace.h"
 using namespace std;
 
 namespace ORB_SLAM3 {
 
+namespace {
+
+// Lost frames reusing the relocalization candidates of the first one before
+// the keyframe database is queried again
+const unsigned long kRelocCandidateFrames = 5;
+
+}  // namespace
+
 Tracking::Tracking(System* pSys, ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer,
                    MapDrawer* pMapDrawer, Atlas* pAtlas,
                    KeyFrameDatabase* pKFDB, const string& strSettingPath,
                    const int sensor, Settings* settings, const string& _nameSeq)
     : mState(NO_IMAGES_YET),
       mSensor(sensor),
+      mpTrajectory(NULL),
       mTrackedFr(0),
       mbStep(false),
       mbOnlyTracking(false),
       mbMapUpdated(false),
+      mbSampleDiagnostics(true),
       mbVO(false),
       mpORBVocabulary(pVoc),
       mpKeyFrameDB(pKFDB),
@@ -69,11 +83,16 @@ Tracking::Tracking(System* pSys, ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer,
       mnFirstFrameId(0),
       mpCamera2(nullptr),
       mpLastKeyFrame(static_cast<KeyFrame*>(NULL)),
-      mbimuInit(false) {
+      mbimuInit(false),
+      mImuRing(8192),
+      mOdomRing(1024),
+      mpRelocCandidatesMap(NULL),
+      mnRelocCandidatesFrameId(0),
+      mRelocalizationBudget(0) {
   mpRegistration = std::make_shared<RegistrationGICP>();
   mpLocalPointCloud =
       pcl::PointCloud<PointType>::Ptr(new pcl::PointCloud<PointType>);
-  voxel = new pcl::VoxelGrid<PointType>();
+  voxel = new VoxelFilter<PointType>();
   voxel->setLeafSize(0.1, 0.1, 0.1);
   // 获取当前执行文件路径
   char result[PATH_MAX];
@@ -653,6 +672,8 @@ void Tracking::newParameterLoader(Settings* settings) {
   mUseOpticalFlow = settings->useOpticalFlow();
   mCameraModel = settings->cameraModel();
   time_recently_lost = settings->timeRecentlyLost();
+  mRelocalizationBudget = std::chrono::microseconds(
+      static_cast<long>(settings->relocalizationBudget() * 1000.f));
 
   // ORB parameters
   int nFeatures = settings->nFeatures();
@@ -1420,6 +1441,7 @@ std::shared_ptr<Frame> Tracking::CreateFrame(const cv::Mat& imLeft,
                                              const cv::Mat& imRight,
                                              const double& timestamp,
                                              const std::string& filename) {
+  TRACE_SPAN("CreateFrame", "frame_pool");
   std::shared_ptr<Frame> frame;
   cv::Mat image_left = imLeft;
   cv::Mat image_right = imRight;
@@ -1509,10 +1531,10 @@ std::shared_ptr<Frame> Tracking::CreateFrame(const cv::Mat& imLeft,
   return frame;
 }
 
-Sophus::SE3f Tracking::GrabImageStereo(Frame& frame) {
+Sophus::SE3f Tracking::GrabImageStereo(Frame&& frame) {
   mImGray = frame.imgLeft;
   mImRight = frame.imgRight;
-  mCurrentFrame = frame;
+  mCurrentFrame = std::move(frame);
   mCurrentFrame.mnDataset = mnNumDataset;
 
 #ifdef REGISTER_TIMES
@@ -1527,6 +1549,7 @@ Sophus::SE3f Tracking::GrabImageStereo(const cv::Mat& imRectLeft,
                                        const cv::Mat& imRectRight,
                                        const double& timestamp,
                                        string filename) {
+  TRACE_SPAN("GrabImageStereo", "tracking");
   // cout << "GrabImageStereo" << endl;
 
   mImGray = imRectLeft;
@@ -1590,9 +1613,9 @@ Sophus::SE3f Tracking::GrabImageStereo(const cv::Mat& imRectLeft,
   return mCurrentFrame.GetPose();
 }
 
-Sophus::SE3f Tracking::GrabImageRGBD(Frame& frame) {
+Sophus::SE3f Tracking::GrabImageRGBD(Frame&& frame) {
   mImGray = frame.imgLeft;
-  mCurrentFrame = frame;
+  mCurrentFrame = std::move(frame);
   mCurrentFrame.mnDataset = mnNumDataset;
 
 #ifdef REGISTER_TIMES
@@ -1604,6 +1627,7 @@ Sophus::SE3f Tracking::GrabImageRGBD(Frame& frame) {
 
 Sophus::SE3f Tracking::GrabImageRGBD(const cv::Mat& imRGB, const cv::Mat& imD,
                                      const double& timestamp, string filename) {
+  TRACE_SPAN("GrabImageRGBD", "tracking");
   mImGray = imRGB;
   cv::Mat imDepth = imD;
   int winsize_lk = mPSettings->getLKWinsize();
@@ -1645,11 +1669,11 @@ Sophus::SE3f Tracking::GrabImageRGBD(const cv::Mat& imRGB, const cv::Mat& imD,
   return mCurrentFrame.GetPose();
 }
 
-Sophus::SE3f Tracking::GrabImageMonocular(Frame& frame) {
+Sophus::SE3f Tracking::GrabImageMonocular(Frame&& frame) {
   mImGray = frame.imgLeft;
-  mCurrentFrame = frame;
+  mCurrentFrame = std::move(frame);
   mCurrentFrame.mnDataset = mnNumDataset;
-  if (mState == NO_IMAGES_YET) t0 = frame.mTimeStamp;
+  if (mState == NO_IMAGES_YET) t0 = mCurrentFrame.mTimeStamp;
 #ifdef REGISTER_TIMES
   vdORBExtract_ms.push_back(mCurrentFrame.mTimeORB_Ext);
 #endif
@@ -1663,6 +1687,7 @@ Sophus::SE3f Tracking::GrabImageMonocular(Frame& frame) {
 Sophus::SE3f Tracking::GrabImageMonocular(const cv::Mat& im,
                                           const double& timestamp,
                                           string filename) {
+  TRACE_SPAN("GrabImageMonocular", "tracking");
   mImGray = im;
   if (mImGray.channels() == 3) {
     if (mbRGB)
@@ -1713,57 +1738,74 @@ Sophus::SE3f Tracking::GrabImageMonocular(const cv::Mat& im,
 }
 
 void Tracking::GrabImuData(const IMU::Point& imuMeasurement) {
-  unique_lock<mutex> lock(mMutexImuQueue);
-  mlQueueImuData.push_back(imuMeasurement);
+  if (!mImuRing.Push(imuMeasurement) && mImuRing.Dropped() % 1000 == 1)
+    cerr << "IMU ring full, " << mImuRing.Dropped()
+         << " measurements dropped" << endl;
 }
 void Tracking::GrabOdomData(const Eigen::Vector3f& odomMeasurement) {
-  unique_lock<mutex> lock(mMutexOdomQueue);
-  mlQueueOdomData.push_back(odomMeasurement);
+  if (!mOdomRing.Push(odomMeasurement) && mOdomRing.Dropped() % 1000 == 1)
+    cerr << "Odom ring full, " << mOdomRing.Dropped()
+         << " measurements dropped" << endl;
+}
+
+static IMU::Point InterpolateImu(const IMU::Point& p0, const IMU::Point& p1,
+                                 const double t) {
+  IMU::Point p;
+  const double dt = p1.t - p0.t;
+  const float alpha = dt > 0 ? (t - p0.t) / dt : 0.f;
+  p.a = p0.a + (p1.a - p0.a) * alpha;
+  p.w = p0.w + (p1.w - p0.w) * alpha;
+  p.t = t;
+  return p;
+}
+
+bool Tracking::ExtractImuSpan(const double tPrev, const double tCur,
+                              std::vector<IMU::Point>& vSpan) {
+  vSpan.clear();
+
+  // Keep only the last sample at or before tPrev to interpolate the start
+  while (mImuRing.Size() >= 2 && mImuRing.At(1).t <= tPrev) mImuRing.Pop();
+
+  const size_t N = mImuRing.Size();
+  if (N < 2) return false;
+
+  vSpan.push_back(InterpolateImu(mImuRing.At(0), mImuRing.At(1), tPrev));
+  size_t i = 0;
+  while (i < N && mImuRing.At(i).t <= tPrev) i++;
+  for (; i < N && mImuRing.At(i).t < tCur; i++)
+    vSpan.push_back(mImuRing.At(i));
+  // Extrapolated from the last two samples if tCur is not reached yet
+  const size_t iEnd = std::max<size_t>(std::min(i, N - 1), 1);
+  vSpan.push_back(
+      InterpolateImu(mImuRing.At(iEnd - 1), mImuRing.At(iEnd), tCur));
+
+  // The last sample at or before tCur starts the next span
+  size_t nPop = 0;
+  while (nPop + 1 < N && mImuRing.At(nPop + 1).t <= tCur) nPop++;
+  mImuRing.Pop(nPop);
+
+  return true;
 }
 
 void Tracking::PreintegrateIMU() {
+  TRACE_SPAN("PreintegrateIMU", "tracking");
   if (!mCurrentFrame.mpPrevFrame) {
     Verbose::PrintMess("non prev frame ", Verbose::VERBOSITY_NORMAL);
+    while (mImuRing.Size() >= 2 &&
+           mImuRing.At(1).t <= mCurrentFrame.mTimeStamp)
+      mImuRing.Pop();
     mCurrentFrame.setIntegrated();
     return;
   }
 
-  mvImuFromLastFrame.clear();
-  mvImuFromLastFrame.reserve(mlQueueImuData.size());
-  if (mlQueueImuData.size() == 0) {
-    Verbose::PrintMess("Not IMU data in mlQueueImuData!!",
+  if (!ExtractImuSpan(mCurrentFrame.mpPrevFrame->mTimeStamp,
+                      mCurrentFrame.mTimeStamp, mvImuFromLastFrame)) {
+    Verbose::PrintMess("Not IMU data in mImuRing!!",
                        Verbose::VERBOSITY_NORMAL);
     mCurrentFrame.setIntegrated();
     return;
   }
 
-  while (true) {
-    bool bSleep = false;
-    {
-      unique_lock<mutex> lock(mMutexImuQueue);
-      if (!mlQueueImuData.empty()) {
-        IMU::Point* m = &mlQueueImuData.front();
-        // cout<<"m->t: "<<m->t<<endl;
-        // cout<<"mCurrentFrame.mpPrevFrame->mTimeStamp-mImuPer:
-        // "<<mCurrentFrame.mpPrevFrame->mTimeStamp-mImuPer<<endl;
-        cout.precision(17);
-        if (m->t < mCurrentFrame.mpPrevFrame->mTimeStamp - mImuPer) {
-          mlQueueImuData.pop_front();
-        } else if (m->t < mCurrentFrame.mTimeStamp - mImuPer) {
-          mvImuFromLastFrame.push_back(*m);
-          mlQueueImuData.pop_front();
-        } else {
-          mvImuFromLastFrame.push_back(*m);
-          break;
-        }
-      } else {
-        break;
-        bSleep = true;
-      }
-    }
-    if (bSleep) usleep(500);
-  }
-
   const int n = mvImuFromLastFrame.size() - 1;
   if (n == 0) {
     cout << "Empty IMU measurements vector!!!\n";
@@ -1773,48 +1815,16 @@ void Tracking::PreintegrateIMU() {
   IMU::Preintegrated* pImuPreintegratedFromLastFrame =
       new IMU::Preintegrated(mLastFrame.mImuBias, mCurrentFrame.mImuCalib);
 
+  // Both endpoints lie on the frame timestamps, integrate the midpoints
+  mvImuSpan.clear();
   for (int i = 0; i < n; i++) {
-    float tstep;
-    Eigen::Vector3f acc, angVel;
-    if ((i == 0) && (i < (n - 1))) {
-      float tab = mvImuFromLastFrame[i + 1].t - mvImuFromLastFrame[i].t;
-      float tini =
-          mvImuFromLastFrame[i].t - mCurrentFrame.mpPrevFrame->mTimeStamp;
-      acc = (mvImuFromLastFrame[i].a + mvImuFromLastFrame[i + 1].a -
-             (mvImuFromLastFrame[i + 1].a - mvImuFromLastFrame[i].a) *
-                 (tini / tab)) *
-            0.5f;
-      angVel = (mvImuFromLastFrame[i].w + mvImuFromLastFrame[i + 1].w -
-                (mvImuFromLastFrame[i + 1].w - mvImuFromLastFrame[i].w) *
-                    (tini / tab)) *
-               0.5f;
-      tstep =
-          mvImuFromLastFrame[i + 1].t - mCurrentFrame.mpPrevFrame->mTimeStamp;
-    } else if (i < (n - 1)) {
-      acc = (mvImuFromLastFrame[i].a + mvImuFromLastFrame[i + 1].a) * 0.5f;
-      angVel = (mvImuFromLastFrame[i].w + mvImuFromLastFrame[i + 1].w) * 0.5f;
-      tstep = mvImuFromLastFrame[i + 1].t - mvImuFromLastFrame[i].t;
-    } else if ((i > 0) && (i == (n - 1))) {
-      float tab = mvImuFromLastFrame[i + 1].t - mvImuFromLastFrame[i].t;
-      float tend = mvImuFromLastFrame[i + 1].t - mCurrentFrame.mTimeStamp;
-      acc = (mvImuFromLastFrame[i].a + mvImuFromLastFrame[i + 1].a -
-             (mvImuFromLastFrame[i + 1].a - mvImuFromLastFrame[i].a) *
-                 (tend / tab)) *
-            0.5f;
-      angVel = (mvImuFromLastFrame[i].w + mvImuFromLastFrame[i + 1].w -
-                (mvImuFromLastFrame[i + 1].w - mvImuFromLastFrame[i].w) *
-                    (tend / tab)) *
-               0.5f;
-      tstep = mCurrentFrame.mTimeStamp - mvImuFromLastFrame[i].t;
-    } else if ((i == 0) && (i == (n - 1))) {
-      acc = mvImuFromLastFrame[i].a;
-      angVel = mvImuFromLastFrame[i].w;
-      tstep = mCurrentFrame.mTimeStamp - mCurrentFrame.mpPrevFrame->mTimeStamp;
-    }
-    
-    mpImuPreintegratedFromLastKF->IntegrateNewMeasurement(acc, angVel, tstep);
-    pImuPreintegratedFromLastFrame->IntegrateNewMeasurement(acc, angVel, tstep);
+    const IMU::Point& p0 = mvImuFromLastFrame[i];
+    const IMU::Point& p1 = mvImuFromLastFrame[i + 1];
+    mvImuSpan.push_back(IMU::Preintegrated::integrable(
+        (p0.a + p1.a) * 0.5f, (p0.w + p1.w) * 0.5f, p1.t - p0.t));
   }
+  mpImuPreintegratedFromLastKF->IntegrateNewMeasurements(mvImuSpan);
+  pImuPreintegratedFromLastFrame->IntegrateNewMeasurements(mvImuSpan);
 
   mCurrentFrame.mpImuPreintegratedFrame = pImuPreintegratedFromLastFrame;
   mCurrentFrame.mpImuPreintegrated = mpImuPreintegratedFromLastKF;
@@ -1830,16 +1840,16 @@ void Tracking::PreintegrateIMU() {
 }
 
 bool Tracking::PredictStateOdom() {
-  if (mlQueueOdomData.size() < 2) {
-    Verbose::PrintMess("Not enough odom data in mlQueueOdomData!!",
+  const int n = mOdomRing.Size();
+  if (n < 2) {
+    Verbose::PrintMess("Not enough odom data in mOdomRing!!",
                        Verbose::VERBOSITY_NORMAL);
     return false;
   }
 
   Eigen::Vector3f sum = {0, 0, 0};
-  int n = mlQueueOdomData.size();
-  for (auto it = mlQueueOdomData.begin(); it != mlQueueOdomData.end(); it++) {
-    sum += *it;
+  for (int i = 0; i < n; i++) {
+    sum += mOdomRing.At(i);
   }
 
   Eigen::Vector3f avg_vel = sum / n;
@@ -1849,7 +1859,7 @@ bool Tracking::PredictStateOdom() {
   Eigen::Matrix3f Rodom2camera = mPSettings->getRodom2cam();
   Eigen::Vector3f delta_pos = Rodom2camera * avg_vel * dt;
 
-  mlQueueOdomData.clear();
+  mOdomRing.Pop(n);
 
   Eigen::Vector3f dpos_camera = delta_pos;
 
@@ -1941,6 +1951,7 @@ void Tracking::ResetFrameIMU() {
 }
 // 计算位姿的函数
 bool Tracking::EstimatePoseByOF() {
+  TRACE_SPAN("EstimatePoseByOF", "tracking");
   // 创建光流的初始点
   if (mLastFrame.image.empty() || mCurrentFrame.image.empty()) {
     std::cerr << "Image is empty!" << std::endl;
@@ -2040,6 +2051,7 @@ bool Tracking::EstimatePoseByOF() {
   }
 }
 void Tracking::Track() {
+  TRACE_SPAN("Track", "tracking");
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_StartTrack =
       std::chrono::steady_clock::now();
@@ -2049,6 +2061,10 @@ void Tracking::Track() {
     while (!mbStep && bStepByStep) usleep(500);
     mbStep = false;
   }
+  if (EpochReclaimer::IsEnabled()) {
+    ReleaseBadMapPoints();
+    EpochReclaimer::Quiescent();
+  }
   // mpLocalMapper->WakeUp();
   if (mpLocalMapper->mbBadImu) {
     cout << "TRACK: Reset map because local mapper set the bad imu flag "
@@ -2058,6 +2074,8 @@ void Tracking::Track() {
     return;
   }
 
+  mbSampleDiagnostics = mpTrajectory->SampleDiagnostics(mCurrentFrame.mnId);
+
   Map* pCurrentMap = mpAtlas->GetCurrentMap();
   if (!pCurrentMap) {
     cout << "ERROR: There is not an active map in the atlas" << endl;
@@ -2068,8 +2086,7 @@ void Tracking::Track() {
       cerr << "ERROR: Frame with a timestamp older than previous frame "
               "detected!"
            << endl;
-      unique_lock<mutex> lock(mMutexImuQueue);
-      mlQueueImuData.clear();
+      mImuRing.Clear();
       CreateMapInAtlas();
       return;
     } else if (mCurrentFrame.mTimeStamp > mLastFrame.mTimeStamp + 1.0) {
@@ -2129,7 +2146,8 @@ void Tracking::Track() {
   mbCreatedMap = false;
 
   // Get Map Mutex -> Map cannot be changed
-  unique_lock<mutex> lock(pCurrentMap->mMutexMapUpdate);
+  unique_lock<mutex> lock =
+      TracedLock(pCurrentMap->mMutexMapUpdate, "MapUpdate");
 
   mbMapUpdated = false;
 
@@ -2660,18 +2678,18 @@ void Tracking::Track() {
     // Store frame pose information to retrieve the complete camera
     // trajectory afterwards.
     if (mCurrentFrame.isSet()) {
-      Sophus::SE3f Tcr_ = mCurrentFrame.GetPose() *
-                          mCurrentFrame.mpReferenceKF->GetPoseInverse();
-      mlRelativeFramePoses.push_back(Tcr_);
-      mlpReferences.push_back(mCurrentFrame.mpReferenceKF);
-      mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
-      mlbLost.push_back(mState == LOST);
-    } else {
+      TrajectoryRecorder::Record record;
+      record.Tcr = mCurrentFrame.GetPose() *
+                   mCurrentFrame.mpReferenceKF->GetPoseInverse();
+      record.pRef = mCurrentFrame.mpReferenceKF;
+      record.timestamp = mCurrentFrame.mTimeStamp;
+      record.bLost = mState == LOST;
+      mpTrajectory->Push(record);
+    } else if (!mpTrajectory->Empty()) {
       // This can happen if tracking is lost
-      mlRelativeFramePoses.push_back(mlRelativeFramePoses.back());
-      mlpReferences.push_back(mlpReferences.back());
-      mlFrameTimes.push_back(mlFrameTimes.back());
-      mlbLost.push_back(mState == LOST);
+      TrajectoryRecorder::Record record = mpTrajectory->Back();
+      record.bLost = mState == LOST;
+      mpTrajectory->Push(record);
     }
   }
 #ifdef REGISTER_TIMES
@@ -2695,6 +2713,7 @@ void Tracking::Track() {
 }
 
 void Tracking::StereoInitialization() {
+  ExtractDeferredORB();
   if (mCurrentFrame.N > 500) {
     if (mSensor == System::IMU_STEREO || mSensor == System::IMU_RGBD) {
       if (!mCurrentFrame.mpImuPreintegrated || !mLastFrame.mpImuPreintegrated) {
@@ -2824,6 +2843,7 @@ void Tracking::StereoInitialization() {
 }
 
 void Tracking::MonocularInitialization() {
+  ExtractDeferredORB();
   if (!mbReadyToInitializate) {
     // Set Reference Frame
     if (mCurrentFrame.mvKeys.size() > 100) {
@@ -3103,7 +3123,39 @@ void Tracking::CheckReplacedInLastFrame() {
   }
 }
 
+void Tracking::ExtractDeferredORB() {
+  mCurrentFrame.ExtractDeferredORB(mSensor == System::MONOCULAR ||
+                                   mSensor == System::IMU_MONOCULAR);
+}
+
+void Tracking::ExtractDeferredORBIfUncovered() {
+  if (mCurrentFrame.IsORBDeferred() &&
+      mCurrentFrame.N < mPSettings->lazyORBMinTracked())
+    ExtractDeferredORB();
+}
+
+void Tracking::ReleaseBadMapPoints() {
+  for (int i = 0; i < mLastFrame.N; i++) {
+    MapPoint* pMP = mLastFrame.mvpMapPoints[i];
+    if (pMP && pMP->isBad()) {
+      MapPoint* pRep = pMP->GetReplaced();
+      mLastFrame.mvpMapPoints[i] = (pRep && !pRep->isBad()) ? pRep : NULL;
+    }
+  }
+
+  const size_t nLocalMPs = mvpLocalMapPoints.size();
+  mvpLocalMapPoints.erase(
+      remove_if(mvpLocalMapPoints.begin(), mvpLocalMapPoints.end(),
+                [](MapPoint* pMP) { return pMP->isBad(); }),
+      mvpLocalMapPoints.end());
+  // The viewer draws the local map from its copy in the map
+  if (mvpLocalMapPoints.size() != nLocalMPs)
+    mpAtlas->SetReferenceMapPoints(mvpLocalMapPoints);
+}
+
 bool Tracking::TrackReferenceKeyFrame() {
+  TRACE_SPAN("TrackReferenceKeyFrame", "tracking");
+  ExtractDeferredORB();
   // Compute Bag of Words vector
   mCurrentFrame.ComputeBoW();
 
@@ -3180,7 +3232,7 @@ void Tracking::UpdateLastFrame() {
   if (mState == RECENTLY_LOST) maxPoint = 200;
   KeyFrame* pRef = mLastFrame.mpReferenceKF;
   // if (!pRef) return;
-  Sophus::SE3f Tlr = mlRelativeFramePoses.back();
+  Sophus::SE3f Tlr = mpTrajectory->Back().Tcr;
   mLastFrame.SetPose(Tlr * pRef->GetPose());
 
   if (mnLastKeyFrameId == mLastFrame.mnId || mSensor == System::MONOCULAR ||
@@ -3464,6 +3516,7 @@ bool Tracking::PredictStateNDT() {
   return false;
 }
 bool Tracking::TrackWithMotionModel() {
+  TRACE_SPAN("TrackWithMotionModel", "tracking");
   ORBmatcher matcher(0.9, true);
 
   // Update last frame pose according to its reference keyframe
@@ -3501,6 +3554,7 @@ bool Tracking::TrackWithMotionModel() {
         DIST_THRESHOLD,
         (mSensor == System::MONOCULAR || mSensor == System::IMU_MONOCULAR));
     // LOG(INFO) << "Matches with optical flow: " << nmatches;
+    ExtractDeferredORBIfUncovered();
 
   } else {
     nmatches = matcher.SearchByProjection(
@@ -3535,9 +3589,9 @@ bool Tracking::TrackWithMotionModel() {
   }
 
   // Optimize frame pose with all matches
-  Optimizer::PoseOptimization(&mCurrentFrame, true, false, 4);
-  mFrame2FrameReprojErr[mCurrentFrame.mnId] =
-      mCurrentFrame.GetFrame2FrameReprojError();
+  Optimizer::PoseOptimization(&mCurrentFrame, mbSampleDiagnostics, false, 4);
+  mpTrajectory->AddFrame2FrameReprojErr(
+      mCurrentFrame.mnId, mCurrentFrame.GetFrame2FrameReprojError());
   // Discard outliers
   int nmatchesMap = 0;
   for (int i = 0; i < mCurrentFrame.N; i++) {
@@ -3574,13 +3628,14 @@ bool Tracking::TrackWithMotionModel() {
 }
 
 bool Tracking::TrackWithMotionModelICP() {
+  TRACE_SPAN("TrackWithMotionModelICP", "tracking");
   ORBmatcher matcher(0.9, true);
 
   // Update last frame pose according to its reference keyframe
   // Create "visual odometry" points if in Localization Mode
   UpdateLastFrame();
   bool bICP = false;
-  int bEnableOdom = mPSettings->enableRobotOdom() && !mlQueueOdomData.empty();
+  int bEnableOdom = mPSettings->enableRobotOdom() && !mOdomRing.Empty();
   // 给ICP提供一个初始位姿
   Eigen::Vector3f dpos =
       mpImuPreintegratedFromLastKF->GetUpdatedDeltaPosition();
@@ -3625,6 +3680,7 @@ bool Tracking::TrackWithMotionModelICP() {
         DIST_THRESHOLD,
         (mSensor == System::MONOCULAR || mSensor == System::IMU_MONOCULAR));
     // LOG(INFO) << "Matches with optical flow: " << nmatches;
+    ExtractDeferredORBIfUncovered();
 
   } else {
     nmatches = matcher.SearchByProjection(
@@ -3674,20 +3730,21 @@ bool Tracking::TrackWithMotionModelICP() {
     if (mPSettings->useLidarObs() && mpLocalPointCloud->size() > 100 &&
         nmatches < 100) {
       Optimizer::PoseLidarVisualOptimization(
-          &mCurrentFrame, mpLocalPointCloud, false, true, nIterations,
-          pointToPlaneInliers, pointToPlaneError);
+          &mCurrentFrame, mpLocalPointCloud, false, mbSampleDiagnostics,
+          nIterations, pointToPlaneInliers, pointToPlaneError);
 
-      mFrame2MapReprojErr[mCurrentFrame.mnId] =
-          mCurrentFrame.GetFrame2MapReprojError();
+      mpTrajectory->AddFrame2MapReprojErr(
+          mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
     } else {
-      Optimizer::PoseOptimization(&mCurrentFrame, false, true, nIterations);
-      mFrame2MapReprojErr[mCurrentFrame.mnId] =
-          mCurrentFrame.GetFrame2MapReprojError();
+      Optimizer::PoseOptimization(&mCurrentFrame, false, mbSampleDiagnostics,
+                                  nIterations);
+      mpTrajectory->AddFrame2MapReprojErr(
+          mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
     }
   } else {
-    Optimizer::PoseOptimization(&mCurrentFrame, true, false, 4);
-    mFrame2FrameReprojErr[mCurrentFrame.mnId] =
-        mCurrentFrame.GetFrame2FrameReprojError();
+    Optimizer::PoseOptimization(&mCurrentFrame, mbSampleDiagnostics, false, 4);
+    mpTrajectory->AddFrame2FrameReprojErr(
+        mCurrentFrame.mnId, mCurrentFrame.GetFrame2FrameReprojError());
   }
 
   // // Discard outliers
@@ -3727,6 +3784,7 @@ bool Tracking::TrackWithMotionModelICP() {
 }
 
 bool Tracking::TrackLocalMap() {
+  TRACE_SPAN("TrackLocalMap", "tracking");
   // We have an estimation of the camera pose and some map points tracked in
   // the frame. We retrieve the local map and try to find matches to points in
   // the local map.
@@ -3745,55 +3803,60 @@ bool Tracking::TrackLocalMap() {
       if (mPSettings->useLidarObs() && mpLocalPointCloud->size() > 100) {
         // // 1HZ update local point cloud
         Optimizer::PoseLidarVisualOptimization(
-            &mCurrentFrame, mpLocalPointCloud, false, true, nIterations,
-            pointToPlaneInliers, pointToPlaneError);
+            &mCurrentFrame, mpLocalPointCloud, false, mbSampleDiagnostics,
+            nIterations, pointToPlaneInliers, pointToPlaneError);
         // Optimizer::PoseOptimization(&mCurrentFrame, false, true,
         // nIterations); mFrame2MapReprojErr[mCurrentFrame.mnId] =
         //     mCurrentFrame.GetFrame2MapReprojError();
       } else {
-        Optimizer::PoseOptimization(&mCurrentFrame, false, true, nIterations);
-        mFrame2MapReprojErr[mCurrentFrame.mnId] =
-            mCurrentFrame.GetFrame2MapReprojError();
+        Optimizer::PoseOptimization(&mCurrentFrame, false,
+                                    mbSampleDiagnostics, nIterations);
+        mpTrajectory->AddFrame2MapReprojErr(
+            mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
       }
     } else {
-      Optimizer::PoseOptimization(&mCurrentFrame, false, true, nIterations);
-      mFrame2MapReprojErr[mCurrentFrame.mnId] =
-          mCurrentFrame.GetFrame2MapReprojError();
+      Optimizer::PoseOptimization(&mCurrentFrame, false, mbSampleDiagnostics,
+                                  nIterations);
+      mpTrajectory->AddFrame2MapReprojErr(
+          mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
     }
   } else {
     if (mCurrentFrame.mnId <= mnLastRelocFrameId + mnFramesToResetIMU) {
       Verbose::PrintMess("TLM: PoseOptimization ", Verbose::VERBOSITY_DEBUG);
-      Optimizer::PoseOptimization(&mCurrentFrame, false, true, nIterations);
-      mFrame2MapReprojErr[mCurrentFrame.mnId] =
-          mCurrentFrame.GetFrame2MapReprojError();
+      Optimizer::PoseOptimization(&mCurrentFrame, false, mbSampleDiagnostics,
+                                  nIterations);
+      mpTrajectory->AddFrame2MapReprojErr(
+          mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
     } else {
       if (!mbMapUpdated) {
         if (mSensor == System::IMU_RGBD && mPSettings->useLidarObs()) {
           mpLidarMapping->GetLocalMap(mpLocalPointCloud);
           Optimizer::PoseLidarVisualInertialOptimizationLastFrame(
-              &mCurrentFrame, mpLocalPointCloud, false, false, true,
-              nIterations, pointToPlaneInliers, pointToPlaneError);
+              &mCurrentFrame, mpLocalPointCloud, false, false,
+              mbSampleDiagnostics, nIterations, pointToPlaneInliers,
+              pointToPlaneError);
         } else {
           Optimizer::PoseInertialOptimizationLastFrame(
-              &mCurrentFrame, false, false, true, nIterations);
+              &mCurrentFrame, false, false, mbSampleDiagnostics, nIterations);
         }
-        mFrame2MapReprojErr[mCurrentFrame.mnId] =
-            mCurrentFrame.GetFrame2MapReprojError();
+        mpTrajectory->AddFrame2MapReprojErr(
+            mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
 
       } else {
         if (mSensor == System::IMU_RGBD && mPSettings->useLidarObs()) {
           mpLidarMapping->GetLocalMap(mpLocalPointCloud);
 
           Optimizer::PoseLidarVisualInertialOptimizationLastKeyFrame(
-              &mCurrentFrame, mpLocalPointCloud, false, false, true,
-              nIterations, pointToPlaneInliers, pointToPlaneError);
+              &mCurrentFrame, mpLocalPointCloud, false, false,
+              mbSampleDiagnostics, nIterations, pointToPlaneInliers,
+              pointToPlaneError);
 
         } else {
           Optimizer::PoseInertialOptimizationLastKeyFrame(
-              &mCurrentFrame, false, false, true, nIterations);
+              &mCurrentFrame, false, false, mbSampleDiagnostics, nIterations);
         }
-        mFrame2MapReprojErr[mCurrentFrame.mnId] =
-            mCurrentFrame.GetFrame2MapReprojError();
+        mpTrajectory->AddFrame2MapReprojErr(
+            mCurrentFrame.mnId, mCurrentFrame.GetFrame2MapReprojError());
       }
     }
   }
@@ -4166,6 +4229,7 @@ bool Tracking::NeedNewKeyFrameNew() {
 }
 
 void Tracking::CreateNewKeyFrame() {
+  TRACE_SPAN("CreateNewKeyFrame", "tracking");
   if (mpLocalMapper->IsInitializing() && !mpAtlas->isImuInitialized()) return;
 
   if (!mpLocalMapper->SetNotStop(true)) {
@@ -4403,13 +4467,10 @@ void Tracking::UpdateLocalKeyFrames() {
       MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
       if (pMP) {
         if (!pMP->isBad()) {
-          const map<KeyFrame*, tuple<int, int>> observations =
-              pMP->GetObservations();
-          for (map<KeyFrame*, tuple<int, int>>::const_iterator
-                   it = observations.begin(),
-                   itend = observations.end();
-               it != itend; it++)
-            keyframeCounter[it->first]++;
+          pMP->ForEachObservation(
+              [&](KeyFrame* pKF, const tuple<int, int>&) {
+                keyframeCounter[pKF]++;
+              });
         } else {
           mCurrentFrame.mvpMapPoints[i] = NULL;
         }
@@ -4422,13 +4483,10 @@ void Tracking::UpdateLocalKeyFrames() {
         MapPoint* pMP = mLastFrame.mvpMapPoints[i];
         if (!pMP) continue;
         if (!pMP->isBad()) {
-          const map<KeyFrame*, tuple<int, int>> observations =
-              pMP->GetObservations();
-          for (map<KeyFrame*, tuple<int, int>>::const_iterator
-                   it = observations.begin(),
-                   itend = observations.end();
-               it != itend; it++)
-            keyframeCounter[it->first]++;
+          pMP->ForEachObservation(
+              [&](KeyFrame* pKF, const tuple<int, int>&) {
+                keyframeCounter[pKF]++;
+              });
         } else {
           // MODIFICATION
           mLastFrame.mvpMapPoints[i] = NULL;
@@ -4535,16 +4593,32 @@ void Tracking::UpdateLocalKeyFrames() {
 }
 
 bool Tracking::Relocalization() {
+  TRACE_SPAN("Relocalization", "tracking");
+  ExtractDeferredORB();
   Verbose::PrintMess("Starting relocalization", Verbose::VERBOSITY_NORMAL);
-  // Compute Bag of Words Vector
-  mCurrentFrame.ComputeBoW();
+  const std::chrono::steady_clock::time_point tStart =
+      std::chrono::steady_clock::now();
 
   // Relocalization is performed when tracking is lost
   // Track Lost: Query KeyFrame Database for keyframe candidates for
-  // relocalisation
-  vector<KeyFrame*> vpCandidateKFs =
-      mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame,
-                                                   mpAtlas->GetCurrentMap());
+  // relocalisation. Consecutive lost frames reuse the candidates of the
+  // first one for a few frames.
+  Map* pCurrentMap = mpAtlas->GetCurrentMap();
+  vector<KeyFrame*> vpCandidateKFs;
+  if (pCurrentMap == mpRelocCandidatesMap &&
+      mCurrentFrame.mnId < mnRelocCandidatesFrameId + kRelocCandidateFrames) {
+    for (KeyFrame* pKF : mvpRelocCandidates)
+      if (!pKF->isBad()) vpCandidateKFs.push_back(pKF);
+  }
+  if (vpCandidateKFs.empty()) {
+    // Compute Bag of Words Vector
+    mCurrentFrame.ComputeBoW();
+    vpCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(
+        &mCurrentFrame, pCurrentMap);
+    mvpRelocCandidates = vpCandidateKFs;
+    mpRelocCandidatesMap = pCurrentMap;
+    mnRelocCandidatesFrameId = mCurrentFrame.mnId;
+  }
 
   if (vpCandidateKFs.empty()) {
     Verbose::PrintMess("There are not candidates", Verbose::VERBOSITY_NORMAL);
@@ -4553,140 +4627,135 @@ bool Tracking::Relocalization() {
 
   const int nKFs = vpCandidateKFs.size();
 
-  // We perform first an ORB matching with each candidate
-  // If enough matches are found we setup a PnP solver
+  // We perform first an ORB matching with the reference keyframe, it does
+  // not depend on the candidate so a single PnP problem is solved
   ORBmatcher matcher(0.75, true);
-
-  vector<MLPnPsolver*> vpMLPnPsolvers;
-  vpMLPnPsolvers.resize(nKFs);
-
-  vector<vector<MapPoint*>> vvpMapPointMatches;
-  vvpMapPointMatches.resize(nKFs);
-
-  vector<bool> vbDiscarded;
-  vbDiscarded.resize(nKFs);
-
-  int nCandidates = 0;
-
-  for (int i = 0; i < nKFs; i++) {
-    KeyFrame* pKF = vpCandidateKFs[i];
-    if (pKF->isBad())
-      vbDiscarded[i] = true;
-    else {
-      // int nmatches =
-      //     matcher.SearchByBoW(pKF, mCurrentFrame, vvpMapPointMatches[i]);
-      int nmatches = matcher.SearchWithGMS(mpReferenceKF, mCurrentFrame,
-                                           vvpMapPointMatches[i]);
-      if (nmatches < 15) {
-        vbDiscarded[i] = true;
-        continue;
-      } else {
-        MLPnPsolver* pSolver =
-            new MLPnPsolver(mCurrentFrame, vvpMapPointMatches[i]);
-        pSolver->SetRansacParameters(
-            0.99, 10, 300, 6, 0.5,
-            5.991);  // This solver needs at least 6 points
-        vpMLPnPsolvers[i] = pSolver;
-        nCandidates++;
-      }
+  vector<MapPoint*> vpMapPointMatches;
+  // int nmatches =
+  //     matcher.SearchByBoW(pKF, mCurrentFrame, vvpMapPointMatches[i]);
+  const int nmatches =
+      matcher.SearchWithGMS(mpReferenceKF, mCurrentFrame, vpMapPointMatches);
+  if (nmatches < 15) return false;
+
+  MLPnPsolver solver(mCurrentFrame, vpMapPointMatches);
+  solver.SetRansacParameters(0.99, 10, 300, 6, 0.5,
+                             5.991);  // This solver needs at least 6 points
+
+  // Perform some iterations of P4P RANSAC until we found a camera pose
+  // supported by enough inliers. Only the refinement of a pose by projection
+  // depends on the candidate, it runs on all of them in parallel, each on its
+  // own copy of the frame. The first candidate in order that succeeds wins
+  // and cancels the ones after it.
+  vector<unique_ptr<Frame>> vpFrames(nKFs);
+  std::atomic<int> nMatch(nKFs);
+  bool bBudgetExceeded = false;
+  bool bNoMore = false;
+  Frame F0;
+  bool bPoseOnly = false;
+
+  while (nMatch == nKFs && !bNoMore && !bBudgetExceeded) {
+    // Perform 5 Ransac Iterations
+    vector<bool> vbInliers;
+    int nInliers;
+    Eigen::Matrix4f eigTcw;
+    const bool bTcw =
+        solver.iterate(5, bNoMore, vbInliers, nInliers, eigTcw);
+
+    bBudgetExceeded =
+        mRelocalizationBudget.count() > 0 &&
+        std::chrono::steady_clock::now() - tStart > mRelocalizationBudget;
+
+    // If a Camera Pose is computed, optimize
+    if (!bTcw) continue;
+
+    F0 = mCurrentFrame;
+    F0.SetPose(Sophus::SE3f(eigTcw));
+
+    set<MapPoint*> sFound;
+
+    const int np = vbInliers.size();
+
+    for (int j = 0; j < np; j++) {
+      if (vbInliers[j]) {
+        F0.mvpMapPoints[j] = vpMapPointMatches[j];
+        sFound.insert(vpMapPointMatches[j]);
+      } else
+        F0.mvpMapPoints[j] = NULL;
     }
-  }
 
-  // Alternatively perform some iterations of P4P RANSAC
-  // Until we found a camera pose supported by enough inliers
-  bool bMatch = false;
-  ORBmatcher matcher2(0.9, true);
+    const int nGood0 = Optimizer::PoseOptimization(&F0);
 
-  while (nCandidates > 0 && !bMatch) {
-    for (int i = 0; i < nKFs; i++) {
-      if (vbDiscarded[i]) continue;
+    if (nGood0 < 10) continue;
 
-      // Perform 5 Ransac Iterations
-      vector<bool> vbInliers;
-      int nInliers;
-      bool bNoMore;
+    for (int io = 0; io < F0.N; io++)
+      if (F0.mvbOutlier[io]) F0.mvpMapPoints[io] = static_cast<MapPoint*>(NULL);
 
-      MLPnPsolver* pSolver = vpMLPnPsolvers[i];
-      Eigen::Matrix4f eigTcw;
-      bool bTcw = pSolver->iterate(5, bNoMore, vbInliers, nInliers, eigTcw);
-
-      // If Ransac reachs max. iterations discard keyframe
-      if (bNoMore) {
-        vbDiscarded[i] = true;
-        nCandidates--;
-      }
-
-      // If a Camera Pose is computed, optimize
-      if (bTcw) {
-        Sophus::SE3f Tcw(eigTcw);
-        mCurrentFrame.SetPose(Tcw);
-        // Tcw.copyTo(mCurrentFrame.mTcw);
-
-        set<MapPoint*> sFound;
-
-        const int np = vbInliers.size();
-
-        for (int j = 0; j < np; j++) {
-          if (vbInliers[j]) {
-            mCurrentFrame.mvpMapPoints[j] = vvpMapPointMatches[i][j];
-            sFound.insert(vvpMapPointMatches[i][j]);
-          } else
-            mCurrentFrame.mvpMapPoints[j] = NULL;
-        }
+    // If the pose is supported by enough inliers no candidate is needed
+    if (nGood0 >= 50) {
+      bPoseOnly = true;
+      break;
+    }
 
-        int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-        if (nGood < 10) continue;
-
-        for (int io = 0; io < mCurrentFrame.N; io++)
-          if (mCurrentFrame.mvbOutlier[io])
-            mCurrentFrame.mvpMapPoints[io] = static_cast<MapPoint*>(NULL);
-
-        // If few inliers, search by projection in a coarse window and
-        // optimize again
-        if (nGood < 50) {
-          int nadditional = matcher2.SearchByProjection(
-              mCurrentFrame, vpCandidateKFs[i], sFound, 10, 100);
-
-          if (nadditional + nGood >= 50) {
-            nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-            // If many inliers but still not enough, search by
-            // projection again in a narrower window the camera has
-            // been already optimized with many points
-            if (nGood > 30 && nGood < 50) {
-              sFound.clear();
-              for (int ip = 0; ip < mCurrentFrame.N; ip++)
-                if (mCurrentFrame.mvpMapPoints[ip])
-                  sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-              nadditional = matcher2.SearchByProjection(
-                  mCurrentFrame, vpCandidateKFs[i], sFound, 3, 64);
-
-              // Final optimization
-              if (nGood + nadditional >= 50) {
-                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                for (int io = 0; io < mCurrentFrame.N; io++)
-                  if (mCurrentFrame.mvbOutlier[io])
-                    mCurrentFrame.mvpMapPoints[io] = NULL;
-              }
-            }
+    // If few inliers, search by projection in a coarse window and
+    // optimize again
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < nKFs; i++) {
+      if (i > nMatch || vpCandidateKFs[i]->isBad()) continue;
+
+      vpFrames[i].reset(new Frame(F0));
+      Frame& F = *vpFrames[i];
+      int nGood = nGood0;
+
+      ORBmatcher matcher2(0.9, true);
+      int nadditional =
+          matcher2.SearchByProjection(F, vpCandidateKFs[i], sFound, 10, 100);
+
+      if (nadditional + nGood >= 50) {
+        nGood = Optimizer::PoseOptimization(&F);
+
+        // If many inliers but still not enough, search by
+        // projection again in a narrower window the camera has
+        // been already optimized with many points
+        if (nGood > 30 && nGood < 50) {
+          set<MapPoint*> sFoundi;
+          for (int ip = 0; ip < F.N; ip++)
+            if (F.mvpMapPoints[ip]) sFoundi.insert(F.mvpMapPoints[ip]);
+          nadditional =
+              matcher2.SearchByProjection(F, vpCandidateKFs[i], sFoundi, 3, 64);
+
+          // Final optimization
+          if (nGood + nadditional >= 50) {
+            nGood = Optimizer::PoseOptimization(&F);
+
+            for (int io = 0; io < F.N; io++)
+              if (F.mvbOutlier[io]) F.mvpMapPoints[io] = NULL;
           }
         }
+      }
 
-        // If the pose is supported by enough inliers stop ransacs and
-        // continue
-        if (nGood >= 50) {
-          bMatch = true;
-          break;
+      // If the pose is supported by enough inliers stop ransacs and
+      // continue
+      if (nGood >= 50) {
+        int nPrev = nMatch;
+        while (i < nPrev && !nMatch.compare_exchange_weak(nPrev, i)) {
         }
       }
     }
   }
 
-  if (!bMatch) {
+  if (!bPoseOnly && nMatch == nKFs) {
+    if (bBudgetExceeded)
+      Verbose::PrintMess("Relocalization out of time budget",
+                         Verbose::VERBOSITY_NORMAL);
     return false;
   } else {
+    const Frame& F = bPoseOnly ? F0 : *vpFrames[nMatch];
+    mCurrentFrame.SetPose(F.GetPose());
+    mCurrentFrame.mvpMapPoints = F.mvpMapPoints;
+    mCurrentFrame.mvbOutlier = F.mvbOutlier;
+    mvpRelocCandidates.clear();
     mnLastRelocFrameId = mCurrentFrame.mnId;
     cout << "Relocalized!!" << endl;
     return true;
@@ -4733,12 +4802,10 @@ void Tracking::Reset(bool bLocMap) {
   mbReadyToInitializate = false;
   mbSetInit = false;
 
-  mlRelativeFramePoses.clear();
-  mlpReferences.clear();
-  mlFrameTimes.clear();
-  mlbLost.clear();
+  mpTrajectory->Clear();
   mCurrentFrame = Frame();
   mnLastRelocFrameId = 0;
+  mvpRelocCandidates.clear();
   mLastFrame = Frame();
   mpReferenceKF = static_cast<KeyFrame*>(NULL);
   mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
@@ -4788,9 +4855,8 @@ void Tracking::ResetActiveMap(bool bLocMap) {
 
   mbReadyToInitializate = false;
 
-  list<bool> lbLost;
-  // lbLost.reserve(mlbLost.size());
-  unsigned int index = mnFirstFrameId;
+  // Records evicted from memory keep their flag
+  unsigned int index = mnFirstFrameId + mpTrajectory->NumEvicted();
   for (Map* pMap : mpAtlas->GetAllMaps()) {
     if (pMap->GetAllKeyFrames().size() > 0) {
       if (index > pMap->GetLowerKFID()) index = pMap->GetLowerKFID();
@@ -4799,12 +4865,9 @@ void Tracking::ResetActiveMap(bool bLocMap) {
 
   int num_lost = 0;
 
-  for (list<bool>::iterator ilbL = mlbLost.begin(); ilbL != mlbLost.end();
-       ilbL++) {
-    if (index < mnInitialFrameId)
-      lbLost.push_back(*ilbL);
-    else {
-      lbLost.push_back(true);
+  for (size_t i = 0; i < mpTrajectory->Size(); i++) {
+    if (index >= mnInitialFrameId) {
+      mpTrajectory->At(i).bLost = true;
       num_lost += 1;
     }
 
@@ -4812,10 +4875,9 @@ void Tracking::ResetActiveMap(bool bLocMap) {
   }
   cout << num_lost << " Frames set to lost" << endl;
 
-  mlbLost = lbLost;
-
   mnInitialFrameId = mCurrentFrame.mnId;
   mnLastRelocFrameId = mCurrentFrame.mnId;
+  mvpRelocCandidates.clear();
 
   mCurrentFrame = Frame();
   mLastFrame = Frame();
@@ -4876,21 +4938,18 @@ void Tracking::UpdateFrameIMU(const float s, const IMU::Bias& b,
                               KeyFrame* pCurrentKeyFrame) {
   Map* pMap = pCurrentKeyFrame->GetMap();
   unsigned int index = mnFirstFrameId;
-  list<ORB_SLAM3::KeyFrame*>::iterator lRit = mlpReferences.begin();
-  list<bool>::iterator lbL = mlbLost.begin();
-  for (auto lit = mlRelativeFramePoses.begin(),
-            lend = mlRelativeFramePoses.end();
-       lit != lend; lit++, lRit++, lbL++) {
-    if (*lbL) continue;
+  for (size_t i = 0; i < mpTrajectory->Size(); i++) {
+    TrajectoryRecorder::Record& record = mpTrajectory->At(i);
+    if (record.bLost) continue;
 
-    KeyFrame* pKF = *lRit;
+    KeyFrame* pKF = record.pRef;
 
     while (pKF->isBad()) {
       pKF = pKF->GetParent();
     }
 
     if (pKF->GetMap() == pMap) {
-      (*lit).translation() *= s;
+      record.Tcr.translation() *= s;
     }
   }
 
@@ -0,0 +1,181 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "TrajectoryRecorder.h"
+
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+
+#include "Atlas.h"
+#include "KeyFrame.h"
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+// Records in flight between the tracking thread and the writer
+const size_t kQueueCapacity = 4096;
+
+}  // namespace
+
+TrajectoryRecorder::TrajectoryRecorder(Atlas* pAtlas, const size_t nCapacity,
+                                       const std::string& strStreamFile,
+                                       const StreamFormat format,
+                                       const int nDiagnosticsPeriod)
+    : mpAtlas(pAtlas),
+      mnCapacity(nCapacity),
+      mFormat(format),
+      mnDiagnosticsPeriod(nDiagnosticsPeriod),
+      mnHead(0),
+      mnEvicted(0),
+      mQueue(kQueueCapacity),
+      mptWriter(NULL),
+      mbStop(false),
+      mnDropped(0) {
+  if (mnCapacity > 0) mvRecords.reserve(mnCapacity);
+  if (strStreamFile.empty()) return;
+
+  if (mFormat == STREAM_BINARY)
+    mStream.open(strStreamFile, std::ios::binary);
+  else
+    mStream.open(strStreamFile);
+  if (!mStream.is_open()) {
+    std::cerr << "Failed to open the trajectory stream " << strStreamFile
+              << std::endl;
+    return;
+  }
+  mStream << std::fixed;
+  mptWriter = new std::thread(&TrajectoryRecorder::Run, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+  if (!mptWriter) return;
+  mbStop = true;
+  mptWriter->join();
+  delete mptWriter;
+}
+
+void TrajectoryRecorder::Push(const Record& record) {
+  if (mnCapacity == 0 || mvRecords.size() < mnCapacity) {
+    mvRecords.push_back(record);
+    return;
+  }
+
+  // Full, the new record takes the place of the oldest one
+  if (mptWriter && !mQueue.Push(mvRecords[mnHead])) mnDropped++;
+  mvRecords[mnHead] = record;
+  mnHead = (mnHead + 1) % mnCapacity;
+  mnEvicted++;
+}
+
+void TrajectoryRecorder::Clear() {
+  mvRecords.clear();
+  mnHead = 0;
+  mnEvicted = 0;
+}
+
+void TrajectoryRecorder::Flush() {
+  if (!mptWriter) return;
+  for (size_t i = 0; i < Size(); i++) {
+    while (!mQueue.Push(At(i))) usleep(1000);
+  }
+  mbStop = true;
+  mptWriter->join();
+  delete mptWriter;
+  mptWriter = NULL;
+  mStream.close();
+
+  if (mnDropped > 0)
+    std::cerr << "Trajectory stream misses " << mnDropped
+              << " frames, the writer could not keep up" << std::endl;
+}
+
+void TrajectoryRecorder::AddFrame2FrameReprojErr(
+    const int frameId, const std::vector<float>& vErr) {
+  AddReprojErr(mFrame2FrameReprojErr, frameId, vErr);
+}
+
+void TrajectoryRecorder::AddFrame2MapReprojErr(const int frameId,
+                                               const std::vector<float>& vErr) {
+  AddReprojErr(mFrame2MapReprojErr, frameId, vErr);
+}
+
+void TrajectoryRecorder::AddReprojErr(std::map<int, std::vector<float>>& mErr,
+                                      const int frameId,
+                                      const std::vector<float>& vErr) {
+  if (!SampleDiagnostics(frameId)) return;
+  mErr[frameId] = vErr;
+  // Same bound as the trajectory, oldest frames first
+  if (mnCapacity > 0 && mErr.size() > mnCapacity) mErr.erase(mErr.begin());
+}
+
+void TrajectoryRecorder::Run() {
+  while (true) {
+    // Read before draining, everything pushed before the stop gets written
+    const bool bStop = mbStop;
+    mQueue.WaitNewData(0, std::chrono::milliseconds(100));
+    const size_t n = mQueue.Size();
+    for (size_t i = 0; i < n; i++) Write(mQueue.At(i));
+    mQueue.Pop(n);
+    if (bStop && mQueue.Empty()) break;
+  }
+  mStream.flush();
+}
+
+void TrajectoryRecorder::Write(const Record& record) {
+  bool bLost = record.bLost || !record.pRef;
+  Sophus::SE3f Twc;
+  // Same origin as SaveTrajectory, the first keyframe of the current map
+  Sophus::SE3f Two;
+  Map* pMap = mpAtlas ? mpAtlas->GetCurrentMap() : NULL;
+  KeyFrame* pOriginKF = pMap ? pMap->GetOriginKF() : NULL;
+  if (pOriginKF) Two = pOriginKF->GetPoseInverse();
+  if (!bLost) {
+    // If the reference keyframe was culled, traverse the spanning tree to get
+    // a suitable keyframe
+    KeyFrame* pKF = record.pRef;
+    Sophus::SE3f Trw;
+    while (pKF && pKF->isBad()) {
+      Trw = Trw * pKF->mTcp;
+      pKF = pKF->GetParent();
+    }
+    if (pKF)
+      Twc = (record.Tcr * Trw * pKF->GetPose() * Two).inverse();
+    else
+      bLost = true;
+  }
+
+  const Eigen::Vector3f twc = Twc.translation();
+  const Eigen::Quaternionf q = Twc.unit_quaternion();
+  if (mFormat == STREAM_BINARY) {
+    StreamRecord r;
+    r.timestamp = record.timestamp;
+    for (int k = 0; k < 3; k++) r.twc[k] = twc[k];
+    r.qwc[0] = q.x();
+    r.qwc[1] = q.y();
+    r.qwc[2] = q.z();
+    r.qwc[3] = q.w();
+    r.bLost = bLost;
+    mStream.write(reinterpret_cast<const char*>(&r), sizeof(r));
+  } else if (!bLost) {
+    mStream << std::setprecision(6) << record.timestamp << " "
+            << std::setprecision(9) << twc(0) << " " << twc(1) << " "
+            << twc(2) << " " << q.x() << " " << q.y() << " " << q.z() << " "
+            << q.w() << "\n";
+  }
+}
+
+}  // namespace ORB_SLAM3
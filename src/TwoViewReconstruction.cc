@@ -25,17 +25,20 @@
 
 #include "Converter.h"
 #include "GeometricTools.h"
+#include "Ransac.h"
 #include "Thirdparty/DBoW2/DUtils/Random.h"
 
 using namespace std;
 namespace ORB_SLAM3 {
 TwoViewReconstruction::TwoViewReconstruction(const Eigen::Matrix3f &k,
-                                             float sigma, int iterations) {
+                                             float sigma, int iterations,
+                                             float confidence) {
   mK = k;
 
   mSigma = sigma;
   mSigma2 = sigma * sigma;
   mMaxIterations = iterations;
+  mfConfidence = confidence;
 }
 
 bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint> &vKeys1,
@@ -65,6 +68,19 @@ bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint> &vKeys1,
 
   const int N = mvMatches12.size();
 
+  mvU1.resize(N);
+  mvV1.resize(N);
+  mvU2.resize(N);
+  mvV2.resize(N);
+  for (int i = 0; i < N; i++) {
+    const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
+    const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
+    mvU1[i] = kp1.pt.x;
+    mvV1[i] = kp1.pt.y;
+    mvU2[i] = kp2.pt.x;
+    mvV2[i] = kp2.pt.y;
+  }
+
   // Indices for minimum set selection
   vector<size_t> vAllIndices;
   vAllIndices.reserve(N);
@@ -129,99 +145,263 @@ bool TwoViewReconstruction::Reconstruct(const std::vector<cv::KeyPoint> &vKeys1,
   }
 }
 
-void TwoViewReconstruction::FindHomography(vector<bool> &vbMatchesInliers,
-                                           float &score, Eigen::Matrix3f &H21) {
-  // Number of putative matches
-  const int N = mvMatches12.size();
+// Homography fitted to normalized points, each match scored by the chi square
+// margins of its transfer errors in both images
+class TwoViewReconstruction::HomographyModel {
+ public:
+  struct Hypothesis {
+    Eigen::Matrix3f H21, H12;
+  };
+
+  static constexpr int kTerms = 2;
+
+  HomographyModel(const TwoViewReconstruction &tvr,
+                  const vector<cv::Point2f> &vPn1,
+                  const vector<cv::Point2f> &vPn2, const Eigen::Matrix3f &T1,
+                  const Eigen::Matrix3f &T2, const float sigma)
+      : mTvr(tvr),
+        mvPn1(vPn1),
+        mvPn2(vPn2),
+        mT1(T1),
+        mT2inv(T2.inverse()),
+        mInvSigmaSquare(1.0 / (sigma * sigma)) {}
+
+  int NumData() const { return mTvr.mvMatches12.size(); }
+
+  float MaxTerm() const { return mTh; }
+
+  bool Fit(const vector<size_t> &vSample, Hypothesis &h) const {
+    vector<cv::Point2f> vPn1i(vSample.size());
+    vector<cv::Point2f> vPn2i(vSample.size());
+    for (size_t j = 0; j < vSample.size(); j++) {
+      const Match &match = mTvr.mvMatches12[vSample[j]];
+      vPn1i[j] = mvPn1[match.first];
+      vPn2i[j] = mvPn2[match.second];
+    }
 
-  // Normalize coordinates
-  vector<cv::Point2f> vPn1, vPn2;
-  Eigen::Matrix3f T1, T2;
-  Normalize(mvKeys1, vPn1, T1);
-  Normalize(mvKeys2, vPn2, T2);
-  Eigen::Matrix3f T2inv = T2.inverse();
+    Eigen::Matrix3f Hn = ComputeH21(vPn1i, vPn2i);
+    h.H21 = mT2inv * Hn * mT1;
+    h.H12 = h.H21.inverse();
+    return true;
+  }
 
-  // Best Results variables
-  score = 0.0;
-  vbMatchesInliers = vector<bool>(N, false);
+  void Score(const Hypothesis &h, const int i0, const int i1, float *pTerms,
+             unsigned char *pbInliers) const {
+    const float h11 = h.H21(0, 0);
+    const float h12 = h.H21(0, 1);
+    const float h13 = h.H21(0, 2);
+    const float h21 = h.H21(1, 0);
+    const float h22 = h.H21(1, 1);
+    const float h23 = h.H21(1, 2);
+    const float h31 = h.H21(2, 0);
+    const float h32 = h.H21(2, 1);
+    const float h33 = h.H21(2, 2);
+
+    const float h11inv = h.H12(0, 0);
+    const float h12inv = h.H12(0, 1);
+    const float h13inv = h.H12(0, 2);
+    const float h21inv = h.H12(1, 0);
+    const float h22inv = h.H12(1, 1);
+    const float h23inv = h.H12(1, 2);
+    const float h31inv = h.H12(2, 0);
+    const float h32inv = h.H12(2, 1);
+    const float h33inv = h.H12(2, 2);
+
+    const float th = mTh;
+    const float invSigmaSquare = mInvSigmaSquare;
+
+    const float *pU1 = mTvr.mvU1.data();
+    const float *pV1 = mTvr.mvV1.data();
+    const float *pU2 = mTvr.mvU2.data();
+    const float *pV2 = mTvr.mvV2.data();
+
+    for (int i = i0; i < i1; i++) {
+      const float u1 = pU1[i];
+      const float v1 = pV1[i];
+      const float u2 = pU2[i];
+      const float v2 = pV2[i];
+
+      // Reprojection error in first image
+      // x2in1 = H12*x2
+
+      const float w2in1inv = 1.0 / (h31inv * u2 + h32inv * v2 + h33inv);
+      const float u2in1 = (h11inv * u2 + h12inv * v2 + h13inv) * w2in1inv;
+      const float v2in1 = (h21inv * u2 + h22inv * v2 + h23inv) * w2in1inv;
+
+      const float squareDist1 =
+          (u1 - u2in1) * (u1 - u2in1) + (v1 - v2in1) * (v1 - v2in1);
+
+      const float chiSquare1 = squareDist1 * invSigmaSquare;
+
+      // Reprojection error in second image
+      // x1in2 = H21*x1
+
+      const float w1in2inv = 1.0 / (h31 * u1 + h32 * v1 + h33);
+      const float u1in2 = (h11 * u1 + h12 * v1 + h13) * w1in2inv;
+      const float v1in2 = (h21 * u1 + h22 * v1 + h23) * w1in2inv;
+
+      const float squareDist2 =
+          (u2 - u1in2) * (u2 - u1in2) + (v2 - v1in2) * (v2 - v1in2);
+
+      const float chiSquare2 = squareDist2 * invSigmaSquare;
+
+      float *pTerm = pTerms + kTerms * (i - i0);
+      pTerm[0] = chiSquare1 > th ? 0.f : th - chiSquare1;
+      pTerm[1] = chiSquare2 > th ? 0.f : th - chiSquare2;
+      pbInliers[i - i0] = !(chiSquare1 > th) && !(chiSquare2 > th);
+    }
+  }
 
-  // Iteration variables
-  vector<cv::Point2f> vPn1i(8);
-  vector<cv::Point2f> vPn2i(8);
-  Eigen::Matrix3f H21i, H12i;
-  vector<bool> vbCurrentInliers(N, false);
-  float currentScore;
+ private:
+  const TwoViewReconstruction &mTvr;
+  const vector<cv::Point2f> &mvPn1;
+  const vector<cv::Point2f> &mvPn2;
+  const Eigen::Matrix3f mT1;
+  const Eigen::Matrix3f mT2inv;
+  const float mInvSigmaSquare;
+  static constexpr float mTh = 5.991;
+};
+
+// Fundamental matrix fitted to normalized points, each match scored by the
+// chi square margins of its distances to the epipolar lines in both images
+class TwoViewReconstruction::FundamentalModel {
+ public:
+  struct Hypothesis {
+    Eigen::Matrix3f F21;
+  };
+
+  static constexpr int kTerms = 2;
+
+  FundamentalModel(const TwoViewReconstruction &tvr,
+                   const vector<cv::Point2f> &vPn1,
+                   const vector<cv::Point2f> &vPn2, const Eigen::Matrix3f &T1,
+                   const Eigen::Matrix3f &T2, const float sigma)
+      : mTvr(tvr),
+        mvPn1(vPn1),
+        mvPn2(vPn2),
+        mT1(T1),
+        mT2t(T2.transpose()),
+        mInvSigmaSquare(1.0 / (sigma * sigma)) {}
+
+  int NumData() const { return mTvr.mvMatches12.size(); }
+
+  // A term is only kept below mTh, so it's at most mThScore
+  float MaxTerm() const { return mThScore; }
+
+  bool Fit(const vector<size_t> &vSample, Hypothesis &h) const {
+    vector<cv::Point2f> vPn1i(vSample.size());
+    vector<cv::Point2f> vPn2i(vSample.size());
+    for (size_t j = 0; j < vSample.size(); j++) {
+      const Match &match = mTvr.mvMatches12[vSample[j]];
+      vPn1i[j] = mvPn1[match.first];
+      vPn2i[j] = mvPn2[match.second];
+    }
 
-  // Perform all RANSAC iterations and save the solution with highest score
-  for (int it = 0; it < mMaxIterations; it++) {
-    // Select a minimum set
-    for (size_t j = 0; j < 8; j++) {
-      int idx = mvSets[it][j];
+    Eigen::Matrix3f Fn = ComputeF21(vPn1i, vPn2i);
+    h.F21 = mT2t * Fn * mT1;
+    return true;
+  }
 
-      vPn1i[j] = vPn1[mvMatches12[idx].first];
-      vPn2i[j] = vPn2[mvMatches12[idx].second];
-    }
+  void Score(const Hypothesis &h, const int i0, const int i1, float *pTerms,
+             unsigned char *pbInliers) const {
+    const float f11 = h.F21(0, 0);
+    const float f12 = h.F21(0, 1);
+    const float f13 = h.F21(0, 2);
+    const float f21 = h.F21(1, 0);
+    const float f22 = h.F21(1, 1);
+    const float f23 = h.F21(1, 2);
+    const float f31 = h.F21(2, 0);
+    const float f32 = h.F21(2, 1);
+    const float f33 = h.F21(2, 2);
 
-    Eigen::Matrix3f Hn = ComputeH21(vPn1i, vPn2i);
-    H21i = T2inv * Hn * T1;
-    H12i = H21i.inverse();
+    const float th = mTh;
+    const float thScore = mThScore;
+    const float invSigmaSquare = mInvSigmaSquare;
+
+    const float *pU1 = mTvr.mvU1.data();
+    const float *pV1 = mTvr.mvV1.data();
+    const float *pU2 = mTvr.mvU2.data();
+    const float *pV2 = mTvr.mvV2.data();
+
+    for (int i = i0; i < i1; i++) {
+      const float u1 = pU1[i];
+      const float v1 = pV1[i];
+      const float u2 = pU2[i];
+      const float v2 = pV2[i];
 
-    currentScore = CheckHomography(H21i, H12i, vbCurrentInliers, mSigma);
+      // Reprojection error in second image
+      // l2=F21x1=(a2,b2,c2)
 
-    if (currentScore > score) {
-      H21 = H21i;
-      vbMatchesInliers = vbCurrentInliers;
-      score = currentScore;
+      const float a2 = f11 * u1 + f12 * v1 + f13;
+      const float b2 = f21 * u1 + f22 * v1 + f23;
+      const float c2 = f31 * u1 + f32 * v1 + f33;
+
+      const float num2 = a2 * u2 + b2 * v2 + c2;
+
+      const float squareDist1 = num2 * num2 / (a2 * a2 + b2 * b2);
+
+      const float chiSquare1 = squareDist1 * invSigmaSquare;
+
+      // Reprojection error in second image
+      // l1 =x2tF21=(a1,b1,c1)
+
+      const float a1 = f11 * u2 + f21 * v2 + f31;
+      const float b1 = f12 * u2 + f22 * v2 + f32;
+      const float c1 = f13 * u2 + f23 * v2 + f33;
+
+      const float num1 = a1 * u1 + b1 * v1 + c1;
+
+      const float squareDist2 = num1 * num1 / (a1 * a1 + b1 * b1);
+
+      const float chiSquare2 = squareDist2 * invSigmaSquare;
+
+      float *pTerm = pTerms + kTerms * (i - i0);
+      pTerm[0] = chiSquare1 > th ? 0.f : thScore - chiSquare1;
+      pTerm[1] = chiSquare2 > th ? 0.f : thScore - chiSquare2;
+      pbInliers[i - i0] = !(chiSquare1 > th) && !(chiSquare2 > th);
     }
   }
+
+ private:
+  const TwoViewReconstruction &mTvr;
+  const vector<cv::Point2f> &mvPn1;
+  const vector<cv::Point2f> &mvPn2;
+  const Eigen::Matrix3f mT1;
+  const Eigen::Matrix3f mT2t;
+  const float mInvSigmaSquare;
+  static constexpr float mTh = 3.841;
+  static constexpr float mThScore = 5.991;
+};
+
+void TwoViewReconstruction::FindHomography(vector<bool> &vbMatchesInliers,
+                                           float &score, Eigen::Matrix3f &H21) {
+  // Normalize coordinates
+  vector<cv::Point2f> vPn1, vPn2;
+  Eigen::Matrix3f T1, T2;
+  Normalize(mvKeys1, vPn1, T1);
+  Normalize(mvKeys2, vPn2, T2);
+
+  // Perform the RANSAC iterations and save the solution with highest score
+  HomographyModel model(*this, vPn1, vPn2, T1, T2, mSigma);
+  Ransac<HomographyModel> ransac(model, mfConfidence);
+  HomographyModel::Hypothesis best;
+  if (ransac.Run(mvSets, best, score, vbMatchesInliers) >= 0) H21 = best.H21;
 }
 
 void TwoViewReconstruction::FindFundamental(vector<bool> &vbMatchesInliers,
                                             float &score,
                                             Eigen::Matrix3f &F21) {
-  // Number of putative matches
-  const int N = vbMatchesInliers.size();
-
   // Normalize coordinates
   vector<cv::Point2f> vPn1, vPn2;
   Eigen::Matrix3f T1, T2;
   Normalize(mvKeys1, vPn1, T1);
   Normalize(mvKeys2, vPn2, T2);
-  Eigen::Matrix3f T2t = T2.transpose();
-
-  // Best Results variables
-  score = 0.0;
-  vbMatchesInliers = vector<bool>(N, false);
-
-  // Iteration variables
-  vector<cv::Point2f> vPn1i(8);
-  vector<cv::Point2f> vPn2i(8);
-  Eigen::Matrix3f F21i;
-  vector<bool> vbCurrentInliers(N, false);
-  float currentScore;
-
-  // Perform all RANSAC iterations and save the solution with highest score
-  for (int it = 0; it < mMaxIterations; it++) {
-    // Select a minimum set
-    for (int j = 0; j < 8; j++) {
-      int idx = mvSets[it][j];
-
-      vPn1i[j] = vPn1[mvMatches12[idx].first];
-      vPn2i[j] = vPn2[mvMatches12[idx].second];
-    }
-
-    Eigen::Matrix3f Fn = ComputeF21(vPn1i, vPn2i);
-
-    F21i = T2t * Fn * T1;
 
-    currentScore = CheckFundamental(F21i, vbCurrentInliers, mSigma);
-
-    if (currentScore > score) {
-      F21 = F21i;
-      vbMatchesInliers = vbCurrentInliers;
-      score = currentScore;
-    }
-  }
+  // Perform the RANSAC iterations and save the solution with highest score
+  FundamentalModel model(*this, vPn1, vPn2, T1, T2, mSigma);
+  Ransac<FundamentalModel> ransac(model, mfConfidence);
+  FundamentalModel::Hypothesis best;
+  if (ransac.Run(mvSets, best, score, vbMatchesInliers) >= 0) F21 = best.F21;
 }
 
 Eigen::Matrix3f TwoViewReconstruction::ComputeH21(
@@ -302,174 +482,6 @@ Eigen::Matrix3f TwoViewReconstruction::ComputeF21(
          svd2.matrixV().transpose();
 }
 
-float TwoViewReconstruction::CheckHomography(const Eigen::Matrix3f &H21,
-                                             const Eigen::Matrix3f &H12,
-                                             vector<bool> &vbMatchesInliers,
-                                             float sigma) {
-  const int N = mvMatches12.size();
-
-  const float h11 = H21(0, 0);
-  const float h12 = H21(0, 1);
-  const float h13 = H21(0, 2);
-  const float h21 = H21(1, 0);
-  const float h22 = H21(1, 1);
-  const float h23 = H21(1, 2);
-  const float h31 = H21(2, 0);
-  const float h32 = H21(2, 1);
-  const float h33 = H21(2, 2);
-
-  const float h11inv = H12(0, 0);
-  const float h12inv = H12(0, 1);
-  const float h13inv = H12(0, 2);
-  const float h21inv = H12(1, 0);
-  const float h22inv = H12(1, 1);
-  const float h23inv = H12(1, 2);
-  const float h31inv = H12(2, 0);
-  const float h32inv = H12(2, 1);
-  const float h33inv = H12(2, 2);
-
-  vbMatchesInliers.resize(N);
-
-  float score = 0;
-
-  const float th = 5.991;
-
-  const float invSigmaSquare = 1.0 / (sigma * sigma);
-
-  for (int i = 0; i < N; i++) {
-    bool bIn = true;
-
-    const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-    const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
-
-    const float u1 = kp1.pt.x;
-    const float v1 = kp1.pt.y;
-    const float u2 = kp2.pt.x;
-    const float v2 = kp2.pt.y;
-
-    // Reprojection error in first image
-    // x2in1 = H12*x2
-
-    const float w2in1inv = 1.0 / (h31inv * u2 + h32inv * v2 + h33inv);
-    const float u2in1 = (h11inv * u2 + h12inv * v2 + h13inv) * w2in1inv;
-    const float v2in1 = (h21inv * u2 + h22inv * v2 + h23inv) * w2in1inv;
-
-    const float squareDist1 =
-        (u1 - u2in1) * (u1 - u2in1) + (v1 - v2in1) * (v1 - v2in1);
-
-    const float chiSquare1 = squareDist1 * invSigmaSquare;
-
-    if (chiSquare1 > th)
-      bIn = false;
-    else
-      score += th - chiSquare1;
-
-    // Reprojection error in second image
-    // x1in2 = H21*x1
-
-    const float w1in2inv = 1.0 / (h31 * u1 + h32 * v1 + h33);
-    const float u1in2 = (h11 * u1 + h12 * v1 + h13) * w1in2inv;
-    const float v1in2 = (h21 * u1 + h22 * v1 + h23) * w1in2inv;
-
-    const float squareDist2 =
-        (u2 - u1in2) * (u2 - u1in2) + (v2 - v1in2) * (v2 - v1in2);
-
-    const float chiSquare2 = squareDist2 * invSigmaSquare;
-
-    if (chiSquare2 > th)
-      bIn = false;
-    else
-      score += th - chiSquare2;
-
-    if (bIn)
-      vbMatchesInliers[i] = true;
-    else
-      vbMatchesInliers[i] = false;
-  }
-
-  return score;
-}
-
-float TwoViewReconstruction::CheckFundamental(const Eigen::Matrix3f &F21,
-                                              vector<bool> &vbMatchesInliers,
-                                              float sigma) {
-  const int N = mvMatches12.size();
-
-  const float f11 = F21(0, 0);
-  const float f12 = F21(0, 1);
-  const float f13 = F21(0, 2);
-  const float f21 = F21(1, 0);
-  const float f22 = F21(1, 1);
-  const float f23 = F21(1, 2);
-  const float f31 = F21(2, 0);
-  const float f32 = F21(2, 1);
-  const float f33 = F21(2, 2);
-
-  vbMatchesInliers.resize(N);
-
-  float score = 0;
-
-  const float th = 3.841;
-  const float thScore = 5.991;
-
-  const float invSigmaSquare = 1.0 / (sigma * sigma);
-
-  for (int i = 0; i < N; i++) {
-    bool bIn = true;
-
-    const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-    const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
-
-    const float u1 = kp1.pt.x;
-    const float v1 = kp1.pt.y;
-    const float u2 = kp2.pt.x;
-    const float v2 = kp2.pt.y;
-
-    // Reprojection error in second image
-    // l2=F21x1=(a2,b2,c2)
-
-    const float a2 = f11 * u1 + f12 * v1 + f13;
-    const float b2 = f21 * u1 + f22 * v1 + f23;
-    const float c2 = f31 * u1 + f32 * v1 + f33;
-
-    const float num2 = a2 * u2 + b2 * v2 + c2;
-
-    const float squareDist1 = num2 * num2 / (a2 * a2 + b2 * b2);
-
-    const float chiSquare1 = squareDist1 * invSigmaSquare;
-
-    if (chiSquare1 > th)
-      bIn = false;
-    else
-      score += thScore - chiSquare1;
-
-    // Reprojection error in second image
-    // l1 =x2tF21=(a1,b1,c1)
-
-    const float a1 = f11 * u2 + f21 * v2 + f31;
-    const float b1 = f12 * u2 + f22 * v2 + f32;
-    const float c1 = f13 * u2 + f23 * v2 + f33;
-
-    const float num1 = a1 * u1 + b1 * v1 + c1;
-
-    const float squareDist2 = num1 * num1 / (a1 * a1 + b1 * b1);
-
-    const float chiSquare2 = squareDist2 * invSigmaSquare;
-
-    if (chiSquare2 > th)
-      bIn = false;
-    else
-      score += thScore - chiSquare2;
-
-    if (bIn)
-      vbMatchesInliers[i] = true;
-    else
-      vbMatchesInliers[i] = false;
-  }
-
-  return score;
-}
-
 bool TwoViewReconstruction::ReconstructF(
     vector<bool> &vbMatchesInliers, Eigen::Matrix3f &F21, Eigen::Matrix3f &K,
     Sophus::SE3f &T21, vector<cv::Point3f> &vP3D, vector<bool> &vbTriangulated,
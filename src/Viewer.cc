@@ -27,6 +27,8 @@
 
 #include <mutex>
 
+#include "EpochReclaimer.h"
+
 namespace ORB_SLAM3 {
 
 Viewer::Viewer(System *pSystem, FrameDrawer *pFrameDrawer,
@@ -160,6 +162,8 @@ void Viewer::Run() {
   mbFinished = false;
   mbStopped = false;
 #ifdef ENABLE_VIEWER
+  // Map points are only read while drawing a frame
+  EpochParticipant epochParticipant;
   pangolin::CreateWindowAndBind("Horizon-SLAM: Map Viewer", 1024, 768);
 
   // 3D Mouse handler requires depth testing to be enabled
@@ -427,6 +431,7 @@ void Viewer::Run() {
       }
     }
 
+    EpochReclaimer::Quiescent();
     if (CheckFinish()) break;
     pangolin::FinishFrame();
     usleep(25000);
@@ -0,0 +1,126 @@
+// Copyright (c) 2022，Horizon Robotics.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Voxelizer.h"
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+// Enough partitions to balance the threads, few enough to keep each hash
+// table busy
+const int kPartitionBits = 6;
+const int kPartitions = 1 << kPartitionBits;
+
+inline uint64_t Mix(const uint64_t key) {
+  // Fibonacci hashing, the high bits depend on all the key bits
+  return key * 0x9E3779B97F4A7C15ull;
+}
+
+inline int Partition(const uint64_t key) {
+  return Mix(key) >> (64 - kPartitionBits);
+}
+
+}  // namespace
+
+void Voxelizer::Group() {
+  const int n = mvKeys.size();
+
+  // Bucket the points by partition, in input order
+  std::vector<int> vPartitionStart(kPartitions + 1, 0);
+  for (int i = 0; i < n; i++)
+    if (mvKeys[i] != kInvalidKey) vPartitionStart[Partition(mvKeys[i]) + 1]++;
+  for (int p = 0; p < kPartitions; p++)
+    vPartitionStart[p + 1] += vPartitionStart[p];
+
+  const int nValid = vPartitionStart[kPartitions];
+  std::vector<int> vPartitionPoints(nValid);
+  {
+    std::vector<int> vFill(vPartitionStart.begin(), vPartitionStart.end() - 1);
+    for (int i = 0; i < n; i++)
+      if (mvKeys[i] != kInvalidKey)
+        vPartitionPoints[vFill[Partition(mvKeys[i])]++] = i;
+  }
+
+  // Voxels of each partition, numbered by first point. Each partition has
+  // its own open addressing table, and fills its own range of vPointVoxel.
+  std::vector<int> vPointVoxel(nValid);
+  std::vector<std::vector<int>> vvVoxelSizes(kPartitions);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int p = 0; p < kPartitions; p++) {
+    const int first = vPartitionStart[p];
+    const int last = vPartitionStart[p + 1];
+    if (first == last) continue;
+
+    int capacityBits = 4;
+    while ((size_t(1) << capacityBits) < 2 * size_t(last - first))
+      capacityBits++;
+    const size_t capacity = size_t(1) << capacityBits;
+    const size_t mask = capacity - 1;
+    std::vector<uint64_t> vTableKeys(capacity, kInvalidKey);
+    std::vector<int> vTableVoxels(capacity);
+
+    std::vector<int>& vVoxelSizes = vvVoxelSizes[p];
+    for (int j = first; j < last; j++) {
+      const uint64_t key = mvKeys[vPartitionPoints[j]];
+      // The top bits chose the partition, start probing from the ones
+      // below. The low bits of the product only depend on the low key bits.
+      size_t slot = (Mix(key) << kPartitionBits) >> (64 - capacityBits);
+      while (vTableKeys[slot] != kInvalidKey && vTableKeys[slot] != key)
+        slot = (slot + 1) & mask;
+      if (vTableKeys[slot] == kInvalidKey) {
+        vTableKeys[slot] = key;
+        vTableVoxels[slot] = vVoxelSizes.size();
+        vVoxelSizes.push_back(0);
+      }
+      const int v = vTableVoxels[slot];
+      vVoxelSizes[v]++;
+      vPointVoxel[j] = v;
+    }
+  }
+
+  // Number the voxels across partitions. The points of the voxels of a
+  // partition fill exactly the range of that partition.
+  std::vector<int> vVoxelBase(kPartitions + 1, 0);
+  for (int p = 0; p < kPartitions; p++)
+    vVoxelBase[p + 1] = vVoxelBase[p] + vvVoxelSizes[p].size();
+
+  mvVoxelStart.resize(vVoxelBase[kPartitions] + 1);
+  mvVoxelStart.back() = nValid;
+  mvPointIndices.resize(nValid);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int p = 0; p < kPartitions; p++) {
+    const std::vector<int>& vVoxelSizes = vvVoxelSizes[p];
+    int* pStart = mvVoxelStart.data() + vVoxelBase[p];
+    int start = vPartitionStart[p];
+    for (size_t v = 0; v < vVoxelSizes.size(); v++) {
+      pStart[v] = start;
+      start += vVoxelSizes[v];
+    }
+
+    // Scatter in input order, pStart[v] becomes the end of voxel v
+    for (int j = vPartitionStart[p]; j < vPartitionStart[p + 1]; j++)
+      mvPointIndices[pStart[vPointVoxel[j]]++] = vPartitionPoints[j];
+    for (size_t v = 0; v < vVoxelSizes.size(); v++)
+      pStart[v] -= vVoxelSizes[v];
+  }
+}
+
+}  // namespace ORB_SLAM3